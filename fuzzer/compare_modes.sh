@@ -0,0 +1,26 @@
+#!/bin/bash
+# Runs N fuzzing processes (-jobs) and then N fuzzing threads (-threads) for the same time
+# and prints the total exec/s and peak RSS of each mode.
+# usage: compare_modes.sh <n> <seconds> <seed corpus dir>
+
+N=${1:-4}
+SECS=${2:-60}
+SEEDS=${3:-/corpus}
+FUZZ=${FUZZ:-$(realpath h2_fuzz/h2_fuzz)}
+WORK=$(mktemp -d)
+
+run() {
+  mkdir -p $WORK/$1/corpus $WORK/$1/out
+  (cd $WORK/$1 && $FUZZ corpus $SEEDS -artifact_prefix=out/ -detect_leaks=0 -max_len=4096 -max_total_time=$SECS \
+    -print_final_stats=1 ${@:2} > run.log 2>&1)
+  # with -jobs, every process logs its own stats to fuzz-<job>.log
+  LOGS=$(ls $WORK/$1/fuzz-*.log 2>/dev/null || echo $WORK/$1/run.log)
+  cat $LOGS | awk -v mode=$1 '
+    /stat::average_exec_per_sec:/ { execs += $2 }
+    /stat::peak_rss_mb:/ { rss += $2 }
+    END { printf "%-10s exec/s: %6d  peak_rss_mb: %6d\n", mode, execs, rss }'
+}
+
+run processes -jobs=$N -workers=$N
+run threads -threads=$N
+rm -rf $WORK
@@ -0,0 +1,160 @@
+#ifndef NEZHA_ADAPTIVE_DEADLINE_H
+#define NEZHA_ADAPTIVE_DEADLINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "proxy_registry.h"
+
+#define SKETCH_GAMMA 1.05        // ratio between consecutive bucket bounds, i.e., at most 5% relative error
+#define SKETCH_BUCKETS 400       // covers 1us .. 1.05^400us (~8.5 hours)
+#define DEADLINE_QUANTILE 0.999  // latency quantile the deadline is derived from
+#define DEADLINE_SAFETY 3.0      // multiplier applied to that quantile
+#define DEADLINE_FLOOR_MS 250    // never go below this, however fast the proxy has been so far
+#define DEADLINE_WARMUP 200      // samples needed before the learned deadline replaces the configured one
+#define DEADLINE_REFRESH 64      // samples between recomputations of the deadline
+
+/**
+ * Streaming quantile sketch over latencies in microseconds.
+ *
+ * Samples are counted in logarithmically sized buckets, so any quantile is answered with a relative error of at most
+ * SKETCH_GAMMA - 1 in constant memory. Buckets are atomic, so one thread may add while others read.
+ */
+class LatencySketch {
+public:
+    LatencySketch() {
+        for (auto &b : buckets_) {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(uint64_t us) {
+        buckets_[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    /** Upper bound of the bucket holding quantile q (0 < q <= 1), in us. 0 if there are no samples */
+    uint64_t quantile(double q) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        auto rank = (uint64_t) std::ceil(q * (double) n);
+        uint64_t seen = 0;
+        for (int i = 0; i < SKETCH_BUCKETS; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return upper(i);
+            }
+        }
+        return upper(SKETCH_BUCKETS - 1);
+    }
+
+    static int bucket(uint64_t us) {
+        if (us <= 1) {
+            return 0;
+        }
+        int b = (int) std::ceil(std::log((double) us) / std::log(SKETCH_GAMMA));
+        return std::min(b, SKETCH_BUCKETS - 1);
+    }
+
+    static uint64_t upper(int b) {
+        return (uint64_t) std::ceil(std::pow(SKETCH_GAMMA, b));
+    }
+
+private:
+    std::atomic<uint64_t> buckets_[SKETCH_BUCKETS];
+    std::atomic<uint64_t> count_{0};
+};
+
+/**
+ * Per-proxy receive deadlines learned from each proxy's own response times.
+ *
+ * Until a proxy has DEADLINE_WARMUP completed exchanges, and for proxies with adaptive_deadline = false, its configured
+ * deadline_ms applies. Afterwards the deadline is DEADLINE_SAFETY times the DEADLINE_QUANTILE of its latencies, kept
+ * between DEADLINE_FLOOR_MS and the configured deadline_ms, which remains the upper bound.
+ *
+ * Only exchanges the proxy finished itself are sampled. Timeouts are censored samples (the true latency is unknown and
+ * at least the deadline) so they are counted separately instead; otherwise a shrinking deadline would feed itself.
+ */
+class AdaptiveDeadline {
+public:
+    explicit AdaptiveDeadline(const ProxyRegistry &reg) {
+        for (const auto &e : reg) {
+            std::unique_ptr<Proxy> p(new Proxy());
+            p->name = e.name;
+            p->configured_ms = e.deadline_ms;
+            p->adaptive = e.adaptive_deadline;
+            p->current_ms = e.deadline_ms;
+            proxies_.push_back(std::move(p));
+        }
+    }
+
+    /** Deadline for the next exchange with the given proxy, in ms */
+    int deadline_ms(size_t prox) const {
+        return proxies_[prox]->current_ms.load(std::memory_order_relaxed);
+    }
+
+    /** Records an exchange that took the given time. timed_out is true if it was cut off by the deadline */
+    void record(size_t prox, uint64_t elapsed_us, bool timed_out) {
+        Proxy &p = *proxies_[prox];
+        if (timed_out) {
+            p.timeouts++;
+            return;
+        }
+        p.sketch.add(elapsed_us);
+        uint64_t n = p.sketch.count();
+        if (p.adaptive && n >= DEADLINE_WARMUP && n % DEADLINE_REFRESH == 0) {
+            p.current_ms.store(compute(p), std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t timeouts(size_t prox) const {
+        return proxies_[prox]->timeouts;
+    }
+
+    const LatencySketch &sketch(size_t prox) const {
+        return proxies_[prox]->sketch;
+    }
+
+    /** Prints one line per proxy, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os) const {
+        for (const auto &p : proxies_) {
+            os << "stat::latency:                 " << p->name << " samples=" << p->sketch.count()
+               << " timeouts=" << p->timeouts << std::fixed << std::setprecision(1)
+               << " p50_ms=" << p->sketch.quantile(0.5) / 1e3 << " p99_ms=" << p->sketch.quantile(0.99) / 1e3
+               << " p999_ms=" << p->sketch.quantile(DEADLINE_QUANTILE) / 1e3
+               << " deadline_ms=" << p->current_ms.load() << std::endl;
+        }
+    }
+
+private:
+    struct Proxy {
+        std::string name;
+        int configured_ms = DEFAULT_DEADLINE_MS;
+        bool adaptive = true;
+        std::atomic<int> current_ms{DEFAULT_DEADLINE_MS};
+        std::atomic<uint64_t> timeouts{0};
+        LatencySketch sketch;
+    };
+
+    std::vector<std::unique_ptr<Proxy>> proxies_;
+
+    static int compute(const Proxy &p) {
+        double ms = DEADLINE_SAFETY * (double) p.sketch.quantile(DEADLINE_QUANTILE) / 1e3;
+        int floor = std::min(DEADLINE_FLOOR_MS, p.configured_ms);
+        return (int) std::max((double) floor, std::min(std::ceil(ms), (double) p.configured_ms));
+    }
+};
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef NEZHA_ADMISSION_H
+#define NEZHA_ADMISSION_H
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include "hash_utils.h"
+#include "proxy_registry.h"
+
+#define ADMISSION_KEY_SALT "h2fuzz-admission-v1"
+
+/**
+ * Queue-wait counters for one proxy, as seen by this worker
+ */
+struct AdmissionStats {
+    std::atomic<uint64_t> admitted{0};
+    std::atomic<uint64_t> waited{0};    // admissions that had to queue
+    std::atomic<uint64_t> wait_us{0};   // total time spent queueing
+    std::atomic<uint64_t> max_wait_us{0};
+};
+
+/**
+ * Caps the number of requests in flight to each replica across every fuzzer process on the host.
+ *
+ * Every proxy with max_inflight > 0 gets a System V semaphore set holding one semaphore per replica, initialized to
+ * max_inflight. A worker takes a slot before connecting and returns it when the exchange is over. Slots are taken with
+ * SEM_UNDO, so the kernel gives back the slots of a worker that crashes or is killed mid-exchange.
+ *
+ * The IPC key is derived from the proxy name, its replicas and the limit, so all jobs of a campaign share a set and
+ * changing the limit starts from a fresh one. Sets outlive the campaign; "ipcrm -a" removes them.
+ *
+ * Waiting is unbounded but short in practice: every slot holder gives it back within the proxy's deadline.
+ */
+class AdmissionControl {
+public:
+    explicit AdmissionControl(const ProxyRegistry &reg) {
+        for (const auto &e : reg) {
+            std::unique_ptr<Proxy> p(new Proxy());
+            p->name = e.name;
+            p->limit = e.max_inflight;
+            if (p->limit > 0) {
+                p->key = key_for(e);
+                p->semid = open_set(p->key, (int) e.replicas.size(), p->limit);
+                if (p->semid < 0) {
+                    std::cerr << "admission control -- could not set up semaphores for " << e.name << ": "
+                              << strerror(errno) << ". Not limiting it" << std::endl;
+                }
+            }
+            proxies_.push_back(std::move(p));
+        }
+    }
+
+    /** Blocks until a slot for the given replica is free and takes it. Returns false if the proxy is not limited */
+    bool acquire(size_t prox, size_t rep) {
+        Proxy &p = *proxies_[prox];
+        if (p.semid < 0) {
+            return false;
+        }
+
+        struct sembuf op{};
+        op.sem_num = (unsigned short) rep;
+        op.sem_op = -1;
+        op.sem_flg = SEM_UNDO | IPC_NOWAIT;
+        if (semop(p.semid, &op, 1) == 0) {
+            p.stats.admitted++;
+            return true;
+        }
+
+        // no free slot: queue, and account for the time spent doing so
+        auto start = std::chrono::steady_clock::now();
+        op.sem_flg = SEM_UNDO;
+        int ret;
+        do {
+            ret = semop(p.semid, &op, 1);
+        } while (ret != 0 && errno == EINTR);
+        if (ret != 0) {
+            return false;  // set was removed under us. run unlimited rather than stall
+        }
+
+        auto waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        uint64_t us = (uint64_t) waited.count();
+        p.stats.admitted++;
+        p.stats.waited++;
+        p.stats.wait_us += us;
+        uint64_t prev = p.stats.max_wait_us;
+        while (us > prev && !p.stats.max_wait_us.compare_exchange_weak(prev, us)) {}
+        return true;
+    }
+
+    /** Returns a slot taken by a successful acquire() */
+    void release(size_t prox, size_t rep) {
+        Proxy &p = *proxies_[prox];
+        struct sembuf op{};
+        op.sem_num = (unsigned short) rep;
+        op.sem_op = 1;
+        op.sem_flg = SEM_UNDO;
+        semop(p.semid, &op, 1);
+    }
+
+    /** Number of free slots of a replica, across all processes. -1 if the proxy is not limited */
+    int available(size_t prox, size_t rep) const {
+        const Proxy &p = *proxies_[prox];
+        return p.semid < 0 ? -1 : semctl(p.semid, (int) rep, GETVAL);
+    }
+
+    const AdmissionStats &stats(size_t prox) const {
+        return proxies_[prox]->stats;
+    }
+
+    /** Removes the semaphore sets of all limited proxies. Other processes using them will run unlimited */
+    void destroy() {
+        for (auto &p : proxies_) {
+            if (p->semid >= 0) {
+                semctl(p->semid, 0, IPC_RMID);
+                p->semid = -1;
+            }
+        }
+    }
+
+    /** Prints one line per limited proxy, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os) const {
+        for (const auto &p : proxies_) {
+            if (p->limit <= 0) {
+                continue;
+            }
+            const AdmissionStats &s = p->stats;
+            uint64_t waited = s.waited;
+            os << "stat::admission:               " << p->name << " limit=" << p->limit << " admitted=" << s.admitted
+               << " queued=" << waited << " avg_wait_ms=" << std::fixed << std::setprecision(1)
+               << (waited ? s.wait_us / 1e3 / (double) waited : 0.0) << " max_wait_ms=" << s.max_wait_us / 1e3
+               << std::endl;
+        }
+    }
+
+    /**
+     * RAII slot holder: takes a slot on construction (if the proxy is limited) and returns it on destruction
+     */
+    class Ticket {
+    public:
+        Ticket(AdmissionControl &ac, size_t prox, size_t rep) : ac_(ac), prox_(prox), rep_(rep) {
+            held_ = ac_.acquire(prox_, rep_);
+        }
+
+        virtual ~Ticket() {
+            if (held_) {
+                ac_.release(prox_, rep_);
+            }
+        }
+
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+
+    private:
+        AdmissionControl &ac_;
+        size_t prox_;
+        size_t rep_;
+        bool held_;
+    };
+
+    static key_t key_for(const ProxyEntry &e) {
+        std::string desc = std::string(ADMISSION_KEY_SALT) + ";" + e.name + ";" + std::to_string(e.max_inflight) + ";";
+        for (const auto &r : e.replicas) {
+            desc += r.to_string() + ",";
+        }
+        uint64_t h = HashUtils::fnv1a(desc);
+        key_t k = (key_t) (h ^ (h >> 32));
+        return k == IPC_PRIVATE ? 1 : k;
+    }
+
+private:
+    struct Proxy {
+        std::string name;
+        int limit = 0;
+        key_t key = IPC_PRIVATE;
+        int semid = -1;
+        AdmissionStats stats;
+    };
+
+    std::vector<std::unique_ptr<Proxy>> proxies_;
+
+    /**
+     * Opens the semaphore set for key, creating it with every semaphore set to limit if it does not exist yet.
+     * A process that opens the set while its creator is still initializing it just waits on a zero semaphore until
+     * SETALL completes.
+     */
+    static int open_set(key_t key, int nsems, int limit) {
+        int semid = semget(key, nsems, IPC_CREAT | IPC_EXCL | 0600);
+        if (semid >= 0) {
+            std::vector<unsigned short> vals((size_t) nsems, (unsigned short) limit);
+            union semun {
+                int val;
+                struct semid_ds *buf;
+                unsigned short *array;
+            } arg{};
+            arg.array = vals.data();
+            if (semctl(semid, 0, SETALL, arg) != 0) {
+                semctl(semid, 0, IPC_RMID);
+                return -1;
+            }
+            return semid;
+        }
+        if (errno != EEXIST) {
+            return -1;
+        }
+        return semget(key, nsems, 0600);
+    }
+};
+
+#endif
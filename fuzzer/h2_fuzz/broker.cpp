@@ -0,0 +1,67 @@
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "broker.h"
+#include "proxy_registry.h"
+
+static std::atomic<bool> g_stop(false);
+
+static void on_signal(int) {
+    g_stop = true;
+}
+
+static void usage(const char *prog) {
+    std::cout << "usage: " << prog << " [-name <shm name>] [-slots <n>] [-pool <n>]" << std::endl
+              << "  Owns all connections to the proxies in " << ProxyRegistry::default_path() << " for the fuzzer"
+              << std::endl
+              << "  jobs that run with " << BROKER_ENV << "=<shm name>. Defaults: -name " << BROKER_DEFAULT_NAME
+              << " -slots " << BROKER_SLOTS << " -pool " << BROKER_POOL << std::endl;
+}
+
+int main(int argc, char **argv) {
+    std::string name = BROKER_DEFAULT_NAME;
+    int slots = BROKER_SLOTS;
+    int pool = BROKER_POOL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "-slots") == 0 && i + 1 < argc) {
+            slots = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-pool") == 0 && i + 1 < argc) {
+            pool = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (slots <= 0 || pool < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ProxyRegistry proxies;
+    std::string reg_fn = ProxyRegistry::default_path();
+    int ret = proxies.load(reg_fn);
+    if (ret != 0) {
+        std::cout << "Error " << ret << " loading proxy registry " << reg_fn << std::endl;
+        return 1;
+    }
+
+    Broker broker(proxies, name, (uint32_t) slots, BROKER_RING_BYTES, pool);
+    if (!broker.init()) {
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "Broker for " << proxies.size() << " proxies listening on " << name << " (" << slots << " slots)"
+              << std::endl;
+    broker.run(g_stop);
+    broker.print_stats(std::cout);
+    return 0;
+}
@@ -0,0 +1,872 @@
+#ifndef NEZHA_BROKER_H
+#define NEZHA_BROKER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "callbacks.h"
+#include "proxy_registry.h"
+#include "shm_ring.h"
+
+#define BROKER_ENV "H2FUZZ_BROKER"       // name of the broker's shared memory; workers use the broker when set
+#define BROKER_DEFAULT_NAME "/h2fuzz_broker"
+#define BROKER_MAGIC 0x68326272u        // "h2br"
+#define BROKER_VERSION 1
+#define BROKER_SLOTS 64                  // workers that can attach at once
+#define BROKER_RING_BYTES (1 << 18)      // per direction and slot
+#define BROKER_POOL 2                    // pre-connected sockets kept per replica
+#define BROKER_POOL_MAX_IDLE_MS 2000     // pooled sockets older than this are replaced before proxies reap them
+#define BROKER_CONNECT_BACKOFF_MS 100    // pause in refilling the pool of a replica after a failed connect
+#define BROKER_GRACE_MS 2000             // how long past the deadline a worker waits for the broker
+#define BROKER_STALL_MS 1000             // a heartbeat unchanged for this long means the broker is gone
+
+#define BROKER_OK 0
+#define BROKER_CONNECT_FAILED (-1)
+#define BROKER_BAD_REQUEST (-2)
+#define BROKER_TOO_LARGE (-3)  // the request or the response does not fit in a ring message
+
+// slot owner values besides the pid of an attached worker
+#define SLOT_FREE 0
+#define SLOT_RELEASING (-1)
+
+/**
+ * Start of the broker's shared memory. It is followed by BrokerSlot[n_slots], then by two ring buffers of
+ * ring_bytes per slot (requests, then responses).
+ */
+struct BrokerShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_slots;
+    uint32_t n_proxies;
+    uint64_t ring_bytes;
+    std::atomic<uint64_t> heartbeat;  // advanced by every iteration of the broker's loop
+};
+
+/**
+ * Per-worker channel: one ring from the worker to the broker and one back
+ */
+struct BrokerSlot {
+    std::atomic<int32_t> owner;  // pid of the attached worker, SLOT_FREE or SLOT_RELEASING
+    SpscRingHeader req;
+    SpscRingHeader resp;
+};
+
+/** Request record header; followed by len bytes of the stream, already rewritten for the proxy */
+struct BrokerRequest {
+    uint64_t seq;
+    uint32_t proxy;
+    uint32_t replica;
+    uint32_t deadline_ms;
+    uint32_t len;
+};
+
+/** Response record header; followed by len bytes read from the proxy */
+struct BrokerResponse {
+    uint64_t seq;
+    uint32_t proxy;
+    int32_t status;     // BROKER_OK or an error
+    uint32_t timed_out;
+    uint32_t len;
+    uint64_t exchange_us;  // time from the start of the exchange to its end, excluding queueing in the broker
+};
+
+/**
+ * Layout helpers shared by the broker and its workers
+ */
+struct BrokerLayout {
+    static size_t slots_offset() {
+        return (sizeof(BrokerShmHeader) + 63) & ~(size_t) 63;
+    }
+
+    static size_t rings_offset(uint32_t n_slots) {
+        return (slots_offset() + n_slots * sizeof(BrokerSlot) + 63) & ~(size_t) 63;
+    }
+
+    static size_t total(uint32_t n_slots, uint64_t ring_bytes) {
+        return rings_offset(n_slots) + 2 * n_slots * ring_bytes;
+    }
+
+    static BrokerSlot *slot(uint8_t *base, uint32_t i) {
+        return reinterpret_cast<BrokerSlot *>(base + slots_offset()) + i;
+    }
+
+    static SpscRing req_ring(uint8_t *base, uint32_t n_slots, uint64_t ring_bytes, uint32_t i) {
+        return SpscRing(&slot(base, i)->req, base + rings_offset(n_slots) + 2 * i * ring_bytes, ring_bytes);
+    }
+
+    static SpscRing resp_ring(uint8_t *base, uint32_t n_slots, uint64_t ring_bytes, uint32_t i) {
+        return SpscRing(&slot(base, i)->resp, base + rings_offset(n_slots) + (2 * i + 1) * ring_bytes, ring_bytes);
+    }
+};
+
+/**
+ * Worker side of the broker: attaches to its shared memory, claims a slot, submits streams and collects responses.
+ * Used by a single thread.
+ */
+class BrokerClient {
+public:
+    struct Result {
+        int status = BROKER_CONNECT_FAILED;
+        bool answered = false;  // the broker ran the exchange. false if the request was not sent or the broker stalled
+        bool timed_out = false;
+        uint64_t exchange_us = 0;
+        std::vector<uint8_t> data;
+    };
+
+    BrokerClient() = default;
+
+    virtual ~BrokerClient() {
+        detach();
+    }
+
+    /** Attaches to the broker with the given shared memory name. Returns false (and prints why) on failure */
+    bool attach(const std::string &name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            std::cerr << "broker -- could not open " << name << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        BrokerShmHeader hdr{};
+        if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr) || hdr.magic != BROKER_MAGIC ||
+            hdr.version != BROKER_VERSION) {
+            std::cerr << "broker -- " << name << " is not a broker of this version" << std::endl;
+            ::close(fd);
+            return false;
+        }
+        size_ = BrokerLayout::total(hdr.n_slots, hdr.ring_bytes);
+        void *m = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            std::cerr << "broker -- could not map " << name << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        base_ = (uint8_t *) m;
+        hdr_ = (BrokerShmHeader *) base_;
+
+        int32_t pid = (int32_t) getpid();
+        for (uint32_t i = 0; i < hdr_->n_slots; ++i) {
+            int32_t expected = SLOT_FREE;
+            if (BrokerLayout::slot(base_, i)->owner.compare_exchange_strong(expected, pid)) {
+                slot_ = (int) i;
+                req_ = BrokerLayout::req_ring(base_, hdr_->n_slots, hdr_->ring_bytes, i);
+                resp_ = BrokerLayout::resp_ring(base_, hdr_->n_slots, hdr_->ring_bytes, i);
+                return true;
+            }
+        }
+        std::cerr << "broker -- all " << hdr_->n_slots << " slots are taken" << std::endl;
+        munmap(base_, size_);
+        base_ = nullptr;
+        return false;
+    }
+
+    /** Hands the slot back to the broker, which resets it */
+    void detach() {
+        if (base_ == nullptr) {
+            return;
+        }
+        if (slot_ >= 0) {
+            BrokerLayout::slot(base_, (uint32_t) slot_)->owner.store(SLOT_RELEASING);
+            slot_ = -1;
+        }
+        munmap(base_, size_);
+        base_ = nullptr;
+    }
+
+    bool attached() const {
+        return slot_ >= 0;
+    }
+
+    /**
+     * Sends one exchange per element of "reqs" and waits for all of them. A request that gets no answer within its
+     * deadline plus BROKER_GRACE_MS, or while the broker's heartbeat stands still, is reported as BROKER_CONNECT_FAILED,
+     * as are the requests still unsent when the heartbeat stands still with the ring full.
+     * A request too large for the ring is not sent and is reported as BROKER_TOO_LARGE.
+     */
+    struct Request {
+        uint32_t proxy;
+        uint32_t replica;
+        uint32_t deadline_ms;
+        const uint8_t *data;
+        uint32_t len;
+    };
+
+    void exchange(const std::vector<Request> &reqs, std::vector<Result> &results) {
+        results.assign(reqs.size(), Result());
+        typedef std::chrono::steady_clock Clock;
+        uint64_t beat = hdr_->heartbeat.load(std::memory_order_relaxed);
+        auto beat_seen = Clock::now();
+        auto stalled = [&](Clock::time_point now) {
+            uint64_t b = hdr_->heartbeat.load(std::memory_order_relaxed);
+            if (b != beat) {
+                beat = b;
+                beat_seen = now;
+            }
+            return now - beat_seen > std::chrono::milliseconds(BROKER_STALL_MS);
+        };
+
+        uint64_t first = next_seq_;
+        uint32_t max_deadline = 0;
+        size_t pending = reqs.size();
+        for (size_t i = 0; i < reqs.size(); ++i) {
+            const Request &r = reqs[i];
+            BrokerRequest br{next_seq_++, r.proxy, r.replica, r.deadline_ms, r.len};
+            if (r.len + sizeof(br) > req_.max_message()) {
+                results[i].status = BROKER_TOO_LARGE;  // can never fit, so no answer is waited for
+                --pending;
+                continue;
+            }
+            max_deadline = std::max(max_deadline, r.deadline_ms);
+            // a full ring drains as the broker runs. one that stopped would keep it full
+            for (unsigned spins = 0; !req_.try_push(&br, sizeof(br), r.data, r.len);) {
+                if (++spins < 64) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                if (stalled(Clock::now())) {
+                    std::cerr << "broker -- gave up submitting " << reqs.size() - i << " requests" << std::endl;
+                    return;
+                }
+            }
+        }
+
+        auto give_up = Clock::now() + std::chrono::milliseconds(max_deadline + BROKER_GRACE_MS);
+        std::vector<uint8_t> msg;
+        unsigned spins = 0;
+        while (pending > 0) {
+            if (resp_.try_pop(msg)) {
+                spins = 0;
+                if (msg.size() < sizeof(BrokerResponse)) {
+                    continue;
+                }
+                BrokerResponse br;
+                memcpy(&br, msg.data(), sizeof(br));
+                if (br.seq < first || br.seq >= first + reqs.size()) {
+                    continue;  // left over from an exec we gave up on
+                }
+                Result &res = results[br.seq - first];
+                res.status = br.status;
+                res.answered = true;
+                res.timed_out = br.timed_out != 0;
+                res.exchange_us = br.exchange_us;
+                res.data.assign(msg.begin() + sizeof(br), msg.begin() + sizeof(br) + br.len);
+                --pending;
+                continue;
+            }
+
+            // nothing yet. spin briefly, then back off so an idle worker does not steal the broker's core
+            if (++spins < 64) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            auto now = Clock::now();
+            if (stalled(now) || now > give_up) {
+                std::cerr << "broker -- gave up waiting for " << pending << " responses" << std::endl;
+                break;
+            }
+        }
+    }
+
+private:
+    uint8_t *base_ = nullptr;
+    size_t size_ = 0;
+    BrokerShmHeader *hdr_ = nullptr;
+    int slot_ = -1;
+    SpscRing req_;
+    SpscRing resp_;
+    uint64_t next_seq_ = 1;
+};
+
+/**
+ * Exec broker: owns every connection to the proxies on behalf of all attached workers.
+ *
+ * Workers push rewritten streams onto their request ring; a single event loop (epoll) runs all exchanges concurrently
+ * with non-blocking sockets, applies each replica's max_inflight cap globally, and pushes the raw responses back.
+ *
+ * Every exchange needs a fresh connection, since a fuzzed stream is a whole HTTP/2 session (preface, SETTINGS, possibly
+ * GOAWAY) and cannot share one with another input. The pool therefore holds connected but unused sockets, replaced
+ * after BROKER_POOL_MAX_IDLE_MS, which takes the connect round trip off the exec path without ever reusing a session.
+ *
+ * Receive deadlines behave like SO_RCVTIMEO in Client: they bound the silence between two reads, not the exchange.
+ */
+class Broker {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct ProxyStats {
+        uint64_t exchanges = 0;
+        uint64_t pool_hits = 0;
+        uint64_t connects = 0;
+        uint64_t connect_failures = 0;
+        uint64_t timeouts = 0;
+        uint64_t queued_us = 0;
+        uint64_t max_queued_us = 0;
+        uint64_t max_inflight = 0;  // most exchanges in flight to one replica at once
+    };
+
+    Broker(const ProxyRegistry &reg, std::string name, uint32_t n_slots = BROKER_SLOTS,
+           uint64_t ring_bytes = BROKER_RING_BYTES, int pool = BROKER_POOL)
+            : name_(std::move(name)), n_slots_(n_slots), ring_bytes_(ring_bytes), pool_size_(pool) {
+        for (const auto &e : reg) {
+            std::unique_ptr<Proxy> p(new Proxy());
+            p->name = e.name;
+            for (const auto &r : e.replicas) {
+                std::unique_ptr<Replica> rep(new Replica());
+                rep->addr = r;
+                rep->limit = e.max_inflight;
+                p->replicas.push_back(std::move(rep));
+            }
+            proxies_.push_back(std::move(p));
+        }
+    }
+
+    virtual ~Broker() {
+        close_all();
+        if (base_ != nullptr) {
+            munmap(base_, size_);
+            shm_unlink(name_.c_str());
+        }
+        if (epfd_ >= 0) {
+            ::close(epfd_);
+        }
+    }
+
+    /** Creates the shared memory (replacing a stale one with the same name). Returns false on failure */
+    bool init() {
+        shm_unlink(name_.c_str());
+        int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            std::cerr << "broker -- could not create " << name_ << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        size_ = BrokerLayout::total(n_slots_, ring_bytes_);
+        if (ftruncate(fd, (off_t) size_) != 0) {
+            std::cerr << "broker -- could not size " << name_ << ": " << strerror(errno) << std::endl;
+            ::close(fd);
+            return false;
+        }
+        void *m = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            return false;
+        }
+        base_ = (uint8_t *) m;
+
+        // fields are written before the magic, so a worker that sees the magic sees a fully initialized header
+        auto *hdr = new(base_) BrokerShmHeader();
+        hdr->version = BROKER_VERSION;
+        hdr->n_slots = n_slots_;
+        hdr->n_proxies = (uint32_t) proxies_.size();
+        hdr->ring_bytes = ring_bytes_;
+        hdr->heartbeat.store(0);
+        for (uint32_t i = 0; i < n_slots_; ++i) {
+            BrokerSlot *s = new(BrokerLayout::slot(base_, i)) BrokerSlot();
+            s->req.reset();
+            s->resp.reset();
+            s->owner.store(SLOT_FREE);
+            slots_.emplace_back();
+            slots_.back().req = BrokerLayout::req_ring(base_, n_slots_, ring_bytes_, i);
+            slots_.back().resp = BrokerLayout::resp_ring(base_, n_slots_, ring_bytes_, i);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        hdr->magic = BROKER_MAGIC;
+        hdr_ = hdr;
+
+        epfd_ = epoll_create1(0);
+        return epfd_ >= 0;
+    }
+
+    /** Runs the event loop until "stop" is set */
+    void run(const std::atomic<bool> &stop) {
+        auto last_reap = Clock::now();
+        std::vector<epoll_event> events(256);
+        while (!stop.load(std::memory_order_relaxed)) {
+            hdr_->heartbeat.fetch_add(1, std::memory_order_relaxed);
+            auto now = Clock::now();
+
+            if (now - last_reap > std::chrono::milliseconds(100)) {
+                reap_slots();
+                last_reap = now;
+            }
+            bool busy = poll_requests(now);
+            start_pending(now);
+            refill_pools(now);
+            busy |= flush_backlogs();
+
+            int n = epoll_wait(epfd_, events.data(), (int) events.size(), busy ? 0 : 1);
+            now = Clock::now();
+            for (int i = 0; i < n; ++i) {
+                handle(static_cast<Conn *>(events[i].data.ptr), events[i].events, now);
+            }
+            expire(now);
+        }
+    }
+
+    const ProxyStats &stats(size_t prox) const {
+        return proxies_[prox]->stats;
+    }
+
+    /** Prints one line per proxy, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os) const {
+        for (const auto &p : proxies_) {
+            const ProxyStats &s = p->stats;
+            os << "stat::broker:                  " << p->name << " exchanges=" << s.exchanges
+               << " pool_hits=" << s.pool_hits << " connects=" << s.connects
+               << " connect_failures=" << s.connect_failures << " timeouts=" << s.timeouts
+               << " max_inflight=" << s.max_inflight << std::fixed << std::setprecision(1)
+               << " avg_queue_ms=" << (s.exchanges ? s.queued_us / 1e3 / (double) s.exchanges : 0.0)
+               << " max_queue_ms=" << s.max_queued_us / 1e3 << std::endl;
+        }
+    }
+
+private:
+    enum ConnKind { POOL, EXCHANGE };
+
+    /** A socket registered with epoll: either a pooled connection or one running an exchange */
+    struct Conn {
+        ConnKind kind;
+        int fd = -1;
+        size_t proxy = 0;
+        size_t replica = 0;
+        bool connecting = true;
+        Clock::time_point since;  // connect start for pooled sockets
+
+        // exchanges only
+        size_t slot = 0;
+        uint32_t generation = 0;
+        uint64_t seq = 0;
+        uint32_t deadline_ms = 0;
+        int attempts = 0;
+        std::vector<uint8_t> req;
+        size_t sent = 0;
+        std::vector<uint8_t> resp;
+        Clock::time_point enqueued;
+        Clock::time_point started;
+        Clock::time_point deadline;
+    };
+
+    struct Replica {
+        ProxyReplica addr;
+        std::deque<Conn *> pending;  // exchanges waiting for an in-flight slot
+        std::deque<Conn *> pool;     // connected, unused sockets
+        int pool_connecting = 0;
+        Clock::time_point pool_backoff;
+        int limit = 0;  // max_inflight of the proxy, which caps each of its replicas
+        int inflight = 0;
+    };
+
+    struct Proxy {
+        std::string name;
+        std::vector<std::unique_ptr<Replica>> replicas;
+        ProxyStats stats;
+    };
+
+    struct Slot {
+        SpscRing req;
+        SpscRing resp;
+        uint32_t generation = 0;  // bumped on reset so results of a previous owner are dropped
+        std::deque<std::vector<uint8_t>> backlog;  // responses that did not fit in the ring yet
+    };
+
+    std::string name_;
+    uint32_t n_slots_;
+    uint64_t ring_bytes_;
+    int pool_size_;
+    uint8_t *base_ = nullptr;
+    size_t size_ = 0;
+    BrokerShmHeader *hdr_ = nullptr;
+    int epfd_ = -1;
+    std::vector<Slot> slots_;
+    std::vector<std::unique_ptr<Proxy>> proxies_;
+    std::vector<Conn *> active_;  // exchanges with a socket
+
+    /** Resets the slots of workers that detached or died */
+    void reap_slots() {
+        for (uint32_t i = 0; i < n_slots_; ++i) {
+            BrokerSlot *s = BrokerLayout::slot(base_, i);
+            int32_t owner = s->owner.load();
+            bool dead = owner > 0 && kill(owner, 0) != 0 && errno == ESRCH;
+            if (owner == SLOT_RELEASING || dead) {
+                slots_[i].generation++;
+                slots_[i].backlog.clear();
+                s->req.reset();
+                s->resp.reset();
+                s->owner.store(SLOT_FREE);
+            }
+        }
+    }
+
+    /** Moves new requests from the rings of attached workers to the pending queues. Returns true if any arrived */
+    bool poll_requests(Clock::time_point now) {
+        bool any = false;
+        std::vector<uint8_t> msg;
+        for (uint32_t i = 0; i < n_slots_; ++i) {
+            if (BrokerLayout::slot(base_, i)->owner.load(std::memory_order_acquire) <= 0) {
+                continue;
+            }
+            while (slots_[i].req.try_pop(msg)) {
+                any = true;
+                BrokerRequest br;
+                if (msg.size() < sizeof(br)) {
+                    continue;
+                }
+                memcpy(&br, msg.data(), sizeof(br));
+                if (br.proxy >= proxies_.size() || br.replica >= proxies_[br.proxy]->replicas.size() ||
+                    msg.size() < sizeof(br) + br.len) {
+                    respond(i, slots_[i].generation, br.seq, br.proxy, BROKER_BAD_REQUEST, false, {}, 0);
+                    continue;
+                }
+                auto *c = new Conn();
+                c->kind = EXCHANGE;
+                c->proxy = br.proxy;
+                c->replica = br.replica;
+                c->slot = i;
+                c->generation = slots_[i].generation;
+                c->seq = br.seq;
+                c->deadline_ms = br.deadline_ms;
+                c->req.assign(msg.begin() + sizeof(br), msg.begin() + sizeof(br) + br.len);
+                c->enqueued = now;
+                proxies_[br.proxy]->replicas[br.replica]->pending.push_back(c);
+            }
+        }
+        return any;
+    }
+
+    /** Starts queued exchanges as far as the in-flight cap of each replica allows */
+    void start_pending(Clock::time_point now) {
+        for (size_t pi = 0; pi < proxies_.size(); ++pi) {
+            Proxy &p = *proxies_[pi];
+            for (auto &rep : p.replicas) {
+                while (!rep->pending.empty() && (rep->limit <= 0 || rep->inflight < rep->limit)) {
+                    Conn *c = rep->pending.front();
+                    rep->pending.pop_front();
+                    auto queued = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                            now - c->enqueued).count();
+                    p.stats.queued_us += queued;
+                    p.stats.max_queued_us = std::max(p.stats.max_queued_us, queued);
+                    rep->inflight++;
+                    p.stats.max_inflight = std::max(p.stats.max_inflight, (uint64_t) rep->inflight);
+                    c->started = now;
+                    begin(c, *rep, now);
+                }
+            }
+        }
+    }
+
+    /** Gives an exchange a socket: a pooled one if a fresh one is available, a new connection otherwise */
+    void begin(Conn *c, Replica &rep, Clock::time_point now) {
+        Proxy &p = *proxies_[c->proxy];
+        while (!rep.pool.empty()) {
+            Conn *pc = rep.pool.front();
+            rep.pool.pop_front();
+            int fd = pc->fd;
+            bool fresh = now - pc->since < std::chrono::milliseconds(BROKER_POOL_MAX_IDLE_MS);
+            delete pc;
+            if (!fresh) {
+                close_fd(fd);
+                continue;
+            }
+            p.stats.pool_hits++;
+            c->fd = fd;
+            c->connecting = false;
+            c->deadline = now + std::chrono::milliseconds(c->deadline_ms);
+            rearm(c, EPOLLOUT | EPOLLIN | EPOLLRDHUP);
+            active_.push_back(c);
+            return;
+        }
+        connect_exchange(c, rep, now);
+    }
+
+    void connect_exchange(Conn *c, Replica &rep, Clock::time_point now) {
+        Proxy &p = *proxies_[c->proxy];
+        c->attempts++;
+        p.stats.connects++;
+        c->fd = open_socket(rep.addr);
+        if (c->fd < 0) {
+            p.stats.connect_failures++;
+            if (c->attempts < CONNECT_ATTEMPTS) {
+                connect_exchange(c, rep, now);
+            } else {
+                finish(c, BROKER_CONNECT_FAILED, false, now);
+            }
+            return;
+        }
+        c->connecting = true;
+        c->deadline = now + std::chrono::milliseconds(c->deadline_ms);
+        epoll_event ev{};
+        ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, c->fd, &ev);
+        active_.push_back(c);
+    }
+
+    /** Keeps pool_size_ connected sockets per replica */
+    void refill_pools(Clock::time_point now) {
+        for (size_t pi = 0; pi < proxies_.size(); ++pi) {
+            Proxy &p = *proxies_[pi];
+            for (size_t ri = 0; ri < p.replicas.size(); ++ri) {
+                Replica &rep = *p.replicas[ri];
+
+                // drop stale sockets at the front (the oldest), so that a hit is always fresh
+                while (!rep.pool.empty() &&
+                       now - rep.pool.front()->since >= std::chrono::milliseconds(BROKER_POOL_MAX_IDLE_MS)) {
+                    discard_pooled(rep, rep.pool.front());
+                }
+
+                while ((int) rep.pool.size() + rep.pool_connecting < pool_size_ && now >= rep.pool_backoff) {
+                    int fd = open_socket(rep.addr);
+                    p.stats.connects++;
+                    if (fd < 0) {
+                        p.stats.connect_failures++;
+                        rep.pool_backoff = now + std::chrono::milliseconds(BROKER_CONNECT_BACKOFF_MS);
+                        break;
+                    }
+                    auto *c = new Conn();
+                    c->kind = POOL;
+                    c->fd = fd;
+                    c->proxy = pi;
+                    c->replica = ri;
+                    c->since = now;
+                    epoll_event ev{};
+                    ev.events = EPOLLOUT | EPOLLRDHUP;
+                    ev.data.ptr = c;
+                    epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev);
+                    rep.pool_connecting++;
+                }
+            }
+        }
+    }
+
+    void discard_pooled(Replica &rep, Conn *c) {
+        rep.pool.erase(std::remove(rep.pool.begin(), rep.pool.end(), c), rep.pool.end());
+        close_fd(c->fd);
+        delete c;
+    }
+
+    void handle(Conn *c, uint32_t ev, Clock::time_point now) {
+        Proxy &p = *proxies_[c->proxy];
+        Replica &rep = *p.replicas[c->replica];
+
+        if (c->kind == POOL) {
+            if (c->connecting) {
+                rep.pool_connecting--;
+                if ((ev & (EPOLLERR | EPOLLHUP)) || !connected(c->fd)) {
+                    p.stats.connect_failures++;
+                    rep.pool_backoff = now + std::chrono::milliseconds(BROKER_CONNECT_BACKOFF_MS);
+                    close_fd(c->fd);
+                    delete c;
+                    return;
+                }
+                c->connecting = false;
+                c->since = now;
+                rearm(c, EPOLLRDHUP);  // only watch for the proxy closing it
+                rep.pool.push_back(c);
+            } else if (ev & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                discard_pooled(rep, c);  // reaped by the proxy before it was used
+            }
+            return;
+        }
+
+        if (c->connecting) {
+            if ((ev & EPOLLERR) || !connected(c->fd)) {
+                p.stats.connect_failures++;
+                drop_active(c);
+                close_fd(c->fd);
+                c->fd = -1;
+                if (c->attempts < CONNECT_ATTEMPTS) {
+                    connect_exchange(c, rep, now);
+                } else {
+                    finish(c, BROKER_CONNECT_FAILED, false, now);
+                }
+                return;
+            }
+            c->connecting = false;
+        }
+
+        if (c->sent < c->req.size() && (ev & EPOLLOUT)) {
+            ssize_t n = ::send(c->fd, c->req.data() + c->sent, c->req.size() - c->sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                c->sent += (size_t) n;
+            } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                c->sent = c->req.size();  // the proxy hung up. read whatever it sent before doing so
+            }
+            if (c->sent == c->req.size()) {
+                rearm(c, EPOLLIN | EPOLLRDHUP);
+            }
+        }
+
+        if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            char buf[4096];
+            while (true) {
+                ssize_t n = ::recv(c->fd, buf, sizeof(buf), 0);
+                if (n > 0) {
+                    c->resp.insert(c->resp.end(), buf, buf + n);
+                    c->deadline = now + std::chrono::milliseconds(c->deadline_ms);
+                } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                } else {
+                    finish(c, BROKER_OK, false, now);  // closed or reset: the exchange is over, as in Client
+                    return;
+                }
+            }
+        }
+    }
+
+    /** Ends exchanges that have been silent for their whole deadline */
+    void expire(Clock::time_point now) {
+        std::vector<Conn *> due;
+        for (Conn *c : active_) {
+            if (now >= c->deadline) {
+                due.push_back(c);
+            }
+        }
+        for (Conn *c : due) {
+            if (c->connecting) {
+                proxies_[c->proxy]->stats.connect_failures++;
+                finish(c, BROKER_CONNECT_FAILED, false, now);
+            } else {
+                proxies_[c->proxy]->stats.timeouts++;
+                finish(c, BROKER_OK, true, now);
+            }
+        }
+    }
+
+    void finish(Conn *c, int status, bool timed_out, Clock::time_point now) {
+        Proxy &p = *proxies_[c->proxy];
+        drop_active(c);
+        if (c->fd >= 0) {
+            close_fd(c->fd);
+        }
+        p.replicas[c->replica]->inflight--;
+        p.stats.exchanges++;
+        auto us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(now - c->started).count();
+        respond(c->slot, c->generation, c->seq, (uint32_t) c->proxy, status, timed_out, c->resp, us);
+        delete c;
+    }
+
+    void respond(size_t slot, uint32_t generation, uint64_t seq, uint32_t proxy, int status, bool timed_out,
+                 const std::vector<uint8_t> &data, uint64_t us) {
+        Slot &s = slots_[slot];
+        if (generation != s.generation) {
+            return;  // the worker that asked is gone
+        }
+        size_t len = data.size();
+        if (len > s.resp.max_message() - sizeof(BrokerResponse)) {
+            status = BROKER_TOO_LARGE;  // a cut response would be parsed as if the proxy had sent less
+            len = 0;
+        }
+        BrokerResponse br{seq, proxy, status, timed_out ? 1u : 0u, (uint32_t) len, us};
+        std::vector<uint8_t> msg(sizeof(br) + len);
+        memcpy(msg.data(), &br, sizeof(br));
+        if (len) {
+            memcpy(msg.data() + sizeof(br), data.data(), len);
+        }
+        if (!s.backlog.empty() || !s.resp.try_push(msg.data(), (uint32_t) msg.size())) {
+            s.backlog.push_back(std::move(msg));
+        }
+    }
+
+    /** Retries responses that found their ring full. Returns true if any are still waiting */
+    bool flush_backlogs() {
+        bool waiting = false;
+        for (auto &s : slots_) {
+            while (!s.backlog.empty() && s.resp.try_push(s.backlog.front().data(), (uint32_t) s.backlog.front().size())) {
+                s.backlog.pop_front();
+            }
+            waiting |= !s.backlog.empty();
+        }
+        return waiting;
+    }
+
+    void rearm(Conn *c, uint32_t events) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd_, EPOLL_CTL_MOD, c->fd, &ev) != 0) {
+            epoll_ctl(epfd_, EPOLL_CTL_ADD, c->fd, &ev);
+        }
+    }
+
+    void drop_active(Conn *c) {
+        auto it = std::find(active_.begin(), active_.end(), c);
+        if (it != active_.end()) {
+            *it = active_.back();
+            active_.pop_back();
+        }
+    }
+
+    void close_fd(int fd) {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+    }
+
+    void close_all() {
+        for (Conn *c : active_) {
+            close_fd(c->fd);
+            delete c;
+        }
+        active_.clear();
+        for (auto &p : proxies_) {
+            for (auto &rep : p->replicas) {
+                for (Conn *c : rep->pool) {
+                    close_fd(c->fd);
+                    delete c;
+                }
+                rep->pool.clear();
+                for (Conn *c : rep->pending) {
+                    delete c;
+                }
+                rep->pending.clear();
+            }
+        }
+    }
+
+    /** Starts a non-blocking connect. Returns -1 if it failed right away */
+    static int open_socket(const ProxyReplica &r) {
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t) r.port);
+        if (inet_pton(AF_INET, r.addr.c_str(), &addr.sin_addr) <= 0) {
+            return -1;
+        }
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        if (fd < 0) {
+            return -1;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (::connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static bool connected(int fd) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        return getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+    }
+};
+
+#endif
@@ -0,0 +1,243 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "broker.h"
+#include "callbacks.h"
+#include "proxy_registry.h"
+#include "test/fake_proxy.h"
+
+/**
+ * Compares exec throughput with and without the exec broker.
+ *
+ * Starts local fake proxies that answer every stream with a canned forwarded request after a fixed delay, then runs
+ * 1, 2, 4, ... forked workers for a fixed time in each mode. A worker exec is what LLVMFuzzerTestOneInput does: send
+ * the stream to every proxy and parse every response. Direct mode opens a connection per proxy and exec from every
+ * worker, as callback() does; broker mode hands the exec to a broker process over shared memory.
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t direct_worker(const ProxyRegistry &reg, const uint8_t *data, size_t size, Clock::time_point end) {
+    uint64_t execs = 0;
+    std::vector<HashComp *> out(reg.size());
+    while (Clock::now() < end) {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < reg.size(); ++i) {
+            threads.emplace_back([&, i]() {
+                const ProxyReplica &r = reg[i].replicas[0];
+                out[i] = callback(r.addr.c_str(), r.port, reg[i].filter, data, size, reg[i].deadline_ms);
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        for (auto hc : out) {
+            delete hc;
+        }
+        execs++;
+    }
+    return execs;
+}
+
+static uint64_t broker_worker(const ProxyRegistry &reg, const std::string &name, const uint8_t *data, size_t size,
+                              Clock::time_point end) {
+    BrokerClient client;
+    if (!client.attach(name)) {
+        return 0;
+    }
+    std::vector<char *> bufs(reg.size());
+    std::vector<BrokerClient::Request> reqs(reg.size());
+    for (size_t i = 0; i < reg.size(); ++i) {
+        size_t sz = preprocess_req(reg[i].filter, data, size, &bufs[i]);
+        reqs[i] = {(uint32_t) i, 0, (uint32_t) reg[i].deadline_ms, (const uint8_t *) bufs[i], (uint32_t) sz};
+    }
+
+    uint64_t execs = 0;
+    std::vector<BrokerClient::Result> results;
+    while (Clock::now() < end) {
+        client.exchange(reqs, results);
+        for (size_t i = 0; i < reg.size(); ++i) {
+            if (results[i].status == BROKER_OK) {
+                delete parse_response(reg[i].filter, (const char *) results[i].data.data(), results[i].data.size(),
+                                      results[i].timed_out);
+            }
+        }
+        execs++;
+    }
+    for (auto b : bufs) {
+        delete[] b;
+    }
+    return execs;
+}
+
+static std::atomic<bool> g_stop(false);
+
+static void on_signal(int) {
+    g_stop = true;
+}
+
+/**
+ * Body of the server process: starts the fake proxies, writes the registry for them to "fn", then runs a broker for
+ * that registry until SIGTERM. Writes one byte to "ready" once workers may attach.
+ */
+static int serve(const char *fn, const std::string &name, int n_proxies, int delay_ms, int pool, int ready) {
+    signal(SIGTERM, on_signal);
+
+    // every fake proxy forwards the same request, as if all proxies agreed
+    std::vector<std::unique_ptr<FakeProxy>> fakes;
+    std::string resp = FakeProxy::echo_response("GET / HTTP/1.1\r\nHost: example.com\r\n\r\n");
+    {
+        std::ofstream out(fn);
+        out << "proxies = (";
+        for (int i = 0; i < n_proxies; ++i) {
+            fakes.emplace_back(new FakeProxy(resp, delay_ms));
+            out << (i ? ", " : " ") << "{ name = \"fake" << i << "\"; addrs = [\"127.0.0.1:" << fakes.back()->port()
+                << "\"]; filter = \"test_1\"; deadline_ms = 5000; }";
+        }
+        out << " );";
+    }
+    ProxyRegistry reg;
+    int ret = reg.load(fn);
+    if (ret != 0) {
+        std::cout << "Error " << ret << " loading the bench registry" << std::endl;
+        return 1;
+    }
+
+    Broker broker(reg, name, BROKER_SLOTS, BROKER_RING_BYTES, pool);
+    if (!broker.init()) {
+        return 1;
+    }
+    char c = 'r';
+    (void) write(ready, &c, 1);
+    broker.run(g_stop);
+    broker.print_stats(std::cout);
+    return 0;
+}
+
+/** Runs n forked workers for the given time and returns their total execs per second */
+static double run_workers(int n, int seconds, const std::function<uint64_t(Clock::time_point)> &work) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return 0;
+    }
+    auto end = Clock::now() + std::chrono::seconds(seconds);
+    std::vector<pid_t> pids;
+    for (int w = 0; w < n; ++w) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            uint64_t execs = work(end);
+            (void) write(fds[1], &execs, sizeof(execs));
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (pid_t pid : pids) {
+        waitpid(pid, nullptr, 0);
+    }
+    uint64_t total = 0;
+    for (int w = 0; w < n; ++w) {
+        uint64_t execs = 0;
+        if (read(fds[0], &execs, sizeof(execs)) == (ssize_t) sizeof(execs)) {
+            total += execs;
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return (double) total / seconds;
+}
+
+static void usage(const char *prog) {
+    std::cout << "usage: " << prog << " [-proxies <n>] [-delay <ms>] [-seconds <s>] [-max_workers <n>] [-pool <n>]"
+              << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int n_proxies = 4;
+    int delay_ms = 1;
+    int seconds = 3;
+    int max_workers = 64;
+    int pool = BROKER_POOL;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-proxies") == 0) {
+            n_proxies = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-delay") == 0) {
+            delay_ms = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-seconds") == 0) {
+            seconds = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-max_workers") == 0) {
+            max_workers = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-pool") == 0) {
+            pool = atoi(argv[i + 1]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc % 2 == 0 || n_proxies <= 0 || seconds <= 0 || max_workers <= 0 || max_workers > BROKER_SLOTS) {
+        usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // the fake proxies and the broker live in their own process, so the forked workers do not inherit their sockets
+    char fn[] = "/tmp/h2fuzz_bench_XXXXXX";
+    int fd = mkstemp(fn);
+    close(fd);
+    std::string name = "/h2fuzz_bench_" + std::to_string(getpid());
+    int ready[2];
+    if (pipe(ready) != 0) {
+        return 1;
+    }
+    pid_t server = fork();
+    if (server == 0) {
+        _exit(serve(fn, name, n_proxies, delay_ms, pool, ready[1]));
+    }
+    char c;
+    if (read(ready[0], &c, 1) != 1) {
+        std::cout << "Broker process failed to start" << std::endl;
+        return 1;
+    }
+    ProxyRegistry reg;
+    int ret = reg.load(fn);
+    unlink(fn);
+    if (ret != 0) {
+        std::cout << "Error " << ret << " loading the bench registry" << std::endl;
+        return 1;
+    }
+
+    uint8_t data[256];
+    size_t size = build_probe_stream(data, sizeof(data));
+
+    std::cout << n_proxies << " proxies, " << delay_ms << " ms per response, " << seconds << " s per run" << std::endl;
+    std::cout << std::setw(8) << "workers" << std::setw(14) << "direct/s" << std::setw(14) << "broker/s"
+              << std::setw(10) << "speedup" << std::endl;
+    for (int n = 1; n <= max_workers; n *= 2) {
+        double direct = run_workers(n, seconds, [&](Clock::time_point end) {
+            return direct_worker(reg, data, size, end);
+        });
+        double brokered = run_workers(n, seconds, [&](Clock::time_point end) {
+            return broker_worker(reg, name, data, size, end);
+        });
+        std::cout << std::setw(8) << n << std::fixed << std::setprecision(1) << std::setw(14) << direct
+                  << std::setw(14) << brokered << std::setw(9) << (direct > 0 ? brokered / direct : 0.0) << "x"
+                  << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));  // let the broker reap the slots of this run
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+    return 0;
+}
@@ -1,10 +1,13 @@
 #include "callbacks.h"
+#include <chrono>
 #include <iostream>
 #include <cerrno>
 #include "h1_parser.h"
 #include "../h2_serializer/src/deserializer.h"
+#include "../h2_serializer/src/frames/frames.h"
 #include "proxy_config.h"
 #include "hashcomp.h"
+#include "hash_utils.h"
 #include "client.h"
 #include "../debug.h"
 
@@ -55,22 +58,40 @@ size_t preprocess_req(const ProxyConfig &filt, const uint8_t *Data, size_t Size,
     return newsz;
 }
 
-HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const uint8_t *Data, size_t Size) {
+uint64_t canonical_stream_hash(const uint8_t *Data, size_t Size) {
+    // the identity rewrite of the grammar's authority. the per-proxy rewrite is a pure function of this output,
+    // so two units with the same canonical form are sent as identical streams to every proxy
+    ProxyConfig canon;
+    canon.authority = GRAMMAR_AUTH;
+
+    char *canon_data;
+    size_t canon_sz;
+    try {
+        canon_sz = preprocess_req(canon, Data, Size, &canon_data);
+    } catch (const std::exception &e) {
+        DEBUG("could not canonicalize stream: " << e.what())
+        return 0;
+    }
+    uint64_t h = HashUtils::fnv1a(canon_data, canon_sz);
+    delete[] canon_data;
+    return h != 0 ? h : 1;  // 0 is reserved for "no canonical form"
+}
+
+HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const uint8_t *Data, size_t Size,
+                   int deadline_ms, ResponseMemo *memo, const CaptureWriter::Tap *capture) {
     DEBUG("in callback")
     Client c;
     DEBUG("connecting")
 
-    // try connecting forever -- hard assumption that the proxy is up and will never die
+    // a proxy may be restarting. give up after a few tries and let the caller decide whether to wait for it
     int conn_ret = -1;
-    int iter = 0;
-    while (conn_ret != 0) {
-        if (iter == 10) {
-            std::cerr << "Failed connecting to " << addr << " 10 times in a row" << std::endl;
-            iter = 0;
-        }
-
-        conn_ret = c.connect(addr, port);
-        ++iter;
+    for (int iter = 0; iter < CONNECT_ATTEMPTS && conn_ret != 0; ++iter) {
+        conn_ret = c.connect(addr, port, deadline_ms);
+    }
+    if (conn_ret != 0) {
+        std::cerr << "Failed connecting to " << addr << ":" << port << " " << CONNECT_ATTEMPTS << " times in a row"
+                  << std::endl;
+        return nullptr;
     }
 
     // preprocess -- modify outgoing authority header
@@ -82,30 +103,54 @@ HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const ui
     // send data to proxy
     ssize_t send_sz = c.send(mut_data, Size, 0);
     DEBUG("sent " << send_sz << " bytes and errno=" << errno)
-    delete[] mut_data;
 
     std::vector<char> full_resp;
     full_resp.reserve(4096);
     char buf[4096];
     ssize_t resp_sz = 0;
+    bool timeout = false;
     while (true) {
         ssize_t amt_read = c.read(buf, sizeof(buf));
         DEBUG("read " << amt_read << " bytes and errno=" << errno)
         if (amt_read == -1 || amt_read == 0) {
+            timeout = amt_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
             break;  // timeout or done reading
         } else {
             resp_sz += amt_read;
             full_resp.insert(full_resp.end(), buf, buf + amt_read);
         }
     }
-    DEBUG("in total read " << resp_sz << " bytes and errno=" << errno)
-    bool timeout = resp_sz == -1 && errno == EAGAIN;
+    DEBUG("in total read " << resp_sz << " bytes and timeout=" << timeout)
 
     int closeval = c.close();
     DEBUG("close returned " << closeval << " and errno=" << errno)
 
+    if (capture != nullptr) {
+        capture->record(mut_data, Size, full_resp.data(), resp_sz, timeout);
+    }
+    delete[] mut_data;
+
+    return parse_response(filt, full_resp.data(), resp_sz, timeout, memo);
+}
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return (uint64_t) ns.count();
+}
+
+/** Copy of the memoized parse of the forwarded request "h1", or nullptr. Records the hit */
+static HashComp *memo_lookup(ResponseMemo *memo, const std::string &h1) {
+    auto start = std::chrono::steady_clock::now();
+    HashComp *hc = memo->find(h1);
+    if (hc != nullptr) {
+        memo->record_hit(elapsed_ns(start));
+    }
+    return hc;
+}
+
+HashComp *parse_response(const ProxyConfig &filt, const char *resp, size_t resp_sz, bool timeout, ResponseMemo *memo) {
     // read response and deserialize to H2 stream
-    H2Stream* h2strm = Deserializer::deserialize_stream(full_resp.data(), resp_sz);
+    H2Stream* h2strm = Deserializer::deserialize_stream(resp, resp_sz);
 
     bool data_found = false;
     std::string status;
@@ -150,7 +195,8 @@ HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const ui
     del_stream(h2strm);
 
     auto *hc = new HashComp();
-    hc->noresp_err = timeout || goaway_err != 0 || rst_stream_err != 0;
+    hc->noresp_err = goaway_err != 0 || rst_stream_err != 0;
+    hc->timeout_err = timeout;
     // hc->status = status; // NOTE: removing this b/c most diffs are variations on error codes. also nondeterministic
     if ((status.empty() || status == "200") && data_found) {
         DEBUG("found status and data")
@@ -158,7 +204,15 @@ HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const ui
         // special case Azure -- returns status 200 with an error body
         if (alldata.rfind("<!DOCTYPE", 0) == 0) {
             hc->noresp_err = true;
+        } else if (HashComp *seen = memo != nullptr ? memo_lookup(memo, alldata) : nullptr) {
+            // the proxy forwarded this exact request before. reuse the parse, keep the flags of this exchange
+            seen->noresp_err = hc->noresp_err;
+            seen->timeout_err = hc->timeout_err;
+            delete hc;
+            hc = seen;
         } else {
+            auto start = std::chrono::steady_clock::now();
+
             // compute hash of request data (presumably an HTTP/1 request)
             // parse and process h1 request
             H1Parser hp;
@@ -168,6 +222,11 @@ HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const ui
             hc->orig = alldata;  // to pass original request to Fuzzer core
             hc->parse(hp, filt);
             hc->hash_indiv();
+
+            if (memo != nullptr) {
+                memo->add(*hc);
+                memo->record_miss(elapsed_ns(start));
+            }
         }
 
 #if DBG_MODE
@@ -182,3 +241,17 @@ HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const ui
     }
     return hc;
 }
+
+size_t build_probe_stream(uint8_t *buf, size_t bufsz) {
+    HeadersFrame hf;
+    hf.flags = FLAG_END_HEADERS | FLAG_END_STREAM;
+    hf.stream_id = 0x00000001;
+    auto npref = hpack::HPacker::PrefixType::LITERAL_HEADER_WITHOUT_INDEXING;
+    auto nidx = hpack::HPacker::IndexingType::NONE;
+    hf.add_header(":method", "GET", npref, nidx);
+    hf.add_header(":scheme", "https", npref, nidx);
+    hf.add_header(":path", "/", npref, nidx);
+    hf.add_header(":authority", GRAMMAR_AUTH, npref, nidx);
+    hpack::HPacker hpe;
+    return hf.serialize((char *) buf, bufsz, &hpe, false);
+}
@@ -3,19 +3,42 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include "capture.h"
 #include "proxy_config.h"
 #include "hashcomp.h"
+#include "response_memo.h"
 #include "../h2_serializer/src/frames/h2stream.h"
 
 typedef HashComp* CallbackRet;
 
-void del_stream(H2Stream *strm);
+#define CONNECT_ATTEMPTS 3  // connection attempts per exchange before the proxy is reported as unreachable
 
 size_t preprocess_req(const ProxyConfig &filt, const uint8_t *Data, size_t Size, char **new_data);
 
+uint64_t canonical_stream_hash(const uint8_t *Data, size_t Size);
+
+void del_stream(H2Stream *strm);
+
 HashComp *callback_test(const char *proxy, int reqid, const ProxyConfig &filt);
 
-HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const uint8_t *Data, size_t Size);
+/**
+ * Sends the stream to the proxy at addr:port and returns the parsed forwarded request, or nullptr if the proxy could
+ * not be reached after CONNECT_ATTEMPTS tries. If memo is set, it is passed on to parse_response(). If capture is set,
+ * the exchange is recorded through it
+ */
+HashComp *callback(const char *addr, int port, const ProxyConfig &filt, const uint8_t *Data, size_t Size,
+                   int deadline_ms = 60000, ResponseMemo *memo = nullptr, const CaptureWriter::Tap *capture = nullptr);
+
+/**
+ * Parses the raw bytes a proxy sent back for one stream into the forwarded request. timeout is true if the proxy
+ * went silent before closing the connection. If memo is set, a forwarded request found there is not parsed again,
+ * and a newly parsed one is added to it
+ */
+HashComp *parse_response(const ProxyConfig &filt, const char *resp, size_t resp_sz, bool timeout,
+                         ResponseMemo *memo = nullptr);
+
+/** Serializes a plain "GET /" stream into buf. Every healthy proxy forwards it. Returns the serialized size */
+size_t build_probe_stream(uint8_t *buf, size_t bufsz);
 
 
 #endif
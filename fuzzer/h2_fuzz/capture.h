@@ -0,0 +1,401 @@
+#ifndef NEZHA_CAPTURE_H
+#define NEZHA_CAPTURE_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hash_utils.h"
+
+#define CAPTURE_RECORD_ENV "H2FUZZ_RECORD"  // capture file or directory every exchange with a proxy is recorded to
+#define CAPTURE_REPLAY_ENV "H2FUZZ_REPLAY"  // capture file or directory execs are served from instead of the proxies
+#define CAPTURE_EXT ".h2cap"                // extension of the capture files of a directory
+
+#define CAPTURE_MAGIC "h2cap001"           // first 8 bytes of a capture file
+#define CAPTURE_INDEX_MAGIC "h2capidx"     // last 8 bytes of a capture file that was closed cleanly
+#define CAPTURE_RECORD_MAGIC 0x31434552u   // "REC1", first field of every record
+#define CAPTURE_TIMED_OUT 0x1u             // record flag: the proxy went silent before closing the connection
+
+/**
+ * Layout of a capture file, in host byte order:
+ *
+ *   CAPTURE_MAGIC
+ *   records:  CaptureRecord, proxy name, preprocessed request, raw response
+ *   index:    (key, offset of the record) per record            -- only if the file was closed cleanly
+ *   footer:   number of index entries, offset of the index, CAPTURE_INDEX_MAGIC
+ *
+ * The key of a record is the FNV-1a hash of the proxy name, a NUL and the request. A file without a valid footer, e.g.
+ * because the fuzzer was killed, is indexed by scanning its records up to the first incomplete one.
+ */
+struct CaptureRecord {
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t proxy_sz;
+    uint32_t req_sz;
+    uint32_t resp_sz;
+};
+
+struct CaptureFooter {
+    uint64_t entries;
+    uint64_t index_off;
+    char magic[8];
+};
+
+typedef std::vector<std::pair<uint64_t, uint64_t>> CaptureIndex;  // key and offset of each record, in file order
+
+/**
+ * Reads capture files and serves the responses they hold, entirely from memory.
+ *
+ * Lookups are keyed by proxy name and the request exactly as callback() sends it, i.e., after preprocess_req(), and
+ * are checked against the full request, so a hash collision cannot return the wrong response. If the same exchange was
+ * recorded more than once, the first recording is served.
+ *
+ * Never modified after load(), so any number of threads can look up responses at once.
+ */
+class CaptureReader {
+public:
+    struct Response {
+        const char *data;
+        size_t size;
+        bool timed_out;
+    };
+
+    /**
+     * Loads the capture file at path, or every CAPTURE_EXT file in it if path is a directory. Returns false (and
+     * prints why) if nothing could be loaded
+     */
+    bool load(const std::string &path) {
+        struct stat st{};
+        if (stat(path.c_str(), &st) != 0) {
+            std::cerr << "capture -- could not open " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            return load_file(path);
+        }
+
+        DIR *dir = opendir(path.c_str());
+        if (dir == nullptr) {
+            std::cerr << "capture -- could not open " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        bool any = false;
+        std::string ext = CAPTURE_EXT;
+        while (struct dirent *ent = readdir(dir)) {
+            std::string fn = ent->d_name;
+            if (fn.size() > ext.size() && fn.compare(fn.size() - ext.size(), ext.size(), ext) == 0) {
+                any = load_file(path + "/" + fn) || any;
+            }
+        }
+        closedir(dir);
+        if (!any) {
+            std::cerr << "capture -- no " << CAPTURE_EXT << " files in " << path << std::endl;
+        }
+        return any;
+    }
+
+    /** Looks up the response proxy sent to req. Returns false if that exchange was not recorded */
+    bool find(const std::string &proxy, const char *req, size_t req_sz, Response &out) const {
+        auto it = index_.find(key(proxy, req, req_sz));
+        if (it != index_.end()) {
+            const std::string &buf = files_[it->second.file];
+            CaptureRecord rec{};
+            memcpy(&rec, &buf[it->second.off], sizeof(rec));
+            const char *p = &buf[it->second.off + sizeof(rec)];
+            if (rec.proxy_sz == proxy.size() && rec.req_sz == req_sz && memcmp(p, proxy.data(), proxy.size()) == 0 &&
+                memcmp(p + rec.proxy_sz, req, req_sz) == 0) {
+                out = {p + rec.proxy_sz + rec.req_sz, rec.resp_sz, (rec.flags & CAPTURE_TIMED_OUT) != 0};
+                hits_++;
+                return true;
+            }
+        }
+        misses_++;
+        return false;
+    }
+
+    /** Number of distinct exchanges loaded */
+    size_t size() const {
+        return index_.size();
+    }
+
+    uint64_t hits() const {
+        return hits_;
+    }
+
+    uint64_t misses() const {
+        return misses_;
+    }
+
+    /** Prints one line of statistics, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os) const {
+        os << "stat::capture_replay:          exchanges=" << index_.size() << " files=" << files_.size() << " hits="
+           << hits_ << " misses=" << misses_ << std::endl;
+    }
+
+    /** Key of the exchange of req with proxy */
+    static uint64_t key(const std::string &proxy, const char *req, size_t req_sz) {
+        uint64_t h = HashUtils::fnv1a(proxy.data(), proxy.size());
+        h = HashUtils::fnv1a("", 1, h);
+        return HashUtils::fnv1a(req, req_sz, h);
+    }
+
+    /**
+     * Reads the index of the capture file in buf into index, from its footer if it has a valid one and by scanning its
+     * records otherwise. Returns the offset at which the records end, or 0 if buf is not a capture file
+     */
+    static uint64_t read_index(const std::string &buf, CaptureIndex &index) {
+        index.clear();
+        if (buf.size() < strlen(CAPTURE_MAGIC) || buf.compare(0, strlen(CAPTURE_MAGIC), CAPTURE_MAGIC) != 0) {
+            return 0;
+        }
+
+        CaptureFooter foot{};
+        if (buf.size() >= strlen(CAPTURE_MAGIC) + sizeof(foot)) {
+            memcpy(&foot, &buf[buf.size() - sizeof(foot)], sizeof(foot));
+            uint64_t index_sz = foot.entries * 2 * sizeof(uint64_t);
+            if (memcmp(foot.magic, CAPTURE_INDEX_MAGIC, sizeof(foot.magic)) == 0 &&
+                foot.index_off >= strlen(CAPTURE_MAGIC) && foot.entries <= buf.size() &&
+                foot.index_off + index_sz + sizeof(foot) == buf.size()) {
+                index.resize(foot.entries);
+                for (uint64_t i = 0; i < foot.entries; ++i) {
+                    memcpy(&index[i].first, &buf[foot.index_off + 16 * i], sizeof(uint64_t));
+                    memcpy(&index[i].second, &buf[foot.index_off + 16 * i + 8], sizeof(uint64_t));
+                }
+                return foot.index_off;
+            }
+        }
+
+        // no index: the records end where the first incomplete one starts
+        uint64_t off = strlen(CAPTURE_MAGIC);
+        CaptureRecord rec{};
+        while (off + sizeof(rec) <= buf.size()) {
+            memcpy(&rec, &buf[off], sizeof(rec));
+            uint64_t len = sizeof(rec) + (uint64_t) rec.proxy_sz + rec.req_sz + rec.resp_sz;
+            if (rec.magic != CAPTURE_RECORD_MAGIC || off + len > buf.size()) {
+                break;
+            }
+            const char *p = &buf[off + sizeof(rec)];
+            index.emplace_back(key(std::string(p, rec.proxy_sz), p + rec.proxy_sz, rec.req_sz), off);
+            off += len;
+        }
+        return off;
+    }
+
+private:
+    struct Location {
+        uint32_t file;
+        uint64_t off;
+    };
+
+    std::vector<std::string> files_;
+    std::unordered_map<uint64_t, Location> index_;
+
+    mutable std::atomic<uint64_t> hits_{0};
+    mutable std::atomic<uint64_t> misses_{0};
+
+    bool load_file(const std::string &fn) {
+        std::ifstream in(fn, std::ios::binary);
+        if (!in) {
+            std::cerr << "capture -- could not open " << fn << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+
+        CaptureIndex index;
+        std::string buf = ss.str();
+        if (read_index(buf, index) == 0) {
+            std::cerr << "capture -- " << fn << " is not a capture file" << std::endl;
+            return false;
+        }
+        auto file = (uint32_t) files_.size();
+        files_.push_back(std::move(buf));
+        for (const auto &e : index) {
+            index_.emplace(e.first, Location{file, e.second});  // keeps the first recording
+        }
+        return true;
+    }
+};
+
+/**
+ * Appends exchanges with the proxies to a capture file, for CaptureReader to serve later.
+ *
+ * Every record is written at once, so a fuzzer that is killed leaves at most one incomplete record behind, which is
+ * dropped when the file is read or appended to again. close() writes the index. An exchange that is
+ * already in the file is not recorded again.
+ *
+ * Safe to use from several threads. Processes must not share a file: given a directory, each one writes its own.
+ */
+class CaptureWriter {
+public:
+    /** A proxy's handle on a writer, through which callback() records its exchanges */
+    struct Tap {
+        CaptureWriter *writer;
+        std::string proxy;
+
+        void record(const char *req, size_t req_sz, const char *resp, size_t resp_sz, bool timed_out) const {
+            writer->record(proxy, req, req_sz, resp, resp_sz, timed_out);
+        }
+    };
+
+    CaptureWriter() = default;
+    CaptureWriter(const CaptureWriter &) = delete;
+    CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+    ~CaptureWriter() {
+        close();
+    }
+
+    /**
+     * Opens the capture file at path for appending, creating it if needed, or <path>/<pid>.h2cap if path is a
+     * directory. Returns false (and prints why) on failure
+     */
+    bool open(const std::string &path) {
+        std::lock_guard<std::mutex> lock(mu_);
+        struct stat st{};
+        fn_ = stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode) ? path + "/" + std::to_string(getpid()) + CAPTURE_EXT
+                                                                   : path;
+        fd_ = ::open(fn_.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) {
+            std::cerr << "capture -- could not open " << fn_ << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        // pick up the records already in the file and cut off its index (or incomplete last record)
+        std::string buf;
+        char chunk[65536];
+        ssize_t n;
+        while ((n = ::read(fd_, chunk, sizeof(chunk))) > 0) {
+            buf.append(chunk, (size_t) n);
+        }
+        if (buf.empty()) {
+            buf = CAPTURE_MAGIC;
+            end_ = write_all(buf.data(), buf.size()) ? buf.size() : 0;
+        } else {
+            end_ = CaptureReader::read_index(buf, index_);
+        }
+        if (end_ == 0 || ftruncate(fd_, (off_t) end_) != 0 || lseek(fd_, (off_t) end_, SEEK_SET) < 0) {
+            std::cerr << "capture -- " << fn_ << " is not a capture file or cannot be written" << std::endl;
+            ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        for (const auto &e : index_) {
+            seen_.insert(e.first);
+        }
+        return true;
+    }
+
+    /** Records that proxy answered the preprocessed request req with resp */
+    void record(const std::string &proxy, const char *req, size_t req_sz, const char *resp, size_t resp_sz,
+                bool timed_out) {
+        uint64_t k = CaptureReader::key(proxy, req, req_sz);
+        CaptureRecord rec{CAPTURE_RECORD_MAGIC, timed_out ? CAPTURE_TIMED_OUT : 0, (uint32_t) proxy.size(),
+                          (uint32_t) req_sz, (uint32_t) resp_sz};
+        std::string buf((const char *) &rec, sizeof(rec));
+        buf.append(proxy);
+        buf.append(req, req_sz);
+        buf.append(resp, resp_sz);
+
+        std::lock_guard<std::mutex> lock(mu_);
+        if (fd_ < 0) {
+            return;
+        }
+        if (!seen_.insert(k).second) {
+            duplicates_++;
+            return;
+        }
+        if (!write_all(buf.data(), buf.size())) {
+            std::cerr << "capture -- could not write " << fn_ << ", recording stopped: " << strerror(errno)
+                      << std::endl;
+            ::close(fd_);
+            fd_ = -1;
+            return;
+        }
+        index_.emplace_back(k, end_);
+        end_ += buf.size();
+        recorded_++;
+    }
+
+    /** Writes the index and closes the file. Exchanges recorded after this are dropped */
+    void close() {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (fd_ < 0) {
+            return;
+        }
+        std::string buf;
+        for (const auto &e : index_) {
+            buf.append((const char *) &e.first, sizeof(e.first));
+            buf.append((const char *) &e.second, sizeof(e.second));
+        }
+        CaptureFooter foot{index_.size(), end_, {}};
+        memcpy(foot.magic, CAPTURE_INDEX_MAGIC, sizeof(foot.magic));
+        buf.append((const char *) &foot, sizeof(foot));
+        if (!write_all(buf.data(), buf.size())) {
+            std::cerr << "capture -- could not index " << fn_ << ": " << strerror(errno) << std::endl;
+        }
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    /** Path of the file records are written to */
+    const std::string &path() const {
+        return fn_;
+    }
+
+    uint64_t recorded() const {
+        return recorded_;
+    }
+
+    uint64_t duplicates() const {
+        return duplicates_;
+    }
+
+    /** Prints one line of statistics, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os) const {
+        std::lock_guard<std::mutex> lock(mu_);
+        os << "stat::capture_record:          file=" << fn_ << " recorded=" << recorded_ << " duplicates="
+           << duplicates_ << " bytes=" << end_ << std::endl;
+    }
+
+private:
+    mutable std::mutex mu_;
+    std::string fn_;
+    int fd_ = -1;
+    uint64_t end_ = 0;               // offset at which the next record is written
+    CaptureIndex index_;             // every record in the file
+    std::unordered_set<uint64_t> seen_;
+
+    std::atomic<uint64_t> recorded_{0};
+    std::atomic<uint64_t> duplicates_{0};
+
+    bool write_all(const char *buf, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd_, buf, len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            buf += n;
+            len -= (size_t) n;
+        }
+        return true;
+    }
+};
+
+#endif
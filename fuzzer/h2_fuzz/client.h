@@ -16,7 +16,7 @@ public:
         }
     }
 
-    int connect(const char *ip_addr, int port) {
+    int connect(const char *ip_addr, int port, int timeout_ms = 60000) {
         struct sockaddr_in serv_addr{};
         serv_addr.sin_family = AF_INET;
         serv_addr.sin_port = htons(port);
@@ -33,10 +33,10 @@ public:
             error("ERROR opening socket");
         }
 
-        // timeout in 5 seconds
+        // receive timeout
         struct timeval tv{};
-        tv.tv_sec = 60;
-        tv.tv_usec = 0;
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
         setsockopt(this->sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv);
 
         int retval = ::connect(this->sock, (struct sockaddr *) &serv_addr, sizeof(struct sockaddr_in));
@@ -0,0 +1,355 @@
+#ifndef NEZHA_FLAKE_VERIFIER_H
+#define NEZHA_FLAKE_VERIFIER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "proxy_registry.h"
+#include "result_matrix.h"
+
+#define VERIFY_ENV "H2FUZZ_VERIFY"  // times every logged difference is executed again. 0 or unset: never
+#define VERIFY_SPACING_ENV "H2FUZZ_VERIFY_SPACING_MS"  // delay between the executions of a difference
+#define VERIFY_SPACING_MS 2000   // default for VERIFY_SPACING_ENV
+#define VERIFY_THREADS 2         // differences being executed again at once
+#define VERIFY_QUEUE_MAX 4096    // differences waiting for verification. further ones are not verified
+#define VERIFY_TICK_MS 50        // granularity of the verification schedule
+#define VERIFY_LOG "verification.log"  // verdicts, next to the logged differences
+
+#define FLAKE_MIN_SAMPLES 4      // verified differences a proxy disagreed on a field in before it can be unstable there
+#define FLAKE_UNSTABLE_PCT 50    // share of those in which its value changed, at or above which it is unstable there
+
+/**
+ * Tells the differences that come from load, timeouts or restarts apart from those that come from parsing.
+ *
+ * Every difference the fuzzer logs is queued with the results it was logged with. Background threads execute it again
+ * `runs` times, `spacing_ms` apart so that a passing hiccup is not seen by every run, while fuzzing goes on. A proxy is
+ * flaky on a key column if its value there changed in some run. The difference is stable if no proxy was, and flaky
+ * otherwise. The verdict is appended to VERIFY_LOG in the directory of the logged file, with the flaky proxies and
+ * fields.
+ *
+ * Each proxy keeps count, per key column, of the verified differences it disagreed on the column in and of how many of
+ * those were flaky for it there. Once FLAKE_UNSTABLE_PCT of at least FLAKE_MIN_SAMPLES were, the proxy is unstable on
+ * the column, and suppress() leaves out later disagreements on the column that only unstable proxies take part in, so
+ * that they are not logged again.
+ *
+ * suppress() is lock-free so it can be called on every exec; the queue and the counts take a mutex.
+ */
+class FlakeVerifier {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /** Executes a stream on every proxy and loads the results into m. Returns false if some proxy did not answer */
+    typedef std::function<bool(const std::string &stream, ResultMatrix &m)> Exec;
+
+    FlakeVerifier(const ProxyRegistry &reg, Exec exec, int runs, int spacing_ms = VERIFY_SPACING_MS,
+                  size_t threads = VERIFY_THREADS)
+            : exec_(std::move(exec)), runs_(std::max(runs, 1)), spacing_(std::chrono::milliseconds(spacing_ms)),
+              n_threads_(threads) {
+        for (const auto &e : reg) {
+            std::unique_ptr<Proxy> p(new Proxy());
+            p->name = e.name;
+            proxies_.push_back(std::move(p));
+        }
+        for (auto &u : unstable_) {
+            u = 0;
+        }
+    }
+
+    virtual ~FlakeVerifier() {
+        stop();
+    }
+
+    /** Starts verifying queued differences in the background */
+    void start() {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (threads_.empty()) {
+            stopping_ = false;
+            for (size_t i = 0; i < n_threads_; ++i) {
+                threads_.emplace_back(&FlakeVerifier::run, this);
+            }
+        }
+    }
+
+    void stop() {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stopping_ = true;
+            threads.swap(threads_);
+        }
+        cv_.notify_all();
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    /**
+     * Queues a difference that was logged to path. orig holds the results it was logged with; they are copied, so the
+     * caller can go on with the next exec. Returns false if the queue is full
+     */
+    bool submit(const std::string &stream, const ResultMatrix &orig, const std::string &path,
+                Clock::time_point now = Clock::now()) {
+        std::unique_ptr<Job> job(new Job());
+        job->stream = stream;
+        job->path = path;
+        job->orig = orig;
+        job->orig.ignore(nullptr);  // verify the difference as the proxies showed it, not as suppress() left it
+        job->next = now + spacing_;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (queue_.size() >= VERIFY_QUEUE_MAX) {
+                dropped_++;
+                return false;
+            }
+            queue_.push_back(std::move(job));
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    /**
+     * Executes one queued difference that is due again. Returns false if none was. Called by the background threads;
+     * exposed so tests can drive the schedule with their own clock
+     */
+    bool step(Clock::time_point now) {
+        Job *job = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (auto &j : queue_) {
+                if (!j->busy && j->next <= now) {
+                    job = j.get();
+                    job->busy = true;
+                    break;
+                }
+            }
+        }
+        if (job == nullptr) {
+            return false;
+        }
+
+        ResultMatrix m;
+        bool answered = exec_(job->stream, m);  // may take up to a deadline, so it runs without the lock
+
+        std::lock_guard<std::mutex> lk(mu_);
+        job->attempts++;
+        if (answered && m.proxies() == job->orig.proxies()) {
+            job->answered++;
+            for (size_t c = 0; c < ResultMatrix::KEY_COLS; ++c) {
+                if (!ResultMatrix::key_compared(c)) {
+                    continue;
+                }
+                for (int i = 0; i < m.proxies(); ++i) {
+                    job->changed[c] |= (uint64_t) (m.key(c)[i] != job->orig.key(c)[i]) << i;
+                }
+            }
+        }
+        job->busy = false;
+        job->next = now + spacing_;
+        // runs no proxy answered do not count, but they are not retried forever either
+        if (job->answered >= runs_ || job->attempts >= 2 * runs_) {
+            finish(*job);
+            for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+                if (it->get() == job) {
+                    queue_.erase(it);
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Leaves out of m the disagreements that only proxies unstable on the column take part in. Returns true if that
+     * made m agree
+     */
+    bool suppress(ResultMatrix &m) {
+        uint64_t unstable[ResultMatrix::KEY_COLS];
+        bool any = false;
+        for (size_t c = 0; c < ResultMatrix::KEY_COLS; ++c) {
+            unstable[c] = unstable_[c].load(std::memory_order_relaxed);
+            any |= unstable[c] != 0;
+        }
+        if (!any || !m.has_diff()) {
+            return false;
+        }
+        m.ignore(unstable);
+        if (m.has_diff()) {
+            return false;
+        }
+        suppressed_++;
+        return true;
+    }
+
+    /** Proxies unstable on a key column */
+    uint64_t unstable(size_t col) const {
+        return unstable_[col].load(std::memory_order_relaxed);
+    }
+
+    uint64_t stable() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return stable_;
+    }
+
+    uint64_t flaky() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return flaky_;
+    }
+
+    /** Differences no proxy answered for in any run */
+    uint64_t unverified() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return unverified_;
+    }
+
+    size_t pending() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return queue_.size();
+    }
+
+    uint64_t suppressed() const {
+        return suppressed_;
+    }
+
+    /** Prints the verdicts so far and a line per proxy that was flaky, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        os << "stat::verify:                  stable=" << stable_ << " flaky=" << flaky_ << " unverified="
+           << unverified_ << " pending=" << queue_.size() << " dropped=" << dropped_ << " suppressed=" << suppressed_
+           << std::endl;
+        for (size_t pi = 0; pi < proxies_.size(); ++pi) {
+            const Proxy &p = *proxies_[pi];
+            if (p.flaky_diffs == 0) {
+                continue;
+            }
+            os << "stat::flaky:                   " << p.name << " diffs=" << p.diffs << " flaky=" << p.flaky_diffs
+               << " unstable=" << columns(unstable_, pi) << std::endl;
+        }
+    }
+
+protected:
+    struct Job {
+        std::string stream;
+        std::string path;
+        ResultMatrix orig;
+        uint64_t changed[ResultMatrix::KEY_COLS] = {};  // per key column, the proxies whose value changed in some run
+        int answered = 0;
+        int attempts = 0;
+        bool busy = false;
+        Clock::time_point next;
+    };
+
+    struct Proxy {
+        std::string name;
+        uint64_t diffs = 0;        // verified differences it disagreed in
+        uint64_t flaky_diffs = 0;  // of those, the ones it was flaky in
+        uint64_t samples[ResultMatrix::KEY_COLS] = {};  // verified differences it disagreed on the column in
+        uint64_t flaky[ResultMatrix::KEY_COLS] = {};    // of those, the ones its value on the column changed in
+    };
+
+    Exec exec_;
+    int runs_;
+    Clock::duration spacing_;
+    size_t n_threads_;
+    std::vector<std::unique_ptr<Proxy>> proxies_;
+    std::atomic<uint64_t> unstable_[ResultMatrix::KEY_COLS];
+    std::atomic<uint64_t> suppressed_{0};
+
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::vector<std::thread> threads_;
+    bool stopping_ = false;
+    std::deque<std::unique_ptr<Job>> queue_;
+    uint64_t stable_ = 0;
+    uint64_t flaky_ = 0;
+    uint64_t unverified_ = 0;
+    uint64_t dropped_ = 0;
+
+    void run() {
+        while (true) {
+            if (step(Clock::now())) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(mu_);
+            if (stopping_) {
+                return;
+            }
+            cv_.wait_for(lk, std::chrono::milliseconds(VERIFY_TICK_MS));
+            if (stopping_) {
+                return;
+            }
+        }
+    }
+
+    /** Comma-separated names of the key columns whose mask has bit pi set, or "-" */
+    template<typename Mask>
+    static std::string columns(const Mask *masks, size_t pi) {
+        std::string out;
+        for (size_t c = 0; c < ResultMatrix::KEY_COLS; ++c) {
+            if ((masks[c] >> pi) & 1) {
+                out += (out.empty() ? "" : ",") + ResultMatrix::key_name(c);
+            }
+        }
+        return out.empty() ? "-" : out;
+    }
+
+    /** Records the verdict on a job whose runs are over. Called with mu_ held */
+    void finish(const Job &job) {
+        bool flaky = false;
+        for (uint64_t ch : job.changed) {
+            flaky |= ch != 0;
+        }
+        const char *verdict = job.answered == 0 ? "unverified" : flaky ? "flaky" : "stable";
+        if (job.answered == 0) {
+            unverified_++;
+        } else if (flaky) {
+            flaky_++;
+        } else {
+            stable_++;
+        }
+
+        std::string culprits;
+        for (size_t pi = 0; pi < proxies_.size() && job.answered > 0; ++pi) {
+            Proxy &p = *proxies_[pi];
+            bool disagreed = false;
+            bool flaky_here = false;
+            for (size_t c = 0; c < ResultMatrix::KEY_COLS; ++c) {
+                flaky_here |= (job.changed[c] >> pi) & 1;
+                if (!((job.orig.disagreement(c) >> pi) & 1)) {
+                    continue;
+                }
+                disagreed = true;
+                p.samples[c]++;
+                p.flaky[c] += (job.changed[c] >> pi) & 1;
+                if (p.samples[c] >= FLAKE_MIN_SAMPLES && p.flaky[c] * 100 >= p.samples[c] * FLAKE_UNSTABLE_PCT) {
+                    unstable_[c] |= 1ULL << pi;
+                } else {
+                    unstable_[c] &= ~(1ULL << pi);
+                }
+            }
+            p.diffs += disagreed;
+            p.flaky_diffs += disagreed && flaky_here;
+            if (flaky_here) {
+                culprits += (culprits.empty() ? "" : " ") + p.name + ":" + columns(job.changed, pi);
+            }
+        }
+
+        size_t slash = job.path.find_last_of('/');
+        std::string log = slash == std::string::npos ? VERIFY_LOG : job.path.substr(0, slash + 1) + VERIFY_LOG;
+        std::string name = slash == std::string::npos ? job.path : job.path.substr(slash + 1);
+        std::ofstream os(log, std::ofstream::app);
+        os << name << "\t" << verdict << "\t" << job.answered << "/" << runs_ << "\t"
+           << (culprits.empty() ? "-" : culprits) << std::endl;
+    }
+};
+
+#endif
@@ -38,4 +38,36 @@ const std::map<std::string, FrameField> H2FuzzConfig::str2frmfld_ = {
         {"delete", FrameField::Delete},
         {"swap", FrameField::Swap},
         {"split", FrameField::Split}
-};
\ No newline at end of file
+};
+
+std::string H2FuzzConfig::frame_key(uint8_t frame_type) {
+    switch (frame_type) {
+        case DATA: return "data";
+        case HEADERS: return "headers";
+        case PRIORITY_TYPE: return "priority";
+        case RST_STREAM: return "rst_stream";
+        case SETTINGS: return "settings";
+        case PUSH_PROMISE: return "push_prom";
+        case PING: return "ping";
+        case GOAWAY: return "goaway";
+        case WINDOW_UPDATE: return "win_update";
+        case CONTINUATION: return "continuation";
+        default: return std::to_string(frame_type);
+    }
+}
+
+std::string H2FuzzConfig::field_key(const FieldRep &fr) {
+    std::string out = "?";
+    for (const auto &p : str2frmfld_) {
+        if (p.second == fr.field) {
+            out = p.first;
+        }
+    }
+    out += "/";
+    for (const auto &p : str2frametype_) {
+        if (p.second == fr.frametype) {
+            return out + p.first;
+        }
+    }
+    return out + "?";
+}
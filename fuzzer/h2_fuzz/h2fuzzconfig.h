@@ -53,6 +53,7 @@ public:
     unsigned int prob_bit = 20, prob_delete = 20, prob_dup = 20, prob_swap = 20, prob_fix = 20;
     unsigned int prob_add = 50, prob_splice = 50;
     unsigned int prob_do_hdr_set_mut = 50;
+    bool adaptive = false;  // whether the likelihoods are only priors of a MutationBandit
 
     int read_config(const std::string &fn) {
         c.readFile(fn.c_str());  // can throw exceptions. allow them to propagate
@@ -67,6 +68,12 @@ public:
         return 0;
     }
 
+    /** Name of the given frame type as used in mutable_fields, e.g., "push_prom" */
+    static std::string frame_key(uint8_t frame_type);
+
+    /** Name of the given field as used in mutable_fields, e.g., "flags/base" */
+    static std::string field_key(const FieldRep &fr);
+
     std::vector<FieldRep> *get_fields(uint8_t frame_type) {
         auto pos = lookup.find(frame_type);
         if (pos != lookup.end()) {
@@ -153,11 +160,8 @@ protected:
     int parse_mutable_fields() {
         if (!c.exists("mutable_fields")) return ERR_CFG_FLD_NEXT;
 
-        // we associate strings in the config file with 1) vectors of mutable fields and 2) the frame type macros
-        // these 3 vectors must be the same size. the same index in all 3 corresponds to the same frame type
-        std::vector<std::string> key_vec{
-                "data", "headers", "priority", "rst_stream", "settings",
-                "push_prom", "ping", "goaway", "win_update", "continuation"};
+        // we associate the frame type macros with vectors of mutable fields, which are read from their frame_key
+        // these 2 vectors must be the same size. the same index in both corresponds to the same frame type
         std::vector<std::vector<FieldRep> *> fr_vec{
                 &datafrm_flds, &hdrfrm_flds, &priority_flds, &rst_stream_flds, &settings_flds,
                 &push_prom_flds, &ping_flds, &goaway_flds, &win_up_flds, &cont_flds};
@@ -167,8 +171,8 @@ protected:
 
         // populate fr_vec with vectors of mutable fields
         // then, map the frame macros to their associated vector in "lookup"
-        for (int i = 0; i < key_vec.size(); ++i) {
-            int ret = read_one(key_vec[i], fr_vec[i]);
+        for (int i = 0; i < type_vec.size(); ++i) {
+            int ret = read_one(frame_key(type_vec[i]), fr_vec[i]);
             if (ret != 0) {
                 return ret;
             }
@@ -193,6 +197,7 @@ protected:
         if (!c.lookupValue("likelihoods.crossover_operators.add", prob_add)) return ERR_LKL_LOOKUP;
         if (!c.lookupValue("likelihoods.crossover_operators.splice", prob_splice)) return ERR_LKL_LOOKUP;
         if (!c.lookupValue("likelihoods.mutate_hdr_settings", prob_do_hdr_set_mut)) return ERR_LKL_LOOKUP;
+        c.lookupValue("likelihoods.adaptive", adaptive);  // optional
 
         if (prob_bit + prob_delete + prob_dup + prob_swap + prob_fix != 100) return ERR_LKL_SUM;
         if (prob_add + prob_splice != 100) return ERR_LKL_SUM;
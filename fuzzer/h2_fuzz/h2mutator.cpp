@@ -8,13 +8,26 @@
 
 extern "C" size_t LLVMFuzzerMutate(uint8_t *Data, size_t Size, size_t MaxSize);
 
+// one per fuzzing thread. credited by LLVMFuzzerMutationFeedback once the unit it helped mutate has run
+static thread_local MutationBandit bandit;
+
+/** Sets up the bandit for the next mutation, if the config asks for one */
+static void use_bandit(H2Mutator &h2m) {
+    bandit.credit(false);  // picks of a unit that never got feedback
+    if (h2m.cfg_.adaptive) {
+        h2m.bandit_ = &bandit;
+    }
+}
+
 extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *Data, size_t Size,
                                           size_t MaxSize, unsigned int Seed) {
     std::string s(reinterpret_cast<const char*>(Data), Size);
     std::stringstream in(s);
     std::stringstream out;
     H2Mutator h2m(in, CFG);
+    use_bandit(h2m);
     if (!h2m.Mutate(LLVMFuzzerMutate, Seed, MaxSize)) {
+        bandit.discard();
         return 0;
     }
 
@@ -22,14 +35,8 @@ extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *Data, size_t Size,
         return Size;
     }
 
-    // TODO make serialize take in a stream to i don't have to worry about memory management
-    char buf[MaxSize];
-    uint32_t newsz = h2m.strm_->serialize(buf, MaxSize);
-    if (newsz > MaxSize) {
-        return 0;
-    }
-    memcpy(Data, buf, newsz);
-    return newsz;
+    // Mutate() only succeeds if the exact serialized size fits into MaxSize, so serialize straight into Data
+    return h2m.strm_->serialize(reinterpret_cast<char *>(Data), MaxSize);
 }
 
 extern "C" size_t LLVMFuzzerCustomCrossOver(const uint8_t *Data1, size_t Size1,
@@ -40,7 +47,9 @@ extern "C" size_t LLVMFuzzerCustomCrossOver(const uint8_t *Data1, size_t Size1,
     std::stringstream in2(std::string(reinterpret_cast<const char *>(Data2), Size2));
     H2Mutator h2m1(in1, CFG);
     H2Mutator h2m2(in2, CFG);
+    use_bandit(h2m1);
     if (!h2m1.CrossOver(h2m2, Seed, MaxSize)) {
+        bandit.discard();
         return 0;
     }
 
@@ -50,9 +59,11 @@ extern "C" size_t LLVMFuzzerCustomCrossOver(const uint8_t *Data1, size_t Size1,
         return 0;
     }
 
-    uint32_t newsz = h2m1.strm_->serialize((char*)Out, MaxSize);
-    if (newsz > MaxSize) {
-        return 0;
-    }
-    return newsz;
+    // as in LLVMFuzzerCustomMutator, CrossOver() only succeeds if the result fits into MaxSize
+    return h2m1.strm_->serialize((char*)Out, MaxSize);
+}
+
+/** Called after every run of a mutated unit with whether it had a new output tuple or a new difference */
+extern "C" void LLVMFuzzerMutationFeedback(int NewOutputs, int NewDiff) {
+    bandit.credit(NewOutputs || NewDiff);
 }
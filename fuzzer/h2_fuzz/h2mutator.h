@@ -10,8 +10,11 @@
 #include "../h2_serializer/src/deserializer.h"
 #include "../h2_serializer/src/frame_copier.h"
 #include "../h2_serializer/src/hpacker/HPacker.h"
-#include "../h2_serializer/src/hpacker/StaticTable.h"
 #include "h2fuzzconfig.h"
+#include "hpack_table.h"
+#include "mutation_bandit.h"
+#include "response_dictionary.h"
+#include "stream_size.h"
 #include "../debug.h"
 #include "proxy_config.h"
 #include "util.h"
@@ -65,7 +68,7 @@ public:
     virtual ~H2Mutator() {
         if (strm_ != nullptr) {
             for (Frame *f: *strm_) {
-                delete f;
+                FrameCopier::release_frame(f);
             }
             delete strm_;
         }
@@ -75,16 +78,21 @@ public:
      * Returns the number of bytes needed to encode the given integer using HPACK integer encoding with a prefix of 7
      */
     static int hpack_int_length(uint64_t I, uint8_t N = 7) {
-        uint8_t NF = (1 << N) - 1;
-        if (I < NF) { return 1; }
-        int out = 1;
-        I -= NF;
-        while (I >= 128) {
-            ++out;
-            I /= 128;
+        return (int) StreamSize::int_size(I, N);
+    }
+
+    /**
+     * Replaces the frames of this stream that other streams hold as well (see FrameCopier::share_frame) with copies,
+     * so that the mutation that follows can write to any frame
+     */
+    void unshare_frames() {
+        for (Frame *&f : *strm_) {
+            if (FrameCopier::is_shared(f)) {
+                Frame *copy = FrameCopier::copy_frame(f);
+                FrameCopier::release_frame(f);
+                f = copy;
+            }
         }
-        ++out;
-        return out;
     }
 
     /**
@@ -100,17 +108,15 @@ public:
         Frame *next_f = this->strm_->at(idx + 1);
 
         // get set of all available headers in Frames prior to this one
-        std::set<HPacker::KeyValuePair> nv_pairs;
-        std::set<std::string> names;
-        headers_in_table(nv_pairs, names, f, 0);
+        HpackTable::View table = headers_in_table(f, 0);
 
         for (int i = 0; i < h->hdr_pairs.size(); ++i) {
             // if this header is added to the dynamic table and is NOT already in the table, we need to check dependencies
-            if (h->prefixes[i] == PrefType::LITERAL_HEADER_WITH_INDEXING && !set_contains(nv_pairs, h->hdr_pairs[i])) {
+            if (h->prefixes[i] == PrefType::LITERAL_HEADER_WITH_INDEXING && !table.contains(h->hdr_pairs[i])) {
                 // don't actually care about modifying encodings of headers in this frame since they will be deleted
                 // pass next_f so that we start scanning on the frame after this one
                 // pass -1 as idx so that the starting index will be 0 (hacky, but it works)
-                post_patch_header_encodings(next_f, -1, h->hdr_pairs[i], set_contains(names, h->hdr_pairs[i].first));
+                post_patch_header_encodings(next_f, -1, h->hdr_pairs[i], table.contains_name(h->hdr_pairs[i].first));
             }
         }
     }
@@ -130,11 +136,13 @@ public:
         DEBUG("Mutate")
         std::minstd_rand rnd(Seed);
         this->rnd_ = &rnd;
+        table_.clear();
 
         if (strm_ == nullptr || strm_->empty()) {
             DEBUG("null or empty stream. returning")
             return 0;
         }
+        unshare_frames();
 
         // pick frame to mutate
         unsigned int pos1 = my_rand(strm_->size());
@@ -145,7 +153,7 @@ public:
         switch (op) {
             case BIT:
                 DEBUG("bit mutation")
-                return bit_mutation(f1, m, MaxSize);
+                return fit(bit_mutation(f1, m, MaxSize), pos1, MaxSize);
             case DELETE:
                 DEBUG("delete frame mutation")
                 // if there are frames after this one and this frame has headers, update header encoding dependencies
@@ -154,8 +162,8 @@ public:
                 }
                 strm_->erase(strm_->begin() + pos1);
                 strm_sz_ -= HDRSZ + f1->len;
-                delete f1;
-                return 1;
+                FrameCopier::release_frame(f1);
+                return fit(1, pos1, MaxSize);
             case DUP:
                 DEBUG("duplicate frame mutation")
                 // check bounds first
@@ -168,11 +176,11 @@ public:
                 DEBUG("duplicating frame index " << pos1 << " of type " << (int) f1->type)
                 strm_->insert(strm_->begin() + pos1, f2);
                 strm_sz_ += f2->len + HDRSZ;
-                return 1;
+                return fit(1, pos1, MaxSize);
             case SWAP:
-                return swap_frames(pos1, MaxSize);
+                return fit(swap_frames(pos1, MaxSize), pos1, MaxSize);
             case FIX:
-                return fix_flags();
+                return fit(fix_flags(), strm_->size(), MaxSize);  // END_STREAM and END_HEADERS do not change sizes
             default:
                 std::cout << "Invalid operation in Mutate: " << op << std::endl;
                 return 0;
@@ -220,7 +228,7 @@ public:
 
         // from swap_headers, max possible size increase from a swap is a header size
         // thus, max possible increase here is the sum of all headers in this frame
-        // huge overestimation, but time required to get it right vs payoff ratio not good...
+        // huge overestimation, so if it does not fit, the swap is sized exactly and undone if it really does not fit
         unsigned int sz_update = 0;
         if (Frame::has_headers(f_sm)) {
             for (auto hdr: dynamic_cast<Headers *>(f_sm)->hdr_pairs) {
@@ -232,21 +240,23 @@ public:
                 sz_update += hdr_sz(&hdr);
             }
         }
-        if (strm_sz_ + sz_update > MaxSize) { return 0; }
+        bool exact = strm_sz_ + sz_update > MaxSize;
+        Encodings orig;
+        if (exact) {
+            orig = save_encodings(idx_sm, idx_lg);
+        }
 
-        std::set<HPacker::KeyValuePair> nv_pairs;
-        std::set<std::string> names;
-        headers_in_table(nv_pairs, names, f_sm, 0);
+        HpackTable::View table = headers_in_table(f_sm, 0);
 
         // if frame at low index has headers, must update header encodings in all frames between idx_sm and idx_lg
         if (Frame::has_headers(f_sm)) {
             auto h = dynamic_cast<Headers *>(f_sm);
             for (int i = 0; i < h->hdr_pairs.size(); ++i) {
                 HPacker::KeyValuePair hdr = h->hdr_pairs[i];
-                if (h->prefixes[i] == PrefType::LITERAL_HEADER_WITH_INDEXING && !set_contains(nv_pairs, hdr)) {
+                if (h->prefixes[i] == PrefType::LITERAL_HEADER_WITH_INDEXING && !table.contains(hdr)) {
                     // patch starting at frame at index after idx_sm, patch every header, and only scan up to frame at idx_lg-1
                     post_patch_header_encodings(this->strm_->at(idx_sm + 1), -1, h->hdr_pairs[i],
-                                                set_contains(names, hdr.first),
+                                                table.contains_name(hdr.first),
                                                 false, -1, idx_lg - 1);
                 }
             }
@@ -258,17 +268,22 @@ public:
             auto h = dynamic_cast<Headers *>(f_lg);
             for (int i = 0; i < h->hdr_pairs.size(); ++i) {
                 if (h->idx_types[i] == IdxType::NONE ||
-                    set_contains(nv_pairs, h->hdr_pairs[i]) ||
-                    (h->idx_types[i] == IdxType::NAME && set_contains(names, h->hdr_pairs[i].first))) {
+                    table.contains(h->hdr_pairs[i]) ||
+                    (h->idx_types[i] == IdxType::NAME && table.contains_name(h->hdr_pairs[i].first))) {
                     continue;
                 }
                 h->prefixes[i] = PrefType::LITERAL_HEADER_WITH_INDEXING;
-                h->idx_types[i] = set_contains(names, h->hdr_pairs[i].first) ? IdxType::NAME : IdxType::NONE;
+                h->idx_types[i] = table.contains_name(h->hdr_pairs[i].first) ? IdxType::NAME : IdxType::NONE;
             }
         }
 
         // perform swap
         std::iter_swap(strm_->begin() + idx_sm, strm_->begin() + idx_lg);
+        if (exact && !fits(idx_sm, MaxSize)) {
+            std::iter_swap(strm_->begin() + idx_sm, strm_->begin() + idx_lg);
+            restore_encodings(orig);
+            return 0;
+        }
         return 1;
     }
 
@@ -293,10 +308,12 @@ public:
         DEBUG("CrossOver")
         std::minstd_rand rnd(Seed);
         this->rnd_ = &rnd;
+        table_.clear();
 
         if (strm_ == nullptr || p.strm_ == nullptr || p.strm_->empty()) {
             return 0;
         }
+        unshare_frames();
 
         unsigned int this_idx, other_idx, op;
 
@@ -312,31 +329,33 @@ public:
             bool bothheaders = Frame::has_headers(this_frm) && Frame::has_headers(other_frm);
             if ((bothsettings || bothheaders) && header_mut_rand()) {
                 if (bothheaders) {
-                    return cross_over_headers(this_frm, other_frm, MaxSize);
+                    return fit(cross_over_headers(this_frm, other_frm, MaxSize), this_idx, MaxSize);
                 } else {
                     auto this_settings = &dynamic_cast<SettingsFrame *>(this_frm)->settings;
                     auto other_settings = &dynamic_cast<SettingsFrame *>(other_frm)->settings;
                     Setting s;
-                    return cross_over_impl(this_settings, other_settings, MaxSize,
-                                           H2Mutator::setting_sz, H2Mutator::setting_cpy,
-                                           &s, this_idx, other_idx, op);
+                    return fit(cross_over_impl(this_settings, other_settings, MaxSize,
+                                               H2Mutator::setting_sz, H2Mutator::setting_cpy,
+                                               &s, this_idx, other_idx, op), this_idx, MaxSize);
                 }
             }
         }
 
-        return cross_over_frames(this->strm_, p.strm_, MaxSize);
+        // the frame added or spliced in is not in the sized prefix of the stream, and the frames whose encodings are
+        // patched follow it, so StreamSize finds the change on its own
+        return fit(cross_over_frames(this->strm_, p.strm_, MaxSize), this->strm_->size(), MaxSize);
     }
 
     H2Stream *strm_ = nullptr;  // HTTP/2 stream to be mutated
 
+    // if set, picks operators and fields instead of the likelihoods in cfg_ alone. See mutation_bandit.h
+    MutationBandit *bandit_ = nullptr;
+
 protected:
     void parse_stream(std::istream &in) {
         try {
             strm_ = Deserializer::deserialize_stream(in);
-            strm_sz_ = 0;
-            for (auto f: *strm_) {
-                strm_sz_ += HDRSZ + f->len;
-            }
+            strm_sz_ = sizes_.total(*strm_);  // not the input's size, e.g., if it has Huffman-encoded strings
         } catch (...) {
             std::cout << "Mutator: could not parse stream" << std::endl;
             strm_ = nullptr;
@@ -344,12 +363,78 @@ protected:
         }
     }
 
+    /**
+     * Completes a mutation that returned ret and changed the stream in place from frame from on: sizes the stream
+     * exactly and rejects the mutation if it does not fit into MaxSize. The operators check their bounds against
+     * strm_sz_ as they go, but those checks cannot see everything, e.g., that a new entry in the HPACK table moves the
+     * indices of later headers past what fits into their prefix
+     */
+    size_t fit(size_t ret, size_t from, unsigned int MaxSize) {
+        sizes_.invalidate(from);
+        if (ret == 0) {
+            return 0;
+        }
+        return fits(from, MaxSize) ? ret : 0;
+    }
+
+    /** Sizes the stream exactly after a change from frame from on and returns whether it fits into MaxSize */
+    bool fits(size_t from, unsigned int MaxSize) {
+        sizes_.invalidate(from);
+        strm_sz_ = sizes_.total(*this->strm_);
+        return strm_sz_ <= MaxSize;
+    }
+
+    /** Returns the index of f in the stream, or the size of the stream if it is not in it */
+    size_t frame_index(Frame *f) const {
+        return std::find(this->strm_->begin(), this->strm_->end(), f) - this->strm_->begin();
+    }
+
+    /** Encodings and lengths of a range of frames of the stream, so that a mutation that does not fit can be undone */
+    struct Encodings {
+        size_t first = 0;
+        uint64_t strm_sz = 0;
+        std::vector<uint32_t> lens;
+        std::vector<std::vector<PrefType>> prefixes;
+        std::vector<std::vector<IdxType>> idx_types;
+    };
+
+    Encodings save_encodings(size_t first, size_t last) {
+        Encodings e;
+        e.first = first;
+        e.strm_sz = strm_sz_;
+        for (size_t i = first; i <= last; ++i) {
+            Frame *f = this->strm_->at(i);
+            auto *h = dynamic_cast<Headers *>(f);
+            e.lens.push_back(f->len);
+            e.prefixes.push_back(h != nullptr ? h->prefixes : std::vector<PrefType>());
+            e.idx_types.push_back(h != nullptr ? h->idx_types : std::vector<IdxType>());
+        }
+        return e;
+    }
+
+    void restore_encodings(const Encodings &e) {
+        for (size_t i = 0; i < e.lens.size(); ++i) {
+            Frame *f = this->strm_->at(e.first + i);
+            auto *h = dynamic_cast<Headers *>(f);
+            f->len = e.lens[i];
+            if (h != nullptr) {
+                h->prefixes = e.prefixes[i];
+                h->idx_types = e.idx_types[i];
+            }
+        }
+        strm_sz_ = e.strm_sz;
+        sizes_.invalidate(e.first);
+    }
+
     /** Wrapper for generating a random unsigned integer in the range [0, mod) */
     virtual unsigned int my_rand(unsigned int mod) {
         return (*this->rnd_)() % mod;
     }
 
     virtual unsigned int get_mut_op() {
+        if (bandit_ != nullptr) {
+            return bandit_->pick_mut_op(cfg_, *rnd_);
+        }
         unsigned int score = my_rand(100);
         unsigned int acc = cfg_.prob_swap;
 
@@ -364,6 +449,9 @@ protected:
     }
 
     virtual unsigned int get_cross_op() {
+        if (bandit_ != nullptr) {
+            return bandit_->pick_cross_op(cfg_, *rnd_);
+        }
         if (my_rand(100) < cfg_.prob_add) return ADD;
         return SPLICE;
     }
@@ -373,17 +461,16 @@ protected:
     }
 
     /** Sets pref and idx_type to the closest valid encoding of the prefix and indexing type of the header at index
-     * "idx" within "h" given sets of available names and name/value pairs in the table.
+     * "idx" within "h" given the names and name/value pairs available in the table.
      */
-    void patch_one_header_encoding(Headers *h, unsigned int idx,
-                                   const std::set<HPacker::KeyValuePair> &nv_pairs, const std::set<std::string> &names,
+    void patch_one_header_encoding(Headers *h, unsigned int idx, const HpackTable::View &table,
                                    PrefType &pref, IdxType &idx_type) {
         pref = h->prefixes[idx];
         idx_type = h->idx_types[idx];
-        if (idx_type == IdxType::ALL && !set_contains(nv_pairs, h->hdr_pairs[idx])) {
+        if (idx_type == IdxType::ALL && !table.contains(h->hdr_pairs[idx])) {
             pref = PrefType::LITERAL_HEADER_WITH_INDEXING; // always add to table
-            idx_type = set_contains(names, h->hdr_pairs[idx].first) ? IdxType::NAME : IdxType::NONE;
-        } else if (idx_type == IdxType::NAME && !set_contains(names, h->hdr_pairs[idx].first)) {
+            idx_type = table.contains_name(h->hdr_pairs[idx].first) ? IdxType::NAME : IdxType::NONE;
+        } else if (idx_type == IdxType::NAME && !table.contains_name(h->hdr_pairs[idx].first)) {
             idx_type = IdxType::NONE;
         }
     }
@@ -422,14 +509,12 @@ protected:
         }
 
         // get headers in table up to the header at the index we are inserting at, as well as the header itself
-        std::set<HPacker::KeyValuePair> nv_pairs;
-        std::set<std::string> names;
-        headers_in_table(nv_pairs, names, this_f, this_idx);
+        HpackTable::View table = headers_in_table(this_f, this_idx);
 
         // compute the prefix and indexing type of the header being added
         PrefType pref;
         IdxType idx_type;
-        patch_one_header_encoding(other_h, other_idx, nv_pairs, names, pref, idx_type);
+        patch_one_header_encoding(other_h, other_idx, table, pref, idx_type);
 
         // now perform the actual header crossover, then update prefixes and indexing types
         if (op == ADD) {
@@ -440,9 +525,9 @@ protected:
             HPacker::KeyValuePair this_hdr = this_h->hdr_pairs[this_idx];
 
             // update future header encodings that may depend on the header being spliced out
-            if (!set_contains(nv_pairs, this_hdr) &&
+            if (!table.contains(this_hdr) &&
                 this_h->prefixes[this_idx] == PrefType::LITERAL_HEADER_WITH_INDEXING) {
-                post_patch_header_encodings(this_f, this_idx, this_hdr, set_contains(names, this_hdr.first));
+                post_patch_header_encodings(this_f, this_idx, this_hdr, table.contains_name(this_hdr.first));
             }
 
             // subtract the size of the header we replace
@@ -468,8 +553,8 @@ protected:
     bool cross_over_frames(H2Stream *this_s, H2Stream *other_s, unsigned int MaxSize) {
         if (other_s->empty()) { return false; }
 
-        // pick a random frame from other_s and copy it
-        Frame *other_f = FrameCopier::copy_frame(other_s->at(my_rand(other_s->size())));
+        // pick a random frame from other_s and share it, which only copies it if it has headers to patch
+        Frame *other_f = FrameCopier::share_frame(other_s->at(my_rand(other_s->size())));
         Headers *other_h;
 
         // compute max size increase by adding/splicing other_f, then terminate early if it exceeds MaxSize
@@ -491,7 +576,7 @@ protected:
             this_idx = my_rand(this_s->size() + 1);
         } else if (op == SPLICE) {
             if (this_s->empty()) {
-                delete other_f;
+                FrameCopier::release_frame(other_f);
                 return false;
             }
             this_idx = my_rand(this_s->size());
@@ -505,32 +590,25 @@ protected:
         }
 
         if ((int64_t) strm_sz_ + max_sz_inc > MaxSize) {
-            delete other_f;
+            FrameCopier::release_frame(other_f);
             return false;
         }
 
         // get headers in table up to the Frame at this_idx
-        std::set<HPacker::KeyValuePair> nv_pairs;
-        std::set<std::string> names;
-        if (this_idx < this_s->size()) {
-            headers_in_table(nv_pairs, names, this_s->at(this_idx), 0);
-        } else {
-            headers_in_table(nv_pairs, names, nullptr, 0);
-        }
+        HpackTable::View table = headers_in_table(this_idx < this_s->size() ? this_s->at(this_idx) : nullptr, 0);
 
         // if frame to be added has headers, update all encodings to be valid based on headers in table
         if (Frame::has_headers(other_f)) {
             for (int i = 0; i < other_h->hdr_pairs.size(); ++i) {
                 PrefType pref;
                 IdxType idx_type;
-                patch_one_header_encoding(other_h, i, nv_pairs, names, pref, idx_type);
+                patch_one_header_encoding(other_h, i, table, pref, idx_type);
                 other_h->prefixes[i] = pref;
                 other_h->idx_types[i] = idx_type;
 
-                // if we add this header, update nv_pairs and names
+                // if we add this header, it is in the table for the headers that follow it
                 if (pref == PrefType::LITERAL_HEADER_WITH_INDEXING) {
-                    nv_pairs.insert(other_h->hdr_pairs[i]);
-                    names.insert(other_h->hdr_pairs[i].first);
+                    table.insert(other_h->hdr_pairs[i]);
                 }
             }
         }
@@ -546,7 +624,7 @@ protected:
             }
 
             strm_sz_ -= HDRSZ + this_f->len;
-            delete this_f;
+            FrameCopier::release_frame(this_f);
             this_s->at(this_idx) = other_f;
         } else {
             throw std::runtime_error("Invalid CrossOver operation");
@@ -718,7 +796,8 @@ protected:
             std::cout << "No mutable fields found for frame: " << (int) f->type << std::endl;
             return 0;
         }
-        unsigned int f_idx = my_rand(fields->size());
+        unsigned int f_idx = bandit_ != nullptr ? bandit_->pick_field(f->type, *fields, *rnd_)
+                                                : my_rand(fields->size());
         DEBUG("Bit mutation on field " << f_idx << " of frame " << (int) f->type)
         FieldRep fr = fields->at(f_idx);
         return do_field_mutation(fr, f, m, MaxSize);
@@ -1109,50 +1188,12 @@ protected:
     }
 
     /**
-     * Populates the given sets with all headers that are inserted into the dynamic table prior to the header at the
-     * given index within the given Frame.
-     *
-     * nv_pairs is filled with HPacker::KeyValuePairs -- that is, the name and value together
-     * names is filled with just the names
+     * Returns the hpack table as it is just before the header at the given index within the given Frame, i.e., the
+     * static table plus all headers inserted into the dynamic table before that header. If f is not in the stream,
+     * returns the table after the whole stream.
      */
-    void headers_in_table(std::set<HPacker::KeyValuePair> &nv_pairs, std::set<std::string> &names, Frame *f,
-                          unsigned int idx) const {
-        // clear tables just in case
-        nv_pairs.clear();
-        names.clear();
-
-        // start with static table
-        for (auto &nv: hpack::hpackStaticTable) {
-            nv_pairs.insert(nv);
-            names.insert(nv.first);
-        }
-
-        // loop over all frames looking for any with headers
-        for (auto f_iter: *(this->strm_)) {
-            if (!Frame::has_headers(f_iter)) {
-                // must check if this is terminating frame
-                if (f_iter == f) {
-                    return;
-                }
-                continue;
-            }
-            auto *h = dynamic_cast<Headers *>(f_iter);  // the prior check ensures this will not return nullptr
-
-            // if this loop's frame is not the target frame, check all headers
-            // otherwise, check only up to the header just before the target header
-            unsigned int max_hdr_idx = (f_iter != f) ? h->hdr_pairs.size() : idx;
-            for (unsigned int i = 0; i < max_hdr_idx; ++i) {
-                if (h->prefixes[i] == PrefType::LITERAL_HEADER_WITH_INDEXING) {
-                    nv_pairs.insert(h->hdr_pairs[i]);
-                    names.insert(h->hdr_pairs[i].first);
-                }
-            }
-
-            // if this is target frame, return since no more to check
-            if (f_iter == f) {
-                return;
-            }
-        }
+    HpackTable::View headers_in_table(Frame *f, unsigned int idx) {
+        return table_.before(*this->strm_, f, idx);
     }
 
     /**
@@ -1240,22 +1281,15 @@ protected:
         }
     }
 
-    /** Helper function that returns whether the given "val" exists within the given set "s" */
-    template<class T>
-    bool set_contains(std::set<T> s, T val) {
-        return s.find(val) != s.end();
-    }
-
     /**
      * Performs a mutation on the HPACK encoding of the header at the given index in f
      * @param f the frame in which the target header resides
      * @param idx the index of the target header
      * @param MaxSize the maximum size that the HTTP/2 stream may occupy when serialized
-     * @param nv_pairs set of all <name, value> pairs in the hpack table prior to this header
-     * @param names set of all http header names in the hpack table prior to this header
+     * @param table the hpack table prior to this header
      */
     size_t mutate_encoding(Frame *f, unsigned int idx, unsigned int MaxSize,
-                           std::set<HPacker::KeyValuePair> &nv_pairs, std::set<std::string> &names) {
+                           const HpackTable::View &table) {
         auto hf = dynamic_cast<Headers *>(f);
         HPacker::KeyValuePair hdr = hf->hdr_pairs[idx];
 
@@ -1298,8 +1332,8 @@ protected:
          *   - thus, max diff = name_length + name_string + value_length + value_string
          */
         size_t sz = hdr_sz(&hdr) - 1;  // maximum possible size increase by applying given mutation
-        bool full_idx_ok = set_contains(nv_pairs, hdr);
-        bool name_idx_ok = set_contains(names, hdr.first);
+        bool full_idx_ok = table.contains(hdr);
+        bool name_idx_ok = table.contains_name(hdr.first);
 
         // exit if we can't make mutation
         if (strm_sz_ + sz > MaxSize) {
@@ -1344,19 +1378,18 @@ protected:
      * @param idx the index of the target header
      * @param MaxSize the maximum size that the HTTP/2 stream may occupy when serialized
      * @param m the Mutator function that performs the base mutation operations on the name
-     * @param nv_pairs set of all <name, value> pairs in the hpack table prior to this header
-     * @param names set of all http header names in the hpack table prior to this header
+     * @param table the hpack table prior to this header
      */
     size_t mutate_name(Frame *f, unsigned int idx, unsigned int MaxSize, Mutator m,
-                       std::set<HPacker::KeyValuePair> &nv_pairs, std::set<std::string> &names) {
+                       const HpackTable::View &table) {
         auto hf = dynamic_cast<Headers *>(f);
         HPacker::KeyValuePair hdr = hf->hdr_pairs[idx];
         unsigned int value_size = hpack_int_length(hdr.second.size()) + hdr.second.size();
         PrefType pref = hf->prefixes[idx];
         IdxType idxType = hf->idx_types[idx];
 
-        bool full_idx_ok = set_contains(nv_pairs, hdr);
-        bool name_idx_ok = set_contains(names, hdr.first);
+        bool full_idx_ok = table.contains(hdr);
+        bool name_idx_ok = table.contains_name(hdr.first);
 
         unsigned int allowed_size;
 
@@ -1431,13 +1464,13 @@ protected:
         }
 
         // update prefix and indexing types of header we just mutated
-        if (pref == PrefType::INDEXED_HEADER && !set_contains(nv_pairs, hf->hdr_pairs[idx])) {
+        if (pref == PrefType::INDEXED_HEADER && !table.contains(hf->hdr_pairs[idx])) {
             // add to table to improve compression and optimistically set to name indexed
             // next "if" statement will check if name indexing is valid
             hf->prefixes[idx] = PrefType::LITERAL_HEADER_WITH_INDEXING;
             hf->idx_types[idx] = IdxType::NAME;
         }
-        if (hf->idx_types[idx] != IdxType::NONE && !set_contains(names, hf->hdr_pairs[idx].first)) {
+        if (hf->idx_types[idx] != IdxType::NONE && !table.contains_name(hf->hdr_pairs[idx].first)) {
             hf->idx_types[idx] = IdxType::NONE;
         }
         unsigned int new_sz = hdr_sz(&hf->hdr_pairs[idx], hf->idx_types[idx]);
@@ -1495,36 +1528,50 @@ protected:
     }
 
     bool do_value_mutation(Headers *hf, HPacker::KeyValuePair &hdr, unsigned int idx, unsigned int allowed_size, Mutator m) {
+        static const std::vector<std::string> methods{"DELETE", "GET", "HEAD", "POST", "PUT", "CONNECT", "OPTIONS",
+                                                      "TRACE"};
+        static const std::vector<std::string> schemes{"http", "https"};
+        static const std::vector<std::string> encodings{"chunked", "identity", "gzip", "trailers"};
+        static const std::vector<std::string> tokens{"close", "host", "cookie", "keep-alive", "upgrade"};
+        static const std::vector<std::string> auth_vals{GRAMMAR_AUTH, "https://", "http://", "test://", "test.com@"};
+
         unsigned int smart_val_cutoff = 50;
         unsigned int rval = my_rand(100);
-        std::string name_lower;
-        for (char c: hdr.first) {
-            name_lower += (char) std::tolower(c);
-        }
+        HeaderClass hclass = classify_header(hdr.first);
 
         size_t avail_space = allowed_size - hdr.second.size();  // space we can grow beyond current value bounds
 
         if (rval < smart_val_cutoff) {
             std::string smart_val;
+            std::string sep = ",";
+
+            // half of the time, use what the proxies were seen forwarding for this kind of header
+            auto dict = ResponseDictionary::global().tables();
+            if (dict != nullptr && !dict->values[hclass].empty() && my_rand(2) == 0) {
+                const std::string &learned = dict->values[hclass][my_rand(dict->values[hclass].size())];
+                if (learned.size() + 1 <= allowed_size) {
+                    smart_val = learned;
+                }
+                if (!dict->separators.empty()) {
+                    sep = dict->separators[my_rand(dict->separators.size())];
+                }
+            }
 
             // allowed_size must be >= length of longest possible smart value + 1 (in case of comma)
-            if (name_lower == ":method" && allowed_size >= 8) {
-                std::vector<std::string> methods{"DELETE", "GET", "HEAD", "POST", "PUT", "CONNECT", "OPTIONS", "TRACE"};
+            if (!smart_val.empty()) {
+                // learned value picked above
+            } else if (hclass == HC_METHOD && allowed_size >= 8) {
                 smart_val = methods[my_rand(methods.size())];
-            } else if (name_lower == ":status" && allowed_size >= 4) {
+            } else if (hclass == HC_STATUS && allowed_size >= 4) {
                 unsigned int code = 100 + my_rand(500); // 100 -> 599
                 smart_val = std::to_string(code);
-            } else if (name_lower == ":scheme" && allowed_size >= 6) {
-                std::vector<std::string> schemes{"http", "https"};
+            } else if (hclass == HC_SCHEME && allowed_size >= 6) {
                 smart_val = schemes[my_rand(schemes.size())];
-            } else if ((Util::special_match(name_lower, "transfer-encoding") || Util::special_match(name_lower, "te"))
-                       && allowed_size >= 9) {
-                std::vector<std::string> encodings{"chunked", "identity", "gzip", "trailers"};
+            } else if (hclass == HC_TE && allowed_size >= 9) {
                 smart_val = encodings[my_rand(encodings.size())];
-            } else if (name_lower == "connection" && allowed_size >= 11) {
-                std::vector<std::string> tokens{"close", "host", "cookie", "keep-alive", "upgrade"};
+            } else if (hclass == HC_CONNECTION && allowed_size >= 11) {
                 smart_val = tokens[my_rand(tokens.size())];
-            } else if (Util::special_match(name_lower, "content-length") && allowed_size >= 7) {
+            } else if (hclass == HC_CL && allowed_size >= 7) {
                 // smart CL values are: 1) random int between 0 and 999999
                 //                      2) the current content-length value
                 //                      3) the actual amount of data in all dataframes of this stream
@@ -1565,14 +1612,12 @@ protected:
             /******
              *  the next headers do NOT have comma-separated values
              ******/
-            else if (name_lower == "expect" && allowed_size >= 12) {
+            else if (hclass == HC_EXPECT && allowed_size >= 12) {
                 hf->hdr_pairs[idx].second = "100-continue";
                 return true;
-            } else if ((name_lower == ":authority" || Util::special_match(name_lower, "host") || name_lower == ":path")
-                       && allowed_size >= strlen(GRAMMAR_AUTH) + 1) {
+            } else if (hclass == HC_AUTHORITY && allowed_size >= strlen(GRAMMAR_AUTH) + 1) {
                 // prepend to the authority/host or path to see if we can forward differing values
-                std::vector<std::string> vals{GRAMMAR_AUTH, "https://", "http://", "test://", "test.com@"};
-                smart_val = vals[my_rand(vals.size())];
+                smart_val = auth_vals[my_rand(auth_vals.size())];
                 if ((rval < smart_val_cutoff / 2) && (1 + smart_val.size() <= avail_space)) {
                     hf->hdr_pairs[idx].second = smart_val + hf->hdr_pairs[idx].second;
                     return true;
@@ -1583,8 +1628,8 @@ protected:
             if (!smart_val.empty()) {
                 if (rval < smart_val_cutoff / 2) {
                     // check whether we would be growing PAST the allowed space
-                    if (1 + smart_val.size() <= avail_space) {
-                        hf->hdr_pairs[idx].second += "," + smart_val;
+                    if (sep.size() + smart_val.size() <= avail_space) {
+                        hf->hdr_pairs[idx].second += sep + smart_val;
                         return true;
                     }
                 } else {
@@ -1607,11 +1652,10 @@ protected:
      * @param idx the index of the target header
      * @param MaxSize the maximum size that the HTTP/2 stream may occupy when serialized
      * @param m the Mutator function that performs the base mutation operations on the name
-     * @param nv_pairs set of all <name, value> pairs in the hpack table prior to this header
-     * @param names set of all http header names in the hpack table prior to this header
+     * @param table the hpack table prior to this header
      */
     size_t mutate_value(Frame *f, unsigned int idx, unsigned int MaxSize, Mutator m,
-                        std::set<HPacker::KeyValuePair> &nv_pairs) {
+                        const HpackTable::View &table) {
         /**
          * Case 1: header name and value are already in the static or dynamic table:
          * | 1 |                 |         <- originally fully indexed
@@ -1646,7 +1690,7 @@ protected:
         unsigned int value_size = hpack_int_length(hdr.second.size()) + hdr.second.size();
         PrefType pref = hf->prefixes[idx];
         IdxType idxType = hf->idx_types[idx];
-        bool full_idx_ok = set_contains(nv_pairs, hdr);
+        bool full_idx_ok = table.contains(hdr);
 
         // if this header is fully indexed or is inserted into the table, the hpack block will expand due to changes in
         // encodings. ensure here that in the worst case, this will not exceed MaxSize
@@ -1669,7 +1713,7 @@ protected:
 
         // update prefix and indexing types of header we just mutated
         // only matters if it's fully indexed, since anything else is unchanged by value mutations
-        if (pref == PrefType::INDEXED_HEADER && !set_contains(nv_pairs, hf->hdr_pairs[idx])) {
+        if (pref == PrefType::INDEXED_HEADER && !table.contains(hf->hdr_pairs[idx])) {
             // add to table to improve compression
             // can safely name index since name guaranteed to be in table still
             hf->prefixes[idx] = PrefType::LITERAL_HEADER_WITH_INDEXING;
@@ -1691,8 +1735,7 @@ protected:
      * Deletes the header at the given index in f from the stream, updating the header encodings of any future headers
      * that depend on it
      */
-    size_t delete_header(Frame *f, unsigned int idx,
-                         std::set<HPacker::KeyValuePair> &nv_pairs, std::set<std::string> &names) {
+    size_t delete_header(Frame *f, unsigned int idx, const HpackTable::View &table) {
         /*
          * header deletion can always take place
          *
@@ -1718,8 +1761,8 @@ protected:
         HPacker::KeyValuePair hdr = hf->hdr_pairs[idx];
         PrefType pref = hf->prefixes[idx];
         IdxType idxType = hf->idx_types[idx];
-        bool full_idx_ok = set_contains(nv_pairs, hdr);
-        bool name_idx_ok = set_contains(names, hdr.first);
+        bool full_idx_ok = table.contains(hdr);
+        bool name_idx_ok = table.contains_name(hdr.first);
 
         if (!full_idx_ok && pref == PrefType::LITERAL_HEADER_WITH_INDEXING) {
             post_patch_header_encodings(f, idx, hdr, name_idx_ok);
@@ -1760,20 +1803,18 @@ protected:
         HPacker::KeyValuePair hdr_sm = hf->hdr_pairs[idx_sm];
         HPacker::KeyValuePair hdr_lg = hf->hdr_pairs[idx_lg];
 
-        std::set<HPacker::KeyValuePair> nv_pairs;
-        std::set<std::string> names;
-        headers_in_table(nv_pairs, names, f, idx_sm); // only check up to smaller index
+        HpackTable::View table = headers_in_table(f, idx_sm); // only check up to smaller index
 
         /*
          * conditions that must be satisfied to freely perform swap without bounds or dependency checks:
-         *   1) hdr_sm is present in nv_pairs OR is not inserted into the table
-         *   2) hdr_lg is not indexed OR is present in nv_pairs OR is name indexed and the name is in names
+         *   1) hdr_sm is already in the table OR is not inserted into the table
+         *   2) hdr_lg is not indexed OR is in the table OR is name indexed and the name is in the table
          */
-        bool hdr_sm_ok = set_contains(nv_pairs, hdr_sm) ||
+        bool hdr_sm_ok = table.contains(hdr_sm) ||
                          hf->prefixes[idx_sm] != PrefType::LITERAL_HEADER_WITH_INDEXING;
         bool hdr_lg_ok = hf->idx_types[idx_lg] == IdxType::NONE ||
-                         set_contains(nv_pairs, hdr_lg) ||
-                         (hf->idx_types[idx_lg] == IdxType::NAME && set_contains(names, hdr_lg.first));
+                         table.contains(hdr_lg) ||
+                         (hf->idx_types[idx_lg] == IdxType::NAME && table.contains_name(hdr_lg.first));
 
         unsigned int sz_update = 0;
         if (!hdr_sm_ok) {
@@ -1787,20 +1828,22 @@ protected:
             sz_update += hdr_sz(&hdr_lg) - 1;
         }
 
-        // terminate early if worst case size update exceeds bounds
-        if (strm_sz_ + sz_update > MaxSize) {
-            return 0;
+        // if the worst case size update exceeds bounds, size the swap exactly and undo it if it really does not fit
+        bool exact = strm_sz_ + sz_update > MaxSize;
+        Encodings orig;
+        if (exact) {
+            orig = save_encodings(frame_index(f), frame_index(f));
         }
 
         // if header at larger index needs post-processing, update its encoding to be valid
         if (!hdr_lg_ok) {
             hf->prefixes[idx_lg] = PrefType::LITERAL_HEADER_WITH_INDEXING; // add to table for later deps
-            hf->idx_types[idx_lg] = set_contains(names, hdr_lg.first) ? IdxType::NAME : IdxType::NONE;
+            hf->idx_types[idx_lg] = table.contains_name(hdr_lg.first) ? IdxType::NAME : IdxType::NONE;
         }
 
         // if header at smaller index needs post-processing, update future headers' encodings
         if (!hdr_sm_ok) {
-            post_patch_header_encodings(f, idx_sm, hdr_sm, set_contains(names, hdr_sm.first),
+            post_patch_header_encodings(f, idx_sm, hdr_sm, table.contains_name(hdr_sm.first),
                                         true, idx_lg - 1);
         }
 
@@ -1808,6 +1851,11 @@ protected:
         std::iter_swap(hf->hdr_pairs.begin() + idx, hf->hdr_pairs.begin() + idx2);
         std::iter_swap(hf->prefixes.begin() + idx, hf->prefixes.begin() + idx2);
         std::iter_swap(hf->idx_types.begin() + idx, hf->idx_types.begin() + idx2);
+        if (exact && !fits(frame_index(f), MaxSize)) {
+            std::iter_swap(hf->hdr_pairs.begin() + idx, hf->hdr_pairs.begin() + idx2);
+            restore_encodings(orig);
+            return 0;
+        }
         return 1;
     }
 
@@ -1869,18 +1917,17 @@ protected:
 
         unsigned int idx = my_rand(hf->hdr_pairs.size());
 
-        std::set<HPacker::KeyValuePair> nv_pairs;
-        std::set<std::string> names;
-        headers_in_table(nv_pairs, names, f, idx);
+        table_.clear();  // may be called on its own, see table_
+        HpackTable::View table = headers_in_table(f, idx);
 
         size_t sz;  // maximum possible size increase by applying given mutation
         switch (fr.field) {
             case FrameField::Name:
-                return mutate_name(f, idx, MaxSize, m, nv_pairs, names);
+                return mutate_name(f, idx, MaxSize, m, table);
             case FrameField::Value:
-                return mutate_value(f, idx, MaxSize, m, nv_pairs);
+                return mutate_value(f, idx, MaxSize, m, table);
             case FrameField::Encoding:
-                return mutate_encoding(f, idx, MaxSize, nv_pairs, names);
+                return mutate_encoding(f, idx, MaxSize, table);
             case FrameField::Dup:
                 sz = hdr_sz(&hf->hdr_pairs[idx], hf->idx_types[idx]);  // get ACTUAL size with idx type
                 if (strm_sz_ + sz <= MaxSize) {
@@ -1895,7 +1942,7 @@ protected:
             case FrameField::Swap:
                 return swap_headers(f, idx, MaxSize);
             case FrameField::Delete:
-                return delete_header(f, idx, nv_pairs, names);
+                return delete_header(f, idx, table);
             case FrameField::Split:
                 return split_headers(f, MaxSize);
             default:
@@ -2014,6 +2061,14 @@ protected:
 
     std::minstd_rand *rnd_ = nullptr;  // shared RNG
     uint64_t strm_sz_ = 0;
+
+    // hpack table of strm_, simulated up to the headers mutations look at. Cleared at the start of every mutation
+    // since strm_ is public and may have changed in between
+    HpackTable table_;
+
+    // exact serialized size of strm_ from parse_stream() on, re-sized from the mutated frame on after every Mutate()
+    // and CrossOver(). A frame changed in place by anything else must be invalidated in it
+    StreamSize sizes_;
 };
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef NEZHA_UTILS_H
 #define NEZHA_UTILS_H
 
+#include <cstdint>
 #include <vector>
 #include <string>
 
@@ -27,6 +28,22 @@ public:
         return out;
     }
 
+    /**
+     * 64-bit FNV-1a. Must stay stable across builds since some of its values are persisted. Passing the hash of a
+     * prefix as h continues it, so fnv1a(b, m, fnv1a(a, n)) is the hash of a followed by b
+     */
+    static uint64_t fnv1a(const char *buf, size_t len, uint64_t h = 0xcbf29ce484222325ULL) {
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char) buf[i];
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    static uint64_t fnv1a(const std::string &s) {
+        return fnv1a(s.data(), s.length());
+    }
+
     static bool cmp_str(std::string *s1, std::string *s2) {
         return *s1 < *s2;
     }
@@ -12,24 +12,19 @@
 #include "../debug.h"
 #include "util.h"
 
-#define PROC_SPECIAL_HDR(HDR_NAME, STR_VAL, VEC_VAL) else if (name == HDR_NAME) { \
-                                                         if (STR_VAL == nullptr) { \
-                                                             STR_VAL = new std::string(val); \
-                                                         } else { \
-                                                             concat_and_add_header(name, val, VEC_VAL); \
-                                                         } \
-                                                     } else if (Util::special_match(name, HDR_NAME)) { \
-                                                         concat_and_add_header(name, val, VEC_VAL); \
-                                                     }
-
 /**
  * Struct of all fields comprising the hash
+ *
+ * The tracked headers (Host, Content-Length, ...) are listed once, in HASHCOMP_FIELDS below. Parsing, hashing,
+ * equality, printing, copying and normalization all iterate over that list, so tracking another header only takes a
+ * pair of string members, a pair of hash members and one entry there.
  */
 struct HashComp {
     HashComp() = default;
 
     // fields that are set EXPLICITLY by the fuzzer itself
-    bool noresp_err = false;
+    bool noresp_err = false;  // protocol-level failure: GOAWAY, RST_STREAM, or no forwarded request
+    bool timeout_err = false;  // the proxy was still silent at the deadline. not compared, since it reflects load
     std::string status;
     std::string orig;  // original request so that Fuzzer core can use it
 
@@ -80,108 +75,24 @@ struct HashComp {
     /**
      * Extracts the hash components from the given H1Parser object
      */
-    void parse(const H1Parser &hp, const ProxyConfig &filter) {
-        cleanup();
-        DEBUG("hashcomp -- parsing and ignoring " << filter.headers.size() << " headers")
-
-        if (hp.reqline != nullptr) {
-            this->reqline_str = new std::string(*hp.reqline);
-        }
-
-        // now parse out headers
-        for (auto h : hp.headers) {
-            // name is everything up to first colon
-            size_t col = h->find(':');
-            if (col == std::string::npos) {
-                continue;
-            }
-
-            // extract name
-            char name_buf[col];
-            for (int i = 0; i < col; ++i) {
-                name_buf[i] = (char) tolower(h->at(i));  // always compare lowercase
-            }
-            std::string name(name_buf, col);
-            std::string val = h->substr(col + 1, h->length() - col);
-            DEBUG("hashcomp -- checking header: " << name << " = " << val)
-
-            // Match header name to list of well-known headers we care about
-            if (filter.headers.find(name) != filter.headers.end()) {
-                // first check if we need to filter out header. faster since most headers are filtered
-                DEBUG("in hashcomp, header " << name << " filtered out")
-                continue;
-            } else if (name == "host") {
-                // normalize host name by replacing known host value with localhost
-                // TODO why do we do this again?
-                patch_host_value(val, filter);
-
-                if (this->host_str == nullptr) {
-                    this->host_str = new std::string(val);
-                } else {
-                    concat_and_add_header(name, val, this->rem_host_str);
-                }
-            } else if (Util::special_match(name, "host")) {
-                patch_host_value(val, filter);
-                concat_and_add_header(name, val, this->rem_host_str);
-            }
-            PROC_SPECIAL_HDR("content-length", this->cl_str, this->rem_cl_str)
-            PROC_SPECIAL_HDR("transfer-encoding", this->te_str, this->rem_te_str)
-            PROC_SPECIAL_HDR("connection", this->conn_str, this->rem_conn_str)
-            PROC_SPECIAL_HDR("expect", this->expect_str, this->rem_expect_str)
-        }
-
-        // quit early if parser somehow didn't find a body (e.g., empty string, or no double CRLF at the end)
-        if (hp.body == nullptr || hp.body->empty()) {
-            return;
-        }
-
-        // now handle request body_str
-        if (this->te_str != nullptr && Util::special_match(*this->te_str, "chunked")) {
-            ChunkParser pars{};
-            int n_read = pars.parse_chunked(hp.body->c_str(), hp.body->length());
-            this->chnk_err = pars.err;
-            this->body_str = new std::string(pars.body);
-
-            // append any lingering body_str such as trailer headers or extraneous chunks
-            if (n_read < hp.body->length()) {
-                this->extra_data = 1;
-                this->body_str->append(hp.body->substr(n_read, this->body_str->length() - n_read));
-            }
-
-            return;
-        }
-
-        this->body_str = new std::string(*hp.body);
-    }
+    void parse(const H1Parser &hp, const ProxyConfig &filter);
 
     ~HashComp() {
         cleanup();
     }
 
-    void cleanup() {
-        delete reqline_str;
-        delete host_str;
-        delete cl_str;
-        delete te_str;
-        delete body_str;
-    }
+    /**
+     * Returns a deep copy of this HashComp. The string fields are owned by each object, so the implicit copy would
+     * free them twice
+     */
+    HashComp *clone() const;
+
+    void cleanup();
 
     /**
      * Printer utility function
      */
-    void print_unif() const {
-        std::cout << "no response?: " << noresp_err << std::endl;
-        std::cout << "chunk error: " << chnk_err << std::endl;
-        std::cout << "version: " << version_hash << " " << (reqline_str != nullptr ? *reqline_str : "null") << std::endl;
-        std::cout << "host: " << host_hash << " " << (host_str != nullptr ? *host_str : "null") << std::endl;
-        std::cout << "content-length: " << cl_hash << " " << (cl_str != nullptr ? *cl_str : "null") << std::endl;
-        std::cout << "transfer-encoding: " << te_hash << " " << (te_str != nullptr ? *te_str : "null") << std::endl;
-        //std::cout << "remaining: " << remain_hash << std::endl;
-        //for (auto &h : remain_str) {
-        //    std::cout << "\t" << h << std::endl;
-        //}
-        std::cout << "body: " << body_hash << " " << (body_str != nullptr ? *body_str : "null") << std::endl;
-    }
+    void print_unif() const;
 
     /** State of algorithm to hash the path separately from the rest */
     enum RLHashState {
@@ -229,53 +140,7 @@ struct HashComp {
     /**
      * Computes hashes of each component in this HashComp
      */
-    void hash_indiv() {
-        // start with request line (parse path separate from rest)
-        this->version_hash = 0;
-        this->method_hash = 0;
-        RLHashState state = Space1; // start by parsing whitespace at the beginning of request
-
-        if (this->reqline_str != nullptr) {
-            for (char c: *this->reqline_str) {
-                if (state == Space1 && !isspace(c)) {
-                    // seen start of method
-                    state = Method;
-                } else if (state == Method && isspace(c)) {
-                    // method over, read whitespace before path
-                    state = Space2;
-                } else if (state == Space2 && !isspace(c)) {
-                    // found path, start adding to out->path
-                    state = Path;
-                } else if (state == Path && isspace(c)) {
-                    // path over, everything else is the version
-                    state = Version;  // no longer in FSM
-                }
-
-                // new approach: parse Method as path so that it gets normalized and parse Version (version) as reqline
-                if (state == Method) {
-                    this->method_hash += c;
-                } else if (state == Version) {
-                    this->version_hash += c;
-                }
-            }
-        }
-
-        // headers just checksummed
-        this->hash_host();
-        this->cl_hash = HashUtils::checksum(this->cl_str);
-        this->te_hash = HashUtils::checksum(this->te_str);
-        this->conn_hash = HashUtils::checksum(this->conn_str);
-        this->expect_hash = HashUtils::checksum(this->expect_str);
-
-        // containers are also checksummed
-        this->rem_cl_hash = HashUtils::checksum(this->rem_cl_str);
-        this->rem_te_hash = HashUtils::checksum(this->rem_te_str);
-        this->rem_conn_hash = HashUtils::checksum(this->rem_conn_str);
-        this->rem_expect_hash = HashUtils::checksum(this->rem_expect_str);
-
-        // body_str just a regular checksum for now
-        this->body_hash = HashUtils::checksum(this->body_str);
-    }
+    void hash_indiv();
 
     /**
      * Hashes this HashComp to a single value for direct comparison by the fuzzer
@@ -283,78 +148,19 @@ struct HashComp {
      * Note that at present, nezha expects integer return values, so we must hash to an int, not a size_t
      * TODO make nezha work with size_t?
      */
-    int hash_full() {
-        std::vector<int> vec;
-        vec.push_back(noresp_err);
-        vec.push_back(reqline_str != nullptr);  // no path vs path normed to zero
-        vec.push_back(method_hash);
-        vec.push_back(version_hash);
-        vec.push_back(host_hash);
-        vec.push_back(!rem_host_str.empty());  // no extra host vals vs extra host vals normed to zero
-        vec.push_back(rem_host_hash);
-        vec.push_back(cl_str != nullptr);  // no CL vs CL normed to zero
-        vec.push_back(cl_hash);
-        vec.push_back(!rem_cl_str.empty());
-        vec.push_back(rem_cl_hash);
-        vec.push_back(te_hash);
-        vec.push_back(!rem_te_str.empty());
-        vec.push_back(rem_te_hash);
-        vec.push_back(conn_hash);
-        vec.push_back(!rem_conn_str.empty());
-        vec.push_back(rem_conn_hash);
-        vec.push_back(expect_hash);
-        vec.push_back(!rem_expect_str.empty());
-        vec.push_back(rem_expect_hash);
-        vec.push_back(body_str != nullptr);  // no body vs body normed to zero
-        vec.push_back(body_hash);
-        vec.push_back(chnk_err);
-
-        // hash function for vector of integers
-        // from https://stackoverflow.com/questions/20511347/a-good-hash-function-for-a-vector/72073933#72073933
-        // TODO make this work for 64 bit
-        int seed = vec.size();
-        for (auto x: vec) {
-            x = ((x >> 16) ^ x) * 0x45d9f3b;
-            x = ((x >> 16) ^ x) * 0x45d9f3b;
-            x = (x >> 16) ^ x;
-            seed ^= x + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        }
-        return seed;
-    }
+    int hash_full();
 
-    bool operator==(const HashComp &other) const {
-        if (this->noresp_err != other.noresp_err ||
-            this->status != other.status ||
-            !Util::str_ptr_equals(this->reqline_str, other.reqline_str) ||
-            !Util::str_ptr_equals(this->host_str, other.host_str) ||
-            this->rem_host_str.size() != other.rem_host_str.size() ||
-            !Util::str_ptr_equals(this->cl_str, other.cl_str) ||
-            !Util::str_ptr_equals(this->te_str, other.te_str) ||
-            //this->remain_str.size() != other.remain_str.size() ||
-            !Util::str_ptr_equals(this->body_str, other.body_str) ||
-            this->chnk_err != other.chnk_err) {
-            return false;
-        }
-        // check remaining headers in their own loop
-        //for (int i = 0; i < this->remain_str.size(); ++i) {
-        //    if (this->remain_str[i] != other.remain_str[i]) {
-        //        return false;
-        //    }
-        //}
-        // check remaining hosts in their own loop
-        for (int i = 0; i < this->rem_host_str.size(); ++i) {
-            if (this->rem_host_str[i] !=  other.rem_host_str[i]) {
-                return false;
-            }
-        }
-        return true;
-    }
+    bool operator==(const HashComp &other) const;
 
     bool operator!=(const HashComp &other) const {
         return !(*this == other);
     }
 
 protected:
+    static std::string *dup(const std::string *s) {
+        return s != nullptr ? new std::string(*s) : nullptr;
+    }
+
     static void concat_and_add_header(const std::string &name, const std::string &val, std::vector<std::string> &vec) {
         std::string lc_hdr(name);
         lc_hdr.append(":");
@@ -374,4 +180,351 @@ protected:
     }
 };
 
+/**
+ * How a tracked header takes part in the operations on a HashComp. Combined as a bitmask in HeaderField::policy
+ */
+enum FieldPolicy : unsigned {
+    FIELD_HOST_VALUES = 1u << 0,   // patch the proxy's host into "localhost" and hash the values with hash_host()
+    FIELD_PRESENCE = 1u << 1,      // hash_full() tells a missing header apart from one whose hash is normed to zero
+    FIELD_CMP_VALUE = 1u << 2,     // operator== compares the first value
+    FIELD_CMP_REM = 1u << 3,       // operator== compares the remaining values
+    FIELD_NORM_VALUE = 1u << 4,    // normalize the hash of the first value, unless it is missing or " 0"
+    FIELD_NORM_REM = 1u << 5,      // normalize the hash of the remaining values, unless there are none
+    FIELD_PRINTED = 1u << 6,       // shown by print_unif()
+};
+
+/**
+ * One tracked header. "str" receives the value of the first header named exactly "name" (lowercase); "rem" receives
+ * every later one, and every header whose name is "name" padded with whitespace, as "<name>:<value>"
+ */
+struct HeaderField {
+    const char *name;
+    std::string *HashComp::*str;
+    std::vector<std::string> HashComp::*rem;
+    size_t HashComp::*hash;
+    size_t HashComp::*rem_hash;
+    unsigned policy;
+};
+
+/** The tracked headers, in hash_full() and result store order */
+constexpr HeaderField HASHCOMP_FIELDS[] = {
+        {"host", &HashComp::host_str, &HashComp::rem_host_str, &HashComp::host_hash, &HashComp::rem_host_hash,
+         FIELD_HOST_VALUES | FIELD_CMP_VALUE | FIELD_CMP_REM | FIELD_NORM_REM | FIELD_PRINTED},
+        {"content-length", &HashComp::cl_str, &HashComp::rem_cl_str, &HashComp::cl_hash, &HashComp::rem_cl_hash,
+         FIELD_PRESENCE | FIELD_CMP_VALUE | FIELD_NORM_VALUE | FIELD_NORM_REM | FIELD_PRINTED},
+        {"transfer-encoding", &HashComp::te_str, &HashComp::rem_te_str, &HashComp::te_hash, &HashComp::rem_te_hash,
+         FIELD_CMP_VALUE | FIELD_NORM_REM | FIELD_PRINTED},
+        {"connection", &HashComp::conn_str, &HashComp::rem_conn_str, &HashComp::conn_hash, &HashComp::rem_conn_hash,
+         FIELD_NORM_REM},
+        {"expect", &HashComp::expect_str, &HashComp::rem_expect_str, &HashComp::expect_hash,
+         &HashComp::rem_expect_hash, FIELD_NORM_REM},
+};
+
+constexpr size_t HASHCOMP_NFIELDS = sizeof(HASHCOMP_FIELDS) / sizeof(HASHCOMP_FIELDS[0]);
+
+/**
+ * Perfect hash from header name to its entry in HASHCOMP_FIELDS.
+ *
+ * The seed is searched at compile time so that no two tracked names share a slot, so a lookup is one hash of the name
+ * and one string comparison, however many headers are tracked.
+ */
+class FieldIndex {
+public:
+    static constexpr size_t SLOTS = 64;  // must be a power of 2 and at least HASHCOMP_NFIELDS
+
+    /** Seeded FNV-1a over len bytes */
+    static constexpr uint32_t hash(const char *s, size_t len, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < len; ++i) {
+            h = (h ^ (unsigned char) s[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    static constexpr size_t length(const char *s) {
+        size_t n = 0;
+        while (s[n] != '\0') {
+            ++n;
+        }
+        return n;
+    }
+
+    static constexpr size_t slot(const char *s, size_t len, uint32_t seed) {
+        return hash(s, len, seed) & (SLOTS - 1);
+    }
+
+    /** First seed that maps every tracked name to its own slot, or 0 if there is none below 1 << 16 */
+    static constexpr uint32_t find_seed() {
+        for (uint32_t seed = 1; seed < (1u << 16); ++seed) {
+            bool used[SLOTS] = {};
+            bool ok = true;
+            for (size_t f = 0; f < HASHCOMP_NFIELDS && ok; ++f) {
+                const char *name = HASHCOMP_FIELDS[f].name;
+                size_t s = slot(name, length(name), seed);
+                ok = !used[s];
+                used[s] = true;
+            }
+            if (ok) {
+                return seed;
+            }
+        }
+        return 0;
+    }
+
+    struct Table {
+        int8_t slots[SLOTS];
+    };
+
+    static constexpr Table build(uint32_t seed) {
+        Table t{};
+        for (size_t s = 0; s < SLOTS; ++s) {
+            t.slots[s] = -1;
+        }
+        for (size_t f = 0; f < HASHCOMP_NFIELDS; ++f) {
+            const char *name = HASHCOMP_FIELDS[f].name;
+            t.slots[slot(name, length(name), seed)] = (int8_t) f;
+        }
+        return t;
+    }
+
+    /**
+     * Returns the tracked header that the lowercase header name "name" refers to, ignoring whitespace around it, or
+     * nullptr. "exact" tells whether the name had no such whitespace
+     */
+    static const HeaderField *lookup(const std::string &name, bool *exact) {
+        size_t s = 0, e = name.length();
+        while (s < e && Util::is_ws(name[s])) {
+            ++s;
+        }
+        while (e > s && Util::is_ws(name[e - 1])) {
+            --e;
+        }
+        static constexpr uint32_t seed = find_seed();
+        static constexpr Table table = build(seed);
+        int8_t f = table.slots[slot(name.data() + s, e - s, seed)];
+        if (f < 0 || name.compare(s, e - s, HASHCOMP_FIELDS[f].name) != 0) {
+            return nullptr;
+        }
+        *exact = e - s == name.length();
+        return &HASHCOMP_FIELDS[f];
+    }
+};
+
+static_assert(FieldIndex::SLOTS >= HASHCOMP_NFIELDS, "FieldIndex::SLOTS is too small for HASHCOMP_FIELDS");
+static_assert(FieldIndex::find_seed() != 0, "no perfect hash seed for HASHCOMP_FIELDS, increase FieldIndex::SLOTS");
+
+inline void HashComp::parse(const H1Parser &hp, const ProxyConfig &filter) {
+    cleanup();
+    DEBUG("hashcomp -- parsing and ignoring " << filter.headers.size() << " headers")
+
+    if (hp.reqline != nullptr) {
+        this->reqline_str = new std::string(*hp.reqline);
+    }
+
+    // now parse out headers
+    for (auto h : hp.headers) {
+        // name is everything up to first colon
+        size_t col = h->find(':');
+        if (col == std::string::npos) {
+            continue;
+        }
+
+        // extract name
+        char name_buf[col];
+        for (int i = 0; i < col; ++i) {
+            name_buf[i] = (char) tolower(h->at(i));  // always compare lowercase
+        }
+        std::string name(name_buf, col);
+        std::string val = h->substr(col + 1, h->length() - col);
+        DEBUG("hashcomp -- checking header: " << name << " = " << val)
+
+        // first check if we need to filter out header. faster since most headers are filtered
+        if (filter.headers.find(name) != filter.headers.end()) {
+            DEBUG("in hashcomp, header " << name << " filtered out")
+            continue;
+        }
+
+        // then match header name to the list of well-known headers we care about
+        bool exact = false;
+        const HeaderField *field = FieldIndex::lookup(name, &exact);
+        if (field == nullptr) {
+            continue;
+        }
+        if (field->policy & FIELD_HOST_VALUES) {
+            // normalize host name by replacing known host value with localhost
+            // TODO why do we do this again?
+            patch_host_value(val, filter);
+        }
+        if (exact && this->*field->str == nullptr) {
+            this->*field->str = new std::string(val);
+        } else {
+            concat_and_add_header(name, val, this->*field->rem);
+        }
+    }
+
+    // quit early if parser somehow didn't find a body (e.g., empty string, or no double CRLF at the end)
+    if (hp.body == nullptr || hp.body->empty()) {
+        return;
+    }
+
+    // now handle request body_str
+    if (this->te_str != nullptr && Util::special_match(*this->te_str, "chunked")) {
+        ChunkParser pars{};
+        int n_read = pars.parse_chunked(hp.body->c_str(), hp.body->length());
+        this->chnk_err = pars.err;
+        this->body_str = new std::string(pars.body);
+
+        // append any lingering body_str such as trailer headers or extraneous chunks
+        if (n_read < hp.body->length()) {
+            this->extra_data = 1;
+            this->body_str->append(hp.body->substr(n_read, this->body_str->length() - n_read));
+        }
+
+        return;
+    }
+
+    this->body_str = new std::string(*hp.body);
+}
+
+inline HashComp *HashComp::clone() const {
+    auto *hc = new HashComp();
+    hc->noresp_err = noresp_err;
+    hc->timeout_err = timeout_err;
+    hc->status = status;
+    hc->orig = orig;
+    hc->reqline_str = dup(reqline_str);
+    hc->body_str = dup(body_str);
+    for (const auto &f : HASHCOMP_FIELDS) {
+        hc->*f.str = dup(this->*f.str);
+        hc->*f.rem = this->*f.rem;
+        hc->*f.hash = this->*f.hash;
+        hc->*f.rem_hash = this->*f.rem_hash;
+    }
+    hc->version_hash = version_hash;
+    hc->method_hash = method_hash;
+    hc->body_hash = body_hash;
+    hc->chnk_err = chnk_err;
+    hc->extra_data = extra_data;
+    return hc;
+}
+
+inline void HashComp::cleanup() {
+    delete reqline_str;
+    delete body_str;
+    reqline_str = body_str = nullptr;
+    for (const auto &f : HASHCOMP_FIELDS) {
+        delete (this->*f.str);
+        this->*f.str = nullptr;
+    }
+}
+
+inline void HashComp::print_unif() const {
+    std::cout << "no response?: " << noresp_err << std::endl;
+    std::cout << "timed out?: " << timeout_err << std::endl;
+    std::cout << "chunk error: " << chnk_err << std::endl;
+    std::cout << "version: " << version_hash << " " << (reqline_str != nullptr ? *reqline_str : "null") << std::endl;
+    for (const auto &f : HASHCOMP_FIELDS) {
+        if (f.policy & FIELD_PRINTED) {
+            const std::string *val = this->*f.str;
+            std::cout << f.name << ": " << this->*f.hash << " " << (val != nullptr ? *val : "null") << std::endl;
+        }
+    }
+    std::cout << "body: " << body_hash << " " << (body_str != nullptr ? *body_str : "null") << std::endl;
+}
+
+inline void HashComp::hash_indiv() {
+    // start with request line (parse path separate from rest)
+    this->version_hash = 0;
+    this->method_hash = 0;
+    RLHashState state = Space1; // start by parsing whitespace at the beginning of request
+
+    if (this->reqline_str != nullptr) {
+        for (char c: *this->reqline_str) {
+            if (state == Space1 && !isspace(c)) {
+                // seen start of method
+                state = Method;
+            } else if (state == Method && isspace(c)) {
+                // method over, read whitespace before path
+                state = Space2;
+            } else if (state == Space2 && !isspace(c)) {
+                // found path, start adding to out->path
+                state = Path;
+            } else if (state == Path && isspace(c)) {
+                // path over, everything else is the version
+                state = Version;  // no longer in FSM
+            }
+
+            // new approach: parse Method as path so that it gets normalized and parse Version (version) as reqline
+            if (state == Method) {
+                this->method_hash += c;
+            } else if (state == Version) {
+                this->version_hash += c;
+            }
+        }
+    }
+
+    // headers and their remaining values just checksummed
+    for (const auto &f : HASHCOMP_FIELDS) {
+        if (f.policy & FIELD_HOST_VALUES) {
+            this->hash_host();
+        } else {
+            this->*f.hash = HashUtils::checksum(this->*f.str);
+            this->*f.rem_hash = HashUtils::checksum(this->*f.rem);
+        }
+    }
+
+    // body_str just a regular checksum for now
+    this->body_hash = HashUtils::checksum(this->body_str);
+}
+
+inline int HashComp::hash_full() {
+    std::vector<int> vec;
+    vec.push_back(noresp_err);
+    vec.push_back(reqline_str != nullptr);  // no path vs path normed to zero
+    vec.push_back(method_hash);
+    vec.push_back(version_hash);
+    for (const auto &f : HASHCOMP_FIELDS) {
+        if (f.policy & FIELD_PRESENCE) {
+            vec.push_back(this->*f.str != nullptr);  // no header vs header normed to zero
+        }
+        vec.push_back(this->*f.hash);
+        vec.push_back(!(this->*f.rem).empty());  // no extra values vs extra values normed to zero
+        vec.push_back(this->*f.rem_hash);
+    }
+    vec.push_back(body_str != nullptr);  // no body vs body normed to zero
+    vec.push_back(body_hash);
+    vec.push_back(chnk_err);
+
+    // hash function for vector of integers
+    // from https://stackoverflow.com/questions/20511347/a-good-hash-function-for-a-vector/72073933#72073933
+    // TODO make this work for 64 bit
+    int seed = vec.size();
+    for (auto x: vec) {
+        x = ((x >> 16) ^ x) * 0x45d9f3b;
+        x = ((x >> 16) ^ x) * 0x45d9f3b;
+        x = (x >> 16) ^ x;
+        seed ^= x + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+    return seed;
+}
+
+inline bool HashComp::operator==(const HashComp &other) const {
+    if (this->noresp_err != other.noresp_err ||
+        this->status != other.status ||
+        !Util::str_ptr_equals(this->reqline_str, other.reqline_str) ||
+        !Util::str_ptr_equals(this->body_str, other.body_str) ||
+        this->chnk_err != other.chnk_err) {
+        return false;
+    }
+    for (const auto &f : HASHCOMP_FIELDS) {
+        if ((f.policy & FIELD_CMP_VALUE) && !Util::str_ptr_equals(this->*f.str, other.*f.str)) {
+            return false;
+        }
+        if ((f.policy & FIELD_CMP_REM) && this->*f.rem != other.*f.rem) {
+            return false;
+        }
+    }
+    return true;
+}
+
 #endif
@@ -0,0 +1,255 @@
+#ifndef NEZHA_HEALTH_MONITOR_H
+#define NEZHA_HEALTH_MONITOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "proxy_registry.h"
+
+#define BACKOFF_MIN_MS 250     // delay before the first probe of a replica that just failed
+#define BACKOFF_MAX_MS 30000   // cap on the delay between probes of a replica that keeps failing
+#define MONITOR_TICK_MS 50     // granularity of the probe schedule
+
+/**
+ * Tracks the liveness of every replica of every proxy and keeps dead replicas out of the fuzzing loop.
+ *
+ * Each replica has a circuit. A failed exchange opens it; while it is open, execs do not use the replica at all. A
+ * background thread probes open replicas, doubling the delay between probes after every failed one (from
+ * BACKOFF_MIN_MS up to BACKOFF_MAX_MS), and closes the circuit once a probe succeeds.
+ *
+ * A proxy is stalled while all of its replicas are open. Execs are skipped during that time instead of blocking, and
+ * the stalled time is accumulated per proxy.
+ *
+ * is_open() is lock-free so it can be called on every exec; state changes take a mutex, but they are rare.
+ */
+class HealthMonitor {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /** Probes a single replica. Returns true if it is healthy */
+    typedef std::function<bool(size_t prox, size_t rep)> Probe;
+
+    HealthMonitor(const ProxyRegistry &reg, Probe probe) : probe_(std::move(probe)) {
+        for (const auto &e : reg) {
+            std::unique_ptr<Proxy> p(new Proxy());
+            p->name = e.name;
+            p->replicas.reset(new Replica[e.replicas.size()]);
+            p->n_replicas = e.replicas.size();
+            proxies_.push_back(std::move(p));
+        }
+    }
+
+    virtual ~HealthMonitor() {
+        stop();
+    }
+
+    /** Starts probing open circuits in the background */
+    void start() {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!thread_.joinable()) {
+            stopping_ = false;
+            thread_ = std::thread(&HealthMonitor::run, this);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    bool is_open(size_t prox, size_t rep) const {
+        return proxies_[prox]->replicas[rep].open.load(std::memory_order_acquire);
+    }
+
+    /** Returns "preferred" if its circuit is closed, otherwise any replica with a closed circuit, or -1 if there is none */
+    int choose(size_t prox, size_t preferred) const {
+        const Proxy &p = *proxies_[prox];
+        if (!p.replicas[preferred].open.load(std::memory_order_acquire)) {
+            return (int) preferred;
+        }
+        for (size_t i = 0; i < p.n_replicas; ++i) {
+            if (!p.replicas[i].open.load(std::memory_order_acquire)) {
+                return (int) i;
+            }
+        }
+        return -1;
+    }
+
+    /** Opens the circuit of a replica after a failed exchange */
+    void report_failure(size_t prox, size_t rep) {
+        std::lock_guard<std::mutex> lk(mu_);
+        open_(prox, rep, Clock::now());
+    }
+
+    /** Counts an exec that was skipped because every replica of the given proxy was down */
+    void report_skip(size_t prox) {
+        proxies_[prox]->skipped++;
+    }
+
+    /**
+     * Probes every open replica whose backoff has expired. Called by the background thread; exposed so tests can
+     * drive the schedule with their own clock.
+     */
+    void probe_due(Clock::time_point now) {
+        for (size_t pi = 0; pi < proxies_.size(); ++pi) {
+            Proxy &p = *proxies_[pi];
+            for (size_t ri = 0; ri < p.n_replicas; ++ri) {
+                Replica &r = p.replicas[ri];
+                if (!r.open.load(std::memory_order_acquire)) {
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lk(mu_);
+                    if (now < r.next_probe) {
+                        continue;
+                    }
+                }
+
+                bool ok = probe_(pi, ri);  // may take up to a deadline, so it runs without the lock
+
+                std::lock_guard<std::mutex> lk(mu_);
+                r.probes++;
+                if (ok) {
+                    close_(pi, ri, now);
+                } else {
+                    r.backoff_ms = std::min(r.backoff_ms * 2, BACKOFF_MAX_MS);
+                    r.next_probe = now + std::chrono::milliseconds(r.backoff_ms);
+                }
+            }
+        }
+    }
+
+    /** Number of times the circuit of a replica has opened */
+    uint64_t trips(size_t prox, size_t rep) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return proxies_[prox]->replicas[rep].trips;
+    }
+
+    uint64_t probes(size_t prox, size_t rep) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return proxies_[prox]->replicas[rep].probes;
+    }
+
+    /** Delay before the next probe of a replica, in ms */
+    int backoff_ms(size_t prox, size_t rep) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return proxies_[prox]->replicas[rep].backoff_ms;
+    }
+
+    uint64_t skipped(size_t prox) const {
+        return proxies_[prox]->skipped;
+    }
+
+    /** Total time during which every replica of the proxy was down, including a stall still in progress */
+    std::chrono::microseconds stalled(size_t prox, Clock::time_point now = Clock::now()) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        const Proxy &p = *proxies_[prox];
+        Clock::duration total = p.stalled;
+        if (p.n_open == p.n_replicas) {
+            total += now - p.stall_start;
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(total);
+    }
+
+    /** Prints one line per proxy that has been unhealthy, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os) const {
+        auto now = Clock::now();
+        for (size_t pi = 0; pi < proxies_.size(); ++pi) {
+            const Proxy &p = *proxies_[pi];
+            uint64_t trips = 0;
+            for (size_t ri = 0; ri < p.n_replicas; ++ri) {
+                trips += this->trips(pi, ri);
+            }
+            if (trips == 0) {
+                continue;
+            }
+            os << "stat::health:                  " << p.name << " trips=" << trips << " skipped=" << p.skipped
+               << " stalled_sec=" << std::fixed << std::setprecision(1) << stalled(pi, now).count() / 1e6 << std::endl;
+        }
+    }
+
+protected:
+    struct Replica {
+        std::atomic<bool> open{false};
+        int backoff_ms = BACKOFF_MIN_MS;
+        Clock::time_point next_probe;
+        uint64_t trips = 0;
+        uint64_t probes = 0;
+    };
+
+    struct Proxy {
+        std::string name;
+        std::unique_ptr<Replica[]> replicas;
+        size_t n_replicas = 0;
+        size_t n_open = 0;
+        Clock::time_point stall_start;  // valid while n_open == n_replicas
+        Clock::duration stalled{0};
+        std::atomic<uint64_t> skipped{0};
+    };
+
+    Probe probe_;
+    std::vector<std::unique_ptr<Proxy>> proxies_;
+
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    bool stopping_ = false;
+
+    void run() {
+        std::unique_lock<std::mutex> lk(mu_);
+        while (!stopping_) {
+            cv_.wait_for(lk, std::chrono::milliseconds(MONITOR_TICK_MS));
+            if (stopping_) {
+                break;
+            }
+            lk.unlock();
+            probe_due(Clock::now());
+            lk.lock();
+        }
+    }
+
+    /** Opens a circuit. Must hold mu_ */
+    void open_(size_t prox, size_t rep, Clock::time_point now) {
+        Proxy &p = *proxies_[prox];
+        Replica &r = p.replicas[rep];
+        if (r.open.load(std::memory_order_relaxed)) {
+            return;  // several execs may fail on the same replica before the first one opens it
+        }
+        r.trips++;
+        r.backoff_ms = BACKOFF_MIN_MS;
+        r.next_probe = now + std::chrono::milliseconds(r.backoff_ms);
+        r.open.store(true, std::memory_order_release);
+        if (++p.n_open == p.n_replicas) {
+            p.stall_start = now;
+        }
+    }
+
+    /** Closes a circuit. Must hold mu_ */
+    void close_(size_t prox, size_t rep, Clock::time_point now) {
+        Proxy &p = *proxies_[prox];
+        Replica &r = p.replicas[rep];
+        if (p.n_open == p.n_replicas) {
+            p.stalled += now - p.stall_start;
+        }
+        p.n_open--;
+        r.backoff_ms = BACKOFF_MIN_MS;
+        r.open.store(false, std::memory_order_release);
+    }
+};
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef NEZHA_HPACK_TABLE_H
+#define NEZHA_HPACK_TABLE_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "../h2_serializer/src/deserializer.h"
+#include "../h2_serializer/src/hpacker/HPacker.h"
+#include "../h2_serializer/src/hpacker/StaticTable.h"
+
+/**
+ * Tracks which headers are in the HPACK table at each point of an H2Stream: the static table plus every header before
+ * that point that is encoded as LITERAL_HEADER_WITH_INDEXING (eviction is not modeled).
+ *
+ * Instead of replaying the stream into a set for every lookup, the table remembers the frame in which every name and
+ * name/value pair was first inserted, so a header is in the table before frame i if it is static or was first inserted
+ * in a frame below i. Frames are simulated lazily and only up to the frame being looked at. Simulated frames are kept
+ * until they no longer match the stream or are invalidated, and are then dropped from that frame on, so a change to
+ * the stream only costs a rescan of the frames from the change on.
+ */
+class HpackTable {
+public:
+    typedef hpack::HPacker::KeyValuePair KeyValuePair;
+
+    /**
+     * The table just before a given header of a given frame. Only valid until the stream or the table change.
+     * Headers can be added on top with insert(), e.g., those of a frame that is about to be added to the stream
+     */
+    class View {
+    public:
+        bool contains(const KeyValuePair &nv) const {
+            if (static_pairs().count(nv) != 0 || before(table_->first_pair_, nv)) {
+                return true;
+            }
+            for (size_t i = 0; cur_ != nullptr && i < hdr_; ++i) {
+                if (cur_->prefixes[i] == hpack::HPacker::PrefixType::LITERAL_HEADER_WITH_INDEXING &&
+                    cur_->hdr_pairs[i] == nv) {
+                    return true;
+                }
+            }
+            for (const auto &e : extra_) {
+                if (e == nv) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool contains_name(const std::string &name) const {
+            if (static_names().count(name) != 0 || before(table_->first_name_, name)) {
+                return true;
+            }
+            for (size_t i = 0; cur_ != nullptr && i < hdr_; ++i) {
+                if (cur_->prefixes[i] == hpack::HPacker::PrefixType::LITERAL_HEADER_WITH_INDEXING &&
+                    cur_->hdr_pairs[i].first == name) {
+                    return true;
+                }
+            }
+            for (const auto &e : extra_) {
+                if (e.first == name) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /** Adds a header to this view only. The table itself is left unchanged */
+        void insert(const KeyValuePair &nv) {
+            extra_.push_back(nv);
+        }
+
+    private:
+        friend class HpackTable;
+
+        const HpackTable *table_ = nullptr;
+        size_t frame_ = 0;             // headers first inserted in frames before this one are in the table
+        const Headers *cur_ = nullptr; // as well as the first hdr_ headers of this frame, if any
+        size_t hdr_ = 0;
+        std::vector<KeyValuePair> extra_;
+
+        template<class M, class K>
+        bool before(const M &first, const K &key) const {
+            auto it = first.find(key);
+            return it != first.end() && it->second < frame_;
+        }
+    };
+
+    /**
+     * Returns the table just before the header at index idx of Frame f in strm. If f is not in strm, returns the table
+     * after all of strm.
+     */
+    View before(const H2Stream &strm, Frame *f, unsigned int idx) {
+        // drop simulated frames from the first one that is no longer where it was
+        size_t same = 0;
+        while (same < frames_.size() && same < strm.size() && frames_[same] == strm[same]) {
+            ++same;
+        }
+        invalidate(same);
+
+        size_t pos = 0;
+        while (pos < strm.size() && strm[pos] != f) {
+            ++pos;
+        }
+        while (frames_.size() < pos) {
+            simulate(strm[frames_.size()]);
+        }
+
+        View v;
+        v.table_ = this;
+        v.frame_ = pos;
+        if (pos < strm.size() && Frame::has_headers(f)) {
+            v.cur_ = dynamic_cast<Headers *>(f);
+            v.hdr_ = idx;
+        }
+        return v;
+    }
+
+    /** Forgets the frames from index frame_idx on, e.g., because their headers changed */
+    void invalidate(size_t frame_idx) {
+        if (frame_idx >= frames_.size()) {
+            return;
+        }
+        while (!inserts_.empty() && inserts_.back().frame >= frame_idx) {
+            const Insert &ins = inserts_.back();
+            if (ins.new_pair) {
+                first_pair_.erase(ins.nv);
+            }
+            if (ins.new_name) {
+                first_name_.erase(ins.nv.first);
+            }
+            inserts_.pop_back();
+        }
+        frames_.resize(frame_idx);
+    }
+
+    void clear() {
+        invalidate(0);
+    }
+
+    /** Number of frames currently simulated */
+    size_t simulated() const {
+        return frames_.size();
+    }
+
+private:
+    struct PairHash {
+        size_t operator()(const KeyValuePair &nv) const {
+            std::hash<std::string> h;
+            return h(nv.first) * 31 + h(nv.second);
+        }
+    };
+
+    /** A header that was the first of its pair or its name to be inserted */
+    struct Insert {
+        size_t frame;
+        KeyValuePair nv;
+        bool new_pair;
+        bool new_name;
+    };
+
+    std::vector<Frame *> frames_;  // simulated frames, which are a prefix of the stream
+    std::vector<Insert> inserts_;  // in stream order, so invalidating pops from the back
+    std::unordered_map<KeyValuePair, size_t, PairHash> first_pair_;  // frame of the first insertion
+    std::unordered_map<std::string, size_t> first_name_;
+
+    void simulate(Frame *f) {
+        size_t idx = frames_.size();
+        frames_.push_back(f);
+        if (!Frame::has_headers(f)) {
+            return;
+        }
+        auto *h = dynamic_cast<Headers *>(f);
+        for (size_t i = 0; i < h->hdr_pairs.size(); ++i) {
+            if (h->prefixes[i] != hpack::HPacker::PrefixType::LITERAL_HEADER_WITH_INDEXING) {
+                continue;
+            }
+            const KeyValuePair &nv = h->hdr_pairs[i];
+            bool new_pair = first_pair_.emplace(nv, idx).second;
+            bool new_name = first_name_.emplace(nv.first, idx).second;
+            if (new_pair || new_name) {
+                inserts_.push_back({idx, nv, new_pair, new_name});
+            }
+        }
+    }
+
+    static const std::unordered_set<KeyValuePair, PairHash> &static_pairs() {
+        static const std::unordered_set<KeyValuePair, PairHash> s(std::begin(hpack::hpackStaticTable),
+                                                                   std::end(hpack::hpackStaticTable));
+        return s;
+    }
+
+    static const std::unordered_set<std::string> &static_names() {
+        static const std::unordered_set<std::string> s = [] {
+            std::unordered_set<std::string> names;
+            for (const auto &nv : hpack::hpackStaticTable) {
+                names.insert(nv.first);
+            }
+            return names;
+        }();
+        return s;
+    }
+};
+
+#endif
@@ -1,71 +1,405 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
 #include <thread>
+#include <vector>
 
+#include "adaptive_deadline.h"
+#include "admission.h"
+#include "broker.h"
 #include "callbacks.h"
+#include "capture.h"
+#include "flake_verifier.h"
+#include "health_monitor.h"
+#include "mutation_bandit.h"
 #include "nezha_diff.h"
 #include "normalizer.h"
+#include "proxy_registry.h"
+#include "replica_selector.h"
+#include "response_dictionary.h"
+#include "response_memo.h"
+#include "result_store.h"
 #include "../debug.h"
 #include "../h2_serializer/src/frames/frames.h"
 
 // Generic interface to packages
 typedef int (*fp_t)(const uint8_t *, uint32_t);
 
-extern "C" void callback_helper(const char *prox, const char *addr, int port, const uint8_t *Data, size_t Size, HashComp **hc) {
-    DEBUG("----- Working on " << prox << " -----")
-    ProxyConfig *filt = ProxyConfig::get_proxy_config(prox);
-    HashComp *out = callback(addr, port, *filt, Data, Size);
+#define EXEC_SKIPPED 1     // return value telling the fuzzer core that the input was not executed
+#define SKIP_PAUSE_MS 10   // pause before returning a skipped exec, so an outage does not turn into a busy loop
+#define PARALLEL 1
+
+// chooses which replica of each proxy serves an exec. set up by GlobalInitializer
+static std::unique_ptr<ReplicaSelector> g_replicas;
+
+// keeps unreachable replicas out of the loop until they answer again. set up by GlobalInitializer
+static std::unique_ptr<HealthMonitor> g_health;
+
+// caps concurrent requests per replica across all jobs. set up by GlobalInitializer
+static std::unique_ptr<AdmissionControl> g_admission;
+
+// learns each proxy's receive deadline from its response times. set up by GlobalInitializer
+static std::unique_ptr<AdaptiveDeadline> g_deadlines;
+
+// per-proxy memo of parsed forwarded requests, so that a request a proxy already forwarded is not parsed again.
+// set up by GlobalInitializer
+static std::vector<std::unique_ptr<ResponseMemo>> g_memos;
+
+// shared memory of the exec broker that owns the proxy connections, if H2FUZZ_BROKER names one. set up by GlobalInitializer
+static std::string g_broker_name;
+
+// records every exchange with the proxies, if H2FUZZ_RECORD names a capture. set up by GlobalInitializer
+static std::unique_ptr<CaptureWriter> g_capture;
+static std::vector<CaptureWriter::Tap> g_taps;  // one per proxy
+
+// serves execs from the capture H2FUZZ_REPLAY names instead of the proxies, if set. set up by GlobalInitializer
+static std::unique_ptr<CaptureReader> g_replay;
+
+// executes logged differences again to tell flaky ones apart, if H2FUZZ_VERIFY is set. set up by GlobalInitializer
+static std::unique_ptr<FlakeVerifier> g_verifier;
+
+/** Broker client of the calling thread. every fuzzing thread (-threads) attaches to its own broker slot */
+static BrokerClient *thread_broker() {
+    static thread_local std::unique_ptr<BrokerClient> client;
+    if (!client) {
+        client.reset(new BrokerClient());
+        if (!client->attach(g_broker_name)) {
+            std::cerr << "Error attaching to exec broker " << g_broker_name << std::endl;
+            exit(1);
+        }
+    }
+    return client.get();
+}
+
+/** Feeds the outcome of one exchange to the health monitor, the deadlines and the replica selector */
+static void record_exchange(size_t idx, size_t rep, uint64_t elapsed_us, uint64_t exchange_us, const HashComp *out) {
+    if (out == nullptr) {
+        g_health->report_failure(idx, rep);
+    } else {
+        g_deadlines->record(idx, exchange_us, out->timeout_err);
+    }
+    g_replicas->record(idx, rep, elapsed_us, out != nullptr, out != nullptr && out->noresp_err);
+}
+
+extern "C" void callback_helper(size_t idx, size_t rep, const uint8_t *Data, size_t Size, HashComp **hc) {
+    const ProxyEntry &prox = ProxyRegistry::global()[idx];
+    const ProxyReplica &r = prox.replicas[rep];
+    DEBUG("----- Working on " << prox.name << " at " << r.to_string() << " -----")
+
+    // queueing for a slot counts towards the replica latency, since it is the clearest sign of a saturated replica,
+    // but not towards the proxy's response time, which sets its deadline
+    auto start = std::chrono::steady_clock::now();
+    HashComp *out;
+    std::chrono::steady_clock::time_point admitted;
+    {
+        AdmissionControl::Ticket ticket(*g_admission, idx, rep);
+        admitted = std::chrono::steady_clock::now();
+        out = callback(r.addr.c_str(), r.port, prox.filter, Data, Size, g_deadlines->deadline_ms(idx),
+                       g_memos[idx].get(), g_capture ? &g_taps[idx] : nullptr);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    auto exchange = std::chrono::duration_cast<std::chrono::microseconds>(end - admitted);
+    record_exchange(idx, rep, (uint64_t) elapsed.count(), (uint64_t) exchange.count(), out);
     *hc = out;
 }
 
+/** Runs one exec with a thread (and a connection) per proxy */
+static void direct_exec(const std::vector<size_t> &reps, const uint8_t *Data, size_t Size, CallbackRet *out) {
+    const ProxyRegistry &proxies = ProxyRegistry::global();
+#if PARALLEL
+    std::vector<std::thread> threads;
+    threads.reserve(proxies.size());
+    for (size_t i = 0; i < proxies.size(); ++i) {
+        threads.emplace_back(callback_helper, i, reps[i], Data, Size, out + i);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+#else
+    for (size_t i = 0; i < proxies.size(); ++i) {
+        callback_helper(i, reps[i], Data, Size, out + i);
+    }
+#endif
+}
+
+/**
+ * Runs one exec through the broker: rewrites the stream for every proxy, hands all of them over at once and parses
+ * the responses as they come back. The broker applies max_inflight itself, so no admission ticket is taken here.
+ */
+static void broker_exec(const std::vector<size_t> &reps, const uint8_t *Data, size_t Size, CallbackRet *ret) {
+    const ProxyRegistry &proxies = ProxyRegistry::global();
+    std::vector<char *> bufs(proxies.size());
+    std::vector<BrokerClient::Request> reqs(proxies.size());
+    for (size_t i = 0; i < proxies.size(); ++i) {
+        size_t sz = preprocess_req(proxies[i].filter, Data, Size, &bufs[i]);
+        reqs[i] = {(uint32_t) i, (uint32_t) reps[i], (uint32_t) g_deadlines->deadline_ms(i), (const uint8_t *) bufs[i],
+                   (uint32_t) sz};
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BrokerClient::Result> results;
+    thread_broker()->exchange(reqs, results);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    for (size_t i = 0; i < proxies.size(); ++i) {
+        const BrokerClient::Result &res = results[i];
+        if (g_capture && res.status == BROKER_OK) {
+            g_taps[i].record(bufs[i], reqs[i].len, (const char *) res.data.data(), res.data.size(), res.timed_out);
+        }
+        delete[] bufs[i];
+        HashComp *out = nullptr;
+        if (res.status == BROKER_OK) {
+            out = parse_response(proxies[i].filter, (const char *) res.data.data(), res.data.size(), res.timed_out,
+                                 g_memos[i].get());
+        }
+        // only exchanges the broker ran with the replica say anything about it. a request or response too large for the
+        // ring, or a broker that stopped answering, just skips the exec
+        if (res.status == BROKER_OK || (res.answered && res.status == BROKER_CONNECT_FAILED)) {
+            record_exchange(i, reps[i], (uint64_t) elapsed.count(), res.exchange_us, out);
+        }
+        ret[i] = out;
+    }
+}
+
+/**
+ * Runs one exec against the capture instead of the proxies: every proxy answers with the response it was recorded
+ * sending for the same request. A stream some proxy was never recorded answering is skipped, like an exec a proxy went
+ * down for. Nothing is learned about replicas, deadlines or health, since no proxy is involved
+ */
+static void replay_exec(const uint8_t *Data, size_t Size, CallbackRet *ret) {
+    const ProxyRegistry &proxies = ProxyRegistry::global();
+    for (size_t i = 0; i < proxies.size(); ++i) {
+        char *buf;
+        size_t sz = preprocess_req(proxies[i].filter, Data, Size, &buf);
+        CaptureReader::Response resp{};
+        ret[i] = nullptr;
+        if (g_replay->find(proxies[i].name, buf, sz, resp)) {
+            ret[i] = parse_response(proxies[i].filter, resp.data, resp.size, resp.timed_out, g_memos[i].get());
+        }
+        delete[] buf;
+    }
+}
+
+/**
+ * Picks a live replica of every proxy. Returns false if a proxy has none, in which case the input is skipped instead
+ * of waiting for it to come back
+ */
+static bool pick_replicas(std::vector<size_t> &reps) {
+    const ProxyRegistry &proxies = ProxyRegistry::global();
+    for (size_t i = 0; i < proxies.size(); ++i) {
+        int rep = g_health->choose(i, g_replicas->pick(i));
+        if (rep < 0) {
+            DEBUG("skipping input -- " << proxies[i].name << " is down")
+            g_health->report_skip(i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(SKIP_PAUSE_MS));
+            return false;
+        }
+        reps[i] = (size_t) rep;
+    }
+    return true;
+}
+
+/**
+ * Health probe: sends the same request as test_proxies_up. A replica that answers at all is up, even if it rejects
+ * the request, since a no-response error says nothing about whether it can take the next input.
+ */
+static bool probe_replica(size_t idx, size_t rep) {
+    const ProxyEntry &prox = ProxyRegistry::global()[idx];
+    const ProxyReplica &r = prox.replicas[rep];
+    uint8_t buf[256];
+    size_t sz = build_probe_stream(buf, sizeof(buf));
+    HashComp *hc = callback(r.addr.c_str(), r.port, prox.filter, buf, sz, prox.deadline_ms);
+    bool ok = hc != nullptr;
+    delete hc;
+    return ok;
+}
+
+/** Executes a logged difference again for the verifier, on whichever replicas are live */
+static bool verify_exec(const std::string &stream, ResultMatrix &m) {
+    std::vector<size_t> reps(ProxyRegistry::global().size());
+    if (!pick_replicas(reps)) {
+        return false;
+    }
+    std::vector<CallbackRet> out(total_libs, nullptr);
+    direct_exec(reps, (const uint8_t *) stream.data(), stream.size(), out.data());
+    bool answered = std::find(out.begin(), out.end(), nullptr) == out.end();
+    if (answered) {
+        m.load(out.data(), total_libs);
+    }
+    for (auto hc : out) {
+        delete hc;
+    }
+    return answered;
+}
+
+/** A difference was logged to Path. Queues it for verification with the results of the exec that found it */
+extern "C" void LLVMFuzzerNezhaDiffLogged(const uint8_t *Data, size_t Size, const char *Path) {
+    if (g_verifier && ret_matrix.proxies() == total_libs) {
+        g_verifier->submit(std::string((const char *) Data, Size), ret_matrix, Path);
+    }
+}
+
+/** Fingerprint of the proxy set and configs. Used by the fuzzer core to invalidate stale stored results */
+extern "C" uint64_t LLVMFuzzerNezhaFingerprint() {
+    return ResultStore::fingerprint(ProxyRegistry::global());
+}
+
+/** Hash of the stream as it is sent to the proxies, modulo the per-proxy authority rewrite. 0 if it cannot be parsed */
+extern "C" uint64_t LLVMFuzzerNezhaCanonicalHash(const uint8_t *Data, size_t Size) {
+    return canonical_stream_hash(Data, Size);
+}
+
+/**
+ * Per-replica throughput and errors, per-proxy outages, queueing, latency, parse memo hits, the capture, the yield of
+ * each mutation arm, the response dictionary and the verdicts on logged differences. Printed with the core's final
+ * stats
+ */
+extern "C" void LLVMFuzzerNezhaPrintStats() {
+    if (g_replicas) {
+        g_replicas->print_stats(std::cerr);
+    }
+    if (g_health) {
+        g_health->print_stats(std::cerr);
+    }
+    if (g_admission) {
+        g_admission->print_stats(std::cerr);
+    }
+    if (g_deadlines) {
+        g_deadlines->print_stats(std::cerr);
+    }
+    for (size_t i = 0; i < g_memos.size(); ++i) {
+        g_memos[i]->print_stats(std::cerr, ProxyRegistry::global()[i].name);
+    }
+    if (g_capture) {
+        g_capture->print_stats(std::cerr);
+    }
+    if (g_replay) {
+        g_replay->print_stats(std::cerr);
+    }
+    MutationBandit::print_stats(std::cerr);
+    ResponseDictionary::global().print_stats(std::cerr);
+    if (g_verifier) {
+        g_verifier->print_stats(std::cerr);
+    }
+}
+
+/** Tokens harvested from the forwarded requests, best first, for the core's dictionary. nullptr until there are any */
+extern "C" ValContainerWords *LLVMFuzzerNezhaDictionary() {
+    // keeps the words alive until the calling thread asks again
+    static thread_local std::shared_ptr<const ResponseDictionary::Tables> tables;
+    static thread_local ValContainerWords vcont;
+    tables = ResponseDictionary::global().tables();
+    if (!tables) {
+        return nullptr;
+    }
+    vcont = {tables->word_data.data(), tables->word_sizes.data(), (int) tables->words.size(), tables->version};
+    return &vcont;
+}
+
+/**
+ * Sets up everything that talks to the proxies: the capture being recorded, if any, health probes, the broker and the
+ * verification of logged differences
+ */
+static void init_live(const char *record) {
+    if (record != nullptr && record[0] != '\0') {
+        g_capture.reset(new CaptureWriter());
+        if (!g_capture->open(record)) {
+            exit(1);
+        }
+        for (const auto &p : ProxyRegistry::global()) {
+            g_taps.push_back({g_capture.get(), p.name});
+        }
+    }
+    g_health->start();
+
+    const char *broker = getenv(BROKER_ENV);
+    if (broker != nullptr && broker[0] != '\0') {
+        g_broker_name = broker;
+        thread_broker();  // fail early if the broker is not there
+    }
+
+    // verification runs on threads of its own, which connect to the proxies directly even with a broker
+    const char *verify = getenv(VERIFY_ENV);
+    int runs = verify != nullptr ? atoi(verify) : 0;
+    if (runs > 0) {
+        const char *spacing = getenv(VERIFY_SPACING_ENV);
+        int spacing_ms = spacing != nullptr && spacing[0] != '\0' ? atoi(spacing) : VERIFY_SPACING_MS;
+        g_verifier.reset(new FlakeVerifier(ProxyRegistry::global(), verify_exec, runs, spacing_ms));
+        g_verifier->start();
+        std::cerr << "Verifying every logged difference " << runs << " times, " << spacing_ms << " ms apart"
+                  << std::endl;
+    }
+}
+
 /** Struct used to initialize global diff-based structures. Static instance ensures that this is called first. */
 struct GlobalInitializer {
     GlobalInitializer() {
+        // load the proxies under test. this sizes every per-proxy structure, so it must come first
+        std::string fn = ProxyRegistry::default_path();
+        int ret = ProxyRegistry::load_global(fn);
+        if (ret != 0) {
+            std::cerr << "Error " << ret << " loading proxy registry " << fn << std::endl;
+            exit(1);
+        }
+        total_libs = (int) ProxyRegistry::global().size();
+        if (total_libs > MATRIX_MAX_PROXIES) {
+            std::cerr << "Error: " << total_libs << " proxies in " << fn << ", at most " << MATRIX_MAX_PROXIES
+                      << " are supported" << std::endl;
+            exit(1);
+        }
+        g_replicas.reset(new ReplicaSelector(ProxyRegistry::global(), ProxyRegistry::global().policy(),
+                                             ReplicaSelector::worker_id()));
+        g_admission.reset(new AdmissionControl(ProxyRegistry::global()));
+        g_deadlines.reset(new AdaptiveDeadline(ProxyRegistry::global()));
+        g_health.reset(new HealthMonitor(ProxyRegistry::global(), probe_replica));
+        for (size_t i = 0; i < ProxyRegistry::global().size(); ++i) {
+            g_memos.emplace_back(new ResponseMemo());
+        }
+
+        // either serve execs from a capture, in which case no proxy is ever contacted, or run against the proxies
+        const char *replay = getenv(CAPTURE_REPLAY_ENV);
+        const char *record = getenv(CAPTURE_RECORD_ENV);
+        if (replay != nullptr && replay[0] != '\0') {
+            if (record != nullptr && record[0] != '\0') {
+                std::cerr << "Error: " << CAPTURE_RECORD_ENV << " and " << CAPTURE_REPLAY_ENV << " are both set"
+                          << std::endl;
+                exit(1);
+            }
+            g_replay.reset(new CaptureReader());
+            if (!g_replay->load(replay)) {
+                exit(1);
+            }
+            std::cerr << "Replaying " << g_replay->size() << " exchanges from " << replay << std::endl;
+        } else {
+            init_live(record);
+        }
+
         // initialize all diff-based structures
         diff_init();
     }
 };
 static GlobalInitializer g_initializer;
 
-#define PARALLEL 1
-
-#if PARALLEL
-#define LAUNCH(tname, fname, addr, idx) std::thread tname(callback_helper, fname, addr, 9090, Data, Size, ret_vals + idx);
-#define CLEAN(tname) tname.join();
-#else
-#define LAUNCH(tname, fname, addr, idx) std::thread tname(callback_helper, fname, addr, 9090, Data, Size, ret_vals + idx); tname.join();
-#define CLEAN(tname)
-#endif
-
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
-    /**
-     * Would be nice to abstract this out -- maybe to the ProxyConfig objects.
-     *
-     * For now though, it's hard-coded
-     */
-    LAUNCH(t_nginx, "nginx", "172.17.0.3", 0)
-    LAUNCH(t_caddy, "caddy", "172.17.0.4", 1)
-    LAUNCH(t_apache, "apache", "172.17.0.5", 2)
-    LAUNCH(t_envoy, "envoy", "172.17.0.6", 3)
-    LAUNCH(t_haproxy, "haproxy", "172.17.0.7", 4)
-    LAUNCH(t_traefik, "traefik", "172.17.0.8", 5)
-    LAUNCH(t_varnish, "varnish", "172.17.0.9", 6)
-    LAUNCH(t_h2o, "h2o", "172.17.0.10", 7)
-    LAUNCH(t_ats, "ats", "172.17.0.11", 8)
-    LAUNCH(t_nghttp2, "nghttp2", "172.17.0.12", 9)
-    LAUNCH(t_ols, "openlitespeed", "172.17.0.13", 10)
-
-    CLEAN(t_nginx)
-    CLEAN(t_caddy)
-    CLEAN(t_apache)
-    CLEAN(t_envoy)
-    CLEAN(t_haproxy)
-    CLEAN(t_traefik)
-    CLEAN(t_varnish)
-    CLEAN(t_h2o)
-    CLEAN(t_ats)
-    CLEAN(t_nghttp2)
-    CLEAN(t_ols)
+    thread_ret_vals();  // allocates ret_vals on the first exec of a fuzzing thread
+    if (g_replay) {
+        replay_exec(Data, Size, ret_vals);
+    } else {
+        std::vector<size_t> reps(ProxyRegistry::global().size());
+        if (!pick_replicas(reps)) {
+            return EXEC_SKIPPED;
+        }
+        if (!g_broker_name.empty()) {
+            broker_exec(reps, Data, Size, ret_vals);
+        } else {
+            direct_exec(reps, Data, Size, ret_vals);
+        }
+    }
 
     // check whether any callback returned nullptr (e.g., if client fails to connect)
     bool any_null = false;
@@ -83,15 +417,26 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
     }
 
     // clean up HashComps and return error code to Fuzzer::ExecuteCallback
+    // a null result means a proxy went down mid-exchange, which says nothing about the input, so it is skipped
     if (any_null || all_err) {
         for (int i = 0; i < total_libs; ++i) {
             delete ret_vals[i];
         }
-        return -1;
+        return any_null ? EXEC_SKIPPED : -1;
     }
 
     DEBUG("--- Normalizing ---")
-    Normalizer::normalize(ret_vals, total_libs);  // perform normalization here. avoids tight coupling inside NEZHA core
+    // perform normalization here. avoids tight coupling inside NEZHA core, which reads which proxies disagree from the
+    // matrix it leaves behind
+    Normalizer::normalize(ret_vals, total_libs, ret_matrix);
+
+    // disagreements only proxies known to be unstable on the field take part in are not worth logging again
+    if (g_verifier) {
+        g_verifier->suppress(ret_matrix);
+    }
+
+    // learn the tokens the proxies forward, and which of them they disagree on
+    ResponseDictionary::global().harvest(ret_vals, total_libs, ret_matrix);
 
 #if DBG_MODE
     for (int i=0; i < total_libs; ++i) {
@@ -0,0 +1,298 @@
+/**
+ * Utility program for shrinking the streams in out/ that make the proxies disagree.
+ *
+ * Each stream is reduced with StreamMinimizer: frames, headers, settings and body bytes are removed as long as the
+ * proxies still disagree on the same fields and still split into the same groups on each. Only the proxies the
+ * difference involves are asked: those that disagree on some field, and one of the largest group that agrees on it.
+ * Candidates of a stream are sent concurrently, and several streams are minimized at once.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "callbacks.h"
+#include "minimizer.h"
+#include "proxy_registry.h"
+#include "result_matrix.h"
+
+#define DEFAULT_CAND_THREADS 4  // candidates of one stream in flight at once
+
+static void usage(const char *prog) {
+    std::cout << "usage: " << prog << " [-j <files at once>] [-t <candidates at once>] <diff file or dir> <output dir>"
+              << std::endl
+              << "  Writes a minimized copy of every stream that makes the proxies in "
+              << ProxyRegistry::default_path() << " disagree" << std::endl
+              << "  to the output dir, under the same name. Streams already there are skipped. Defaults: -j <cores> -t "
+              << DEFAULT_CAND_THREADS << std::endl;
+}
+
+/** Whether path is a directory */
+static bool is_dir(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool file_exists(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+static std::string base_name(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+/**
+ * Stream files of an out/ directory, as trim.py picks them: the *_h1_* files and the inputs before mutation are left
+ * out, and of the files with the same stream hash (the last part of the name) only the first is kept
+ */
+static std::vector<std::string> list_diffs(const std::string &dir) {
+    std::vector<std::string> names;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return names;
+    }
+    while (struct dirent *e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.find('_') == std::string::npos || name.find("_h1_") != std::string::npos ||
+            name.find("BeforeMutationWas") != std::string::npos) {
+            continue;
+        }
+        names.push_back(name);
+    }
+    closedir(d);
+
+    std::sort(names.begin(), names.end());
+    std::set<std::string> hashes;
+    std::vector<std::string> out;
+    for (const auto &name : names) {
+        if (hashes.insert(name.substr(name.find_last_of('_') + 1)).second) {
+            out.push_back(dir + "/" + name);
+        }
+    }
+    return out;
+}
+
+/**
+ * One difference being minimized: the proxies it involves and the disagreement it shows between them
+ */
+class DiffOracle {
+public:
+    explicit DiffOracle(const ProxyRegistry &proxies) : proxies_(proxies) {}
+
+    /**
+     * Sends stream to every proxy and picks the ones the difference involves. Returns false if the proxies agree, a
+     * proxy could not be reached, or the involved proxies do not disagree the same way when asked again
+     */
+    bool init(const std::string &stream, std::string &why) {
+        std::vector<size_t> all(proxies_.size());
+        for (size_t i = 0; i < all.size(); ++i) {
+            all[i] = i;
+        }
+        std::vector<HashComp *> hcs = run(all, stream);
+        if (hcs.empty()) {
+            why = "a proxy did not answer";
+            return false;
+        }
+        ResultMatrix m;
+        m.load(hcs.data(), (int) hcs.size());
+        if (!m.has_diff()) {
+            release(hcs);
+            why = "no difference";
+            return false;
+        }
+
+        // the disagreeing proxies, and the lowest proxy of the group that agrees, on every differing compared field.
+        // splits on fields that are not compared are not kept
+        uint64_t involved = 0;
+        for (size_t c = 0; c < ResultMatrix::KEY_COLS; ++c) {
+            uint64_t out = m.disagreement(c);
+            if (out != 0 && (m.differing_columns() & (1ULL << c))) {
+                involved |= out;
+                uint64_t agree = ~out & (proxies_.size() == 64 ? ~0ULL : (1ULL << proxies_.size()) - 1);
+                involved |= agree & (0 - agree);
+            }
+        }
+        for (size_t i = 0; i < proxies_.size(); ++i) {
+            if (involved & (1ULL << i)) {
+                subset_.push_back(i);
+            }
+        }
+        std::vector<HashComp *> sub;
+        for (size_t i : subset_) {
+            sub.push_back(hcs[i]);
+        }
+        signature_ = signature(sub);
+        release(hcs);
+
+        // a difference that does not show up again would make every candidate fail
+        if (!accepts(stream)) {
+            why = "not reproducible";
+            return false;
+        }
+        return true;
+    }
+
+    /** Whether the involved proxies disagree on stream as they did on the original */
+    bool accepts(const std::string &stream) const {
+        std::vector<HashComp *> hcs = run(subset_, stream);
+        if (hcs.empty()) {
+            return false;
+        }
+        bool same = signature(hcs) == signature_;
+        release(hcs);
+        return same;
+    }
+
+    size_t involved() const {
+        return subset_.size();
+    }
+
+private:
+    const ProxyRegistry &proxies_;
+    std::vector<size_t> subset_;
+    uint64_t signature_ = 0;
+
+    static uint64_t signature(const std::vector<HashComp *> &hcs) {
+        ResultMatrix m;
+        m.load(hcs.data(), (int) hcs.size());
+        return m.signature();
+    }
+
+    static void release(std::vector<HashComp *> &hcs) {
+        for (auto hc : hcs) {
+            delete hc;
+        }
+        hcs.clear();
+    }
+
+    /** Sends stream to the given proxies at once. Returns their results in order, or nothing if any is missing */
+    std::vector<HashComp *> run(const std::vector<size_t> &which, const std::string &stream) const {
+        std::vector<HashComp *> hcs(which.size(), nullptr);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < which.size(); ++i) {
+            threads.emplace_back([this, &which, &stream, &hcs, i]() {
+                const ProxyEntry &prox = proxies_[which[i]];
+                const ProxyReplica &r = prox.replicas[0];
+                hcs[i] = callback(r.addr.c_str(), r.port, prox.filter, (const uint8_t *) stream.data(),
+                                  stream.size(), prox.deadline_ms);
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        for (auto hc : hcs) {
+            if (hc == nullptr) {
+                release(hcs);
+                break;
+            }
+        }
+        return hcs;
+    }
+};
+
+int main(int argc, char **argv) {
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    size_t cands = DEFAULT_CAND_THREADS;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = (size_t) std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            cands = (size_t) std::max(1, atoi(argv[++i]));
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            args.emplace_back(argv[i]);
+        }
+    }
+    if (args.size() != 2 || !is_dir(args[1])) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ProxyRegistry proxies;
+    std::string reg_fn = ProxyRegistry::default_path();
+    int ret = proxies.load(reg_fn);
+    if (ret != 0) {
+        std::cout << "Error " << ret << " loading proxy registry " << reg_fn << std::endl;
+        return 1;
+    }
+    if (proxies.size() > MATRIX_MAX_PROXIES) {
+        std::cout << "Error: at most " << MATRIX_MAX_PROXIES << " proxies are supported" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files = is_dir(args[0]) ? list_diffs(args[0]) : std::vector<std::string>{args[0]};
+    const std::string &dest = args[1];
+    std::cout << "Minimizing " << files.size() << " streams, " << jobs << " at once" << std::endl;
+
+    std::mutex out_mu;
+    std::atomic<size_t> next{0}, done{0}, skipped{0};
+    std::atomic<size_t> bytes_in{0}, bytes_out{0};
+    auto work = [&]() {
+        for (size_t i; (i = next++) < files.size();) {
+            std::string name = base_name(files[i]);
+            std::string out_fn = dest + "/" + name;
+            if (file_exists(out_fn)) {
+                skipped++;
+                continue;
+            }
+            std::ifstream is(files[i], std::ifstream::binary);
+            std::stringstream ss;
+            ss << is.rdbuf();
+            std::string stream = ss.str();
+
+            std::string why;
+            std::string min;
+            size_t tested = 0;
+            DiffOracle oracle(proxies);
+            try {
+                if (oracle.init(stream, why)) {
+                    StreamMinimizer m([&oracle](const std::string &cand) { return oracle.accepts(cand); }, cands);
+                    min = m.minimize(stream);
+                    tested = m.tested();
+                }
+            } catch (const std::exception &e) {
+                why = std::string("does not parse: ") + e.what();
+            }
+
+            std::lock_guard<std::mutex> lock(out_mu);
+            if (!why.empty()) {
+                std::cout << name << ": skipped, " << why << std::endl;
+                skipped++;
+                continue;
+            }
+            std::ofstream os(out_fn, std::ofstream::binary);
+            os.write(min.data(), (std::streamsize) min.size());
+            bytes_in += stream.size();
+            bytes_out += min.size();
+            done++;
+            std::cout << name << ": " << stream.size() << " -> " << min.size() << " bytes, "
+                      << StreamMinimizer::count(min, StreamMinimizer::LVL_FRAMES) << " frames, " << tested
+                      << " candidates on " << oracle.involved() << " proxies" << std::endl;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < jobs; ++i) {
+        threads.emplace_back(work);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    std::cout << "Minimized " << done << " streams from " << bytes_in << " to " << bytes_out << " bytes; skipped "
+              << skipped << std::endl;
+    return 0;
+}
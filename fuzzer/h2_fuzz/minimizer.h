@@ -0,0 +1,221 @@
+#ifndef NEZHA_MINIMIZER_H
+#define NEZHA_MINIMIZER_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../h2_serializer/src/deserializer.h"
+#include "../h2_serializer/src/frames/frames.h"
+
+#define MIN_SRLZ_SLACK 4096  // extra room for a candidate's serialization. removing parts rarely makes a stream larger
+
+/**
+ * Delta debugging of a serialized stream that knows its structure. Instead of cutting bytes, which mostly yields
+ * streams that no longer parse, it removes parts of the deserialized stream, coarsest first: whole frames, then single
+ * headers of HEADERS, CONTINUATION and PUSH_PROMISE frames, then single settings, then DATA bytes. Each level is
+ * reduced ddmin-style: the parts are split into chunks, the stream without each chunk is tried, and the chunks get
+ * smaller until no single part can go. Since removing headers can make a frame removable and the other way round, the
+ * levels are repeated until a round removes nothing.
+ *
+ * The candidates of a split are tested in parallel, up to `threads` at once, and the first one in split order that
+ * the oracle accepts is taken, so the result does not depend on which test finished first.
+ */
+class StreamMinimizer {
+public:
+    /** Whether a serialized candidate still behaves like the original. Called from several threads at once */
+    typedef std::function<bool(const std::string &)> Oracle;
+
+    /** Parts of a stream, coarsest first */
+    enum Level { LVL_FRAMES, LVL_HEADERS, LVL_SETTINGS, LVL_BODY, LEVELS };
+
+    StreamMinimizer(Oracle oracle, size_t threads) : oracle_(std::move(oracle)), threads_(std::max<size_t>(threads, 1)) {}
+
+    /** Returns the smallest stream found that the oracle accepts, or stream itself. Throws if stream does not parse */
+    std::string minimize(const std::string &stream) {
+        delete_stream(parse(stream));
+        std::string cur = stream;
+        bool progress = true;
+        while (progress) {
+            progress = false;
+            for (int l = 0; l < LEVELS; ++l) {
+                progress |= ddmin((Level) l, cur);
+            }
+        }
+        return cur;
+    }
+
+    /** Candidates passed to the oracle so far */
+    size_t tested() const {
+        return tested_;
+    }
+
+    /** Number of parts of level l in strm */
+    static size_t count(const H2Stream &strm, Level l) {
+        size_t n = 0;
+        for (Frame *f : strm) {
+            n += parts(f, l);
+        }
+        return n;
+    }
+
+    /** Number of parts of level l in a serialized stream */
+    static size_t count(const std::string &stream, Level l) {
+        H2Stream *strm = parse(stream);
+        size_t n = count(*strm, l);
+        delete_stream(strm);
+        return n;
+    }
+
+    /** Removes the parts of level l numbered [begin, end) in the order count() counts them */
+    static void remove(H2Stream &strm, Level l, size_t begin, size_t end) {
+        size_t first = 0;  // number of the first part of the current frame
+        for (size_t i = 0; i < strm.size();) {
+            Frame *f = strm[i];
+            size_t n = parts(f, l);
+            size_t b = begin > first ? std::min(begin - first, n) : 0;
+            size_t e = end > first ? std::min(end - first, n) : 0;
+            first += n;
+            if (l == LVL_FRAMES && b < e) {
+                delete f;
+                strm.erase(strm.begin() + i);
+                continue;
+            }
+            if (b < e) {
+                remove_parts(f, l, b, e);
+            }
+            ++i;
+        }
+    }
+
+    /** Parses a serialized stream. Throws if it does not parse */
+    static H2Stream *parse(const std::string &stream) {
+        return Deserializer::deserialize_stream(stream.data(), stream.size());
+    }
+
+    static void delete_stream(H2Stream *strm) {
+        for (Frame *f : *strm) {
+            delete f;
+        }
+        delete strm;
+    }
+
+private:
+    Oracle oracle_;
+    size_t threads_;
+    std::atomic<size_t> tested_{0};
+
+    /** Number of parts of level l in frame f */
+    static size_t parts(Frame *f, Level l) {
+        switch (l) {
+            case LVL_FRAMES:
+                return 1;
+            case LVL_HEADERS:
+                return Frame::has_headers(f) ? dynamic_cast<Headers *>(f)->hdr_pairs.size() : 0;
+            case LVL_SETTINGS:
+                return f->type == SETTINGS ? static_cast<SettingsFrame *>(f)->settings.size() : 0;
+            case LVL_BODY:
+                return f->type == DATA ? static_cast<DataFrame *>(f)->data.size() : 0;
+            default:
+                return 0;
+        }
+    }
+
+    /** Removes the parts [b, e) of level l from frame f */
+    static void remove_parts(Frame *f, Level l, size_t b, size_t e) {
+        switch (l) {
+            case LVL_HEADERS: {
+                auto *h = dynamic_cast<Headers *>(f);
+                h->hdr_pairs.erase(h->hdr_pairs.begin() + b, h->hdr_pairs.begin() + e);
+                h->prefixes.erase(h->prefixes.begin() + b, h->prefixes.begin() + e);
+                h->idx_types.erase(h->idx_types.begin() + b, h->idx_types.begin() + e);
+                h->reset_srlz_blk();
+                break;
+            }
+            case LVL_SETTINGS: {
+                auto &s = static_cast<SettingsFrame *>(f)->settings;
+                s.erase(s.begin() + b, s.begin() + e);
+                break;
+            }
+            case LVL_BODY: {
+                auto &d = static_cast<DataFrame *>(f)->data;
+                d.erase(d.begin() + b, d.begin() + e);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    /** cur without the parts [begin, end) of level l, serialized, or "" if the result cannot be serialized */
+    static std::string without(const std::string &cur, Level l, size_t begin, size_t end) {
+        H2Stream *strm = parse(cur);
+        std::string out;
+        try {
+            remove(*strm, l, begin, end);
+            std::vector<char> buf(cur.size() + MIN_SRLZ_SLACK);
+            uint32_t sz = strm->serialize(buf.data(), (uint32_t) buf.size());
+            out.assign(buf.data(), sz);
+            delete_stream(parse(out));  // the proxies get what the fuzzer would send, which is parsed first
+        } catch (const std::exception &e) {
+            // e.g., a header left referring to a table entry that was removed
+            out.clear();
+        }
+        delete_stream(strm);
+        return out;
+    }
+
+    /** Reduces the parts of level l in cur. Returns true if any were removed */
+    bool ddmin(Level l, std::string &cur) {
+        size_t n = count(cur, l);
+        bool removed = false;
+        size_t chunks = std::min<size_t>(2, n);
+        while (n > 0) {
+            std::vector<std::string> cands;
+            for (size_t i = 0; i < chunks; ++i) {
+                cands.push_back(without(cur, l, i * n / chunks, (i + 1) * n / chunks));
+            }
+            int k = first_accepted(cands);
+            if (k >= 0) {
+                cur = cands[k];
+                n = count(cur, l);
+                removed = true;
+                chunks = std::min(std::max<size_t>(chunks - 1, 2), n);
+            } else if (chunks >= n) {
+                break;
+            } else {
+                chunks = std::min(chunks * 2, n);
+            }
+        }
+        return removed;
+    }
+
+    /** Index of the first candidate the oracle accepts, or -1. Empty candidates are never accepted */
+    int first_accepted(const std::vector<std::string> &cands) {
+        for (size_t start = 0; start < cands.size(); start += threads_) {
+            size_t end = std::min(cands.size(), start + threads_);
+            std::vector<char> ok(end - start, 0);
+            std::vector<std::thread> threads;
+            for (size_t i = start; i < end; ++i) {
+                if (!cands[i].empty()) {
+                    threads.emplace_back([this, &cands, &ok, i, start]() { ok[i - start] = oracle_(cands[i]); });
+                }
+            }
+            for (auto &t : threads) {
+                t.join();
+            }
+            tested_ += threads.size();
+            for (size_t i = start; i < end; ++i) {
+                if (ok[i - start]) {
+                    return (int) i;
+                }
+            }
+        }
+        return -1;
+    }
+};
+
+#endif
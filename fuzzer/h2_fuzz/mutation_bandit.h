@@ -0,0 +1,200 @@
+#ifndef NEZHA_MUTATION_BANDIT_H
+#define NEZHA_MUTATION_BANDIT_H
+
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "h2fuzzconfig.h"
+
+// Arms. Mutate() and CrossOver() operators come first, in the order of their macros in h2mutator.h, followed by
+// BANDIT_MAX_FIELDS arms per frame type for the fields of its mutable_fields list
+#define BANDIT_MUT_OPS 0
+#define BANDIT_CROSS_OPS 5
+#define BANDIT_FIELDS 7
+#define BANDIT_FRAME_TYPES 10  // DATA .. CONTINUATION
+#define BANDIT_MAX_FIELDS 32   // frames with longer field lists are mutated uniformly
+#define BANDIT_ARMS (BANDIT_FIELDS + BANDIT_FRAME_TYPES * BANDIT_MAX_FIELDS)
+
+#define BANDIT_PSEUDO_PULLS 64.0  // how many pulls an arm's yield needs to move away from its group's
+#define BANDIT_EXPLORE 0.1        // share of choices made by the configured likelihoods alone
+#define BANDIT_WINDOW 65536.0     // statistics of a group are halved once it has been pulled this many times
+
+/**
+ * Multi-armed bandit over the choices H2Mutator makes: which Mutate() and CrossOver() operator to apply, and which
+ * field of a frame a bit mutation goes to. An arm is credited when the exec of the unit it helped produce has a new
+ * output tuple or a new difference, so choices that keep producing new outputs get picked more often.
+ *
+ * Each choice is drawn with probability proportional to prior * yield, mixed with BANDIT_EXPLORE of the prior alone.
+ * The prior is the likelihood in the mutator config (uniform for fields), so an arm the config disables stays
+ * disabled and the config's mix is what is used until there is evidence against it. An arm's yield is its
+ * credits/pulls shrunk towards the yield of its whole group, so arms are not judged on a handful of pulls. Statistics
+ * decay by halving, so the schedule keeps following the campaign as easy outputs run out.
+ *
+ * One bandit is used per fuzzing thread. Lifetime pull and credit counts of all threads are kept in process-wide
+ * counters for print_stats().
+ */
+class MutationBandit {
+public:
+    /** Picks a Mutate() operator (BIT .. FIX) */
+    unsigned int pick_mut_op(const H2FuzzConfig &cfg, std::minstd_rand &rnd) {
+        double prior[] = {(double) cfg.prob_bit, (double) cfg.prob_delete, (double) cfg.prob_dup,
+                          (double) cfg.prob_swap, (double) cfg.prob_fix};
+        return (unsigned int) pick(BANDIT_MUT_OPS, 5, prior, rnd);
+    }
+
+    /** Picks a CrossOver() operator (ADD or SPLICE) */
+    unsigned int pick_cross_op(const H2FuzzConfig &cfg, std::minstd_rand &rnd) {
+        double prior[] = {(double) cfg.prob_add, (double) cfg.prob_splice};
+        return (unsigned int) pick(BANDIT_CROSS_OPS, 2, prior, rnd);
+    }
+
+    /** Picks one of the given mutable fields of a frame of the given type */
+    size_t pick_field(uint8_t frame_type, const std::vector<FieldRep> &fields, std::minstd_rand &rnd) {
+        if (frame_type >= BANDIT_FRAME_TYPES || fields.size() > BANDIT_MAX_FIELDS) {
+            return std::uniform_int_distribution<size_t>(0, fields.size() - 1)(rnd);
+        }
+        size_t first = BANDIT_FIELDS + frame_type * BANDIT_MAX_FIELDS;
+        std::vector<double> prior(fields.size(), 1.0);
+        size_t i = pick(first, fields.size(), prior.data(), rnd);
+        totals().field[first + i - BANDIT_FIELDS].store(field_id(fields[i]), std::memory_order_relaxed);
+        return i;
+    }
+
+    /** Credits the arms picked since the last call if productive, and forgets them */
+    void credit(bool productive) {
+        for (size_t arm : picked_) {
+            if (productive) {
+                wins_[arm] += 1;
+                totals().credits[arm].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        picked_.clear();
+    }
+
+    /** Forgets the arms picked since the last credit, e.g., because the mutation failed and nothing is executed */
+    void discard() {
+        for (size_t arm : picked_) {
+            totals().failed[arm].fetch_add(1, std::memory_order_relaxed);
+        }
+        picked_.clear();
+    }
+
+    /** Prints the lifetime statistics of every arm that was pulled, in all threads */
+    static void print_stats(std::ostream &os) {
+        static const char *ops[] = {"bit", "delete", "dup", "swap", "fix", "add", "splice"};
+        Totals &t = totals();
+        for (size_t arm = 0; arm < BANDIT_ARMS; ++arm) {
+            uint64_t pulls = t.pulls[arm].load(std::memory_order_relaxed);
+            if (pulls == 0) {
+                continue;
+            }
+            uint64_t credits = t.credits[arm].load(std::memory_order_relaxed);
+            uint64_t failed = t.failed[arm].load(std::memory_order_relaxed);
+            std::string name;
+            if (arm < BANDIT_FIELDS) {
+                name = ops[arm];
+            } else {
+                uint32_t id = t.field[arm - BANDIT_FIELDS].load(std::memory_order_relaxed);
+                name = H2FuzzConfig::frame_key((uint8_t) ((arm - BANDIT_FIELDS) / BANDIT_MAX_FIELDS)) + "." +
+                       H2FuzzConfig::field_key(FieldRep((FrameField) (id >> 8), (uint8_t) (id & 0xff)));
+            }
+            os << "stat::mutation_arm:            " << name << " pulls=" << pulls << " failed=" << failed
+               << " credits=" << credits << " yield_pct=" << std::fixed << std::setprecision(3)
+               << (pulls > failed ? 100.0 * credits / (double) (pulls - failed) : 0.0) << std::endl;
+        }
+    }
+
+private:
+    double pulls_[BANDIT_ARMS] = {};
+    double wins_[BANDIT_ARMS] = {};
+    std::vector<size_t> picked_;
+
+    struct Totals {
+        std::atomic<uint64_t> pulls[BANDIT_ARMS];
+        std::atomic<uint64_t> credits[BANDIT_ARMS];
+        std::atomic<uint64_t> failed[BANDIT_ARMS];
+        std::atomic<uint32_t> field[BANDIT_ARMS - BANDIT_FIELDS];  // field_id of each field arm, for names
+
+        Totals() {
+            for (size_t i = 0; i < BANDIT_ARMS; ++i) {
+                pulls[i] = credits[i] = failed[i] = 0;
+            }
+            for (auto &f : field) {
+                f = 0;
+            }
+        }
+    };
+
+    static Totals &totals() {
+        static Totals t;
+        return t;
+    }
+
+    static uint32_t field_id(const FieldRep &fr) {
+        return ((uint32_t) fr.field << 8) | fr.frametype;
+    }
+
+    void weights(size_t first, size_t n, const double *prior, double *w) const {
+        double pulls = 0, wins = 0, prior_sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            pulls += pulls_[first + i];
+            wins += wins_[first + i];
+            prior_sum += prior[i];
+        }
+        double group_yield = (wins + 1) / (pulls + 2);
+        double yield_sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            size_t a = first + i;
+            w[i] = prior[i] * (wins_[a] + BANDIT_PSEUDO_PULLS * group_yield) / (pulls_[a] + BANDIT_PSEUDO_PULLS);
+            yield_sum += w[i];
+        }
+        for (size_t i = 0; i < n; ++i) {
+            w[i] = (1 - BANDIT_EXPLORE) * (yield_sum > 0 ? w[i] / yield_sum : 0) +
+                   BANDIT_EXPLORE * (prior_sum > 0 ? prior[i] / prior_sum : 0);
+        }
+    }
+
+    size_t pick(size_t first, size_t n, const double *prior, std::minstd_rand &rnd) {
+        std::vector<double> w(n);
+        weights(first, n, prior, w.data());
+        double sum = 0;
+        for (double x : w) {
+            sum += x;
+        }
+        double r = std::uniform_real_distribution<double>(0, sum)(rnd);
+        size_t i = 0;
+        while (i + 1 < n && (r -= w[i]) >= 0) {
+            ++i;
+        }
+        while (w[i] <= 0 && i > 0) {  // r landed on the upper edge of a disabled arm
+            --i;
+        }
+
+        size_t arm = first + i;
+        pulls_[arm] += 1;
+        picked_.push_back(arm);
+        totals().pulls[arm].fetch_add(1, std::memory_order_relaxed);
+        decay(first, n);
+        return i;
+    }
+
+    void decay(size_t first, size_t n) {
+        double pulls = 0;
+        for (size_t i = 0; i < n; ++i) {
+            pulls += pulls_[first + i];
+        }
+        if (pulls < BANDIT_WINDOW) {
+            return;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            pulls_[first + i] /= 2;
+            wins_[first + i] /= 2;
+        }
+    }
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include <cstdio>
 #include <cassert>
 //#include <dlfcn.h>
+#include "result_matrix.h"
 
 #if defined(__has_include)
 #if __has_include(<sanitizer / coverage_interface.h>)
@@ -50,16 +51,15 @@ __sanitizer_get_number_of_counters();
   FREE_PTR(vcont_u64.vals) \
   FREE_PTR(bitset)
 
-// Let's just increase the number of libs upon includes to append them in-order
-// into the array but this assumes that always the calls will happen in the same
-// order inside the code because otherwise things will break!
-int total_libs = 11;
+// Number of proxies under test. Set from the proxy registry before diff_init()
+// allocates the per-proxy arrays below.
+int total_libs = 0;
 
 // Current lib we are visiting.
 int cur_lib = 0;
 
-// Array holding return values.
-CallbackRet *ret_vals = nullptr;
+// Array holding return values. Every fuzzing thread (-threads) fills its own.
+thread_local CallbackRet *ret_vals = nullptr;
 
 // Array holding indexes to the start of the global PC buffer (start, end).
 // We use this to track the per-lib list of unique PCs executed.
@@ -83,18 +83,36 @@ uint32_t num_bitcounters;
 struct ValContainerInt {
     int *vals;
     int size;
-} vcont_int = { nullptr, 0 };
+};
+thread_local ValContainerInt vcont_int = { nullptr, 0 };
 
 struct ValContainerU64 {
     uint64_t *vals;
     int size;
-} vcont_u64 = { nullptr, 0 };
+};
+thread_local ValContainerU64 vcont_u64 = { nullptr, 0 };
 
 struct ValContainerCallback {
     CallbackRet *vals;
     int size;
-} vcont_callback = { nullptr, 0 };
+};
+thread_local ValContainerCallback vcont_callback = { nullptr, 0 };
 
+struct ValContainerWords {
+    const char *const *vals;
+    const size_t *sizes;
+    int size;
+    uint64_t version;
+};
+
+// Return value array of the calling thread, allocated on its first exec.
+CallbackRet *thread_ret_vals() {
+    if (!ret_vals) {
+        ret_vals = (CallbackRet *) calloc(total_libs, sizeof(CallbackRet));
+        assert(ret_vals != nullptr && "error allocating ret_vals");
+    }
+    return ret_vals;
+}
 
 extern "C" ValContainerCallback *LLVMFuzzerNezhaOutputs() {
     if (!ret_vals)
@@ -104,6 +122,32 @@ extern "C" ValContainerCallback *LLVMFuzzerNezhaOutputs() {
     return &vcont_callback;
 }
 
+// Results of the current exec of every fuzzing thread, as the normalizer left them.
+thread_local ResultMatrix ret_matrix;
+
+// Which proxies disagree on which fields, laid out as described next to DISAGREE_PROXIES.
+thread_local uint64_t disagree_vals[DISAGREE_COLS + ResultMatrix::KEY_COLS];
+thread_local ValContainerU64 vcont_disagree = { nullptr, 0 };
+
+// Reload: the outputs did not come from this exec (e.g., they were loaded from
+// the result store), so ret_matrix is rebuilt from them first.
+extern "C" ValContainerU64 *LLVMFuzzerNezhaDisagreement(int Reload) {
+    if (!ret_vals)
+        return nullptr;
+    if (Reload)
+        ret_matrix.load(ret_vals, total_libs);
+    if (ret_matrix.proxies() != total_libs)
+        return nullptr;
+    disagree_vals[DISAGREE_PROXIES] = ret_matrix.disagreeing_proxies();
+    disagree_vals[DISAGREE_FIELDS] = ret_matrix.differing_columns();
+    disagree_vals[DISAGREE_SIGNATURE] = ret_matrix.signature();
+    for (size_t c = 0; c < ResultMatrix::KEY_COLS; ++c)
+        disagree_vals[DISAGREE_COLS + c] = ret_matrix.disagreement(c);
+    vcont_disagree.vals = disagree_vals;
+    vcont_disagree.size = DISAGREE_COLS + ResultMatrix::KEY_COLS;
+    return &vcont_disagree;
+}
+
 extern "C" ValContainerInt *LLVMFuzzerBitcounts() {
     if (!bitcounts)
         return nullptr;
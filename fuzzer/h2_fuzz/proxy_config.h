@@ -47,6 +47,16 @@ struct ProxyConfig {
         }
 
         auto *filt = new ProxyConfig();
+        read_proxy_config(proxy, srcdir, *filt);
+        ProxyConfig::cache[proxy] = filt;
+        return filt;
+    }
+
+    /**
+     * Reads the config file for the given proxy in srcdir into "filt" without going through the cache.
+     * libconfig exceptions (missing file, parse errors, missing ignore_headers) propagate to the caller.
+     */
+    static void read_proxy_config(const char *proxy, const char *srcdir, ProxyConfig &filt) {
         libconfig::Config c;
 
         // get name of file with config contents
@@ -58,21 +68,19 @@ struct ProxyConfig {
         c.readFile(fn);
         if (!c.exists("filter")) { std::cout << "config does not have \"filter\" element" << std::endl; }
 
-        if (!c.lookupValue("filter.in_host", filt->host)) { std::cout << "config does not have in_host" << std::endl; }
-        if (!c.lookupValue("filter.out_authority", filt->authority)) { std::cout << "config does not have out_authority" << std::endl; }
+        if (!c.lookupValue("filter.in_host", filt.host)) { std::cout << "config does not have in_host" << std::endl; }
+        if (!c.lookupValue("filter.out_authority", filt.authority)) { std::cout << "config does not have out_authority" << std::endl; }
 
         libconfig::Setting &flt_hdrs = c.lookup("filter.ignore_headers");
         if (!flt_hdrs.isList()) { std::cout << "config ignore_headers is not a list" << std::endl; }
         for (int i = 0; i < flt_hdrs.getLength(); ++i) {
-            filt->headers.insert(flt_hdrs[i]);
+            filt.headers.insert(flt_hdrs[i]);
         }
 
-        ProxyConfig::cache[proxy] = filt;
         DEBUG("loaded proxy config from file system")
-        DEBUG_NOLN(filt->host << ", " << filt->authority << ", ")
-        for (const auto& hdr : filt->headers) { DEBUG_NOLN(hdr << ", ") }
+        DEBUG_NOLN(filt.host << ", " << filt.authority << ", ")
+        for (const auto& hdr : filt.headers) { DEBUG_NOLN(hdr << ", ") }
         DEBUG("")
-        return filt;
     }
 
     /**
@@ -0,0 +1,257 @@
+#ifndef NEZHA_PROXY_REGISTRY_H
+#define NEZHA_PROXY_REGISTRY_H
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <libconfig.h++>
+#include "proxy_config.h"
+#include "basedir.h"
+#include "../debug.h"
+
+#define PROX_REGISTRY_FILE BASEDIR"proxies.conf"
+#define PROX_REGISTRY_ENV "H2FUZZ_PROXIES"  // overrides PROX_REGISTRY_FILE when set
+
+#define DEFAULT_PORT 9090
+#define DEFAULT_DEADLINE_MS 60000
+
+#define ERR_REG_READ (-1)
+#define ERR_REG_LIST (-2)
+#define ERR_REG_NAME (-3)
+#define ERR_REG_ADDR (-4)
+#define ERR_REG_PORT (-5)
+#define ERR_REG_FILTER (-6)
+#define ERR_REG_DUP (-7)
+#define ERR_REG_EMPTY (-8)
+#define ERR_REG_POLICY (-9)
+#define ERR_REG_LIMIT (-10)
+#define ERR_REG_DEADLINE (-11)
+
+#define SEMVMX_LIMIT 32767  // largest max_inflight a System V semaphore can hold
+
+/** How a worker chooses among the replicas of a proxy */
+enum class ReplicaPolicy {
+    HASH,          // fixed replica per fuzzing thread, from a consistent-hash ring keyed on the worker id and thread
+    LEAST_LOADED,  // replica with the lowest smoothed exchange latency seen by this worker
+};
+
+/**
+ * One instance of a proxy under test. Replicas of a proxy are interchangeable: whichever one serves an exec,
+ * its results fill the same slot in ret_vals and are compared as the same participant.
+ */
+struct ProxyReplica {
+    std::string addr;
+    int port = DEFAULT_PORT;
+
+    std::string to_string() const { return addr + ":" + std::to_string(port); }
+};
+
+/**
+ * A single proxy under test, as listed in the proxy registry file
+ */
+struct ProxyEntry {
+    std::string name;
+    std::vector<ProxyReplica> replicas;  // one or more instances serving this proxy
+    ProxyConfig filter;  // owned copy of proxy_configs/<filter>, so lookups need no lock
+    int deadline_ms = DEFAULT_DEADLINE_MS;  // receive timeout for a single exchange; upper bound if adaptive
+    bool adaptive_deadline = true;  // learn a tighter deadline from observed latencies (see AdaptiveDeadline)
+    bool enabled = true;  // false drops the proxy from the registry without deleting its entry
+    int max_inflight = 0;  // cap on concurrent requests to each replica across all fuzzer processes; 0 for none
+};
+
+/**
+ * Ordered set of proxies under test, read once from a libconfig file such as
+ *
+ *   replica_policy = "hash";
+ *   proxies = (
+ *     { name = "nginx"; addrs = ["172.17.0.3", "172.17.0.20:9091"]; port = 9090; filter = "nginx"; deadline_ms = 60000; }
+ *   );
+ *
+ * Only "name" and "addrs" are required. Each address is one replica, given as "host" or "host:port"; "port" is the
+ * default for addresses without one. "filter" names the file in proxy_configs and defaults to "name".
+ * Entries with "enabled" set to false are skipped, so a proxy can be dropped without deleting its entry.
+ * "deadline_ms" is the receive timeout, or its upper bound unless "adaptive_deadline" is false. It must be positive.
+ * "max_inflight" caps the requests in flight to each replica of the proxy across all jobs (see AdmissionControl).
+ * "replica_policy" is "hash" (default) or "least_loaded".
+ *
+ * The registry is never modified after load(), so fuzzing threads read it without synchronization.
+ * The index of an entry is the index of its results in ret_vals.
+ */
+class ProxyRegistry {
+public:
+    ProxyRegistry() = default;
+
+    /**
+     * Reads the registry in "fn", resolving filter configs in "filtdir". Returns 0 on success or an ERR_REG_* code.
+     * On failure the registry is left empty.
+     */
+    int load(const std::string &fn, const char *filtdir = PROX_CFG_DIR) {
+        entries_.clear();
+        policy_ = ReplicaPolicy::HASH;
+        int ret = load_(fn, filtdir);
+        if (ret != 0) {
+            entries_.clear();
+        }
+        return ret;
+    }
+
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+    const ProxyEntry &operator[](size_t i) const { return entries_[i]; }
+    ReplicaPolicy policy() const { return policy_; }
+    std::vector<ProxyEntry>::const_iterator begin() const { return entries_.begin(); }
+    std::vector<ProxyEntry>::const_iterator end() const { return entries_.end(); }
+
+    /** Returns the entry with the given name, or nullptr if there is none */
+    const ProxyEntry *find(const std::string &name) const {
+        for (const auto &e : entries_) {
+            if (e.name == name) {
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+    /** Path of the registry file: $H2FUZZ_PROXIES if set, PROX_REGISTRY_FILE otherwise */
+    static std::string default_path() {
+        const char *env = getenv(PROX_REGISTRY_ENV);
+        return env != nullptr && *env != '\0' ? std::string(env) : std::string(PROX_REGISTRY_FILE);
+    }
+
+    /**
+     * Process-wide registry. Must be loaded with load_global() before any fuzzing thread starts;
+     * it is read-only afterwards.
+     */
+    static const ProxyRegistry &global() {
+        return global_();
+    }
+
+    static int load_global(const std::string &fn) {
+        return global_().load(fn);
+    }
+
+    /**
+     * Parses "host" or "host:port" into r, using default_port for the former. Returns false if the port is invalid.
+     */
+    static bool parse_replica(const std::string &s, int default_port, ProxyReplica &r) {
+        size_t colon = s.find(':');
+        if (colon == std::string::npos) {
+            r.addr = s;
+            r.port = default_port;
+            return !r.addr.empty();
+        }
+
+        r.addr = s.substr(0, colon);
+        std::string port = s.substr(colon + 1);
+        if (r.addr.empty() || port.empty() || port.length() > 5 ||
+            port.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        r.port = atoi(port.c_str());
+        return r.port > 0 && r.port <= 65535;
+    }
+
+protected:
+    std::vector<ProxyEntry> entries_;
+    ReplicaPolicy policy_ = ReplicaPolicy::HASH;
+
+    int load_(const std::string &fn, const char *filtdir) {
+        libconfig::Config c;
+        try {
+            c.readFile(fn.c_str());
+        } catch (const std::exception &e) {
+            std::cerr << "could not read proxy registry " << fn << ": " << e.what() << std::endl;
+            return ERR_REG_READ;
+        }
+
+        if (!c.exists("proxies") || !c.lookup("proxies").isList()) {
+            return ERR_REG_LIST;
+        }
+        libconfig::Setting &proxies = c.lookup("proxies");
+
+        std::string policy = "hash";
+        c.lookupValue("replica_policy", policy);
+        if (policy == "hash") {
+            policy_ = ReplicaPolicy::HASH;
+        } else if (policy == "least_loaded") {
+            policy_ = ReplicaPolicy::LEAST_LOADED;
+        } else {
+            return ERR_REG_POLICY;
+        }
+
+        for (int i = 0; i < proxies.getLength(); ++i) {
+            libconfig::Setting &p = proxies[i];
+            ProxyEntry e;
+
+            if (!p.lookupValue("name", e.name) || e.name.empty()) {
+                return ERR_REG_NAME;
+            }
+            if (find(e.name) != nullptr) {
+                return ERR_REG_DUP;
+            }
+
+            if (!p.exists("addrs")) {
+                return ERR_REG_ADDR;
+            }
+            libconfig::Setting &addrs = p.lookup("addrs");
+            if (!addrs.isArray() && !addrs.isList()) {
+                return ERR_REG_ADDR;
+            }
+
+            int port = DEFAULT_PORT;
+            if (p.exists("port") && (!p.lookupValue("port", port) || port <= 0 || port > 65535)) {
+                return ERR_REG_PORT;
+            }
+            for (int j = 0; j < addrs.getLength(); ++j) {
+                std::string a = addrs[j];
+                ProxyReplica r;
+                if (!parse_replica(a, port, r)) {
+                    return ERR_REG_PORT;
+                }
+                e.replicas.push_back(r);
+            }
+            if (e.replicas.empty()) {
+                return ERR_REG_ADDR;
+            }
+            // 0 would make the receive timeout infinite, and setsockopt rejects negative ones
+            if (p.exists("deadline_ms") && (!p.lookupValue("deadline_ms", e.deadline_ms) || e.deadline_ms <= 0)) {
+                return ERR_REG_DEADLINE;
+            }
+            p.lookupValue("adaptive_deadline", e.adaptive_deadline);
+            if (p.exists("max_inflight") && (!p.lookupValue("max_inflight", e.max_inflight) || e.max_inflight < 0 ||
+                                              e.max_inflight > SEMVMX_LIMIT)) {
+                return ERR_REG_LIMIT;
+            }
+            p.lookupValue("enabled", e.enabled);
+            if (!e.enabled) {
+                DEBUG("proxy registry -- skipping disabled proxy " << e.name)
+                continue;
+            }
+
+            std::string filt_name = e.name;
+            p.lookupValue("filter", filt_name);
+            try {
+                ProxyConfig::read_proxy_config(filt_name.c_str(), filtdir, e.filter);
+            } catch (const std::exception &ex) {
+                std::cerr << "could not read filter config " << filt_name << " for " << e.name << ": " << ex.what() << std::endl;
+                return ERR_REG_FILTER;
+            }
+
+            entries_.push_back(e);
+        }
+
+        if (entries_.empty()) {
+            return ERR_REG_EMPTY;
+        }
+        return 0;
+    }
+
+    /** Function-local static avoids depending on static initialization order across translation units */
+    static ProxyRegistry &global_() {
+        static ProxyRegistry reg;
+        return reg;
+    }
+};
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef NEZHA_REPLICA_SELECTOR_H
+#define NEZHA_REPLICA_SELECTOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "hash_utils.h"
+#include "proxy_registry.h"
+
+#define WORKER_ID_ENV "NEZHA_JOB_ID"  // set by the fuzzer core for each -jobs process
+#define RING_VNODES 64                // points per replica on the consistent-hash ring
+#define LATENCY_ALPHA 0.2             // weight of the newest sample in the smoothed latency
+#define LATENCY_DECAY 0.99            // per-exec decay of replicas that were not picked, so they get re-probed
+
+/**
+ * Throughput and error counters for a single replica, as seen by this worker
+ */
+struct ReplicaStats {
+    std::atomic<uint64_t> execs{0};
+    std::atomic<uint64_t> noresp{0};   // execs that produced no forwarded request
+    std::atomic<uint64_t> failed{0};   // execs that produced no result at all
+    std::atomic<uint64_t> busy_us{0};  // total time spent in exchanges with this replica
+};
+
+/**
+ * Assigns each exec of a proxy to one of its replicas and keeps per-replica statistics.
+ *
+ * With ReplicaPolicy::HASH, every replica owns RING_VNODES points on a hash ring per proxy and each fuzzing thread of a
+ * worker always uses the replica that owns the first point at or after the hash of the worker id and the thread's index
+ * (see thread_key). Threads are indexed in the order of their first pick(). Adding or removing a replica therefore only
+ * moves the threads that hashed next to it.
+ *
+ * With ReplicaPolicy::LEAST_LOADED, each exec goes to the replica with the lowest smoothed exchange latency. A saturated
+ * replica answers slowly, so this steers work away from it without any coordination between workers.
+ *
+ * pick() and record() may be called from several threads at once, as the fuzzing threads of one process (-threads) share
+ * a selector. Statistics may be read from any thread.
+ */
+class ReplicaSelector {
+public:
+    ReplicaSelector(const ProxyRegistry &reg, ReplicaPolicy policy, uint64_t worker_id)
+            : policy_(policy), worker_id_(worker_id), id_(next_id()) {
+        for (const auto &e : reg) {
+            Proxy p;
+            p.name = e.name;
+            p.replicas = e.replicas;
+            p.stats.reset(new ReplicaStats[e.replicas.size()]);
+            p.latency.assign(e.replicas.size(), 0.0);
+            p.mu.reset(new std::mutex());
+            proxies_.push_back(std::move(p));
+        }
+    }
+
+    /** Returns the index of the replica of proxy "prox" that should serve the next exec */
+    size_t pick(size_t prox) const {
+        const Proxy &p = proxies_[prox];
+        if (p.replicas.size() == 1) {
+            return 0;
+        }
+        if (policy_ == ReplicaPolicy::HASH) {
+            return affinity()[prox];
+        }
+        std::lock_guard<std::mutex> lock(*p.mu);
+        return (size_t) (std::min_element(p.latency.begin(), p.latency.end()) - p.latency.begin());
+    }
+
+    const ProxyReplica &replica(size_t prox, size_t rep) const {
+        return proxies_[prox].replicas[rep];
+    }
+
+    /**
+     * Records the outcome of an exec served by replica "rep" of proxy "prox". "has_result" is false if the exec produced
+     * no result at all; otherwise "noresp" tells whether the replica failed to forward a request.
+     */
+    void record(size_t prox, size_t rep, uint64_t elapsed_us, bool has_result, bool noresp) {
+        Proxy &p = proxies_[prox];
+        ReplicaStats &s = p.stats[rep];
+        s.execs++;
+        s.busy_us += elapsed_us;
+        if (!has_result) {
+            s.failed++;
+        } else if (noresp) {
+            s.noresp++;
+        }
+
+        if (policy_ == ReplicaPolicy::LEAST_LOADED) {
+            std::lock_guard<std::mutex> lock(*p.mu);
+            for (size_t i = 0; i < p.latency.size(); ++i) {
+                if (i == rep) {
+                    p.latency[i] = p.latency[i] == 0.0 ? (double) elapsed_us
+                                                       : LATENCY_ALPHA * elapsed_us + (1 - LATENCY_ALPHA) * p.latency[i];
+                } else {
+                    p.latency[i] *= LATENCY_DECAY;
+                }
+            }
+        }
+    }
+
+    const ReplicaStats &stats(size_t prox, size_t rep) const {
+        return proxies_[prox].stats[rep];
+    }
+
+    size_t num_replicas(size_t prox) const {
+        return proxies_[prox].replicas.size();
+    }
+
+    /** Prints one line of statistics per replica, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os) const {
+        for (const auto &p : proxies_) {
+            for (size_t i = 0; i < p.replicas.size(); ++i) {
+                const ReplicaStats &s = p.stats[i];
+                uint64_t execs = s.execs;
+                uint64_t busy = s.busy_us;
+                os << "stat::replica:                 " << p.name << " " << p.replicas[i].to_string()
+                   << " execs=" << execs << " noresp=" << s.noresp << " failed=" << s.failed
+                   << " exec_per_sec=" << std::fixed << std::setprecision(1)
+                   << (busy ? execs * 1e6 / (double) busy : 0.0) << std::endl;
+            }
+        }
+    }
+
+    /** Id of this worker: the job index assigned by the fuzzer core if there is one, the pid otherwise */
+    static uint64_t worker_id() {
+        const char *env = getenv(WORKER_ID_ENV);
+        if (env != nullptr && *env != '\0') {
+            return strtoull(env, nullptr, 10);
+        }
+        return (uint64_t) getpid();
+    }
+
+    /**
+     * Ring position of fuzzing thread "thread" of the given worker. Thread 0 sits where the worker alone would, so a
+     * single-threaded worker keeps its replicas
+     */
+    static uint64_t thread_key(uint64_t worker_id, uint64_t thread) {
+        return thread == 0 ? worker_id : mix(worker_id + thread * 0x9e3779b97f4a7c15ULL);
+    }
+
+    /** Index of the replica of e that owns the first ring point at or after the position of the given worker */
+    static size_t ring_lookup(const ProxyEntry &e, uint64_t worker_id) {
+        return ring_lookup(e.name, e.replicas, worker_id);
+    }
+
+private:
+    struct Proxy {
+        std::string name;
+        std::vector<ProxyReplica> replicas;
+        std::unique_ptr<ReplicaStats[]> stats;
+        std::vector<double> latency;  // smoothed exchange latency in us, 0 until first used
+        std::unique_ptr<std::mutex> mu;  // guards latency
+    };
+
+    /** Replicas assigned to the calling thread by the hash ring, per proxy */
+    struct Affinity {
+        uint64_t selector = 0;  // id_ of the selector they were computed for
+        std::vector<size_t> fixed;
+    };
+
+    ReplicaPolicy policy_;
+    uint64_t worker_id_;
+    uint64_t id_;  // unique per selector, since a new one may reuse the address of a destroyed one
+    mutable std::atomic<uint64_t> threads_{0};  // fuzzing threads that have picked so far
+    std::vector<Proxy> proxies_;
+
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> ids{0};
+        return ++ids;
+    }
+
+    /** Replicas of the calling thread, computed on its first pick() */
+    const std::vector<size_t> &affinity() const {
+        static thread_local Affinity a;
+        if (a.selector != id_) {
+            uint64_t key = thread_key(worker_id_, threads_++);
+            a.fixed.clear();
+            for (const auto &p : proxies_) {
+                a.fixed.push_back(ring_lookup(p.name, p.replicas, key));
+            }
+            a.selector = id_;
+        }
+        return a.fixed;
+    }
+
+    static size_t ring_lookup(const std::string &name, const std::vector<ProxyReplica> &replicas, uint64_t worker_id) {
+        uint64_t key = mix(worker_id);
+        size_t best = 0;
+        uint64_t best_dist = UINT64_MAX;
+        for (size_t r = 0; r < replicas.size(); ++r) {
+            std::string id = name + "/" + replicas[r].to_string() + "#";
+            for (int v = 0; v < RING_VNODES; ++v) {
+                uint64_t point = mix(HashUtils::fnv1a(id + std::to_string(v)));
+                uint64_t dist = point - key;  // clockwise distance from key, wrapping around the ring
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = r;
+                }
+            }
+        }
+        return best;
+    }
+
+    /** splitmix64 finalizer. Small worker ids hash to well-spread ring positions */
+    static uint64_t mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+};
+
+#endif
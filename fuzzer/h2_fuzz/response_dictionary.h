@@ -0,0 +1,344 @@
+#ifndef NEZHA_RESPONSE_DICTIONARY_H
+#define NEZHA_RESPONSE_DICTIONARY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "hashcomp.h"
+#include "result_matrix.h"
+
+#define DICT_MAX_TOKENS 4096    // interned tokens. once full, tokens seen once and never in a diff are pruned
+#define DICT_MAX_TOKEN_LEN 64   // longer names and values are not harvested
+#define DICT_REBUILD_EVERY 256  // harvested execs between two rebuilds of the tables
+#define DICT_TOP_VALUES 32      // smart values kept per header class
+#define DICT_TOP_SEPARATORS 8   // list separators kept
+#define DICT_TOP_WORDS 256      // words handed to the fuzzer core's dictionary
+
+/** Headers whose values H2Mutator has smart values for */
+enum HeaderClass {
+    HC_OTHER, HC_METHOD, HC_STATUS, HC_SCHEME, HC_TE, HC_CONNECTION, HC_CL, HC_EXPECT, HC_AUTHORITY, HC_COUNT
+};
+
+/** Whether name[b, e) equals the lowercase string t, ignoring case */
+inline bool header_name_is(const std::string &name, size_t b, size_t e, const char *t) {
+    size_t n = strlen(t);
+    if (e - b != n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (std::tolower((unsigned char) name[b + i]) != t[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns the class of a header name, ignoring case. Transfer-Encoding, TE, Content-Length and Host also match with
+ * whitespace around them (see Util::special_match). :authority and :path are HC_AUTHORITY, like Host
+ */
+inline HeaderClass classify_header(const std::string &name) {
+    size_t n = name.size();
+    if (header_name_is(name, 0, n, ":method")) {
+        return HC_METHOD;
+    } else if (header_name_is(name, 0, n, ":status")) {
+        return HC_STATUS;
+    } else if (header_name_is(name, 0, n, ":scheme")) {
+        return HC_SCHEME;
+    } else if (header_name_is(name, 0, n, "connection")) {
+        return HC_CONNECTION;
+    } else if (header_name_is(name, 0, n, "expect")) {
+        return HC_EXPECT;
+    } else if (header_name_is(name, 0, n, ":authority") || header_name_is(name, 0, n, ":path")) {
+        return HC_AUTHORITY;
+    }
+
+    size_t b = 0, e = n;
+    while (b < e && Util::is_ws(name[b])) {
+        ++b;
+    }
+    while (e > b && Util::is_ws(name[e - 1])) {
+        --e;
+    }
+    if (header_name_is(name, b, e, "transfer-encoding") || header_name_is(name, b, e, "te")) {
+        return HC_TE;
+    } else if (header_name_is(name, b, e, "content-length")) {
+        return HC_CL;
+    } else if (header_name_is(name, b, e, "host")) {
+        return HC_AUTHORITY;
+    }
+    return HC_OTHER;
+}
+
+/**
+ * Dictionary of the tokens that the proxies actually put in the HTTP/1 requests they forward: methods, header names,
+ * header values and the separators around them (": ", ", ", ...). Every exec is harvested from the original requests
+ * in its HashComps, and each token counts the execs it appeared in and how many of those had the proxies disagree on
+ * the field it came from (on the request line for methods, on the header for tracked headers, on anything for the
+ * rest). Tokens are ranked by that disagreement count, then by how often they are seen.
+ *
+ * Tokens are interned under a lock as they are harvested. Every DICT_REBUILD_EVERY execs the ranked Tables are rebuilt
+ * and published, and readers (the mutators of every fuzzing thread and the fuzzer core) take the current Tables
+ * without locking. Once DICT_MAX_TOKENS are interned, tokens seen once and never in a disagreement are pruned, since
+ * mutated garbage is mostly that.
+ */
+class ResponseDictionary {
+public:
+    /** Ranked tokens, best first. Immutable once published */
+    struct Tables {
+        uint64_t version = 0;
+        std::vector<std::string> values[HC_COUNT];  // header values (and methods) per header class
+        std::vector<std::string> separators;        // between the values of a list
+        std::vector<std::string> words;             // all kinds of tokens, for the fuzzer core's dictionary
+        std::vector<const char *> word_data;        // words[i].data() and words[i].size()
+        std::vector<size_t> word_sizes;
+    };
+
+    /** Harvests the original requests of n HashComps. m holds the same results, loaded before normalization */
+    void harvest(HashComp *const *hashes, int n, const ResultMatrix &m) {
+        std::vector<Found> found;
+        for (int i = 0; i < n; ++i) {
+            if (hashes[i] != nullptr) {
+                scan(hashes[i]->orig, m, found);
+            }
+        }
+        // count every token once per exec, as involved if it was in any of the proxies
+        std::sort(found.begin(), found.end(), [](const Found &a, const Found &b) { return a.key < b.key; });
+
+        std::lock_guard<std::mutex> lock(mu_);
+        for (size_t i = 0; i < found.size();) {
+            size_t j = i;
+            bool involved = false;
+            while (j < found.size() && found[j].key == found[i].key) {
+                involved |= found[j].involved;
+                ++j;
+            }
+            count(found[i].key, involved);
+            i = j;
+        }
+        if (++execs_ % DICT_REBUILD_EVERY == 0) {
+            rebuild_locked();
+        }
+    }
+
+    /** The last published tables, or nullptr before the first rebuild */
+    std::shared_ptr<const Tables> tables() const {
+        return std::atomic_load(&tables_);
+    }
+
+    /** Ranks the tokens harvested so far and publishes them */
+    void rebuild() {
+        std::lock_guard<std::mutex> lock(mu_);
+        rebuild_locked();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mu_);
+        return entries_.size();
+    }
+
+    void print_stats(std::ostream &os) const {
+        std::shared_ptr<const Tables> t = tables();
+        std::lock_guard<std::mutex> lock(mu_);
+        os << "stat::response_dict:           tokens=" << entries_.size() << " execs=" << execs_
+           << " version=" << (t ? t->version : 0) << " top=";
+        for (size_t i = 0; t && i < t->words.size() && i < 8; ++i) {
+            os << (i ? "|" : "") << t->words[i];
+        }
+        os << std::endl;
+    }
+
+    /** Dictionary of this process */
+    static ResponseDictionary &global() {
+        static ResponseDictionary d;
+        return d;
+    }
+
+private:
+    enum TokenKind : char { TOK_VALUE = 'v', TOK_NAME = 'n', TOK_NAME_SEP = 'c', TOK_LIST_SEP = 'l' };
+
+    /** Interned token. Its key is its kind, its header class and its text */
+    struct Entry {
+        std::string key;
+        uint64_t seen;
+        uint64_t disagree;
+
+        TokenKind kind() const { return (TokenKind) key[0]; }
+        HeaderClass cls() const { return (HeaderClass) (key[1] - 'A'); }
+        std::string text() const { return key.substr(2); }
+    };
+
+    /** Token found in one request */
+    struct Found {
+        std::string key;
+        bool involved;
+    };
+
+    mutable std::mutex mu_;
+    std::vector<Entry> entries_;
+    std::unordered_map<std::string, uint32_t> ids_;  // key -> index in entries_
+    uint64_t execs_ = 0;
+    uint64_t version_ = 0;
+    std::shared_ptr<const Tables> tables_;
+
+    static void add(std::vector<Found> &out, TokenKind kind, HeaderClass cls, const std::string &s, size_t b,
+                    size_t e, bool involved) {
+        if (e <= b || e - b > DICT_MAX_TOKEN_LEN) {
+            return;
+        }
+        std::string key;
+        key.reserve(2 + e - b);
+        key += (char) kind;
+        key += (char) ('A' + cls);
+        key.append(s, b, e - b);
+        out.push_back({std::move(key), involved});
+    }
+
+    /** Splits one HTTP/1 request into tokens: the method, then the name, separator and values of every header */
+    static void scan(const std::string &req, const ResultMatrix &m, std::vector<Found> &out) {
+        size_t pos = 0;
+        bool reqline = true;
+        while (pos < req.size()) {
+            size_t eol = req.find('\n', pos);
+            if (eol == std::string::npos) {
+                eol = req.size();
+            }
+            size_t end = eol > pos && req[eol - 1] == '\r' ? eol - 1 : eol;
+            if (end == pos) {
+                break;  // end of the headers
+            }
+            if (reqline) {
+                size_t sp = req.find(' ', pos);
+                add(out, TOK_VALUE, HC_METHOD, req, pos, std::min(sp, end),
+                    m.disagreement(ResultMatrix::KEY_REQLINE) != 0);
+                reqline = false;
+            } else {
+                scan_header(req, pos, end, m, out);
+            }
+            pos = eol + 1;
+        }
+    }
+
+    static void scan_header(const std::string &req, size_t b, size_t e, const ResultMatrix &m,
+                            std::vector<Found> &out) {
+        size_t colon = req.find(':', b);
+        if (colon == std::string::npos || colon >= e || colon == b) {
+            return;
+        }
+        std::string name = req.substr(b, colon - b);
+        std::string lower = name;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        bool exact;
+        const HeaderField *field = FieldIndex::lookup(lower, &exact);
+        bool involved = m.has_diff();
+        for (size_t f = 0; field != nullptr && f < HASHCOMP_NFIELDS; ++f) {
+            // by name, since HASHCOMP_FIELDS is a different array in every translation unit
+            if (strcmp(HASHCOMP_FIELDS[f].name, field->name) == 0) {
+                size_t col = ResultMatrix::KEY_FIELDS + 2 * f;
+                involved = (m.disagreement(col) | m.disagreement(col + 1)) != 0;
+            }
+        }
+        HeaderClass cls = classify_header(name);
+
+        size_t v = colon + 1;
+        while (v < e && Util::is_ws(req[v])) {
+            ++v;
+        }
+        add(out, TOK_NAME, HC_OTHER, req, b, colon, involved);
+        add(out, TOK_NAME_SEP, HC_OTHER, req, colon, v, involved);
+
+        // values of a list, and the separators between them
+        while (v < e) {
+            size_t comma = req.find(',', v);
+            if (comma == std::string::npos || comma > e) {
+                comma = e;
+            }
+            size_t ve = comma;
+            while (ve > v && Util::is_ws(req[ve - 1])) {
+                --ve;
+            }
+            add(out, TOK_VALUE, cls, req, v, ve, involved);
+            if (comma == e) {
+                break;
+            }
+            size_t next = comma + 1;
+            while (next < e && Util::is_ws(req[next])) {
+                ++next;
+            }
+            add(out, TOK_LIST_SEP, HC_OTHER, req, ve, next, involved);
+            v = next;
+        }
+    }
+
+    void count(const std::string &key, bool involved) {
+        auto it = ids_.find(key);
+        if (it == ids_.end()) {
+            if (entries_.size() >= DICT_MAX_TOKENS) {
+                return;
+            }
+            it = ids_.emplace(key, (uint32_t) entries_.size()).first;
+            entries_.push_back({key, 0, 0});
+        }
+        Entry &en = entries_[it->second];
+        en.seen++;
+        en.disagree += involved;
+    }
+
+    void rebuild_locked() {
+        if (entries_.size() >= DICT_MAX_TOKENS) {
+            prune();
+        }
+        std::vector<const Entry *> ranked;
+        ranked.reserve(entries_.size());
+        for (const auto &en : entries_) {
+            ranked.push_back(&en);
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const Entry *a, const Entry *b) {
+            return a->disagree != b->disagree ? a->disagree > b->disagree
+                                              : a->seen != b->seen ? a->seen > b->seen : a->key < b->key;
+        });
+
+        auto *t = new Tables();
+        t->version = ++version_;
+        std::unordered_set<std::string> words;
+        for (const Entry *en : ranked) {
+            if (en->kind() == TOK_VALUE && t->values[en->cls()].size() < DICT_TOP_VALUES) {
+                t->values[en->cls()].push_back(en->text());
+            } else if (en->kind() == TOK_LIST_SEP && t->separators.size() < DICT_TOP_SEPARATORS) {
+                t->separators.push_back(en->text());
+            }
+            if (t->words.size() < DICT_TOP_WORDS && words.insert(en->text()).second) {
+                t->words.push_back(en->text());
+            }
+        }
+        for (const auto &w : t->words) {
+            t->word_data.push_back(w.data());
+            t->word_sizes.push_back(w.size());
+        }
+        std::atomic_store(&tables_, std::shared_ptr<const Tables>(t));
+    }
+
+    void prune() {
+        std::vector<Entry> kept;
+        for (auto &en : entries_) {
+            if (en.seen > 1 || en.disagree > 0) {
+                kept.push_back(std::move(en));
+            }
+        }
+        entries_.swap(kept);
+        ids_.clear();
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            ids_.emplace(entries_[i].key, (uint32_t) i);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef NEZHA_RESPONSE_MEMO_H
+#define NEZHA_RESPONSE_MEMO_H
+
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include "hash_utils.h"
+#include "hashcomp.h"
+
+#define MEMO_ENTRIES 1024  // forwarded requests per generation. two generations are kept
+
+/**
+ * Memo of parsed forwarded requests for one proxy, keyed by the raw HTTP/1 bytes the proxy echoed back.
+ *
+ * Most execs make a proxy forward a request it has already forwarded byte for byte, so the H1 parse and the hashing of
+ * its fields can be replaced by a copy of the earlier result. Entries are HashComps as parse_response() builds them,
+ * before normalization, and are checked against the full request, so a hash collision cannot return a wrong result.
+ *
+ * Entries are added to the current generation. When it holds MEMO_ENTRIES, it becomes the previous generation and the
+ * old previous one is dropped, so requests that keep coming back survive while one-offs age out. Hits in the previous
+ * generation are moved back into the current one.
+ *
+ * Safe to use from several threads. Timings cover the lookup and the copy on a hit, and the parse and the insertion on
+ * a miss, so the difference of the averages is the time a hit saves.
+ */
+class ResponseMemo {
+public:
+    explicit ResponseMemo(size_t entries = MEMO_ENTRIES) : entries_(entries) {}
+
+    /** Returns a copy of the result stored for the forwarded request "h1", or nullptr if there is none */
+    HashComp *find(const std::string &h1) {
+        uint64_t key = HashUtils::fnv1a(h1);
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = cur_.find(key);
+        if (it != cur_.end()) {
+            return it->second->orig == h1 ? it->second->clone() : nullptr;
+        }
+        it = prev_.find(key);
+        if (it == prev_.end() || it->second->orig != h1) {
+            return nullptr;
+        }
+        std::unique_ptr<HashComp> hc = std::move(it->second);
+        prev_.erase(it);
+        HashComp *out = hc->clone();
+        insert(key, std::move(hc));
+        return out;
+    }
+
+    /** Stores a copy of hc, the result of parsing the forwarded request hc.orig */
+    void add(const HashComp &hc) {
+        if (entries_ == 0) {
+            return;
+        }
+        std::unique_ptr<HashComp> copy(hc.clone());
+        uint64_t key = HashUtils::fnv1a(copy->orig);
+        std::lock_guard<std::mutex> lock(mu_);
+        insert(key, std::move(copy));
+    }
+
+    void record_hit(uint64_t ns) {
+        hits_++;
+        hit_ns_ += ns;
+    }
+
+    void record_miss(uint64_t ns) {
+        misses_++;
+        miss_ns_ += ns;
+    }
+
+    uint64_t hits() const {
+        return hits_;
+    }
+
+    uint64_t misses() const {
+        return misses_;
+    }
+
+    /** Parse time the hits avoided, in ns: what the hits would have cost at the average miss cost, minus their cost */
+    uint64_t saved_ns() const {
+        uint64_t hits = hits_, misses = misses_, hit_ns = hit_ns_, miss_ns = miss_ns_;
+        if (misses == 0) {
+            return 0;
+        }
+        double saved = (double) hits * ((double) miss_ns / (double) misses) - (double) hit_ns;
+        return saved > 0 ? (uint64_t) saved : 0;
+    }
+
+    /** Prints one line of statistics, in the style of the fuzzer core's final stats */
+    void print_stats(std::ostream &os, const std::string &name) const {
+        uint64_t hits = hits_, total = hits_ + misses_;
+        os << "stat::response_memo:           " << name << " hits=" << hits << " misses=" << misses_
+           << " hit_pct=" << std::fixed << std::setprecision(1) << (total ? 100.0 * hits / total : 0.0)
+           << " saved_ms=" << saved_ns() / 1000000 << std::endl;
+    }
+
+private:
+    typedef std::unordered_map<uint64_t, std::unique_ptr<HashComp>> Generation;
+
+    size_t entries_;
+    std::mutex mu_;
+    Generation cur_;
+    Generation prev_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> hit_ns_{0};
+    std::atomic<uint64_t> miss_ns_{0};
+
+    /** Adds an entry to the current generation, rotating generations first if it is full. mu_ must be held */
+    void insert(uint64_t key, std::unique_ptr<HashComp> hc) {
+        if (cur_.size() >= entries_) {
+            prev_ = std::move(cur_);
+            cur_.clear();
+        }
+        cur_[key] = std::move(hc);
+    }
+};
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef NEZHA_RESULT_MATRIX_H
+#define NEZHA_RESULT_MATRIX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "hash_utils.h"
+#include "hashcomp.h"
+
+#define MATRIX_MAX_PROXIES 64  // proxies are tracked in 64-bit masks
+
+// layout of the masks returned by LLVMFuzzerNezhaDisagreement
+#define DISAGREE_PROXIES 0    // proxies that disagree on a compared column. nonzero if the exec is a difference
+#define DISAGREE_FIELDS 1     // ResultMatrix::differing_columns()
+#define DISAGREE_SIGNATURE 2  // ResultMatrix::signature()
+#define DISAGREE_COLS 3       // followed by ResultMatrix::disagreement() of every key column
+
+/**
+ * The results of one exec as a proxies x fields matrix of 64-bit values, stored column by column.
+ *
+ * Key columns hold a fingerprint of each compared value (the strings operator== looks at, the status and the error
+ * flags). A column whose keys are not all equal is a field the proxies disagree on, and disagreement(col) tells which
+ * proxies are outside the largest group that agrees on it, so callers can tell a lone outlier from an even split
+ * without looking at the HashComps again.
+ *
+ * Hash columns hold the hashes that get normalized, with a presence mask per column of the proxies whose value takes
+ * part. normalize() scales each present value by the number of present values and subtracts their sum. Its loops run
+ * over one contiguous column and are branch free, so the compiler vectorizes them.
+ *
+ * Values are loaded from HashComps with load() and written back with store(), since hash_full() and the result store
+ * still work on HashComps.
+ */
+class ResultMatrix {
+public:
+    /** Key columns. The two columns of HASHCOMP_FIELDS[f] are KEY_FIELDS + 2 * f (first value) and the next (rest) */
+    enum KeyCol : size_t {
+        KEY_NORESP, KEY_STATUS, KEY_REQLINE, KEY_FIELDS, KEY_BODY = KEY_FIELDS + 2 * HASHCOMP_NFIELDS, KEY_CHNK, KEY_COLS
+    };
+
+    /** Hash columns. The two columns of HASHCOMP_FIELDS[f] are HASH_FIELDS + 2 * f (first value) and the next (rest) */
+    enum HashCol : size_t {
+        HASH_METHOD, HASH_FIELDS, HASH_BODY = HASH_FIELDS + 2 * HASHCOMP_NFIELDS, HASH_COLS
+    };
+
+    /** Name of a key column, as used in logs. The rest of a header's values are named "<header>+" */
+    static std::string key_name(size_t col) {
+        switch (col) {
+            case KEY_NORESP:
+                return "noresp";
+            case KEY_STATUS:
+                return "status";
+            case KEY_REQLINE:
+                return "reqline";
+            case KEY_BODY:
+                return "body";
+            case KEY_CHNK:
+                return "chunk_err";
+            default:
+                return std::string(HASHCOMP_FIELDS[(col - KEY_FIELDS) / 2].name) + ((col - KEY_FIELDS) % 2 ? "+" : "");
+        }
+    }
+
+    /** Whether operator== on HashComps looks at a key column. Only these columns make an exec a difference */
+    static bool key_compared(size_t col) {
+        if (col < KEY_FIELDS || col >= KEY_BODY) {
+            return true;
+        }
+        const HeaderField &f = HASHCOMP_FIELDS[(col - KEY_FIELDS) / 2];
+        return (f.policy & ((col - KEY_FIELDS) % 2 ? FIELD_CMP_REM : FIELD_CMP_VALUE)) != 0;
+    }
+
+    /** Fills the matrix from the results of n proxies. n must not exceed MATRIX_MAX_PROXIES */
+    void load(HashComp *const *hashes, int n) {
+        n_ = n;
+        keys_.assign(KEY_COLS * n, 0);
+        hashes_.assign(HASH_COLS * n, 0);
+        for (size_t c = 0; c < HASH_COLS; ++c) {
+            present_[c] = 0;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            const HashComp *hc = hashes[i];
+            uint64_t bit = 1ULL << i;
+            key_col(KEY_NORESP)[i] = hc->noresp_err;
+            key_col(KEY_STATUS)[i] = HashUtils::fnv1a(hc->status);
+            key_col(KEY_REQLINE)[i] = str_key(hc->reqline_str);
+            key_col(KEY_BODY)[i] = str_key(hc->body_str);
+            key_col(KEY_CHNK)[i] = (uint64_t) hc->chnk_err;
+
+            hash_col(HASH_METHOD)[i] = hc->method_hash;
+            present_[HASH_METHOD] |= hc->reqline_str != nullptr ? bit : 0;
+            hash_col(HASH_BODY)[i] = hc->body_hash;
+            present_[HASH_BODY] |= hc->body_str != nullptr && !hc->body_str->empty() ? bit : 0;
+
+            for (size_t f = 0; f < HASHCOMP_NFIELDS; ++f) {
+                const HeaderField &field = HASHCOMP_FIELDS[f];
+                const std::string *val = hc->*field.str;
+                key_col(KEY_FIELDS + 2 * f)[i] = str_key(val);
+                key_col(KEY_FIELDS + 2 * f + 1)[i] = vec_key(hc->*field.rem);
+
+                hash_col(HASH_FIELDS + 2 * f)[i] = hc->*field.hash;
+                hash_col(HASH_FIELDS + 2 * f + 1)[i] = hc->*field.rem_hash;
+                if ((field.policy & FIELD_NORM_VALUE) && val != nullptr && *val != " 0") {
+                    present_[HASH_FIELDS + 2 * f] |= bit;
+                }
+                if ((field.policy & FIELD_NORM_REM) && !(hc->*field.rem).empty()) {
+                    present_[HASH_FIELDS + 2 * f + 1] |= bit;
+                }
+            }
+        }
+        find_disagreement();
+    }
+
+    /** Normalizes every hash column over the proxies present in it */
+    void normalize() {
+        for (size_t c = 0; c < HASH_COLS; ++c) {
+            uint64_t *v = hash_col(c);
+            uint64_t mask = present_[c];
+            uint64_t k = (uint64_t) __builtin_popcountll(mask);
+            uint64_t sum = 0;
+            for (int i = 0; i < n_; ++i) {
+                sum += v[i] & (0 - ((mask >> i) & 1));
+            }
+            for (int i = 0; i < n_; ++i) {
+                uint64_t sel = 0 - ((mask >> i) & 1);
+                v[i] = ((v[i] * k - sum) & sel) | (v[i] & ~sel);
+            }
+        }
+    }
+
+    /** Writes the hash columns back into the HashComps they were loaded from */
+    void store(HashComp **hashes) const {
+        for (int i = 0; i < n_; ++i) {
+            HashComp *hc = hashes[i];
+            hc->method_hash = hash(HASH_METHOD)[i];
+            hc->body_hash = hash(HASH_BODY)[i];
+            for (size_t f = 0; f < HASHCOMP_NFIELDS; ++f) {
+                hc->*HASHCOMP_FIELDS[f].hash = hash(HASH_FIELDS + 2 * f)[i];
+                hc->*HASHCOMP_FIELDS[f].rem_hash = hash(HASH_FIELDS + 2 * f + 1)[i];
+            }
+        }
+    }
+
+    int proxies() const {
+        return n_;
+    }
+
+    /** Proxies outside the largest group that agrees on a key column. 0 if they all agree */
+    uint64_t disagreement(size_t col) const {
+        return disagree_[col];
+    }
+
+    /** Proxies that disagree on at least one compared column */
+    uint64_t disagreeing_proxies() const {
+        return any_;
+    }
+
+    /** Bit c is set if the proxies disagree on key column c and operator== looks at it */
+    uint64_t differing_columns() const {
+        return cols_;
+    }
+
+    /**
+     * Disagreement signature: a hash of the compared key columns the proxies disagree on and of how the proxies split
+     * into groups on each. It only depends on which proxies share a value, not on the values, so two execs where the
+     * same proxies fall out the same way have the same signature however different their requests are. Splits on
+     * columns that are not compared leave it alone. 0 if there is no difference, i.e. if has_diff() is false
+     */
+    uint64_t signature() const {
+        return sig_;
+    }
+
+    /** Whether the results differ, i.e. whether some pair of HashComps is not operator== */
+    bool has_diff() const {
+        return any_ != 0;
+    }
+
+    /**
+     * Recomputes which proxies disagree, leaving out every key column where only proxies in unstable[col] disagree, as
+     * if they all agreed there. The keys are kept, so ignore(nullptr) brings the left out columns back
+     */
+    void ignore(const uint64_t *unstable) {
+        find_disagreement(unstable);
+    }
+
+    /** Key columns the proxies disagree on that the last ignore() left out */
+    uint64_t ignored_columns() const {
+        return ignored_;
+    }
+
+    /** Which proxies are present in a hash column */
+    uint64_t presence(size_t col) const {
+        return present_[col];
+    }
+
+    const uint64_t *key(size_t col) const {
+        return keys_.data() + col * n_;
+    }
+
+    const uint64_t *hash(size_t col) const {
+        return hashes_.data() + col * n_;
+    }
+
+private:
+    int n_ = 0;
+    std::vector<uint64_t> keys_;    // KEY_COLS columns of n_ values
+    std::vector<uint64_t> hashes_;  // HASH_COLS columns of n_ values
+    uint64_t present_[HASH_COLS] = {};
+    uint64_t disagree_[KEY_COLS] = {};
+    uint64_t any_ = 0;
+    uint64_t cols_ = 0;
+    uint64_t ignored_ = 0;
+    uint64_t sig_ = 0;
+
+    static_assert(KEY_COLS <= 64, "differing_columns() holds one bit per key column");
+
+    uint64_t *key_col(size_t col) {
+        return keys_.data() + col * n_;
+    }
+
+    uint64_t *hash_col(size_t col) {
+        return hashes_.data() + col * n_;
+    }
+
+    /** Missing values get a key of their own, so that they differ from empty ones */
+    static uint64_t str_key(const std::string *s) {
+        return s != nullptr ? HashUtils::fnv1a(*s) : 0;
+    }
+
+    static uint64_t vec_key(const std::vector<std::string> &vec) {
+        uint64_t h = vec.size();
+        for (const auto &s : vec) {
+            h = (h ^ HashUtils::fnv1a(s)) * 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    static uint64_t mix(uint64_t h, uint64_t v) {
+        return (h ^ v) * 0x100000001b3ULL;
+    }
+
+    /**
+     * Groups the proxies of every key column by value. Groups are found in order of their lowest proxy. Columns where
+     * only proxies in unstable[col] are outside the largest group count as agreeing
+     */
+    void find_disagreement(const uint64_t *unstable = nullptr) {
+        any_ = cols_ = ignored_ = 0;
+        uint64_t sig = 0xcbf29ce484222325ULL;
+        for (size_t c = 0; c < KEY_COLS; ++c) {
+            const uint64_t *v = key(c);
+            uint64_t best = 0;
+            int best_n = 0;
+            uint64_t seen = 0;
+            uint64_t col_sig = mix(sig, c);
+            for (int i = 0; i < n_; ++i) {
+                if (seen & (1ULL << i)) {
+                    continue;
+                }
+                uint64_t group = 0;
+                for (int j = i; j < n_; ++j) {
+                    group |= (uint64_t) (v[j] == v[i]) << j;
+                }
+                seen |= group;
+                col_sig = mix(col_sig, group);
+                int size = __builtin_popcountll(group);
+                if (size > best_n) {  // ties go to the group of the lowest proxy
+                    best = group;
+                    best_n = size;
+                }
+            }
+            uint64_t all = n_ == 64 ? ~0ULL : (1ULL << n_) - 1;
+            disagree_[c] = all & ~best;
+            if (disagree_[c] != 0 && unstable != nullptr && (disagree_[c] & ~unstable[c]) == 0) {
+                ignored_ |= 1ULL << c;
+                disagree_[c] = 0;
+            }
+            if (disagree_[c] != 0 && key_compared(c)) {
+                sig = col_sig;
+                cols_ |= 1ULL << c;
+                any_ |= disagree_[c];
+            }
+        }
+        sig_ = any_ != 0 ? sig : 0;
+    }
+};
+
+#endif
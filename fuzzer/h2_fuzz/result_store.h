@@ -0,0 +1,271 @@
+#ifndef NEZHA_RESULT_STORE_H
+#define NEZHA_RESULT_STORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "hashcomp.h"
+#include "hash_utils.h"
+#include "proxy_registry.h"
+#include "../debug.h"
+
+#define RESULT_STORE_MAGIC "h2rs2"
+
+/**
+ * File-backed store of normalized per-proxy execution results, keyed by unit hash.
+ *
+ * Each entry lives in its own file (<dir>/<unit hash>) so that every job of a campaign can share one directory.
+ * Entries are written to a temporary file and renamed into place, so readers never see a partial record.
+ *
+ * Every record is stamped with a fingerprint of the proxy configuration set that produced it. A record whose
+ * fingerprint does not match the current one is treated as a miss and overwritten on the next store.
+ */
+class ResultStore {
+public:
+    ResultStore(std::string dir, uint64_t fingerprint) : dir_(std::move(dir)), fingerprint_(fingerprint) {}
+
+    /**
+     * Loads the results stored for the given key into out, which receives one newly allocated HashComp per proxy.
+     * Returns false if there is no valid entry for the key.
+     */
+    bool load(const std::string &key, std::vector<HashComp*> &out) const {
+        std::ifstream in(path(key), std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return decode(ss.str(), fingerprint_, out);
+    }
+
+    /**
+     * Stores the given results under the given key, replacing any existing entry. Returns false on I/O errors.
+     */
+    bool store(const std::string &key, const std::vector<HashComp*> &results) const {
+        std::string fn = path(key);
+        static std::atomic<uint64_t> seq{0};  // the pid alone is shared by the threads of a job storing the same key
+        std::string tmp = fn + ".tmp." + std::to_string(getpid()) + "." + std::to_string(seq++);
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                return false;
+            }
+            out << encode(results, fingerprint_);
+            if (!out) {
+                std::remove(tmp.c_str());
+                return false;
+            }
+        }
+        if (std::rename(tmp.c_str(), fn.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t get_fingerprint() const { return fingerprint_; }
+
+    /**
+     * Serializes the given results into a single record stamped with the given fingerprint
+     */
+    static std::string encode(const std::vector<HashComp*> &results, uint64_t fingerprint) {
+        std::ostringstream os;
+        os << RESULT_STORE_MAGIC << ' ' << fingerprint << ' ' << results.size() << '\n';
+        for (const HashComp *hc : results) {
+            put_int(os, hc->noresp_err);
+            put_int(os, hc->timeout_err);
+            put_str(os, hc->status);
+            put_str(os, hc->orig);
+
+            put_opt(os, hc->reqline_str);
+            for (const auto &f : HASHCOMP_FIELDS) {
+                put_opt(os, hc->*f.str);
+                put_vec(os, hc->*f.rem);
+            }
+            put_opt(os, hc->body_str);
+
+            os << hc->version_hash << ' ' << hc->method_hash << ' ';
+            for (const auto &f : HASHCOMP_FIELDS) {
+                os << hc->*f.hash << ' ' << hc->*f.rem_hash << ' ';
+            }
+            os << hc->body_hash << ' ';
+            put_int(os, hc->chnk_err);
+            put_int(os, hc->extra_data);
+            os << '\n';
+        }
+        return os.str();
+    }
+
+    /**
+     * Parses a record produced by encode. Returns false (and leaves out empty) if the record is malformed or was
+     * produced under a different fingerprint.
+     */
+    static bool decode(const std::string &record, uint64_t fingerprint, std::vector<HashComp*> &out) {
+        out.clear();
+        std::istringstream is(record);
+
+        std::string magic;
+        uint64_t fp;
+        size_t n;
+        if (!(is >> magic >> fp >> n) || magic != RESULT_STORE_MAGIC) {
+            return false;
+        }
+        if (fp != fingerprint) {
+            DEBUG("result store -- stale entry with fingerprint " << fp)
+            return false;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            auto *hc = new HashComp();
+            out.push_back(hc);
+
+            long long noresp, timeout;
+            if (!get_int(is, noresp) || !get_int(is, timeout)) { return fail(out); }
+            hc->noresp_err = noresp != 0;
+            hc->timeout_err = timeout != 0;
+            if (!get_str(is, hc->status) || !get_str(is, hc->orig)) { return fail(out); }
+
+            if (!get_opt(is, hc->reqline_str)) { return fail(out); }
+            for (const auto &f : HASHCOMP_FIELDS) {
+                if (!get_opt(is, hc->*f.str) || !get_vec(is, hc->*f.rem)) { return fail(out); }
+            }
+            if (!get_opt(is, hc->body_str)) { return fail(out); }
+
+            if (!(is >> hc->version_hash >> hc->method_hash)) { return fail(out); }
+            for (const auto &f : HASHCOMP_FIELDS) {
+                if (!(is >> hc->*f.hash >> hc->*f.rem_hash)) { return fail(out); }
+            }
+            if (!(is >> hc->body_hash)) { return fail(out); }
+
+            long long chnk_err, extra_data;
+            if (!get_int(is, chnk_err) || !get_int(is, extra_data)) { return fail(out); }
+            hc->chnk_err = (int) chnk_err;
+            hc->extra_data = (int) extra_data;
+        }
+        return true;
+    }
+
+    /**
+     * Computes a fingerprint of the given proxy set and their filter configurations.
+     *
+     * Any change to the order of the proxies, their forwarded host/authority values, or their ignored headers changes
+     * the fingerprint and thereby invalidates all previously stored results. Addresses, ports and deadlines are not
+     * included since they do not change what a proxy forwards. The tracked headers are included too, since records
+     * hold one entry per field of HASHCOMP_FIELDS.
+     */
+    static uint64_t fingerprint(const ProxyRegistry &proxies) {
+        std::string desc;
+        for (const auto &f : HASHCOMP_FIELDS) {
+            desc += std::string(f.name) + ",";
+        }
+        desc += ";" + std::to_string(proxies.size()) + ";";
+        for (const auto &p : proxies) {
+            const ProxyConfig &cfg = p.filter;
+            desc += p.name + ";" + cfg.host + ";" + cfg.authority + ";";
+            for (const auto &h : cfg.headers) {  // std::set, so iteration order is stable
+                desc += h + ",";
+            }
+            desc += ";";
+        }
+        return HashUtils::fnv1a(desc);
+    }
+
+private:
+    std::string dir_;
+    uint64_t fingerprint_;
+
+    std::string path(const std::string &key) const {
+        return dir_ + "/" + key;
+    }
+
+    static bool fail(std::vector<HashComp*> &out) {
+        for (auto *hc : out) {
+            delete hc;
+        }
+        out.clear();
+        return false;
+    }
+
+    static void put_int(std::ostream &os, long long v) {
+        os << v << ' ';
+    }
+
+    /** Strings are length-prefixed since they may contain arbitrary bytes (e.g., CRLFs in forwarded requests) */
+    static void put_str(std::ostream &os, const std::string &s) {
+        os << s.length() << ' ' << s;
+    }
+
+    /** Null strings are written with a length of -1 so they are distinguishable from empty ones */
+    static void put_opt(std::ostream &os, const std::string *s) {
+        if (s == nullptr) {
+            os << "-1 ";
+        } else {
+            put_str(os, *s);
+        }
+    }
+
+    static void put_vec(std::ostream &os, const std::vector<std::string> &v) {
+        os << v.size() << ' ';
+        for (const auto &s : v) {
+            put_str(os, s);
+        }
+    }
+
+    static bool get_int(std::istream &is, long long &v) {
+        return (bool) (is >> v);
+    }
+
+    /** Bytes left to read in is, which bounds the lengths a valid record can hold from there on */
+    static size_t remaining(std::istream &is) {
+        std::streampos pos = is.tellg();
+        is.seekg(0, std::ios::end);
+        std::streampos end = is.tellg();
+        is.seekg(pos);
+        return pos < 0 || end < pos ? 0 : (size_t) (end - pos);
+    }
+
+    /** Lengths beyond the rest of the record come from a corrupt file and fail the load rather than being allocated */
+    static bool get_str(std::istream &is, std::string &s) {
+        long long len;
+        if (!(is >> len) || len < 0 || is.get() != ' ' || (unsigned long long) len > remaining(is)) {
+            return false;
+        }
+        s.resize((size_t) len);
+        return len == 0 || (bool) is.read(&s[0], len);
+    }
+
+    static bool get_opt(std::istream &is, std::string *&s) {
+        std::streampos pos = is.tellg();
+        long long len;
+        if (!(is >> len)) {
+            return false;
+        }
+        if (len == -1) {
+            return is.get() == ' ';
+        }
+        is.seekg(pos);
+        s = new std::string();
+        return get_str(is, *s);
+    }
+
+    static bool get_vec(std::istream &is, std::vector<std::string> &v) {
+        size_t n;
+        if (!(is >> n) || n > remaining(is) / 2) {  // every string takes at least "0 "
+            return false;
+        }
+        v.resize(n);
+        for (auto &s : v) {
+            if (!get_str(is, s)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
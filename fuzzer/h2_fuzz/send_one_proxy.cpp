@@ -11,21 +11,19 @@
 #include <iostream>
 
 #include "callbacks.h"
+#include "proxy_registry.h"
 #include "../h2_serializer/src/frames/frames.h"
 #include "../h2_serializer/src/deserializer.h"
 
-void callback_helper(const char *prox, const char *addr, int port, const uint8_t *Data, size_t Size, HashComp **hc) {
-    DEBUG("----- Working on " << prox << " -----")
-    ProxyConfig *filt = ProxyConfig::get_proxy_config(prox);
-    HashComp *out = callback(addr, port, *filt, Data, Size);
+void callback_helper(const ProxyEntry *prox, const uint8_t *Data, size_t Size, HashComp **hc) {
+    const ProxyReplica &r = prox->replicas[0];
+    DEBUG("----- Working on " << prox->name << " at " << r.to_string() << " -----")
+    HashComp *out = callback(r.addr.c_str(), r.port, prox->filter, Data, Size, prox->deadline_ms);
     *hc = out;
 }
 
-#define LAUNCH(tname, fname, addr, idx) std::thread tname(callback_helper, fname, addr, 9090, Data, Size, ret_vals + idx);
-#define CLEAN(tname) tname.join();
-
 int main(int argc, char **argv) {
-    HashComp *ret_vals[11];
+    HashComp *ret_vals[1];
     for (auto & ret_val : ret_vals) {
         ret_val = nullptr;
     }
@@ -40,22 +38,16 @@ int main(int argc, char **argv) {
     char *pname = argv[1];
     char *fn = argv[2];
 
-    std::map<std::string, std::string> ips = {
-            {"nginx",         "172.17.0.3"},
-            {"caddy",         "172.17.0.4"},
-            {"apache",        "172.17.0.5"},
-            {"envoy",         "172.17.0.6"},
-            {"haproxy",       "172.17.0.7"},
-            {"traefik",       "172.17.0.8"},
-            {"varnish",       "172.17.0.9"},
-            {"h2o",           "172.17.0.10"},
-            {"ats",           "172.17.0.11"},
-            {"nghttp2",       "172.17.0.12"},
-            {"openlitespeed", "172.17.0.13"},
-    };
+    ProxyRegistry proxies;
+    std::string reg_fn = ProxyRegistry::default_path();
+    int ret = proxies.load(reg_fn);
+    if (ret != 0) {
+        std::cout << "Error " << ret << " loading proxy registry " << reg_fn << std::endl;
+        return 1;
+    }
 
-    auto it = ips.find(pname);
-    if (it == ips.end()) {
+    const ProxyEntry *prox = proxies.find(pname);
+    if (prox == nullptr) {
         std::cout << "Invalid proxy" << std::endl;
         return 1;
     }
@@ -68,8 +60,7 @@ int main(int argc, char **argv) {
     }
     delete strm;
 
-    LAUNCH(t_name, argv[1], it->second.c_str(), 0)
-    CLEAN(t_name)
+    callback_helper(prox, Data, Size, &ret_vals[0]);
 
     for (auto hc: ret_vals) {
         if (hc != nullptr) {
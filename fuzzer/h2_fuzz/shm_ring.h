@@ -0,0 +1,125 @@
+#ifndef NEZHA_SHM_RING_H
+#define NEZHA_SHM_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "ring indices must be lock-free to be shared between processes");
+
+#define RING_ALIGN 8
+#define RING_WRAP 0xffffffffu  // record length marking that the producer skipped to the start of the buffer
+
+/**
+ * Producer and consumer positions of an SpscRing. Lives in shared memory next to the ring's buffer; each index sits on
+ * its own cache line so the two sides do not invalidate each other's line on every message.
+ */
+struct SpscRingHeader {
+    alignas(64) std::atomic<uint64_t> head;  // total bytes published by the producer
+    alignas(64) std::atomic<uint64_t> tail;  // total bytes released by the consumer
+
+    void reset() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Lock-free single-producer single-consumer queue of variable-sized messages over a byte buffer, usable between
+ * processes when the header and buffer are in shared memory.
+ *
+ * Each message is stored as a 4-byte length followed by its bytes, padded to RING_ALIGN, and is never split: if it
+ * does not fit before the end of the buffer, the producer writes a RING_WRAP marker and starts over at offset 0.
+ * A message must therefore be at most half the capacity to be guaranteed to fit.
+ *
+ * The producer publishes a message with a release store of head after writing it, and the consumer frees the space
+ * with a release store of tail after reading it, so neither side ever sees a partially written message.
+ */
+class SpscRing {
+public:
+    SpscRing() = default;
+
+    /** cap must be a power of two and a multiple of RING_ALIGN */
+    SpscRing(SpscRingHeader *hdr, uint8_t *buf, uint64_t cap) : hdr_(hdr), buf_(buf), cap_(cap) {}
+
+    /** Largest message that always fits in an empty ring */
+    uint64_t max_message() const {
+        return cap_ / 2 - sizeof(uint32_t) - RING_ALIGN;
+    }
+
+    /** Appends a message made of the two given parts. Returns false if there is not enough free space right now */
+    bool try_push(const void *a, uint32_t alen, const void *b = nullptr, uint32_t blen = 0) {
+        uint64_t len = (uint64_t) alen + blen;
+        if (len > max_message()) {
+            return false;
+        }
+        uint64_t rec = pad(sizeof(uint32_t) + len);
+        uint64_t head = hdr_->head.load(std::memory_order_relaxed);
+        uint64_t tail = hdr_->tail.load(std::memory_order_acquire);
+
+        uint64_t off = head & (cap_ - 1);
+        uint64_t skip = off + rec > cap_ ? cap_ - off : 0;  // room left at the end is too small for the record
+        if (head + skip + rec - tail > cap_) {
+            return false;
+        }
+        if (skip) {
+            put_len(off, RING_WRAP);
+            head += skip;
+            off = 0;
+        }
+
+        put_len(off, (uint32_t) len);
+        memcpy(buf_ + off + sizeof(uint32_t), a, alen);
+        if (blen) {
+            memcpy(buf_ + off + sizeof(uint32_t) + alen, b, blen);
+        }
+        hdr_->head.store(head + rec, std::memory_order_release);
+        return true;
+    }
+
+    /** Removes the oldest message and copies it into out. Returns false if the ring is empty */
+    bool try_pop(std::vector<uint8_t> &out) {
+        uint64_t tail = hdr_->tail.load(std::memory_order_relaxed);
+        uint64_t head = hdr_->head.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+
+        uint64_t off = tail & (cap_ - 1);
+        uint32_t len = get_len(off);
+        if (len == RING_WRAP) {
+            tail += cap_ - off;
+            off = 0;
+            len = get_len(off);
+        }
+        out.assign(buf_ + off + sizeof(uint32_t), buf_ + off + sizeof(uint32_t) + len);
+        hdr_->tail.store(tail + pad(sizeof(uint32_t) + len), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return hdr_->head.load(std::memory_order_acquire) == hdr_->tail.load(std::memory_order_acquire);
+    }
+
+private:
+    SpscRingHeader *hdr_ = nullptr;
+    uint8_t *buf_ = nullptr;
+    uint64_t cap_ = 0;
+
+    static uint64_t pad(uint64_t n) {
+        return (n + RING_ALIGN - 1) & ~(uint64_t) (RING_ALIGN - 1);
+    }
+
+    void put_len(uint64_t off, uint32_t len) {
+        memcpy(buf_ + off, &len, sizeof(len));
+    }
+
+    uint32_t get_len(uint64_t off) const {
+        uint32_t len;
+        memcpy(&len, buf_ + off, sizeof(len));
+        return len;
+    }
+};
+
+#endif
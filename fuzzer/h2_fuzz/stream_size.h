@@ -0,0 +1,281 @@
+#ifndef NEZHA_STREAM_SIZE_H
+#define NEZHA_STREAM_SIZE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hpack_table.h"  // for the static table, whose header cannot be included twice
+
+// size of a frame that serialize() cannot encode, e.g., because a header is indexed but not in the table
+#define UNENCODABLE ((uint64_t) UINT32_MAX)
+#define HPACK_TABLE_LIMIT 4096  // size of the dynamic table of HPackTable, see limitSize_
+
+/**
+ * Exact size of an H2Stream once serialized, computed without serializing it.
+ *
+ * Every frame is sized the way its serialize() lays it out. Header blocks are sized against a model of the HPACK
+ * encoder of H2Stream::serialize(), so the table size update that opens the first header block, indices that take more
+ * bytes once the dynamic table grows, and evictions are all accounted for. Frames are dispatched on their class, not on
+ * their (mutable) type field, just like serialize() is.
+ *
+ * Like HpackTable, sized frames are kept until they no longer match the stream or are invalidated, so a change to the
+ * stream only costs re-sizing the frames from the change on. The dynamic table only grows at the front and shrinks at
+ * the back, so all of its entries are kept in one vector in insertion order, and the encoder state before a frame is
+ * just which of them are in the table.
+ */
+class StreamSize {
+public:
+    /** Returns the exact number of bytes strm serializes to, or at least UNENCODABLE if it cannot be serialized */
+    uint64_t total(const H2Stream &strm) {
+        // drop sized frames from the first one that is no longer where it was
+        size_t same = 0;
+        while (same < frames_.size() && same < strm.size() && frames_[same] == strm[same]) {
+            ++same;
+        }
+        invalidate(same);
+
+        while (frames_.size() < strm.size()) {
+            simulate(strm[frames_.size()]);
+        }
+
+        uint64_t out = 0;
+        for (uint64_t sz : sizes_) {
+            out += sz;
+        }
+        return out;
+    }
+
+    /** Forgets the frames from index frame_idx on, e.g., because they were mutated in place */
+    void invalidate(size_t frame_idx) {
+        if (frame_idx >= frames_.size()) {
+            return;
+        }
+        enc_ = before_[frame_idx];
+        entries_.resize(enc_.end);
+        frames_.resize(frame_idx);
+        sizes_.resize(frame_idx);
+        before_.resize(frame_idx);
+    }
+
+    void clear() {
+        invalidate(0);
+    }
+
+    /** Number of frames currently sized */
+    size_t simulated() const {
+        return frames_.size();
+    }
+
+    /** Returns the number of bytes needed to encode integer I with an N-bit prefix (RFC 7541, 5.1) */
+    static size_t int_size(uint64_t I, uint8_t N) {
+        uint64_t NF = (1u << N) - 1;
+        if (I < NF) {
+            return 1;
+        }
+        size_t out = 2;
+        for (I -= NF; I >= 128; I /= 128) {
+            ++out;
+        }
+        return out;
+    }
+
+private:
+    typedef hpack::HPacker::KeyValuePair KeyValuePair;
+
+    /** State of the encoder between two frames. The dynamic table holds entries_[first, end) */
+    struct Encoder {
+        size_t first = 0;
+        size_t end = 0;
+        size_t table_sz = 0;
+        bool size_update = true;  // the next non-empty header block starts with a dynamic table size update
+    };
+
+    std::vector<Frame *> frames_;        // sized frames, which are a prefix of the stream
+    std::vector<uint64_t> sizes_;        // serialized size of each sized frame
+    std::vector<Encoder> before_;        // encoder state before each sized frame
+    Encoder enc_;                        // encoder state after the sized frames
+    std::vector<KeyValuePair> entries_;  // every entry inserted into the dynamic table, oldest first
+
+    void simulate(Frame *f) {
+        before_.push_back(enc_);
+        frames_.push_back(f);
+
+        auto *h = dynamic_cast<Headers *>(f);
+        uint64_t blk = h != nullptr && !h->hdr_pairs.empty() ? block_size(*h) : 0;
+        sizes_.push_back(blk == UNENCODABLE ? UNENCODABLE : HDRSZ + payload_size(f, blk));
+    }
+
+    /** Size of the payload of f, given the size of its header block, if any */
+    static uint64_t payload_size(Frame *f, uint64_t blk) {
+        if (auto *df = dynamic_cast<DataFrame *>(f)) {
+            return padding_size(df, f->flags) + df->data.size();
+        }
+        if (auto *hf = dynamic_cast<HeadersFrame *>(f)) {
+            return padding_size(hf, f->flags) + (f->flags & FLAG_PRIORITY ? 5 : 0) + blk;
+        }
+        if (auto *pp = dynamic_cast<PushPromiseFrame *>(f)) {
+            return padding_size(pp, f->flags) + 4 + blk;
+        }
+        if (dynamic_cast<Continuation *>(f) != nullptr) {
+            return blk;
+        }
+        if (auto *sf = dynamic_cast<SettingsFrame *>(f)) {
+            return 6 * sf->settings.size();
+        }
+        if (auto *ga = dynamic_cast<GoAway *>(f)) {
+            return 8 + ga->debug_data.size();
+        }
+        if (dynamic_cast<PriorityFrame *>(f) != nullptr) {
+            return 5;
+        }
+        if (dynamic_cast<PingFrame *>(f) != nullptr) {
+            return 8;
+        }
+        return 4;  // RST_STREAM and WINDOW_UPDATE
+    }
+
+    /** Pad length field and padding, which serialize() writes only if the PADDED flag is set */
+    static uint64_t padding_size(Padded *p, uint8_t flags) {
+        return flags & FLAG_PADDED ? 1 + p->padlen : 0;
+    }
+
+    /**
+     * Size of the header block of h, mirroring HPacker::encode() and HPacker::encodeHeader(). Advances enc_ to the
+     * state after the block. Returns UNENCODABLE where encode() fails, including blocks that do not fit into the buffer
+     * Headers serializes them into
+     */
+    uint64_t block_size(const Headers &h) {
+        typedef hpack::HPacker::PrefixType PrefType;
+        typedef hpack::HPacker::IndexingType IdxType;
+        if (h.prefixes.size() != h.hdr_pairs.size() || h.idx_types.size() != h.hdr_pairs.size()) {
+            return UNENCODABLE;
+        }
+
+        uint64_t out = 0;
+        if (enc_.size_update) {
+            enc_.size_update = false;
+            out += int_size(HPACK_TABLE_LIMIT, 5);
+        }
+        for (size_t i = 0; i < h.hdr_pairs.size(); ++i) {
+            const KeyValuePair &hdr = h.hdr_pairs[i];
+            PrefType pref = h.prefixes[i];
+            IdxType idx_type = h.idx_types[i];
+
+            bool value_indexed = false;
+            int index = get_index(hdr, value_indexed);
+            if ((pref == PrefType::INDEXED_HEADER) != (idx_type == IdxType::ALL) ||
+                (pref == PrefType::INDEXED_HEADER && (index == -1 || !value_indexed)) ||
+                (idx_type != IdxType::NONE && index == -1)) {
+                return UNENCODABLE;
+            }
+
+            uint8_t n_bits;
+            switch (pref) {
+                case PrefType::INDEXED_HEADER:
+                    n_bits = 7;
+                    break;
+                case PrefType::LITERAL_HEADER_WITH_INDEXING:
+                    n_bits = 6;
+                    break;
+                case PrefType::LITERAL_HEADER_WITHOUT_INDEXING:
+                case PrefType::LITERAL_HEADER_NEVER_INDEXED:
+                    n_bits = 4;
+                    break;
+                default:
+                    return UNENCODABLE;
+            }
+
+            if (idx_type == IdxType::NONE) {
+                out += 1 + int_size(hdr.first.size(), 7) + hdr.first.size();
+            } else {
+                out += int_size(index, n_bits);
+            }
+            if (idx_type != IdxType::ALL) {
+                out += int_size(hdr.second.size(), 7) + hdr.second.size();
+            }
+            if (pref == PrefType::LITERAL_HEADER_WITH_INDEXING) {
+                add_header(hdr);
+            }
+        }
+        return out <= 4096 ? out : UNENCODABLE;  // see Headers::do_srlz
+    }
+
+    /**
+     * Index HPackTable::getIndex() returns for hdr: its most recent copy in the dynamic table, else its entry in the
+     * static table, else the same for its name alone. -1 if the name is in neither table
+     */
+    int get_index(const KeyValuePair &hdr, bool &value_indexed) const {
+        value_indexed = true;
+        for (size_t i = enc_.end; i > enc_.first; --i) {
+            if (entries_[i - 1] == hdr) {
+                return (int) (HPACK_DYNAMIC_START_INDEX + enc_.end - i);
+            }
+        }
+        auto s = static_index().find(hdr);
+        if (s != static_index().end()) {
+            return s->second;
+        }
+
+        value_indexed = false;
+        for (size_t i = enc_.end; i > enc_.first; --i) {
+            if (entries_[i - 1].first == hdr.first) {
+                return (int) (HPACK_DYNAMIC_START_INDEX + enc_.end - i);
+            }
+        }
+        auto n = static_name_index().find(hdr.first);
+        if (n != static_name_index().end()) {
+            value_indexed = hpack::hpackStaticTable[n->second - 1].second == hdr.second;
+            return n->second;
+        }
+        return -1;
+    }
+
+    /** HPackTable::addHeader(), which evicts from the back until the new entry fits, if it fits at all */
+    void add_header(const KeyValuePair &hdr) {
+        size_t sz = hdr.first.size() + hdr.second.size() + TABLE_ENTRY_SIZE_EXTRA;
+        while (enc_.table_sz + sz > HPACK_TABLE_LIMIT && enc_.first < enc_.end) {
+            const KeyValuePair &old = entries_[enc_.first++];
+            enc_.table_sz -= old.first.size() + old.second.size() + TABLE_ENTRY_SIZE_EXTRA;
+        }
+        if (sz > HPACK_TABLE_LIMIT) {
+            return;
+        }
+        entries_.resize(enc_.end);
+        entries_.push_back(hdr);
+        ++enc_.end;
+        enc_.table_sz += sz;
+    }
+
+    struct PairHash {
+        size_t operator()(const KeyValuePair &nv) const {
+            std::hash<std::string> h;
+            return h(nv.first) * 31 + h(nv.second);
+        }
+    };
+
+    /** 1-based index of every pair and the first index of every name of the static table */
+    static const std::unordered_map<KeyValuePair, int, PairHash> &static_index() {
+        static const std::unordered_map<KeyValuePair, int, PairHash> m = [] {
+            std::unordered_map<KeyValuePair, int, PairHash> out;
+            for (int i = 0; i < HPACK_STATIC_TABLE_SIZE; ++i) {
+                out.emplace(hpack::hpackStaticTable[i], i + 1);
+            }
+            return out;
+        }();
+        return m;
+    }
+
+    static const std::unordered_map<std::string, int> &static_name_index() {
+        static const std::unordered_map<std::string, int> m = [] {
+            std::unordered_map<std::string, int> out;
+            for (int i = 0; i < HPACK_STATIC_TABLE_SIZE; ++i) {
+                out.emplace(hpack::hpackStaticTable[i].first, i + 1);
+            }
+            return out;
+        }();
+        return m;
+    }
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef NEZHA_FAKE_PROXY_H
+#define NEZHA_FAKE_PROXY_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../../h2_serializer/src/frames/frames.h"
+
+/**
+ * Stand-in for a proxy under test: listens on an ephemeral port of 127.0.0.1 and answers every connection with a fixed
+ * response after reading the request, optionally after a delay. A silent proxy never answers or closes on its own.
+ */
+class FakeProxy {
+public:
+    explicit FakeProxy(std::string response, int delay_ms = 0, bool silent = false)
+            : response_(std::move(response)), delay_ms_(delay_ms), silent_(silent) {
+        lfd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(lfd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(lfd_, (struct sockaddr *) &addr, sizeof(addr));
+        listen(lfd_, 1024);
+        socklen_t len = sizeof(addr);
+        getsockname(lfd_, (struct sockaddr *) &addr, &len);
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread(&FakeProxy::serve, this);
+    }
+
+    virtual ~FakeProxy() {
+        stop_ = true;
+        thread_.join();
+        while (live_ > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ::close(lfd_);
+    }
+
+    int port() const {
+        return port_;
+    }
+
+    uint64_t accepted() const {
+        return accepted_;
+    }
+
+    /** HEADERS with status 200, then DATA carrying the given HTTP/1 request, as if the proxy had echoed it back */
+    static std::string echo_response(const std::string &h1) {
+        char buf[8192];
+        hpack::HPacker hpe;
+        HeadersFrame hf;
+        hf.flags = FLAG_END_HEADERS;
+        hf.stream_id = 1;
+        hf.add_header(":status", "200", hpack::HPacker::PrefixType::LITERAL_HEADER_WITHOUT_INDEXING,
+                      hpack::HPacker::IndexingType::NONE);
+        uint32_t sz = hf.serialize(buf, sizeof(buf), &hpe, false);
+        DataFrame df;
+        df.flags = FLAG_END_STREAM;
+        df.stream_id = 1;
+        df.data.assign(h1.begin(), h1.end());
+        sz += df.serialize(buf + sz, sizeof(buf) - sz, &hpe, false);
+        return std::string(buf, sz);
+    }
+
+private:
+    std::string response_;
+    int delay_ms_;
+    bool silent_;
+    int lfd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> stop_{false};
+    std::atomic<uint64_t> accepted_{0};
+    std::atomic<int> live_{0};  // connection handlers still running
+    std::thread thread_;
+
+    void serve() {
+        while (!stop_) {
+            struct pollfd p{lfd_, POLLIN, 0};
+            if (poll(&p, 1, 10) <= 0) {
+                continue;
+            }
+            int fd = accept(lfd_, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            accepted_++;
+            live_++;
+            std::thread(&FakeProxy::handle, this, fd).detach();
+        }
+    }
+
+    void handle(int fd) {
+        // wait for the request, so that pre-connected sockets stay idle until used, like a real proxy's
+        char buf[4096];
+        while (!stop_) {
+            struct pollfd p{fd, POLLIN, 0};
+            if (poll(&p, 1, 10) > 0) {
+                break;
+            }
+        }
+        if (!stop_ && ::recv(fd, buf, sizeof(buf), 0) > 0 && !silent_) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms_));
+            ::send(fd, response_.data(), response_.size(), MSG_NOSIGNAL);
+        }
+        while (silent_ && !stop_) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ::close(fd);
+        live_--;
+    }
+};
+
+#endif
@@ -402,4 +402,41 @@ TEST(HashComp, StrCmpHelper) {
     ASSERT_TRUE(Util::str_ptr_equals(&s1, &s1));
     ASSERT_FALSE(Util::str_ptr_equals(&s1, &s2));
     ASSERT_TRUE(Util::str_ptr_equals(&s1, &s3));
-}
\ No newline at end of file
+}
+
+TEST(HashComp, FieldIndex_FindsEveryField) {
+    for (const auto &f : HASHCOMP_FIELDS) {
+        bool exact = false;
+        ASSERT_EQ(FieldIndex::lookup(f.name, &exact), &f) << f.name;
+        ASSERT_TRUE(exact);
+
+        std::string padded = std::string(" ") + f.name + "\t";
+        ASSERT_EQ(FieldIndex::lookup(padded, &exact), &f) << padded;
+        ASSERT_FALSE(exact);
+    }
+}
+
+TEST(HashComp, FieldIndex_IgnoresOtherNames) {
+    bool exact = false;
+    for (const char *name : {"", " ", "hos", "hostt", "content-type", "x-host", "transfer-encodin", "expect2"}) {
+        ASSERT_EQ(FieldIndex::lookup(name, &exact), nullptr) << name;
+    }
+}
+
+TEST(HashComp, SchemaFieldsParsed) {
+    const char *req = "GET / HTTP/1.1\r\nConnection: close\r\nConnection : keep-alive\r\nExpect: 100-continue\r\n"
+                      "Expect: x\r\n\r\n";
+    ProxyConfig f;
+    HashComp hc;
+    hashcomp_common(req, &f, &hc);
+
+    ASSERT_STREQ(hc.conn_str->c_str(), " close");
+    ASSERT_EQ(hc.rem_conn_str, std::vector<std::string>({"connection : keep-alive"}));
+    ASSERT_STREQ(hc.expect_str->c_str(), " 100-continue");
+    ASSERT_EQ(hc.rem_expect_str, std::vector<std::string>({"expect: x"}));
+
+    std::unique_ptr<HashComp> copy(hc.clone());
+    ASSERT_NE(copy->conn_str, hc.conn_str);
+    ASSERT_STREQ(copy->conn_str->c_str(), " close");
+    ASSERT_EQ(copy->rem_expect_str, hc.rem_expect_str);
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include <random>
+#include "../adaptive_deadline.h"
+#include "test_registry_common.h"
+
+/** Builds a registry with the given proxy entries, all using the test_1 filter */
+static void make_registry(ProxyRegistry &reg, const std::string &entries) {
+    ASSERT_EQ(load_string(reg, "proxies = ( " + entries + " );"), 0);
+}
+
+TEST(Test_Latency_Sketch, Quantiles) {
+    LatencySketch s;
+    ASSERT_EQ(s.quantile(0.5), 0);
+
+    std::mt19937 rng(1);
+    std::vector<uint64_t> samples;
+    std::lognormal_distribution<double> dist(8.0, 1.0);  // median ~3ms
+    for (int i = 0; i < 100000; ++i) {
+        auto us = (uint64_t) dist(rng) + 1;
+        samples.push_back(us);
+        s.add(us);
+    }
+    std::sort(samples.begin(), samples.end());
+    ASSERT_EQ(s.count(), samples.size());
+
+    for (double q : {0.5, 0.9, 0.99, 0.999}) {
+        double exact = (double) samples[(size_t) (q * samples.size()) - 1];
+        double approx = (double) s.quantile(q);
+        ASSERT_GE(approx, exact * 0.99) << q;
+        ASSERT_LE(approx, exact * (SKETCH_GAMMA + 0.01)) << q;
+    }
+}
+
+TEST(Test_Latency_Sketch, Extremes) {
+    LatencySketch s;
+    s.add(0);
+    s.add(UINT64_MAX);
+    ASSERT_EQ(LatencySketch::bucket(0), 0);
+    ASSERT_EQ(LatencySketch::bucket(UINT64_MAX), SKETCH_BUCKETS - 1);
+    ASSERT_EQ(s.quantile(0.5), 1);
+}
+
+TEST(Test_Adaptive_Deadline, LearnsAfterWarmup) {
+    ProxyRegistry reg;
+    make_registry(reg, "{ name = \"fast\"; addrs = [\"10.0.0.1\"]; filter = \"test_1\"; deadline_ms = 60000; }");
+    AdaptiveDeadline ad(reg);
+    ASSERT_EQ(ad.deadline_ms(0), 60000);
+
+    for (int i = 0; i < DEADLINE_WARMUP - 1; ++i) {
+        ad.record(0, 100000, false);  // 100ms
+    }
+    ASSERT_EQ(ad.deadline_ms(0), 60000);  // not enough samples yet
+
+    for (int i = 0; i < DEADLINE_REFRESH; ++i) {
+        ad.record(0, 100000, false);
+    }
+    int d = ad.deadline_ms(0);
+    ASSERT_GE(d, 300);  // 3 x 100ms
+    ASSERT_LE(d, 320);
+}
+
+TEST(Test_Adaptive_Deadline, Bounds) {
+    ProxyRegistry reg;
+    make_registry(reg, "{ name = \"quick\"; addrs = [\"10.0.0.1\"]; filter = \"test_1\"; },"
+                       "{ name = \"slow\"; addrs = [\"10.0.0.2\"]; filter = \"test_1\"; deadline_ms = 1000; },"
+                       "{ name = \"fixed\"; addrs = [\"10.0.0.3\"]; filter = \"test_1\"; adaptive_deadline = false; }");
+    AdaptiveDeadline ad(reg);
+    for (int i = 0; i < 2 * DEADLINE_WARMUP; ++i) {
+        ad.record(0, 100, false);       // far below the floor
+        ad.record(1, 5000000, false);   // far above the configured deadline
+        ad.record(2, 100, false);
+    }
+    ASSERT_EQ(ad.deadline_ms(0), DEADLINE_FLOOR_MS);
+    ASSERT_EQ(ad.deadline_ms(1), 1000);
+    ASSERT_EQ(ad.deadline_ms(2), DEFAULT_DEADLINE_MS);
+}
+
+TEST(Test_Adaptive_Deadline, TimeoutsAreCensored) {
+    ProxyRegistry reg;
+    make_registry(reg, "{ name = \"p\"; addrs = [\"10.0.0.1\"]; filter = \"test_1\"; }");
+    AdaptiveDeadline ad(reg);
+    for (int i = 0; i < 2 * DEADLINE_WARMUP; ++i) {
+        ad.record(0, 60000000, true);
+    }
+    ASSERT_EQ(ad.timeouts(0), 2 * DEADLINE_WARMUP);
+    ASSERT_EQ(ad.sketch(0).count(), 0);
+    ASSERT_EQ(ad.deadline_ms(0), DEFAULT_DEADLINE_MS);
+
+    std::ostringstream os;
+    ad.print_stats(os);
+    ASSERT_NE(os.str().find("p samples=0 timeouts=400"), std::string::npos);
+}
@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../admission.h"
+#include "test_registry_common.h"
+
+class Admission_Fixture : public ::testing::Test {
+protected:
+    ProxyRegistry reg;
+
+    void SetUp() override {
+        // the pid keeps concurrent test runs from sharing semaphores
+        std::string name = "adm_" + std::to_string(getpid());
+        ASSERT_EQ(load_string(reg, "proxies = ( { name = \"" + name + "\"; addrs = [\"10.0.0.1\", \"10.0.0.2\"]; "
+                                   "filter = \"test_1\"; max_inflight = 2; },"
+                                   "            { name = \"free_" + name + "\"; addrs = [\"10.0.0.3\"]; filter = \"test_1\"; } );"),
+                  0);
+    }
+};
+
+TEST_F(Admission_Fixture, Unlimited) {
+    AdmissionControl ac(reg);
+    ASSERT_EQ(ac.available(1, 0), -1);
+    ASSERT_FALSE(ac.acquire(1, 0));
+    ac.destroy();
+}
+
+TEST_F(Admission_Fixture, CapsInflight) {
+    AdmissionControl ac(reg);
+    ASSERT_EQ(ac.available(0, 0), 2);
+    ASSERT_EQ(ac.available(0, 1), 2);
+
+    ASSERT_TRUE(ac.acquire(0, 0));
+    ASSERT_TRUE(ac.acquire(0, 0));
+    ASSERT_EQ(ac.available(0, 0), 0);
+    ASSERT_EQ(ac.available(0, 1), 2);  // replicas are limited independently
+    ASSERT_EQ(ac.stats(0).waited, 0);
+
+    std::atomic<bool> admitted(false);
+    std::thread t([&]() {
+        AdmissionControl::Ticket ticket(ac, 0, 0);
+        admitted = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_FALSE(admitted);
+
+    ac.release(0, 0);
+    t.join();
+    ASSERT_TRUE(admitted);
+    ASSERT_EQ(ac.available(0, 0), 1);  // the ticket gave its slot back
+
+    ASSERT_EQ(ac.stats(0).admitted, 3);
+    ASSERT_EQ(ac.stats(0).waited, 1);
+    ASSERT_GE(ac.stats(0).max_wait_us, 40000);
+
+    std::ostringstream os;
+    ac.print_stats(os);
+    ASSERT_NE(os.str().find("limit=2 admitted=3 queued=1"), std::string::npos);
+    ASSERT_EQ(os.str().find("free_"), std::string::npos);
+
+    ac.release(0, 0);
+    ac.destroy();
+}
+
+TEST_F(Admission_Fixture, SharedAcrossProcesses) {
+    AdmissionControl ac(reg);
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // a worker that takes both slots and dies without returning them
+        AdmissionControl child(reg);
+        child.acquire(0, 1);
+        child.acquire(0, 1);
+        char c = 'x';
+        (void) write(fds[1], &c, 1);
+        pause();
+        _exit(0);
+    }
+
+    char c;
+    ASSERT_EQ(read(fds[0], &c, 1), 1);
+    ASSERT_EQ(ac.available(0, 1), 0);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    ASSERT_EQ(ac.available(0, 1), 2);  // the kernel undid the dead worker's slots
+
+    close(fds[0]);
+    close(fds[1]);
+    ac.destroy();
+}
+
+TEST_F(Admission_Fixture, KeyDependsOnLimit) {
+    ProxyEntry e = reg[0];
+    key_t k1 = AdmissionControl::key_for(e);
+    e.max_inflight = 3;
+    ASSERT_NE(k1, AdmissionControl::key_for(e));
+    e.max_inflight = 2;
+    ASSERT_EQ(k1, AdmissionControl::key_for(e));
+}
@@ -0,0 +1,234 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include "fake_proxy.h"
+#include "../broker.h"
+#include "test_registry_common.h"
+
+#define TEST_H1 "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n"
+
+class Broker_Fixture : public ::testing::Test {
+protected:
+    ProxyRegistry reg;
+    std::string name = "/h2fuzz_test_" + std::to_string(getpid());
+    std::unique_ptr<Broker> broker;
+    std::atomic<bool> stop{false};
+    std::thread loop;
+
+    /** Loads a registry with the given proxy entries and starts a broker for it, on its own thread if "run" */
+    void start(const std::string &entries, uint32_t slots = 4, uint64_t ring_bytes = BROKER_RING_BYTES,
+               bool run = true) {
+        ASSERT_EQ(load_string(reg, "proxies = ( " + entries + " );"), 0);
+
+        broker.reset(new Broker(reg, name, slots, ring_bytes));
+        ASSERT_TRUE(broker->init());
+        if (run) {
+            loop = std::thread([this]() { broker->run(stop); });
+        }
+    }
+
+    /** Stops the event loop, so that its stats can be read */
+    void finish() {
+        stop = true;
+        if (loop.joinable()) {
+            loop.join();
+        }
+    }
+
+    void TearDown() override {
+        finish();
+    }
+
+    static std::string entry(const std::string &name, int port, const std::string &extra = "") {
+        return "{ name = \"" + name + "\"; addrs = [\"127.0.0.1:" + std::to_string(port) +
+               "\"]; filter = \"test_1\"; " + extra + " }";
+    }
+
+    static BrokerClient::Request request(uint32_t prox, const std::string &data, uint32_t deadline_ms = 1000) {
+        return {prox, 0, deadline_ms, (const uint8_t *) data.data(), (uint32_t) data.size()};
+    }
+};
+
+TEST_F(Broker_Fixture, RoundTrip) {
+    std::string resp = FakeProxy::echo_response(TEST_H1);
+    FakeProxy fp(resp);
+    start(entry("a", fp.port()) + "," + entry("b", fp.port()));
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::string stream = "not parsed by the broker";
+    std::vector<BrokerClient::Result> results;
+    for (int exec = 0; exec < 3; ++exec) {
+        client.exchange({request(0, stream), request(1, stream)}, results);
+        ASSERT_EQ(results.size(), 2);
+        for (const auto &res : results) {
+            ASSERT_EQ(res.status, BROKER_OK);
+            ASSERT_FALSE(res.timed_out);
+            ASSERT_EQ(std::string(res.data.begin(), res.data.end()), resp);
+
+            HashComp *hc = parse_response(reg[0].filter, (const char *) res.data.data(), res.data.size(), false);
+            ASSERT_FALSE(hc->noresp_err);
+            ASSERT_EQ(hc->orig, TEST_H1);
+            delete hc;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));  // time to refill the pools
+    }
+    finish();
+
+    ASSERT_EQ(broker->stats(0).exchanges, 3);
+    ASSERT_EQ(broker->stats(1).exchanges, 3);
+    ASSERT_GE(broker->stats(0).pool_hits, 2);  // at least every exec after the first had a connection ready
+    ASSERT_EQ(broker->stats(0).connect_failures, 0);
+}
+
+TEST_F(Broker_Fixture, Timeout) {
+    FakeProxy fp("", 0, true);
+    start(entry("silent", fp.port()));
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::vector<BrokerClient::Result> results;
+    auto t0 = std::chrono::steady_clock::now();
+    client.exchange({request(0, "x", 100)}, results);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+
+    ASSERT_EQ(results[0].status, BROKER_OK);
+    ASSERT_TRUE(results[0].timed_out);
+    ASSERT_TRUE(results[0].data.empty());
+    ASSERT_GE(ms, 100);
+    ASSERT_LT(ms, 1000);
+    finish();
+    ASSERT_EQ(broker->stats(0).timeouts, 1);
+}
+
+TEST_F(Broker_Fixture, ConnectFailure) {
+    start(entry("down", 1));  // nothing listens on port 1
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::vector<BrokerClient::Result> results;
+    client.exchange({request(0, "x")}, results);
+    ASSERT_EQ(results[0].status, BROKER_CONNECT_FAILED);
+    ASSERT_TRUE(results[0].answered);
+    finish();
+    ASSERT_GE(broker->stats(0).connect_failures, CONNECT_ATTEMPTS);
+}
+
+TEST_F(Broker_Fixture, InflightCap) {
+    FakeProxy fp(FakeProxy::echo_response(TEST_H1), 30);
+    start(entry("capped", fp.port(), "max_inflight = 1;") + "," + entry("free", fp.port()));
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::vector<BrokerClient::Result> results;
+    client.exchange({request(0, "x"), request(0, "x"), request(0, "x"), request(1, "x"), request(1, "x")}, results);
+    for (const auto &res : results) {
+        ASSERT_EQ(res.status, BROKER_OK);
+        ASSERT_FALSE(res.timed_out);
+    }
+    finish();
+
+    ASSERT_EQ(broker->stats(0).max_inflight, 1);
+    ASSERT_GE(broker->stats(0).max_queued_us, 50000);  // the third waited for the first two
+    ASSERT_EQ(broker->stats(1).max_inflight, 2);
+}
+
+TEST_F(Broker_Fixture, InflightCapIsPerReplica) {
+    FakeProxy fp1(FakeProxy::echo_response(TEST_H1), 30);
+    FakeProxy fp2(FakeProxy::echo_response(TEST_H1), 30);
+    start("{ name = \"capped\"; addrs = [\"127.0.0.1:" + std::to_string(fp1.port()) + "\", \"127.0.0.1:" +
+          std::to_string(fp2.port()) + "\"]; filter = \"test_1\"; max_inflight = 1; }");
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::vector<BrokerClient::Result> results;
+    std::string stream = "x";
+    std::vector<BrokerClient::Request> reqs(4, request(0, stream));
+    reqs[2].replica = reqs[3].replica = 1;
+    client.exchange(reqs, results);
+    for (const auto &res : results) {
+        ASSERT_EQ(res.status, BROKER_OK);
+    }
+    finish();
+
+    // the replicas run one exchange each at once, so only the second on each waits; a cap on the whole proxy would
+    // make the last wait for the three others
+    ASSERT_EQ(broker->stats(0).max_inflight, 1);
+    ASSERT_GE(broker->stats(0).max_queued_us, 25000);
+    ASSERT_LT(broker->stats(0).max_queued_us, 80000);
+}
+
+TEST_F(Broker_Fixture, SlotsAreReclaimed) {
+    start(entry("a", 1), 1);
+
+    BrokerClient first;
+    ASSERT_TRUE(first.attach(name));
+    BrokerClient second;
+    ASSERT_FALSE(second.attach(name));  // the only slot is taken
+
+    first.detach();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    ASSERT_TRUE(second.attach(name));
+}
+
+TEST_F(Broker_Fixture, BadRequest) {
+    start(entry("a", 1));
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::vector<BrokerClient::Result> results;
+    client.exchange({request(7, "x")}, results);
+    ASSERT_EQ(results[0].status, BROKER_BAD_REQUEST);
+}
+
+TEST_F(Broker_Fixture, RequestTooLarge) {
+    std::string resp = FakeProxy::echo_response(TEST_H1);
+    FakeProxy fp(resp);
+    start(entry("a", fp.port()), 4, 4096);
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::vector<BrokerClient::Result> results;
+    auto t0 = std::chrono::steady_clock::now();
+    client.exchange({request(0, std::string(4096, 'x')), request(0, "x")}, results);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+
+    // failed without waiting for an answer that cannot come, while the other request went through
+    ASSERT_EQ(results[0].status, BROKER_TOO_LARGE);
+    ASSERT_FALSE(results[0].answered);
+    ASSERT_EQ(results[1].status, BROKER_OK);
+    ASSERT_EQ(std::string(results[1].data.begin(), results[1].data.end()), resp);
+    ASSERT_LT(ms, 1000);
+}
+
+TEST_F(Broker_Fixture, ResponseTooLarge) {
+    FakeProxy fp(std::string(4096, 'x'));
+    start(entry("a", fp.port()), 4, 4096);
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::vector<BrokerClient::Result> results;
+    client.exchange({request(0, "x")}, results);
+    ASSERT_EQ(results[0].status, BROKER_TOO_LARGE);
+    ASSERT_TRUE(results[0].data.empty());
+}
+
+TEST_F(Broker_Fixture, StalledBrokerWithFullRing) {
+    start(entry("a", 1), 4, 4096, false);  // never runs, so nothing drains the request ring
+
+    BrokerClient client;
+    ASSERT_TRUE(client.attach(name));
+    std::string stream(1500, 'x');
+    std::vector<BrokerClient::Result> results;
+    auto t0 = std::chrono::steady_clock::now();
+    client.exchange({request(0, stream), request(0, stream), request(0, stream)}, results);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+
+    ASSERT_GE(ms, BROKER_STALL_MS);
+    ASSERT_LT(ms, BROKER_STALL_MS + 1000);
+    for (const auto &res : results) {
+        ASSERT_EQ(res.status, BROKER_CONNECT_FAILED);
+        ASSERT_FALSE(res.answered);
+    }
+}
@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <memory>
+#include <unistd.h>
+#include "fake_proxy.h"
+#include "../callbacks.h"
+#include "../capture.h"
+
+#define TEST_H1 "GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+class Capture_Fixture : public ::testing::Test {
+protected:
+    std::string fn;
+
+    void SetUp() override {
+        char tmpl[] = "/tmp/h2fuzz_capture_XXXXXX";
+        int fd = mkstemp(tmpl);
+        close(fd);
+        fn = tmpl;
+    }
+
+    void TearDown() override {
+        unlink(fn.c_str());
+    }
+
+    static void record(CaptureWriter &w, const std::string &proxy, const std::string &req, const std::string &resp,
+                       bool timed_out = false) {
+        w.record(proxy, req.data(), req.size(), resp.data(), resp.size(), timed_out);
+    }
+
+    /** Response recorded for proxy and req, or "<miss>" */
+    static std::string find(const CaptureReader &r, const std::string &proxy, const std::string &req) {
+        CaptureReader::Response resp{};
+        return r.find(proxy, req.data(), req.size(), resp) ? std::string(resp.data, resp.size) : "<miss>";
+    }
+
+    void resize(off_t sz) {
+        ASSERT_EQ(truncate(fn.c_str(), sz), 0);
+    }
+
+    off_t file_size() {
+        std::ifstream in(fn, std::ios::binary | std::ios::ate);
+        return (off_t) in.tellg();
+    }
+};
+
+TEST_F(Capture_Fixture, RoundTrip) {
+    {
+        CaptureWriter w;
+        ASSERT_TRUE(w.open(fn));
+        record(w, "nginx", "req1", "resp1");
+        record(w, "envoy", "req1", "resp2", true);
+        record(w, "nginx", std::string("req\0two", 7), "");
+    }
+
+    CaptureReader r;
+    ASSERT_TRUE(r.load(fn));
+    ASSERT_EQ(r.size(), 3);
+    ASSERT_EQ(find(r, "nginx", "req1"), "resp1");
+    ASSERT_EQ(find(r, "envoy", "req1"), "resp2");
+    ASSERT_EQ(find(r, "nginx", std::string("req\0two", 7)), "");
+    ASSERT_EQ(find(r, "nginx", "req"), "<miss>");
+    ASSERT_EQ(find(r, "haproxy", "req1"), "<miss>");
+    ASSERT_EQ(r.hits(), 3);
+    ASSERT_EQ(r.misses(), 2);
+
+    CaptureReader::Response resp{};
+    ASSERT_TRUE(r.find("envoy", "req1", 4, resp));
+    ASSERT_TRUE(resp.timed_out);
+    ASSERT_TRUE(r.find("nginx", "req1", 4, resp));
+    ASSERT_FALSE(resp.timed_out);
+}
+
+TEST_F(Capture_Fixture, DuplicatesKeepTheFirstRecording) {
+    CaptureWriter w;
+    ASSERT_TRUE(w.open(fn));
+    record(w, "nginx", "req", "first");
+    record(w, "nginx", "req", "second");
+    ASSERT_EQ(w.recorded(), 1);
+    ASSERT_EQ(w.duplicates(), 1);
+    w.close();
+
+    CaptureReader r;
+    ASSERT_TRUE(r.load(fn));
+    ASSERT_EQ(find(r, "nginx", "req"), "first");
+}
+
+TEST_F(Capture_Fixture, UnindexedFilesAreScanned) {
+    {
+        CaptureWriter w;
+        ASSERT_TRUE(w.open(fn));
+        record(w, "nginx", "req1", "resp1");
+        record(w, "nginx", "req2", "resp2");
+    }
+
+    // a file that was never closed has no index, and may end in the middle of a record
+    CaptureIndex index;
+    std::ifstream in(fn, std::ios::binary);
+    std::string buf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint64_t end = CaptureReader::read_index(buf, index);
+    ASSERT_EQ(index.size(), 2);
+    resize((off_t) end - 1);
+
+    CaptureReader r;
+    ASSERT_TRUE(r.load(fn));
+    ASSERT_EQ(r.size(), 1);
+    ASSERT_EQ(find(r, "nginx", "req1"), "resp1");
+    ASSERT_EQ(find(r, "nginx", "req2"), "<miss>");
+}
+
+TEST_F(Capture_Fixture, ReopeningAppends) {
+    {
+        CaptureWriter w;
+        ASSERT_TRUE(w.open(fn));
+        record(w, "nginx", "req1", "resp1");
+    }
+    off_t indexed = file_size();
+    {
+        CaptureWriter w;
+        ASSERT_TRUE(w.open(fn));
+        record(w, "nginx", "req1", "again");  // already in the file
+        record(w, "nginx", "req2", "resp2");
+        ASSERT_EQ(w.recorded(), 1);
+    }
+    ASSERT_GT(file_size(), indexed);
+
+    CaptureReader r;
+    ASSERT_TRUE(r.load(fn));
+    ASSERT_EQ(r.size(), 2);
+    ASSERT_EQ(find(r, "nginx", "req1"), "resp1");
+    ASSERT_EQ(find(r, "nginx", "req2"), "resp2");
+}
+
+TEST_F(Capture_Fixture, RejectsOtherFiles) {
+    {
+        std::ofstream out(fn);
+        out << "not a capture";
+    }
+    CaptureWriter w;
+    ASSERT_FALSE(w.open(fn));
+    CaptureReader r;
+    ASSERT_FALSE(r.load(fn));
+    ASSERT_FALSE(r.load(fn + ".missing"));
+}
+
+TEST_F(Capture_Fixture, DirectoriesHoldOneFilePerProcess) {
+    char tmpl[] = "/tmp/h2fuzz_capdir_XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    std::string path;
+    {
+        CaptureWriter w;
+        ASSERT_TRUE(w.open(dir));
+        path = w.path();
+        record(w, "nginx", "req", "resp");
+    }
+    ASSERT_EQ(path, dir + "/" + std::to_string(getpid()) + CAPTURE_EXT);
+
+    CaptureReader r;
+    ASSERT_TRUE(r.load(dir));
+    ASSERT_EQ(find(r, "nginx", "req"), "resp");
+    unlink(path.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_F(Capture_Fixture, ReplayMatchesTheLiveExchange) {
+    ProxyConfig filt;
+    filt.authority = "x.test";
+    uint8_t stream[256];
+    size_t sz = build_probe_stream(stream, sizeof(stream));
+
+    FakeProxy fp(FakeProxy::echo_response(TEST_H1));
+    CaptureWriter w;
+    ASSERT_TRUE(w.open(fn));
+    CaptureWriter::Tap tap{&w, "fake"};
+    std::unique_ptr<HashComp> live(callback("127.0.0.1", fp.port(), filt, stream, sz, 1000, nullptr, &tap));
+    ASSERT_NE(live, nullptr);
+    w.close();
+
+    // looked up by the request as callback() sends it
+    CaptureReader r;
+    ASSERT_TRUE(r.load(fn));
+    char *req;
+    size_t req_sz = preprocess_req(filt, stream, sz, &req);
+    CaptureReader::Response resp{};
+    bool found = r.find("fake", req, req_sz, resp);
+    delete[] req;
+    ASSERT_TRUE(found);
+
+    std::unique_ptr<HashComp> replayed(parse_response(filt, resp.data, resp.size, resp.timed_out));
+    ASSERT_TRUE(*live == *replayed);
+    ASSERT_EQ(live->hash_full(), replayed->hash_full());
+    ASSERT_EQ(replayed->orig, TEST_H1);
+}
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <set>
+#include <unistd.h>
+#include "../../nezha-0.1/FuzzerInternal.h"
+
+using fuzzer::CampaignCheckpoint;
+using fuzzer::DiffJournal;
+using fuzzer::ShardedCorpus;
+using fuzzer::SignatureSet;
+using fuzzer::Unit;
+using fuzzer::UnitPtr;
+using fuzzer::UnitStats;
+
+typedef CampaignCheckpoint::Status Status;
+
+class Checkpoint_Fixture : public ::testing::Test {
+protected:
+    std::string fn;
+
+    void SetUp() override {
+        char tmpl[] = "/tmp/h2fuzz_checkpoint_XXXXXX";
+        int fd = mkstemp(tmpl);
+        close(fd);
+        fn = tmpl;
+        unlink(fn.c_str());
+    }
+
+    void TearDown() override {
+        unlink(fn.c_str());
+    }
+
+    off_t file_size() {
+        std::ifstream in(fn, std::ios::binary | std::ios::ate);
+        return (off_t) in.tellg();
+    }
+
+    std::vector<std::string> load(Status expected = Status::Loaded, uint64_t fingerprint = 42) {
+        CampaignCheckpoint c(fn, fingerprint);
+        std::vector<std::string> segments;
+        EXPECT_EQ(c.Load(&segments), expected);
+        return segments;
+    }
+};
+
+TEST_F(Checkpoint_Fixture, RewriteThenAppend) {
+    ASSERT_EQ(load(Status::Missing).size(), 0);
+
+    CampaignCheckpoint c(fn, 42);
+    ASSERT_TRUE(c.NeedsRewrite());
+    ASSERT_FALSE(c.Append("too early"));
+    ASSERT_TRUE(c.Rewrite("full"));
+    ASSERT_TRUE(c.Append("delta1"));
+    ASSERT_TRUE(c.Append(std::string("delta\0two", 9)));
+    ASSERT_EQ(c.Appended(), 2);
+    ASSERT_EQ(load(), std::vector<std::string>({"full", "delta1", std::string("delta\0two", 9)}));
+
+    // a rewrite drops everything appended before it
+    ASSERT_TRUE(c.Rewrite("full2"));
+    ASSERT_EQ(c.Appended(), 0);
+    ASSERT_TRUE(c.Append("delta3"));
+    ASSERT_EQ(load(), std::vector<std::string>({"full2", "delta3"}));
+}
+
+TEST_F(Checkpoint_Fixture, TornSegmentsAreDropped) {
+    CampaignCheckpoint c(fn, 42);
+    ASSERT_TRUE(c.Rewrite("full"));
+    ASSERT_TRUE(c.Append("delta1"));
+    off_t complete = file_size();
+    ASSERT_TRUE(c.Append("delta2"));
+
+    // killed while appending: every prefix of the last segment loads as if it was never written
+    for (off_t sz = complete; sz < file_size(); ++sz) {
+        std::string copy = fn + ".torn";
+        {
+            std::ifstream in(fn, std::ios::binary);
+            std::string buf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            std::ofstream out(copy, std::ios::binary);
+            out.write(buf.data(), sz);
+        }
+        CampaignCheckpoint torn(copy, 42);
+        std::vector<std::string> segments;
+        ASSERT_EQ(torn.Load(&segments), Status::Loaded);
+        ASSERT_EQ(segments, std::vector<std::string>({"full", "delta1"})) << sz;
+        unlink(copy.c_str());
+    }
+}
+
+TEST_F(Checkpoint_Fixture, CorruptSegmentsEndTheCheckpoint) {
+    CampaignCheckpoint c(fn, 42);
+    ASSERT_TRUE(c.Rewrite("full"));
+    ASSERT_TRUE(c.Append("delta1"));
+    ASSERT_TRUE(c.Append("delta2"));
+
+    // flip the last byte of "delta1"
+    std::fstream f(fn, std::ios::binary | std::ios::in | std::ios::out);
+    f.seekp(file_size() - 6 - 24 - 1);
+    f.put('X');
+    f.close();
+    ASSERT_EQ(load(), std::vector<std::string>({"full"}));
+}
+
+TEST_F(Checkpoint_Fixture, RejectsOtherFiles) {
+    {
+        CampaignCheckpoint c(fn, 42);
+        ASSERT_TRUE(c.Rewrite("full"));
+    }
+    load(Status::Invalid, 43);  // written for other proxies
+
+    {
+        std::ofstream out(fn);
+        out << "not a checkpoint";
+    }
+    load(Status::Invalid);
+}
+
+TEST(TestCheckpointState, JournalRecordsOnlyWhenEnabled) {
+    DiffJournal j;
+    j.AddOutput({1, 2});
+    j.AddSignature(7);
+    ASSERT_TRUE(j.Outputs.empty());
+
+    j.Enabled = true;
+    j.AddOutput({1, 2});
+    j.AddSignature(7);
+    j.AddCovPath("p");
+    DiffJournal taken;
+    j.Take(&taken);
+    ASSERT_EQ(taken.Outputs, std::vector<std::vector<int>>({{1, 2}}));
+    ASSERT_EQ(taken.Signatures, std::vector<uint64_t>({7}));
+    ASSERT_EQ(taken.CovPaths, std::vector<std::string>({"p"}));
+    ASSERT_TRUE(j.Outputs.empty());
+    ASSERT_TRUE(j.Signatures.empty());
+}
+
+TEST(TestCheckpointState, SignatureSetForEach) {
+    SignatureSet s;
+    std::set<uint64_t> in = {0, 1, 64, 1ULL << 40, ~0ULL};
+    for (uint64_t sig : in) {
+        s.Insert(sig);
+    }
+    std::set<uint64_t> out;
+    s.ForEach([&](uint64_t sig) { out.insert(sig); });
+    ASSERT_EQ(in, out);
+}
+
+TEST(TestCheckpointState, CorpusSnapshotFrom) {
+    ShardedCorpus corpus(2);
+    UnitStats stats;
+    stats.Record(0.5, true, false);
+    corpus.Add(0, Unit{1});
+    corpus.Add(0, Unit{2}, stats);
+    corpus.Add(1, Unit{3});
+
+    std::vector<UnitPtr> units;
+    std::vector<UnitStats> all;
+    corpus.Snapshot(0, 1, &units, &all);
+    ASSERT_EQ(units.size(), 1);
+    ASSERT_EQ(*units[0], Unit{2});
+    ASSERT_EQ(all.size(), 2);
+    ASSERT_EQ(all[1].Children, 1);
+    ASSERT_EQ(all[1].NewTuples, 1);
+
+    corpus.Snapshot(1, 1, &units, &all);
+    ASSERT_TRUE(units.empty());
+    ASSERT_EQ(all.size(), 1);
+}
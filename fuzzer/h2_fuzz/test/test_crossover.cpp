@@ -217,6 +217,38 @@ TEST(StreamMutator, CrossOver_Frame_ADD_Overflow_Second) {
     TestMutator::delete_stream(s1);
 }
 
+TEST(StreamMutator, CrossOver_DataFrame_SharedUntilWritten) {
+    DataFrame df1, df2;
+    df1.len = df2.len = 16;
+    df1.data.insert(df1.data.begin(), 16, 'A');
+    df2.data.insert(df2.data.begin(), 16, 'B');
+    H2Stream s1 = {&df1};
+    H2Stream s2 = {&df2};
+
+    char buf1[128], buf2[128];
+    uint32_t sz1 = s1.serialize(buf1, 128);
+    uint32_t sz2 = s2.serialize(buf2, 128);
+    s1.clear();
+    s2.clear();
+
+    H2Mutator mut(buf2, sz2);
+    {
+        // add the frame of mut after the one in tm, then duplicate it
+        TestMutator tm(buf1, sz1, {0, 0, 0, ADD, 1,
+                                   1, DUP});
+        ASSERT_EQ(1, tm.CrossOver(mut, 0, 512));
+        ASSERT_EQ(tm.strm_->at(1), mut.strm_->at(0));  // not copied
+        ASSERT_TRUE(FrameCopier::is_shared(mut.strm_->at(0)));
+
+        ASSERT_EQ(1, tm.Mutate(nullptr, 0, 512));
+        ASSERT_EQ(tm.strm_->size(), 3);
+        ASSERT_NE(tm.strm_->at(1), mut.strm_->at(0));  // copied before the mutation
+        ASSERT_FALSE(FrameCopier::is_shared(mut.strm_->at(0)));
+        frame_eq(tm.strm_->at(2), &df2);
+    }
+    frame_eq(mut.strm_->at(0), &df2);
+}
+
 TEST_F(TestCrossOver, CrossOver_1_SPLICE_1_Frame) {
     // at index 1 of s1, splice in frame 1 in s2
     std::vector<unsigned int> rands{1, 1, 1, SPLICE, 1};
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+#include "../callbacks.h"
+#include "../../nezha-0.1/FuzzerBloomFilter.h"
+#include "../../h2_serializer/src/frames/frames.h"
+
+typedef hpack::HPacker::PrefixType PrefType;
+typedef hpack::HPacker::IndexingType IdxType;
+
+/** Serializes a single HEADERS frame with the given :path into buf */
+static size_t build_stream(char *buf, size_t bufsz, const std::string &path) {
+    HeadersFrame hf;
+    hf.flags = FLAG_END_HEADERS | FLAG_END_STREAM;
+    hf.stream_id = 0x00000001;
+    hf.add_header(":method", "GET", PrefType::LITERAL_HEADER_NEVER_INDEXED, IdxType::NONE);
+    hf.add_header(":scheme", "https", PrefType::LITERAL_HEADER_NEVER_INDEXED, IdxType::NONE);
+    hf.add_header(":path", path, PrefType::LITERAL_HEADER_NEVER_INDEXED, IdxType::NONE);
+    hf.add_header(":authority", GRAMMAR_AUTH, PrefType::LITERAL_HEADER_NEVER_INDEXED, IdxType::NONE);
+
+    hpack::HPacker hpe;
+    return hf.serialize(buf, bufsz, &hpe, false);
+}
+
+TEST(TestDedup, CanonicalHashStable) {
+    char buf1[256], buf2[256], buf3[256];
+    size_t sz1 = build_stream(buf1, sizeof(buf1), "/a");
+    size_t sz2 = build_stream(buf2, sizeof(buf2), "/a");
+    size_t sz3 = build_stream(buf3, sizeof(buf3), "/b");
+
+    uint64_t h1 = canonical_stream_hash((uint8_t *) buf1, sz1);
+    ASSERT_NE(h1, 0);
+    ASSERT_EQ(h1, canonical_stream_hash((uint8_t *) buf2, sz2));
+    ASSERT_NE(h1, canonical_stream_hash((uint8_t *) buf3, sz3));
+}
+
+TEST(TestDedup, CanonicalHashUnparseable) {
+    // frame header with an unknown frame type
+    const char bad[] = "\x00\x00\x00\xff\x00\x00\x00\x00\x01";
+    ASSERT_EQ(canonical_stream_hash((const uint8_t *) bad, sizeof(bad) - 1), 0);
+}
+
+TEST(TestDedup, BloomNoFalseNegatives) {
+    fuzzer::ScalableBloomFilter bf(1024, 1e-3, 8);
+    for (uint64_t i = 0; i < 5000; ++i) {
+        bf.TestAndInsert(i * 7919);  // may report a false positive, but never drops a new item
+    }
+    ASSERT_GT(bf.NumSlices(), 1);
+    for (uint64_t i = 0; i < 5000; ++i) {
+        ASSERT_TRUE(bf.Contains(i * 7919)) << i;
+        ASSERT_TRUE(bf.TestAndInsert(i * 7919)) << i;
+    }
+}
+
+TEST(TestDedup, BloomFalsePositiveRate) {
+    fuzzer::ScalableBloomFilter bf(1024, 1e-3, 8);
+    for (uint64_t i = 0; i < 5000; ++i) {
+        bf.TestAndInsert(i);
+    }
+    int fps = 0;
+    for (uint64_t i = 1000000; i < 1100000; ++i) {
+        fps += bf.Contains(i);
+    }
+    ASSERT_LT(fps, 300);  // 1e-3 of 100000 is 100, leave generous slack
+}
+
+TEST(TestDedup, BloomAgesOut) {
+    fuzzer::ScalableBloomFilter bf(16, 1e-3, 2);
+    bf.TestAndInsert(42);
+    for (uint64_t i = 1000; i < 1100; ++i) {
+        bf.TestAndInsert(i);
+    }
+    ASSERT_EQ(bf.NumSlices(), 2);
+    ASSERT_FALSE(bf.Contains(42));
+}
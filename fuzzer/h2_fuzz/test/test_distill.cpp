@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include "../../nezha-0.1/FuzzerInternal.h"
+#include "../result_matrix.h"
+
+using fuzzer::DistillSample;
+using fuzzer::DistillSelect;
+
+static DistillSample sample(size_t size, uint64_t tuple, uint64_t sig = 0, double secs = 0) {
+    DistillSample s;
+    s.Size = size;
+    s.ExecSeconds = secs;
+    s.Executed = true;
+    s.Tuple = tuple;
+    s.HasDiff = sig != 0;
+    s.Signature = sig;
+    return s;
+}
+
+TEST(TestDistill, KeepsTheSmallestUnitOfEachTuple) {
+    std::vector<DistillSample> s = {sample(30, 1), sample(10, 1), sample(20, 2), sample(5, 2, 0, 2.0),
+                                    sample(5, 2, 0, 1.0)};
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({1, 4}));
+}
+
+TEST(TestDistill, KeepsEverySignature) {
+    // two differences with the same outputs but different disagreements, and one with the same disagreement as
+    // another but new outputs. the second and third show everything the first does
+    std::vector<DistillSample> s = {sample(10, 1, 7), sample(20, 1, 8), sample(30, 2, 7), sample(40, 1, 7)};
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({1, 2}));
+
+    s = {sample(10, 1, 7), sample(20, 1, 8), sample(30, 2, 9)};
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({0, 1, 2}));
+}
+
+/** Disagreement signature of proxies that forward the given requests */
+static uint64_t signature(const std::vector<std::string> &reqs) {
+    ProxyConfig f;
+    std::vector<HashComp *> hcs;
+    for (const auto &r : reqs) {
+        H1Parser hp;
+        hp.parse(r.c_str(), r.length());
+        hcs.push_back(new HashComp());
+        hcs.back()->parse(hp, f);
+        hcs.back()->hash_indiv();
+    }
+    ResultMatrix m;
+    m.load(hcs.data(), (int) hcs.size());
+    for (auto *hc : hcs) {
+        delete hc;
+    }
+    return m.signature();
+}
+
+TEST(TestDistill, UncomparedSplitsAreNoSignature) {
+    // the larger unit only splits the proxies on Connection, which is not compared: nothing new to keep it for
+    uint64_t sig = signature({"GET / HTTP/1.1\r\n\r\n", "GET / HTTP/1.1\r\nConnection: close\r\n\r\n"});
+    ASSERT_EQ(sig, 0);
+    std::vector<DistillSample> s = {sample(10, 1), sample(20, 1, sig)};
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({0}));
+}
+
+TEST(TestDistill, DropsUnitsShownByLargerOnes) {
+    // the smallest unit is taken for tuple 1, but the unit taken for signature 9 shows tuple 1 as well
+    std::vector<DistillSample> s = {sample(10, 1), sample(20, 1, 9)};
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({1}));
+
+    // a later unit only shows what earlier ones did: the earlier ones stay
+    s = {sample(10, 1), sample(20, 2, 9), sample(30, 1, 9)};
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({0, 1}));
+}
+
+TEST(TestDistill, PinnedUnitsAreKept) {
+    std::vector<DistillSample> s = {sample(50, 1), sample(10, 1), sample(60, 3), sample(5, 2)};
+    s[0].Pinned = s[2].Pinned = true;
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({0, 2, 3}));
+
+    // even if they were not executed
+    s[2].Executed = false;
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({0, 2, 3}));
+}
+
+TEST(TestDistill, UnexecutedUnitsAreLeftOut) {
+    std::vector<DistillSample> s = {sample(10, 1), sample(5, 2)};
+    s[1].Executed = false;
+    ASSERT_EQ(DistillSelect(s), std::vector<size_t>({0}));
+    ASSERT_TRUE(DistillSelect({}).empty());
+}
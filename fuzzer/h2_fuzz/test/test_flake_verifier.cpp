@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include "../flake_verifier.h"
+#include "test_registry_common.h"
+
+typedef FlakeVerifier::Clock Clock;
+
+/** Results of three proxies that forward a request with the given statuses */
+static ResultMatrix statuses(const std::vector<std::string> &st) {
+    std::vector<HashComp *> hcs;
+    for (const auto &s : st) {
+        hcs.push_back(new HashComp());
+        hcs.back()->status = s;
+    }
+    ResultMatrix m;
+    m.load(hcs.data(), (int) hcs.size());
+    for (auto hc : hcs) {
+        delete hc;
+    }
+    return m;
+}
+
+class Flake_Verifier_Fixture : public ::testing::Test {
+protected:
+    ProxyRegistry reg;
+    std::string dir;
+    std::vector<std::string> next;  // statuses the proxies answer with. empty: some proxy does not answer
+    std::atomic<int> n_execs{0};
+
+    void SetUp() override {
+        char d[] = "/tmp/h2fuzz_verify_XXXXXX";
+        ASSERT_NE(mkdtemp(d), nullptr);
+        dir = d;
+        ASSERT_EQ(load_string(reg, "proxies = ( { name = \"one\"; addrs = [\"10.0.0.1\"]; filter = \"test_1\"; },"
+                                   "            { name = \"two\"; addrs = [\"10.0.0.2\"]; filter = \"test_1\"; },"
+                                   "            { name = \"three\"; addrs = [\"10.0.0.3\"]; filter = \"test_1\"; } );"),
+                  0);
+    }
+
+    void TearDown() override {
+        unlink((dir + "/" + VERIFY_LOG).c_str());
+        rmdir(dir.c_str());
+    }
+
+    FlakeVerifier::Exec exec() {
+        return [this](const std::string &, ResultMatrix &m) {
+            n_execs++;
+            if (next.empty()) {
+                return false;
+            }
+            m = statuses(next);
+            return true;
+        };
+    }
+
+    /** Steps the verifier 1 s apart until nothing is due */
+    static Clock::time_point drain(FlakeVerifier &v, Clock::time_point t) {
+        while (v.pending() > 0) {
+            t += std::chrono::seconds(1);
+            while (v.step(t)) {
+            }
+        }
+        return t;
+    }
+
+    std::string log() const {
+        std::ifstream in(dir + "/" + VERIFY_LOG);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    }
+};
+
+TEST_F(Flake_Verifier_Fixture, StableDifference) {
+    FlakeVerifier v(reg, exec(), 3, 1000);
+    auto t = Clock::now();
+    next = {"200", "200", "400"};
+    ASSERT_TRUE(v.submit("s", statuses(next), dir + "/diff_1", t));
+
+    // runs are spaced out
+    ASSERT_FALSE(v.step(t));
+    ASSERT_TRUE(v.step(t + std::chrono::seconds(1)));
+    ASSERT_FALSE(v.step(t + std::chrono::seconds(1)));
+    drain(v, t + std::chrono::seconds(1));
+
+    ASSERT_EQ(n_execs, 3);
+    ASSERT_EQ(v.stable(), 1);
+    ASSERT_EQ(v.flaky(), 0);
+    ASSERT_EQ(log(), "diff_1\tstable\t3/3\t-\n");
+}
+
+TEST_F(Flake_Verifier_Fixture, FlakyDifferenceNamesTheProxy) {
+    FlakeVerifier v(reg, exec(), 2, 1000);
+    next = {"200", "200", "200"};  // three only disagreed under load
+    v.submit("s", statuses({"200", "200", "504"}), dir + "/diff_1", Clock::now());
+    drain(v, Clock::now());
+
+    ASSERT_EQ(v.flaky(), 1);
+    ASSERT_EQ(log(), "diff_1\tflaky\t2/2\tthree:status\n");
+    ASSERT_EQ(v.unstable(ResultMatrix::KEY_STATUS), 0);  // not after a single difference
+}
+
+TEST_F(Flake_Verifier_Fixture, UnstableProxiesAreSuppressed) {
+    FlakeVerifier v(reg, exec(), 1, 1000);
+    auto t = Clock::now();
+    next = {"200", "200", "200"};
+    for (int i = 0; i < FLAKE_MIN_SAMPLES; ++i) {
+        v.submit("s", statuses({"200", "200", "504"}), dir + "/diff", t);
+    }
+    t = drain(v, t);
+    ASSERT_EQ(v.unstable(ResultMatrix::KEY_STATUS), 0b100);
+
+    // three alone disagreeing on the status is left out, but not another proxy disagreeing
+    ResultMatrix m = statuses({"200", "200", "502"});
+    ASSERT_TRUE(v.suppress(m));
+    ASSERT_FALSE(m.has_diff());
+    m = statuses({"200", "400", "502"});
+    ASSERT_FALSE(v.suppress(m));
+    ASSERT_TRUE(m.has_diff());
+    ASSERT_EQ(v.suppressed(), 1);
+
+    // the proxy is verified again on logged differences it takes part in, and is stable again once it behaves
+    next = {"200", "400", "502"};
+    for (int i = 0; i <= FLAKE_MIN_SAMPLES; ++i) {
+        v.submit("s", m, dir + "/diff", t);
+    }
+    drain(v, t);
+    ASSERT_EQ(v.unstable(ResultMatrix::KEY_STATUS), 0);
+}
+
+TEST_F(Flake_Verifier_Fixture, UnstableAtTheThreshold) {
+    static_assert(FLAKE_MIN_SAMPLES == 4 && FLAKE_UNSTABLE_PCT == 50, "samples below assume these");
+    FlakeVerifier v(reg, exec(), 1, 1000);
+    auto t = Clock::now();
+    ResultMatrix diff = statuses({"200", "200", "504"});
+    for (const auto &n : std::vector<std::vector<std::string>>{{"200", "200", "504"}, {"200", "200", "504"},
+                                                                {"200", "200", "200"}, {"200", "200", "200"}}) {
+        next = n;
+        v.submit("s", diff, dir + "/diff", t);
+        t = drain(v, t);
+    }
+    ASSERT_EQ(v.unstable(ResultMatrix::KEY_STATUS), 0b100);  // flaky in exactly half
+
+    next = {"200", "200", "504"};
+    v.submit("s", diff, dir + "/diff", t);
+    drain(v, t);
+    ASSERT_EQ(v.unstable(ResultMatrix::KEY_STATUS), 0);  // 2 of 5 is below it
+}
+
+TEST_F(Flake_Verifier_Fixture, UnansweredRunsAreRetried) {
+    FlakeVerifier v(reg, exec(), 2, 1000);
+    v.submit("s", statuses({"200", "200", "400"}), dir + "/diff_1", Clock::now());
+    drain(v, Clock::now());
+    ASSERT_EQ(n_execs, 4);
+    ASSERT_EQ(v.unverified(), 1);
+    ASSERT_EQ(log(), "diff_1\tunverified\t0/2\t-\n");
+}
+
+TEST_F(Flake_Verifier_Fixture, BackgroundThreads) {
+    FlakeVerifier v(reg, exec(), 2, 10);
+    next = {"200", "200", "400"};
+    v.start();
+    for (int i = 0; i < 8; ++i) {
+        v.submit("s", statuses(next), dir + "/diff_" + std::to_string(i));
+    }
+    for (int i = 0; i < 200 && v.stable() < 8; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    v.stop();
+    ASSERT_EQ(v.stable(), 8);
+    ASSERT_EQ(v.pending(), 0);
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include "../callbacks.h"
+#include "../health_monitor.h"
+#include "test_registry_common.h"
+
+typedef HealthMonitor::Clock Clock;
+
+class Health_Monitor_Fixture : public ::testing::Test {
+protected:
+    ProxyRegistry reg;
+    std::vector<std::vector<bool>> up;  // probe result per proxy and replica
+    int n_probes = 0;
+
+    void SetUp() override {
+        ASSERT_EQ(load_string(reg, "proxies = ( { name = \"one\"; addrs = [\"10.0.0.1\"]; filter = \"test_1\"; },"
+                                   "            { name = \"two\"; addrs = [\"10.0.0.2\", \"10.0.0.3\"]; filter = \"test_1\"; } );"),
+                  0);
+        up = {{false}, {false, false}};
+    }
+
+    HealthMonitor::Probe probe() {
+        return [this](size_t prox, size_t rep) {
+            n_probes++;
+            return (bool) up[prox][rep];
+        };
+    }
+};
+
+TEST_F(Health_Monitor_Fixture, ClosedByDefault) {
+    HealthMonitor hm(reg, probe());
+    ASSERT_EQ(hm.choose(0, 0), 0);
+    ASSERT_EQ(hm.choose(1, 1), 1);
+    hm.probe_due(Clock::now());
+    ASSERT_EQ(n_probes, 0);  // nothing to probe while every circuit is closed
+}
+
+TEST_F(Health_Monitor_Fixture, FailoverToOtherReplica) {
+    HealthMonitor hm(reg, probe());
+    hm.report_failure(1, 1);
+    ASSERT_TRUE(hm.is_open(1, 1));
+    ASSERT_EQ(hm.choose(1, 1), 0);
+    ASSERT_EQ(hm.stalled(1).count(), 0);  // the other replica is still up
+
+    hm.report_failure(1, 0);
+    ASSERT_EQ(hm.choose(1, 1), -1);
+    ASSERT_EQ(hm.choose(0, 0), 0);
+}
+
+TEST_F(Health_Monitor_Fixture, ExponentialBackoff) {
+    HealthMonitor hm(reg, probe());
+    auto t0 = Clock::now();
+    hm.report_failure(0, 0);
+    ASSERT_EQ(hm.trips(0, 0), 1);
+    ASSERT_EQ(hm.backoff_ms(0, 0), BACKOFF_MIN_MS);
+
+    hm.probe_due(t0);  // backoff has not expired yet
+    ASSERT_EQ(n_probes, 0);
+
+    auto t = t0;
+    int expected = BACKOFF_MIN_MS;
+    for (int i = 0; i < 10; ++i) {
+        t += std::chrono::milliseconds(BACKOFF_MAX_MS + 1);
+        hm.probe_due(t);
+        expected = std::min(expected * 2, BACKOFF_MAX_MS);
+        ASSERT_EQ(hm.backoff_ms(0, 0), expected);
+        ASSERT_TRUE(hm.is_open(0, 0));
+    }
+    ASSERT_EQ(n_probes, 10);
+    ASSERT_EQ(hm.backoff_ms(0, 0), BACKOFF_MAX_MS);
+
+    // the next probe is not due until the full backoff has passed
+    hm.probe_due(t + std::chrono::milliseconds(BACKOFF_MAX_MS - 1));
+    ASSERT_EQ(n_probes, 10);
+
+    up[0][0] = true;
+    hm.probe_due(t + std::chrono::milliseconds(BACKOFF_MAX_MS));
+    ASSERT_FALSE(hm.is_open(0, 0));
+    ASSERT_EQ(hm.choose(0, 0), 0);
+    ASSERT_EQ(hm.probes(0, 0), 11);
+
+    // a new failure starts over from the minimum backoff
+    hm.report_failure(0, 0);
+    ASSERT_EQ(hm.trips(0, 0), 2);
+    ASSERT_EQ(hm.backoff_ms(0, 0), BACKOFF_MIN_MS);
+}
+
+TEST_F(Health_Monitor_Fixture, StalledTime) {
+    HealthMonitor hm(reg, probe());
+    hm.report_failure(0, 0);
+    auto t0 = Clock::now();
+    hm.report_skip(0);
+    hm.report_skip(0);
+    ASSERT_EQ(hm.skipped(0), 2);
+    ASSERT_GE(hm.stalled(0, t0 + std::chrono::seconds(5)).count(), 5000000);
+
+    up[0][0] = true;
+    hm.probe_due(t0 + std::chrono::seconds(10));
+    auto stalled = hm.stalled(0, t0 + std::chrono::seconds(100));
+    ASSERT_GE(stalled.count(), 10000000);
+    ASSERT_LT(stalled.count(), 11000000);  // stopped counting once the proxy came back
+
+    std::ostringstream os;
+    hm.print_stats(os);
+    ASSERT_NE(os.str().find("one trips=1 skipped=2 stalled_sec=10.0"), std::string::npos);
+    ASSERT_EQ(os.str().find("two"), std::string::npos);
+}
+
+TEST_F(Health_Monitor_Fixture, BackgroundThread) {
+    up[0][0] = true;
+    HealthMonitor hm(reg, probe());
+    hm.start();
+    hm.report_failure(0, 0);
+    for (int i = 0; i < 100 && hm.is_open(0, 0); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ASSERT_FALSE(hm.is_open(0, 0));
+    hm.stop();
+}
+
+TEST(TestCallbacks, ConnectGivesUp) {
+    // nothing listens on port 1, so the callback must fail instead of retrying forever
+    uint8_t buf[256];
+    size_t sz = build_probe_stream(buf, sizeof(buf));
+    ProxyConfig filt;
+    filt.authority = GRAMMAR_AUTH;
+    ASSERT_EQ(callback("127.0.0.1", 1, filt, buf, sz, 1000), nullptr);
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <set>
+#include "../hpack_table.h"
+
+typedef hpack::HPacker::PrefixType PrefType;
+typedef hpack::HPacker::IndexingType IdxType;
+
+#define WITH PrefType::LITERAL_HEADER_WITH_INDEXING
+#define WITHOUT PrefType::LITERAL_HEADER_WITHOUT_INDEXING
+#define IDX PrefType::INDEXED_HEADER
+
+/** Replays strm up to header idx of f into sets, the way H2Mutator used to for every lookup */
+static void reference(const H2Stream &strm, Frame *f, unsigned int idx, std::set<HpackTable::KeyValuePair> &nv_pairs,
+                      std::set<std::string> &names) {
+    for (auto &nv : hpack::hpackStaticTable) {
+        nv_pairs.insert(nv);
+        names.insert(nv.first);
+    }
+    for (auto fr : strm) {
+        if (Frame::has_headers(fr)) {
+            auto *h = dynamic_cast<Headers *>(fr);
+            unsigned int max = fr != f ? h->hdr_pairs.size() : idx;
+            for (unsigned int i = 0; i < max; ++i) {
+                if (h->prefixes[i] == WITH) {
+                    nv_pairs.insert(h->hdr_pairs[i]);
+                    names.insert(h->hdr_pairs[i].first);
+                }
+            }
+        }
+        if (fr == f) {
+            return;
+        }
+    }
+}
+
+static const std::vector<HpackTable::KeyValuePair> CANDIDATES = {
+        {"a", "1"}, {"a", "2"}, {"b", "1"}, {"c", "3"}, {":method", "GET"}, {":method", "PUT"}, {"accept", "x"},
+};
+
+/** Checks every header position of strm against a full replay */
+static void check_all(HpackTable &t, const H2Stream &strm) {
+    for (size_t fi = 0; fi <= strm.size(); ++fi) {
+        Frame *f = fi < strm.size() ? strm[fi] : nullptr;
+        size_t nhdrs = f != nullptr && Frame::has_headers(f) ? dynamic_cast<Headers *>(f)->hdr_pairs.size() : 0;
+        for (unsigned int idx = 0; idx <= nhdrs; ++idx) {
+            std::set<HpackTable::KeyValuePair> nv_pairs;
+            std::set<std::string> names;
+            reference(strm, f, idx, nv_pairs, names);
+            HpackTable::View v = t.before(strm, f, idx);
+            for (const auto &nv : CANDIDATES) {
+                ASSERT_EQ(v.contains(nv), nv_pairs.count(nv) != 0) << fi << " " << idx << " " << nv.first;
+                ASSERT_EQ(v.contains_name(nv.first), names.count(nv.first) != 0) << fi << " " << idx;
+            }
+        }
+    }
+}
+
+class HpackTableTest : public ::testing::Test {
+protected:
+    HeadersFrame h1;
+    DataFrame d;
+    Continuation c;
+    HeadersFrame h2;
+    H2Stream strm;
+
+    void SetUp() override {
+        h1.add_header("a", "1", WITH, IdxType::NONE);
+        h1.add_header("b", "1", WITHOUT, IdxType::NONE);
+        h1.add_header(":method", "PUT", WITH, IdxType::NAME);
+        c.add_header("a", "2", WITH, IdxType::NAME);
+        c.add_header("a", "1", IDX, IdxType::ALL);
+        h2.add_header("c", "3", WITH, IdxType::NONE);
+        h2.add_header("a", "1", WITH, IdxType::NONE);
+        strm = {&h1, &d, &c, &h2};
+    }
+
+    void TearDown() override {
+        strm.clear();
+    }
+};
+
+TEST_F(HpackTableTest, MatchesReplay) {
+    HpackTable t;
+    check_all(t, strm);
+}
+
+TEST_F(HpackTableTest, SimulatesOnlyUpToTheQuery) {
+    HpackTable t;
+    HpackTable::View v = t.before(strm, &c, 1);
+    ASSERT_EQ(t.simulated(), 2);
+    ASSERT_TRUE(v.contains({"a", "2"}));  // earlier in the same frame
+    ASSERT_FALSE(v.contains({"c", "3"}));
+
+    t.before(strm, nullptr, 0);
+    ASSERT_EQ(t.simulated(), strm.size());
+}
+
+TEST_F(HpackTableTest, FramesMovedOrRemoved) {
+    HpackTable t;
+    check_all(t, strm);
+
+    std::swap(strm[0], strm[2]);
+    check_all(t, strm);
+
+    strm.erase(strm.begin());
+    check_all(t, strm);
+
+    strm.insert(strm.begin() + 1, &c);
+    check_all(t, strm);
+}
+
+TEST_F(HpackTableTest, InvalidatedFrameIsRescanned) {
+    HpackTable t;
+    t.before(strm, nullptr, 0);
+
+    h1.prefixes[0] = WITHOUT;
+    t.invalidate(0);
+    check_all(t, strm);
+
+    c.hdr_pairs[0].first = "b";
+    t.invalidate(2);
+    check_all(t, strm);
+}
+
+TEST_F(HpackTableTest, ViewInsertsStayInTheView) {
+    HpackTable t;
+    HpackTable::View v = t.before(strm, &h1, 0);
+    ASSERT_FALSE(v.contains_name("z"));
+    v.insert({"z", "1"});
+    ASSERT_TRUE(v.contains({"z", "1"}));
+    ASSERT_TRUE(v.contains_name("z"));
+    ASSERT_FALSE(t.before(strm, nullptr, 0).contains_name("z"));
+}
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include <mutex>
+#include <set>
+#include "test_mutator_common.h"
+#include "../minimizer.h"
+
+typedef StreamMinimizer::Level Level;
+
+static std::string serialize(H2Stream *strm) {
+    std::vector<char> buf(1 << 16);
+    uint32_t sz = strm->serialize(buf.data(), buf.size());
+    TestMutator::delete_stream(strm);
+    return std::string(buf.data(), sz);
+}
+
+/** Whether the stream has a header named name with the given value */
+static bool has_header(const std::string &stream, const std::string &name, const std::string &value) {
+    H2Stream *strm = StreamMinimizer::parse(stream);
+    bool found = false;
+    for (Frame *f : *strm) {
+        if (Frame::has_headers(f)) {
+            for (const auto &h : dynamic_cast<Headers *>(f)->hdr_pairs) {
+                found |= h.first == name && h.second == value;
+            }
+        }
+    }
+    StreamMinimizer::delete_stream(strm);
+    return found;
+}
+
+/** Bytes of all DATA frames of the stream */
+static std::string body(const std::string &stream) {
+    H2Stream *strm = StreamMinimizer::parse(stream);
+    std::string out;
+    for (Frame *f : *strm) {
+        if (f->type == DATA) {
+            auto &d = dynamic_cast<DataFrame *>(f)->data;
+            out.append(d.begin(), d.end());
+        }
+    }
+    StreamMinimizer::delete_stream(strm);
+    return out;
+}
+
+TEST(StreamMinimizer, CountAndRemove) {
+    std::string s = serialize(TestMutator::get_stream1());
+    EXPECT_EQ(StreamMinimizer::count(s, Level::LVL_FRAMES), 6);
+    EXPECT_EQ(StreamMinimizer::count(s, Level::LVL_HEADERS), 10);
+    EXPECT_EQ(StreamMinimizer::count(s, Level::LVL_SETTINGS), 3);
+    EXPECT_EQ(StreamMinimizer::count(s, Level::LVL_BODY), 12);
+
+    // parts are numbered across frames
+    H2Stream *strm = StreamMinimizer::parse(s);
+    StreamMinimizer::remove(*strm, Level::LVL_BODY, 6, 10);
+    ASSERT_EQ(dynamic_cast<DataFrame *>(strm->at(1))->data.size(), 6);
+    ASSERT_EQ(dynamic_cast<DataFrame *>(strm->at(2))->data, std::vector<char>({'\xbe', '\xef'}));
+    StreamMinimizer::remove(*strm, Level::LVL_HEADERS, 3, 5);
+    ASSERT_EQ(dynamic_cast<Headers *>(strm->at(0))->hdr_pairs.size(), 3);
+    ASSERT_EQ(dynamic_cast<Headers *>(strm->at(4))->hdr_pairs[0].first, ":path");
+    StreamMinimizer::remove(*strm, Level::LVL_FRAMES, 1, 4);
+    ASSERT_EQ(strm->size(), 3);
+    ASSERT_EQ(strm->at(1)->type, CONTINUATION);
+    StreamMinimizer::delete_stream(strm);
+}
+
+TEST(StreamMinimizer, KeepsOnlyWhatTheOracleNeeds) {
+    std::string s = serialize(TestMutator::get_stream1());
+    std::mutex mu;
+    std::set<std::string> seen;
+    StreamMinimizer m([&](const std::string &cand) {
+        std::lock_guard<std::mutex> lock(mu);
+        seen.insert(cand);
+        return has_header(cand, "hdr1", "value1") && body(cand).find('\xad') != std::string::npos;
+    }, 4);
+    std::string min = m.minimize(s);
+
+    H2Stream *strm = StreamMinimizer::parse(min);
+    ASSERT_EQ(strm->size(), 2);
+    EXPECT_EQ(strm->at(0)->type, DATA);
+    EXPECT_EQ(dynamic_cast<DataFrame *>(strm->at(0))->data, std::vector<char>({'\xad'}));
+    EXPECT_EQ(strm->at(1)->type, CONTINUATION);
+    EXPECT_EQ(dynamic_cast<Headers *>(strm->at(1))->hdr_pairs.size(), 1);
+    StreamMinimizer::delete_stream(strm);
+
+    EXPECT_GE(m.tested(), seen.size());
+    EXPECT_EQ(seen.count(s), 0);  // the original is never tested
+}
+
+TEST(StreamMinimizer, SameResultWithOneThread) {
+    std::string s = serialize(TestMutator::get_stream2());
+    auto oracle = [](const std::string &cand) {
+        return StreamMinimizer::count(cand, Level::LVL_HEADERS) >= 2 && !body(cand).empty();
+    };
+    StreamMinimizer one(oracle, 1), many(oracle, 8);
+    std::string min = one.minimize(s);
+    EXPECT_EQ(min, many.minimize(s));
+    EXPECT_LT(min.size(), s.size());
+}
+
+TEST(StreamMinimizer, NothingToRemove) {
+    std::string s = serialize(TestMutator::get_stream1());
+    StreamMinimizer m([](const std::string &) { return false; }, 2);
+    EXPECT_EQ(m.minimize(s), s);
+    EXPECT_THROW(m.minimize(std::string("\x00\x00\x01\xff", 4)), std::exception);
+}
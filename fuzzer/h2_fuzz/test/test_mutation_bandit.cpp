@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include "../mutation_bandit.h"
+
+static H2FuzzConfig config() {
+    H2FuzzConfig cfg;
+    cfg.prob_bit = cfg.prob_delete = cfg.prob_dup = cfg.prob_swap = cfg.prob_fix = 1;
+    cfg.prob_add = cfg.prob_splice = 1;
+    return cfg;
+}
+
+TEST(MutationBandit, CreditedArmIsPickedMoreOften) {
+    H2FuzzConfig cfg = config();
+    MutationBandit b;
+    std::minstd_rand rnd(1);
+    for (int i = 0; i < 20000; ++i) {
+        unsigned int op = b.pick_mut_op(cfg, rnd);
+        b.credit(op == 2 && i % 2 == 0);
+    }
+    unsigned int counts[5] = {};
+    for (int i = 0; i < 5000; ++i) {
+        ++counts[b.pick_mut_op(cfg, rnd)];
+        b.credit(false);
+    }
+    for (int op = 0; op < 5; ++op) {
+        if (op != 2) {
+            ASSERT_GT(counts[2], 2 * counts[op]) << op;
+            ASSERT_GT(counts[op], 0) << op;  // still explored
+        }
+    }
+}
+
+TEST(MutationBandit, DisabledArmIsNeverPicked) {
+    H2FuzzConfig cfg = config();
+    cfg.prob_swap = 0;
+    cfg.prob_splice = 0;
+    MutationBandit b;
+    std::minstd_rand rnd(2);
+    for (int i = 0; i < 5000; ++i) {
+        ASSERT_NE(b.pick_mut_op(cfg, rnd), 3);
+        ASSERT_EQ(b.pick_cross_op(cfg, rnd), 0);
+        b.credit(true);
+    }
+}
+
+TEST(MutationBandit, DiscardDoesNotCredit) {
+    H2FuzzConfig cfg = config();
+    MutationBandit b;
+    std::minstd_rand rnd(3);
+    for (int i = 0; i < 20000; ++i) {
+        unsigned int op = b.pick_cross_op(cfg, rnd);
+        if (op == 1) {
+            b.discard();
+            b.credit(true);  // nothing left to credit
+        } else {
+            b.credit(i % 4 == 0);
+        }
+    }
+    unsigned int add = 0;
+    for (int i = 0; i < 2000; ++i) {
+        add += b.pick_cross_op(cfg, rnd) == 0;
+        b.credit(false);
+    }
+    ASSERT_GT(add, 1500);
+}
+
+TEST(MutationBandit, FieldsStayInRange) {
+    MutationBandit b;
+    std::minstd_rand rnd(4);
+    std::vector<FieldRep> fields = {FieldRep(Length, BASE), FieldRep(Flags, BASE), FieldRep(Padding, PAD)};
+    std::vector<FieldRep> many(BANDIT_MAX_FIELDS + 1, FieldRep(Data, DATA));
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_LT(b.pick_field(HEADERS, fields, rnd), fields.size());
+        ASSERT_LT(b.pick_field(DATA, many, rnd), many.size());
+        ASSERT_LT(b.pick_field(0xfa, fields, rnd), fields.size());
+        b.credit(i % 3 == 0);
+    }
+}
+
+TEST(MutationBandit, ConfigKeys) {
+    ASSERT_EQ(H2FuzzConfig::frame_key(DATA), "data");
+    ASSERT_EQ(H2FuzzConfig::frame_key(CONTINUATION), "continuation");
+    ASSERT_EQ(H2FuzzConfig::field_key(FieldRep(Padding, PAD)), "padding/pad");
+}
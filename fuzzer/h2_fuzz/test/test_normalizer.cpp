@@ -351,4 +351,16 @@ TEST_F(Normalize_Fixture, AllFieldsNormalizedToZero) {
     EXPECT_EQ(v[1]->body_hash, 0);
 
     del_hc(v);
-}
\ No newline at end of file
+}
+
+TEST_F(Normalize_Fixture, ExtraValuesNormalizedOnlyWhenPresent) {
+    // both requests have an extra TE value, but only the second one has an extra Connection value
+    const char *req1 = "POST /a HTTP/1.1\r\nTransfer-Encoding: a\r\nTransfer-Encoding: b\r\nConnection: a\r\n\r\n";
+    const char *req2 = "POST /a HTTP/1.1\r\nTransfer-Encoding: a\r\nTransfer-Encoding: b\r\nConnection: a\r\n"
+                       "Connection: b\r\n\r\n";
+    auto v = parse_hash_normalize_two(req1, req2);
+    ASSERT_EQ(v[0]->rem_conn_hash, 0);  // nothing to normalize
+    ASSERT_EQ(v[1]->rem_conn_hash, 0);  // the only value, so it is its own mean
+    ASSERT_NE(v[0]->hash_full(), v[1]->hash_full());
+    del_hc(v);
+}
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include "test_registry_common.h"
+
+TEST(Test_Proxy_Registry, DefaultFile) {
+    ProxyRegistry reg;
+    ASSERT_EQ(reg.load(PROX_REGISTRY_FILE), 0);
+    ASSERT_EQ(reg.size(), 11);
+    ASSERT_EQ(reg[0].name, "nginx");
+    ASSERT_EQ(reg[0].replicas.size(), 1);
+    ASSERT_EQ(reg[0].replicas[0].addr, "172.17.0.3");
+    ASSERT_EQ(reg[0].replicas[0].port, 9090);
+    ASSERT_FALSE(reg[0].filter.host.empty());
+    ASSERT_EQ(reg[10].name, "openlitespeed");
+    ASSERT_NE(reg.find("varnish"), nullptr);
+    ASSERT_EQ(reg.find("nonexistent"), nullptr);
+}
+
+TEST(Test_Proxy_Registry, Defaults) {
+    ProxyRegistry reg;
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"p\"; addrs = [\"10.0.0.1\", \"10.0.0.2\"]; filter = \"test_2\"; } );"), 0);
+    ASSERT_EQ(reg.size(), 1);
+    ASSERT_EQ(reg.policy(), ReplicaPolicy::HASH);
+    ASSERT_EQ(reg[0].replicas.size(), 2);
+    ASSERT_EQ(reg[0].replicas[0].port, DEFAULT_PORT);
+    ASSERT_EQ(reg[0].replicas[1].addr, "10.0.0.2");
+    ASSERT_EQ(reg[0].deadline_ms, DEFAULT_DEADLINE_MS);
+    ASSERT_EQ(reg[0].max_inflight, 0);
+    ASSERT_TRUE(reg[0].enabled);
+    ASSERT_EQ(reg[0].filter.host, "INCOMING_HOST");
+    ASSERT_EQ(reg[0].filter.authority, "OUTGOING_AUTH");
+    ASSERT_EQ(reg[0].filter.headers.size(), 3);
+}
+
+TEST(Test_Proxy_Registry, Overrides) {
+    ProxyRegistry reg;
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1\"]; port = 8443; deadline_ms = 500; } );"), 0);
+    ASSERT_EQ(reg[0].replicas[0].port, 8443);
+    ASSERT_EQ(reg[0].deadline_ms, 500);
+    ASSERT_EQ(reg[0].filter.host, "HOST_VAL");  // filter defaults to the proxy name
+}
+
+TEST(Test_Proxy_Registry, Replicas) {
+    ProxyRegistry reg;
+    ASSERT_EQ(load_string(reg, "replica_policy = \"least_loaded\";"
+                               "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1\", \"10.0.0.2:9091\"]; port = 8443; } );"), 0);
+    ASSERT_EQ(reg.policy(), ReplicaPolicy::LEAST_LOADED);
+    ASSERT_EQ(reg[0].replicas.size(), 2);
+    ASSERT_EQ(reg[0].replicas[0].to_string(), "10.0.0.1:8443");
+    ASSERT_EQ(reg[0].replicas[1].to_string(), "10.0.0.2:9091");
+
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1:\"]; } );"), ERR_REG_PORT);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1:0\"]; } );"), ERR_REG_PORT);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1:x\"]; } );"), ERR_REG_PORT);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1\"]; max_inflight = -1; } );"),
+              ERR_REG_LIMIT);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1\"]; deadline_ms = 0; } );"),
+              ERR_REG_DEADLINE);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1\"]; deadline_ms = -5; } );"),
+              ERR_REG_DEADLINE);
+    ASSERT_EQ(load_string(reg, "replica_policy = \"random\"; proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1\"]; } );"),
+              ERR_REG_POLICY);
+}
+
+TEST(Test_Proxy_Registry, DisabledSkipped) {
+    ProxyRegistry reg;
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"a\"; addrs = [\"10.0.0.1\"]; filter = \"test_1\"; enabled = false; },"
+                               "            { name = \"b\"; addrs = [\"10.0.0.2\"]; filter = \"test_1\"; } );"), 0);
+    ASSERT_EQ(reg.size(), 1);
+    ASSERT_EQ(reg[0].name, "b");
+
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"a\"; addrs = [\"10.0.0.1\"]; filter = \"test_1\"; enabled = false; } );"),
+              ERR_REG_EMPTY);
+    ASSERT_TRUE(reg.empty());
+}
+
+TEST(Test_Proxy_Registry, Errors) {
+    ProxyRegistry reg;
+    ASSERT_EQ(reg.load("/nonexistent/proxies.conf"), ERR_REG_READ);
+    ASSERT_EQ(load_string(reg, "other = 1;"), ERR_REG_LIST);
+    ASSERT_EQ(load_string(reg, "proxies = ( { addrs = [\"10.0.0.1\"]; } );"), ERR_REG_NAME);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; } );"), ERR_REG_ADDR);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = []; } );"), ERR_REG_ADDR);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1\"]; port = 70000; } );"), ERR_REG_PORT);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"p\"; addrs = [\"10.0.0.1\"]; filter = \"no_such_filter\"; } );"),
+              ERR_REG_FILTER);
+    ASSERT_EQ(load_string(reg, "proxies = ( { name = \"test_1\"; addrs = [\"10.0.0.1\"]; },"
+                               "            { name = \"test_1\"; addrs = [\"10.0.0.2\"]; } );"), ERR_REG_DUP);
+    ASSERT_TRUE(reg.empty());
+}
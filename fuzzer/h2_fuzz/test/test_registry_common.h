@@ -0,0 +1,27 @@
+#ifndef NEZHA_TEST_REGISTRY_COMMON_H
+#define NEZHA_TEST_REGISTRY_COMMON_H
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include "../proxy_registry.h"
+
+/** Writes the given registry contents to a temporary file and returns its name */
+inline std::string write_registry(const std::string &contents) {
+    char fn[] = "/tmp/h2fuzz_registry_XXXXXX";
+    int fd = mkstemp(fn);
+    close(fd);
+    std::ofstream out(fn);
+    out << contents;
+    return fn;
+}
+
+/** Loads the given registry contents into reg. Returns the result of ProxyRegistry::load */
+inline int load_string(ProxyRegistry &reg, const std::string &contents) {
+    std::string fn = write_registry(contents);
+    int ret = reg.load(fn);
+    unlink(fn.c_str());
+    return ret;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+#include "../replica_selector.h"
+#include "test_registry_common.h"
+
+/** Builds a registry with a single proxy "test_1" served by the given replicas */
+static void make_registry(ProxyRegistry &reg, const std::string &addrs, const std::string &policy = "hash") {
+    ASSERT_EQ(load_string(reg, "replica_policy = \"" + policy + "\"; proxies = ( { name = \"test_1\"; addrs = [" + addrs +
+                               "]; } );"), 0);
+}
+
+TEST(Test_Replica_Selector, SingleReplica) {
+    ProxyRegistry reg;
+    make_registry(reg, "\"10.0.0.1\"");
+    for (uint64_t w = 0; w < 16; ++w) {
+        ReplicaSelector sel(reg, reg.policy(), w);
+        ASSERT_EQ(sel.pick(0), 0);
+    }
+}
+
+TEST(Test_Replica_Selector, HashIsStickyAndSpread) {
+    ProxyRegistry reg;
+    make_registry(reg, "\"10.0.0.1\", \"10.0.0.2\", \"10.0.0.3\"");
+
+    std::vector<int> counts(3, 0);
+    for (uint64_t w = 0; w < 300; ++w) {
+        ReplicaSelector sel(reg, reg.policy(), w);
+        size_t rep = sel.pick(0);
+        ASSERT_EQ(sel.pick(0), rep);  // a worker always uses the same replica
+        sel.record(0, rep, 1000, true, false);
+        ASSERT_EQ(sel.pick(0), rep);
+        counts[rep]++;
+    }
+    for (int c : counts) {
+        ASSERT_GT(c, 50);  // 100 expected per replica
+    }
+}
+
+TEST(Test_Replica_Selector, HashSpreadsThreads) {
+    ProxyRegistry reg;
+    make_registry(reg, "\"10.0.0.1\", \"10.0.0.2\", \"10.0.0.3\"");
+    ReplicaSelector sel(reg, reg.policy(), 7);
+    ASSERT_EQ(sel.pick(0), ReplicaSelector::ring_lookup(reg[0], 7));  // the first thread keeps the worker's replica
+
+    // the other fuzzing threads of the same worker each stick to a replica of their own
+    std::vector<size_t> picks(90);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < picks.size(); ++t) {
+        threads.emplace_back([&sel, &picks, t]() {
+            picks[t] = sel.pick(0);
+            for (int i = 0; i < 10; ++i) {
+                if (sel.pick(0) != picks[t]) {
+                    picks[t] = SIZE_MAX;
+                }
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    std::vector<int> counts(3, 0);
+    for (size_t rep : picks) {
+        ASSERT_LT(rep, 3);
+        counts[rep]++;
+    }
+    for (int c : counts) {
+        ASSERT_GT(c, 15);  // 30 expected per replica
+    }
+
+    // thread keys of different workers do not coincide
+    std::set<uint64_t> keys;
+    for (uint64_t w = 0; w < 16; ++w) {
+        for (uint64_t t = 0; t < 16; ++t) {
+            keys.insert(ReplicaSelector::thread_key(w, t));
+        }
+    }
+    ASSERT_EQ(keys.size(), 256);
+}
+
+TEST(Test_Replica_Selector, HashIsConsistent) {
+    ProxyRegistry three, four;
+    make_registry(three, "\"10.0.0.1\", \"10.0.0.2\", \"10.0.0.3\"");
+    make_registry(four, "\"10.0.0.1\", \"10.0.0.2\", \"10.0.0.3\", \"10.0.0.4\"");
+
+    // adding a replica only moves workers onto the new replica, never between existing ones
+    int moved = 0;
+    for (uint64_t w = 0; w < 300; ++w) {
+        size_t before = ReplicaSelector::ring_lookup(three[0], w);
+        size_t after = ReplicaSelector::ring_lookup(four[0], w);
+        if (before != after) {
+            ASSERT_EQ(after, 3);
+            moved++;
+        }
+    }
+    ASSERT_GT(moved, 0);
+    ASSERT_LT(moved, 150);
+}
+
+TEST(Test_Replica_Selector, LeastLoaded) {
+    ProxyRegistry reg;
+    make_registry(reg, "\"10.0.0.1\", \"10.0.0.2\"", "least_loaded");
+    ReplicaSelector sel(reg, reg.policy(), 0);
+
+    // every replica is tried once before latencies are compared
+    size_t first = sel.pick(0);
+    sel.record(0, first, first == 0 ? 50000 : 1000, true, false);
+    size_t second = sel.pick(0);
+    ASSERT_NE(first, second);
+    sel.record(0, second, second == 0 ? 50000 : 1000, true, false);
+
+    // the slow replica is avoided, but re-probed once its latency estimate has decayed
+    int slow = 0;
+    for (int i = 0; i < 1000; ++i) {
+        size_t rep = sel.pick(0);
+        sel.record(0, rep, rep == 0 ? 50000 : 1000, true, false);
+        slow += rep == 0;
+    }
+    ASSERT_GT(slow, 0);
+    ASSERT_LT(slow, 100);
+}
+
+TEST(Test_Replica_Selector, Stats) {
+    ProxyRegistry reg;
+    make_registry(reg, "\"10.0.0.1\", \"10.0.0.2:9091\"");
+    ReplicaSelector sel(reg, reg.policy(), 0);
+
+    sel.record(0, 1, 1000, true, false);
+    sel.record(0, 1, 1000, true, true);
+    sel.record(0, 1, 2000, false, false);
+    ASSERT_EQ(sel.stats(0, 1).execs, 3);
+    ASSERT_EQ(sel.stats(0, 1).noresp, 1);
+    ASSERT_EQ(sel.stats(0, 1).failed, 1);
+    ASSERT_EQ(sel.stats(0, 1).busy_us, 4000);
+    ASSERT_EQ(sel.stats(0, 0).execs, 0);
+
+    std::ostringstream os;
+    sel.print_stats(os);
+    ASSERT_NE(os.str().find("test_1 10.0.0.2:9091 execs=3 noresp=1 failed=1 exec_per_sec=750.0"), std::string::npos);
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include "../response_dictionary.h"
+
+static std::vector<HashComp*> parse_all(const std::vector<std::string> &reqs) {
+    ProxyConfig f;
+    f.host = "localhost";
+    std::vector<HashComp*> out;
+    for (const auto &r : reqs) {
+        H1Parser hp;
+        auto *hc = new HashComp();
+        hp.parse(r.c_str(), r.length());
+        hc->parse(hp, f);
+        hc->orig = r;
+        out.push_back(hc);
+    }
+    return out;
+}
+
+static void harvest(ResponseDictionary &d, const std::vector<std::string> &reqs) {
+    auto v = parse_all(reqs);
+    ResultMatrix m;
+    m.load(v.data(), (int) v.size());
+    d.harvest(v.data(), (int) v.size(), m);
+    for (auto *hc : v) {
+        delete hc;
+    }
+}
+
+static bool has(const std::vector<std::string> &v, const std::string &s) {
+    return std::find(v.begin(), v.end(), s) != v.end();
+}
+
+TEST(ResponseDictionary, ClassifyHeader) {
+    ASSERT_EQ(classify_header(":method"), HC_METHOD);
+    ASSERT_EQ(classify_header(":METHOD"), HC_METHOD);
+    ASSERT_EQ(classify_header(" :method"), HC_OTHER);
+    ASSERT_EQ(classify_header(":status"), HC_STATUS);
+    ASSERT_EQ(classify_header(":scheme"), HC_SCHEME);
+    ASSERT_EQ(classify_header(" Transfer-Encoding\t"), HC_TE);
+    ASSERT_EQ(classify_header("te"), HC_TE);
+    ASSERT_EQ(classify_header("tex"), HC_OTHER);
+    ASSERT_EQ(classify_header("Connection"), HC_CONNECTION);
+    ASSERT_EQ(classify_header("connection "), HC_OTHER);
+    ASSERT_EQ(classify_header("content-length "), HC_CL);
+    ASSERT_EQ(classify_header("expect"), HC_EXPECT);
+    ASSERT_EQ(classify_header(":authority"), HC_AUTHORITY);
+    ASSERT_EQ(classify_header(":path"), HC_AUTHORITY);
+    ASSERT_EQ(classify_header(" HOST"), HC_AUTHORITY);
+    ASSERT_EQ(classify_header("x-foo"), HC_OTHER);
+}
+
+TEST(ResponseDictionary, HarvestsTokens) {
+    ResponseDictionary d;
+    ASSERT_EQ(d.tables(), nullptr);
+    const char *req = "POST /a HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: gzip ,  chunked\r\n"
+                      "X-Foo:\tbar\r\n\r\n0\r\n\r\n";
+    harvest(d, {req, req});
+    d.rebuild();
+    auto t = d.tables();
+    ASSERT_NE(t, nullptr);
+    ASSERT_EQ(t->version, 1);
+    ASSERT_TRUE(has(t->values[HC_METHOD], "POST"));
+    ASSERT_TRUE(has(t->values[HC_AUTHORITY], "localhost"));
+    ASSERT_TRUE(has(t->values[HC_TE], "gzip"));
+    ASSERT_TRUE(has(t->values[HC_TE], "chunked"));
+    ASSERT_TRUE(has(t->values[HC_OTHER], "bar"));
+    ASSERT_EQ(t->separators, std::vector<std::string>{" ,  "});
+    ASSERT_TRUE(has(t->words, "Transfer-Encoding"));
+    ASSERT_TRUE(has(t->words, ":\t"));
+    ASSERT_TRUE(has(t->words, ": "));
+    ASSERT_FALSE(has(t->words, "0"));  // body
+    ASSERT_EQ(t->words.size(), t->word_data.size());
+    for (size_t i = 0; i < t->words.size(); ++i) {
+        ASSERT_EQ(std::string(t->word_data[i], t->word_sizes[i]), t->words[i]);
+    }
+}
+
+TEST(ResponseDictionary, DisagreementsRankFirst) {
+    ResponseDictionary d;
+    for (int i = 0; i < 10; ++i) {
+        harvest(d, {"GET / HTTP/1.1\r\nTransfer-Encoding: identity\r\n\r\n",
+                    "GET / HTTP/1.1\r\nTransfer-Encoding: identity\r\n\r\n"});
+    }
+    harvest(d, {"GET / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+                "GET / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n"});
+    // a disagreement on another field does not count for Transfer-Encoding
+    harvest(d, {"GET /a HTTP/1.1\r\nTransfer-Encoding: deflate\r\n\r\n",
+                "GET /b HTTP/1.1\r\nTransfer-Encoding: deflate\r\n\r\n"});
+    d.rebuild();
+    auto t = d.tables();
+    std::vector<std::string> expected{"chunked", "gzip", "identity", "deflate"};
+    ASSERT_EQ(t->values[HC_TE], expected);
+    ASSERT_EQ(t->values[HC_METHOD], std::vector<std::string>{"GET"});
+}
+
+TEST(ResponseDictionary, LongTokensAreSkipped) {
+    ResponseDictionary d;
+    std::string big(DICT_MAX_TOKEN_LEN + 1, 'a');
+    harvest(d, {"GET / HTTP/1.1\r\nX-Big: " + big + "\r\n" + big + ": x\r\n\r\n"});
+    d.rebuild();
+    for (const auto &w : d.tables()->words) {
+        ASSERT_LE(w.size(), DICT_MAX_TOKEN_LEN);
+    }
+    ASSERT_TRUE(has(d.tables()->words, "X-Big"));
+}
+
+TEST(ResponseDictionary, PrunesGarbageWhenFull) {
+    ResponseDictionary d;
+    harvest(d, {"GET / HTTP/1.1\r\nConnection: close\r\n\r\n"});
+    harvest(d, {"GET / HTTP/1.1\r\nConnection: close\r\n\r\n"});
+    for (int i = 0; d.size() < DICT_MAX_TOKENS; ++i) {
+        harvest(d, {"GET / HTTP/1.1\r\nX-" + std::to_string(i) + ": v" + std::to_string(i) + "\r\n\r\n"});
+    }
+    d.rebuild();
+    ASSERT_LT(d.size(), 16);
+    ASSERT_TRUE(has(d.tables()->values[HC_CONNECTION], "close"));
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include "fake_proxy.h"
+#include "../callbacks.h"
+#include "../response_memo.h"
+
+#define TEST_H1 "POST /a HTTP/1.1\r\nHost: localhost\r\nHost: other\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n"
+
+static HashComp *parse(const std::string &h1, ResponseMemo *memo, bool timeout = false) {
+    ProxyConfig filt;
+    std::string resp = FakeProxy::echo_response(h1);
+    return parse_response(filt, resp.data(), resp.size(), timeout, memo);
+}
+
+TEST(ResponseMemo, CloneIsDeep) {
+    std::unique_ptr<HashComp> hc(parse(TEST_H1, nullptr));
+    std::unique_ptr<HashComp> copy(hc->clone());
+    ASSERT_TRUE(*hc == *copy);
+    ASSERT_EQ(hc->hash_full(), copy->hash_full());
+    ASSERT_NE(hc->te_str, copy->te_str);
+    ASSERT_NE(hc->body_str, copy->body_str);
+    hc.reset();
+    ASSERT_EQ(*copy->body_str, "abc");
+}
+
+TEST(ResponseMemo, HitMatchesFullParse) {
+    ResponseMemo memo;
+    std::unique_ptr<HashComp> full(parse(TEST_H1, nullptr));
+    std::unique_ptr<HashComp> miss(parse(TEST_H1, &memo));
+    std::unique_ptr<HashComp> hit(parse(TEST_H1, &memo, true));
+    ASSERT_EQ(memo.misses(), 1);
+    ASSERT_EQ(memo.hits(), 1);
+
+    ASSERT_TRUE(*full == *miss);
+    ASSERT_TRUE(*full == *hit);
+    ASSERT_EQ(full->hash_full(), hit->hash_full());
+    ASSERT_EQ(full->rem_host_str, hit->rem_host_str);
+    ASSERT_EQ(hit->orig, TEST_H1);
+    ASSERT_TRUE(hit->timeout_err);  // flags come from the exchange, not from the memo
+    ASSERT_FALSE(miss->timeout_err);
+}
+
+TEST(ResponseMemo, DifferentRequestsMiss) {
+    ResponseMemo memo;
+    delete parse("GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n", &memo);
+    delete parse("GET /b HTTP/1.1\r\nHost: localhost\r\n\r\n", &memo);
+    ASSERT_EQ(memo.misses(), 2);
+    ASSERT_EQ(memo.hits(), 0);
+    ASSERT_EQ(memo.find("GET /c HTTP/1.1\r\n\r\n"), nullptr);
+}
+
+TEST(ResponseMemo, ErrorsAreNotMemoized) {
+    ResponseMemo memo;
+    ProxyConfig filt;
+    delete parse_response(filt, "", 0, true, &memo);
+    ASSERT_EQ(memo.misses(), 0);
+    ASSERT_EQ(memo.hits(), 0);
+}
+
+TEST(ResponseMemo, OldEntriesAgeOut) {
+    ResponseMemo memo(2);
+    HashComp hcs[4];
+    const char *reqs[] = {"a", "b", "c", "d"};
+    for (int i = 0; i < 4; ++i) {
+        hcs[i].orig = reqs[i];
+    }
+    memo.add(hcs[0]);
+    memo.add(hcs[1]);
+    memo.add(hcs[2]);  // a and b become the previous generation
+    ASSERT_NE(std::unique_ptr<HashComp>(memo.find("a")), nullptr);  // and a moves back to the current one
+    memo.add(hcs[3]);  // drops b
+
+    ASSERT_EQ(std::unique_ptr<HashComp>(memo.find("b")), nullptr);
+    ASSERT_NE(std::unique_ptr<HashComp>(memo.find("a")), nullptr);
+    ASSERT_NE(std::unique_ptr<HashComp>(memo.find("c")), nullptr);
+    ASSERT_NE(std::unique_ptr<HashComp>(memo.find("d")), nullptr);
+}
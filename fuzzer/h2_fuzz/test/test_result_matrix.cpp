@@ -0,0 +1,210 @@
+#include <gtest/gtest.h>
+#include "../normalizer.h"
+
+static std::vector<HashComp*> parse_all(const std::vector<std::string> &reqs) {
+    ProxyConfig f;
+    f.host = "localhost";
+    std::vector<HashComp*> out;
+    for (const auto &r : reqs) {
+        H1Parser hp;
+        auto *hc = new HashComp();
+        hp.parse(r.c_str(), r.length());
+        hc->parse(hp, f);
+        hc->hash_indiv();
+        out.push_back(hc);
+    }
+    return out;
+}
+
+static void del_all(const std::vector<HashComp*> &v) {
+    for (auto *hc : v) {
+        delete hc;
+    }
+}
+
+/** Normalizes one member the way the normalizer did before it went through a matrix */
+template <typename Pred>
+static void reference_one(std::vector<HashComp*> &v, size_t HashComp::*h, Pred present) {
+    size_t sum = 0, n = 0;
+    for (auto *hc : v) {
+        if (present(hc)) {
+            sum += hc->*h;
+            ++n;
+        }
+    }
+    for (auto *hc : v) {
+        if (present(hc)) {
+            hc->*h = hc->*h * n - sum;
+        }
+    }
+}
+
+static void reference_normalize(std::vector<HashComp*> &v) {
+    reference_one(v, &HashComp::method_hash, [](HashComp *hc) { return hc->reqline_str != nullptr; });
+    for (const auto &f : HASHCOMP_FIELDS) {
+        if (f.policy & FIELD_NORM_VALUE) {
+            reference_one(v, f.hash, [&f](HashComp *hc) { return hc->*f.str != nullptr && *(hc->*f.str) != " 0"; });
+        }
+        if (f.policy & FIELD_NORM_REM) {
+            reference_one(v, f.rem_hash, [&f](HashComp *hc) { return !(hc->*f.rem).empty(); });
+        }
+    }
+    reference_one(v, &HashComp::body_hash,
+                  [](HashComp *hc) { return hc->body_str != nullptr && !hc->body_str->empty(); });
+}
+
+static const std::vector<std::string> REQS = {
+        "POST /a HTTP/1.1\r\nHost: localhost\r\nContent-Length: 3\r\n\r\nabc",
+        "POST /a HTTP/1.1\r\nHost: localhost, other\r\nContent-Length: 0\r\n\r\n",
+        "GET /b HTTP/1.0\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: x\r\n\r\n3\r\nabc\r\n0\r\n\r\n",
+        "PUT /a HTTP/1.1\r\nConnection: close\r\nConnection: a\r\nExpect: 100-continue\r\nExpect: b\r\n\r\nxyz",
+        "",
+        "POST /a HTTP/1.1\r\nHost: localhost\r\nContent-Length: 3\r\n\r\nabc",
+};
+
+TEST(ResultMatrix, NormalizeMatchesReference) {
+    auto expected = parse_all(REQS);
+    auto actual = parse_all(REQS);
+    reference_normalize(expected);
+    Normalizer::normalize(actual.data(), (int) actual.size());
+
+    for (size_t i = 0; i < REQS.size(); ++i) {
+        ASSERT_EQ(expected[i]->method_hash, actual[i]->method_hash) << i;
+        ASSERT_EQ(expected[i]->body_hash, actual[i]->body_hash) << i;
+        for (const auto &f : HASHCOMP_FIELDS) {
+            ASSERT_EQ(expected[i]->*f.hash, actual[i]->*f.hash) << i << " " << f.name;
+            ASSERT_EQ(expected[i]->*f.rem_hash, actual[i]->*f.rem_hash) << i << " " << f.name;
+        }
+        ASSERT_EQ(expected[i]->hash_full(), actual[i]->hash_full()) << i;
+    }
+    del_all(expected);
+    del_all(actual);
+}
+
+TEST(ResultMatrix, HasDiffMatchesOperatorEq) {
+    auto v = parse_all(REQS);
+    v[4]->noresp_err = true;
+    for (size_t i = 0; i < v.size(); ++i) {
+        for (size_t j = 0; j < v.size(); ++j) {
+            HashComp *pair[] = {v[i], v[j]};
+            ResultMatrix m;
+            m.load(pair, 2);
+            ASSERT_EQ(m.has_diff(), *v[i] != *v[j]) << i << " " << j;
+        }
+    }
+    del_all(v);
+}
+
+TEST(ResultMatrix, UncomparedFieldsDoNotMakeADiff) {
+    auto v = parse_all({"GET / HTTP/1.1\r\nConnection: close\r\n\r\n", "GET / HTTP/1.1\r\n\r\n"});
+    ResultMatrix m;
+    m.load(v.data(), 2);
+    ASSERT_FALSE(m.has_diff());
+    ASSERT_EQ(m.disagreement(ResultMatrix::KEY_FIELDS + 2 * 3), 0b10);  // connection, tie goes to the first proxy
+    ASSERT_EQ(m.differing_columns(), 0);
+    ASSERT_EQ(m.signature(), 0);
+    del_all(v);
+}
+
+TEST(ResultMatrix, DisagreementNamesTheOutliers) {
+    const char *same = "POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n";
+    auto v = parse_all({same, same, "POST /a HTTP/1.1\r\nTransfer-Encoding: chunked \r\n\r\n0\r\n\r\n", same});
+    ResultMatrix m;
+    m.load(v.data(), 4);
+    ASSERT_TRUE(m.has_diff());
+    ASSERT_EQ(m.disagreeing_proxies(), 0b0100);
+
+    size_t te = ResultMatrix::KEY_FIELDS + 2 * 2;
+    ASSERT_EQ(ResultMatrix::key_name(te), "transfer-encoding");
+    ASSERT_EQ(ResultMatrix::key_name(te + 1), "transfer-encoding+");
+    ASSERT_EQ(m.disagreement(te), 0b0100);
+    ASSERT_EQ(m.differing_columns(), 1ULL << te);
+    ASSERT_EQ(m.key(te)[0], m.key(te)[3]);
+    del_all(v);
+}
+
+TEST(ResultMatrix, EvenSplitKeepsTheFirstGroup) {
+    auto v = parse_all({"GET /a HTTP/1.1\r\n\r\n", "GET /b HTTP/1.1\r\n\r\n", "GET /b HTTP/1.1\r\n\r\n",
+                        "GET /a HTTP/1.1\r\n\r\n"});
+    ResultMatrix m;
+    m.load(v.data(), 4);
+    ASSERT_EQ(m.disagreement(ResultMatrix::KEY_REQLINE), 0b0110);
+    del_all(v);
+}
+
+TEST(ResultMatrix, MissingBodyIsNotEmptyBody) {
+    auto v = parse_all({"GET / HTTP/1.1\r\n\r\n", "GET / HTTP/1.1\r\n\r\n"});
+    v[1]->body_str = new std::string();
+    ResultMatrix m;
+    m.load(v.data(), 2);
+    ASSERT_NE(m.key(ResultMatrix::KEY_BODY)[0], m.key(ResultMatrix::KEY_BODY)[1]);
+    ASSERT_TRUE(m.has_diff());
+    ASSERT_EQ(m.presence(ResultMatrix::HASH_BODY), 0);  // but neither body is normalized
+    del_all(v);
+}
+
+static uint64_t signature(const std::vector<std::string> &reqs) {
+    auto v = parse_all(reqs);
+    ResultMatrix m;
+    m.load(v.data(), (int) v.size());
+    del_all(v);
+    return m.signature();
+}
+
+TEST(ResultMatrix, SignatureIgnoresValues) {
+    const char *a = "GET /a HTTP/1.1\r\n\r\n";
+    const char *b = "GET /b HTTP/1.1\r\n\r\n";
+    const char *c = "GET /c HTTP/1.1\r\n\r\n";
+    ASSERT_EQ(signature({a, a, a}), 0);
+    ASSERT_NE(signature({a, b, a}), 0);
+
+    // same proxies split the same way on the same field
+    ASSERT_EQ(signature({a, b, a}), signature({b, a, b}));
+    ASSERT_EQ(signature({a, b, a}), signature({c, a, c}));
+
+    // another proxy falls out, or the split is different
+    ASSERT_NE(signature({a, b, a}), signature({a, a, b}));
+    ASSERT_NE(signature({a, b, c}), signature({a, b, a}));
+}
+
+TEST(ResultMatrix, UncomparedSplitsLeaveTheSignatureAlone) {
+    const char *a = "GET /a HTTP/1.1\r\n\r\n";
+    const char *b = "GET /b HTTP/1.1\r\n\r\n";
+    const char *a_close = "GET /a HTTP/1.1\r\nConnection: close\r\n\r\n";
+    const char *b_close = "GET /b HTTP/1.1\r\nConnection: close\r\n\r\n";
+    ASSERT_EQ(signature({a, a_close, a}), 0);  // a Connection-only split is no difference
+    ASSERT_EQ(signature({a, b, a}), signature({a, b_close, a}));
+    ASSERT_EQ(signature({a, b, a}), signature({a_close, b, a}));
+}
+
+TEST(ResultMatrix, SignatureNamesTheField) {
+    ASSERT_NE(signature({"GET /a HTTP/1.1\r\n\r\n", "GET /b HTTP/1.1\r\n\r\n"}),
+              signature({"GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n", "GET /a HTTP/1.1\r\n\r\n"}));
+}
+
+TEST(ResultMatrix, IgnoreLeavesOutUnstableProxies) {
+    const char *a = "GET /a HTTP/1.1\r\n\r\n";
+    auto v = parse_all({a, "GET /b HTTP/1.1\r\n\r\n", a});
+    ResultMatrix m;
+    m.load(v.data(), 3);
+    uint64_t sig = m.signature();
+
+    uint64_t unstable[ResultMatrix::KEY_COLS] = {};
+    unstable[ResultMatrix::KEY_REQLINE] = 0b001;  // not the proxy that disagrees
+    m.ignore(unstable);
+    ASSERT_TRUE(m.has_diff());
+    ASSERT_EQ(m.signature(), sig);
+    ASSERT_EQ(m.ignored_columns(), 0);
+
+    unstable[ResultMatrix::KEY_REQLINE] = 0b010;
+    m.ignore(unstable);
+    ASSERT_FALSE(m.has_diff());
+    ASSERT_EQ(m.signature(), 0);
+    ASSERT_EQ(m.disagreement(ResultMatrix::KEY_REQLINE), 0);
+    ASSERT_EQ(m.ignored_columns(), 1ULL << ResultMatrix::KEY_REQLINE);
+
+    m.ignore(nullptr);
+    ASSERT_EQ(m.signature(), sig);
+    ASSERT_EQ(m.disagreement(ResultMatrix::KEY_REQLINE), 0b010);
+    del_all(v);
+}
@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <thread>
+#include "../result_store.h"
+#include "../normalizer.h"
+
+/** Test fixture that builds normalized HashComps from raw HTTP/1 requests */
+class Result_Store_Fixture : public ::testing::Test {
+protected:
+    std::vector<HashComp*> hcs;
+
+    void build(const std::vector<const char *> &reqs) {
+        ProxyConfig f;
+        f.host = "localhost";
+        for (auto req : reqs) {
+            H1Parser hp;
+            auto *hc = new HashComp();
+            hp.parse(req, strlen(req));
+            hc->parse(hp, f);
+            hc->hash_indiv();
+            hc->orig = req;
+            hc->status = "200";
+            hcs.push_back(hc);
+        }
+        Normalizer::normalize(hcs.data(), (int) hcs.size());
+    }
+
+    static void del_hc(std::vector<HashComp*> &v) {
+        for (auto hc : v) {
+            delete hc;
+        }
+        v.clear();
+    }
+
+    void TearDown() override {
+        del_hc(hcs);
+    }
+};
+
+TEST_F(Result_Store_Fixture, RoundTrip) {
+    build({"GET / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\nConnection: close\r\n\r\nhello",
+           "POST /x HTTP/1.1\r\nHost: localhost, other\r\nTransfer-Encoding: chunked\r\nExpect: 100-continue\r\n\r\n"
+           "5\r\nhello\r\n0\r\n\r\n",
+           "GET / HTTP/1.1\r\n\r\n"});
+    hcs[2]->noresp_err = true;
+    hcs[1]->chnk_err = 3;
+    hcs[0]->timeout_err = true;
+
+    std::string rec = ResultStore::encode(hcs, 42);
+    std::vector<HashComp*> out;
+    ASSERT_TRUE(ResultStore::decode(rec, 42, out));
+    ASSERT_EQ(out.size(), hcs.size());
+    for (size_t i = 0; i < hcs.size(); ++i) {
+        EXPECT_EQ(*out[i], *hcs[i]);
+        EXPECT_EQ(out[i]->hash_full(), hcs[i]->hash_full());
+        EXPECT_EQ(out[i]->to_filedata(), hcs[i]->to_filedata());
+        EXPECT_EQ(out[i]->rem_te_str, hcs[i]->rem_te_str);
+        EXPECT_EQ(out[i]->extra_data, hcs[i]->extra_data);
+        EXPECT_EQ(out[i]->timeout_err, hcs[i]->timeout_err);
+        EXPECT_EQ(out[i]->conn_str == nullptr, hcs[i]->conn_str == nullptr);
+        EXPECT_EQ(out[i]->expect_str == nullptr, hcs[i]->expect_str == nullptr);
+    }
+    del_hc(out);
+}
+
+TEST_F(Result_Store_Fixture, EmptyVsNullStrings) {
+    build({"GET / HTTP/1.1\r\n\r\n"});
+    delete hcs[0]->body_str;
+    hcs[0]->body_str = new std::string();
+
+    std::vector<HashComp*> out;
+    ASSERT_TRUE(ResultStore::decode(ResultStore::encode(hcs, 1), 1, out));
+    ASSERT_NE(out[0]->body_str, nullptr);
+    EXPECT_TRUE(out[0]->body_str->empty());
+    EXPECT_EQ(out[0]->cl_str, nullptr);
+    del_hc(out);
+}
+
+TEST_F(Result_Store_Fixture, StaleFingerprint) {
+    build({"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"});
+    std::vector<HashComp*> out;
+    ASSERT_FALSE(ResultStore::decode(ResultStore::encode(hcs, 1), 2, out));
+    ASSERT_TRUE(out.empty());
+}
+
+TEST_F(Result_Store_Fixture, Malformed) {
+    build({"GET / HTTP/1.1\r\nHost: localhost\r\n\r\nbody"});
+    std::string rec = ResultStore::encode(hcs, 7);
+    std::vector<HashComp*> out;
+    ASSERT_FALSE(ResultStore::decode(rec.substr(0, rec.length() / 2), 7, out));
+    ASSERT_TRUE(out.empty());
+    ASSERT_FALSE(ResultStore::decode("garbage", 7, out));
+    ASSERT_FALSE(ResultStore::decode("", 7, out));
+}
+
+TEST_F(Result_Store_Fixture, CorruptLengths) {
+    build({"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"});
+    hcs[0]->*HASHCOMP_FIELDS[0].rem = {"marker"};
+    std::string rec = ResultStore::encode(hcs, 7);
+    std::vector<HashComp*> out;
+
+    // lengths past the end of the record are a miss, not an allocation of that size
+    std::string bad_str = rec;
+    bad_str.replace(bad_str.find("3 200"), 5, "99999999999999 200");
+    ASSERT_FALSE(ResultStore::decode(bad_str, 7, out));
+    ASSERT_TRUE(out.empty());
+
+    std::string bad_vec = rec;
+    bad_vec.replace(bad_vec.find("1 6 marker"), 10, "99999999999999 6 marker");
+    ASSERT_FALSE(ResultStore::decode(bad_vec, 7, out));
+    ASSERT_TRUE(out.empty());
+
+    ASSERT_TRUE(ResultStore::decode(rec, 7, out));
+    del_hc(out);
+}
+
+TEST_F(Result_Store_Fixture, StoreAndLoad) {
+    char tmpl[] = "/tmp/h2rs_XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    std::string dir(tmpl);
+
+    build({"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n", "GET / HTTP/1.0\r\n\r\n"});
+    ResultStore store(dir, 99);
+    std::vector<HashComp*> out;
+    ASSERT_FALSE(store.load("abc", out));
+    ASSERT_TRUE(store.store("abc", hcs));
+    ASSERT_TRUE(store.load("abc", out));
+    ASSERT_EQ(out.size(), 2);
+    EXPECT_EQ(*out[0], *hcs[0]);
+    EXPECT_EQ(*out[1], *hcs[1]);
+    del_hc(out);
+
+    // a store built for a different proxy config set must not see the entry
+    ResultStore other(dir, 100);
+    ASSERT_FALSE(other.load("abc", out));
+
+    std::remove((dir + "/abc").c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_F(Result_Store_Fixture, ConcurrentStores) {
+    char tmpl[] = "/tmp/h2rs_XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    std::string dir(tmpl);
+
+    build({"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n", "GET / HTTP/1.0\r\n\r\n"});
+    ResultStore store(dir, 99);
+    std::atomic<int> failed{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 50; ++i) {
+                failed += store.store("abc", hcs) ? 0 : 1;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    ASSERT_EQ(failed, 0);
+
+    std::vector<HashComp*> out;
+    ASSERT_TRUE(store.load("abc", out));
+    EXPECT_EQ(*out[1], *hcs[1]);
+    del_hc(out);
+
+    std::remove((dir + "/abc").c_str());
+    ASSERT_EQ(rmdir(dir.c_str()), 0);  // no temporary file was left behind
+}
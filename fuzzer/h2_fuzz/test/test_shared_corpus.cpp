@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <set>
+#include <thread>
+#include "../../nezha-0.1/FuzzerInternal.h"
+
+using fuzzer::ConcurrentTupleSet;
+using fuzzer::Random;
+using fuzzer::ShardedCorpus;
+using fuzzer::Unit;
+using fuzzer::UnitPtr;
+
+static Unit unit(int i) {
+    std::string s = "unit" + std::to_string(i);
+    return Unit(s.begin(), s.end());
+}
+
+TEST(TestSharedCorpus, AddDeduplicatesAcrossShards) {
+    ShardedCorpus corpus(4);
+    ASSERT_TRUE(corpus.Add(0, unit(1)));
+    ASSERT_FALSE(corpus.Add(0, unit(1)));
+    ASSERT_FALSE(corpus.Add(3, unit(1)));  // already added by another thread
+    ASSERT_TRUE(corpus.Add(3, unit(2)));
+    ASSERT_EQ(corpus.size(), 2);
+    ASSERT_TRUE(corpus.Contains(fuzzer::Hash(unit(2))));
+    ASSERT_FALSE(corpus.Contains(fuzzer::Hash(unit(3))));
+}
+
+TEST(TestSharedCorpus, SampleEmpty) {
+    ShardedCorpus corpus(4);
+    Random rand(1);
+    ASSERT_EQ(corpus.Sample(rand), nullptr);
+    ASSERT_EQ(corpus.SampleUniform(rand), nullptr);
+}
+
+TEST(TestSharedCorpus, SampleFavorsRecentUnits) {
+    ShardedCorpus corpus(1);
+    for (int i = 0; i < 10; ++i) {
+        corpus.Add(0, unit(i));
+    }
+    Random rand(1);
+    int first = 0, last = 0;
+    for (int i = 0; i < 10000; ++i) {
+        UnitPtr u = corpus.Sample(rand);
+        ASSERT_NE(u, nullptr);
+        if (*u == unit(0)) {
+            first++;
+        } else if (*u == unit(9)) {
+            last++;
+        }
+    }
+    // weights 1 and 10 out of 55
+    ASSERT_GT(first, 0);
+    ASSERT_GT(last, 5 * first);
+}
+
+TEST(TestSharedCorpus, SampleReachesEveryShard) {
+    ShardedCorpus corpus(4);
+    for (int i = 0; i < 4; ++i) {
+        corpus.Add(i, unit(i));
+    }
+    Random rand(1);
+    std::set<Unit> seen;
+    for (int i = 0; i < 1000; ++i) {
+        seen.insert(*corpus.SampleUniform(rand));
+    }
+    ASSERT_EQ(seen.size(), 4);
+    ASSERT_EQ(corpus.MaxUnitSize(), unit(0).size());
+}
+
+TEST(TestSharedCorpus, ConcurrentAddAndSample) {
+    const int threads = 8;
+    const int per_thread = 500;
+    ShardedCorpus corpus(threads);
+    corpus.Add(0, unit(-1));
+    std::atomic<int> added{0};
+    std::vector<std::thread> v;
+    for (int t = 0; t < threads; ++t) {
+        v.emplace_back([&, t]() {
+            Random rand(t + 1);
+            for (int i = 0; i < per_thread; ++i) {
+                // every unit is offered by two threads, only one of them adds it
+                if (corpus.Add(t, unit((t / 2) * per_thread + i))) {
+                    added++;
+                }
+                ASSERT_NE(corpus.Sample(rand), nullptr);
+            }
+        });
+    }
+    for (auto &th : v) {
+        th.join();
+    }
+    ASSERT_EQ(added, threads / 2 * per_thread);
+    ASSERT_EQ(corpus.size(), threads / 2 * per_thread + 1);
+}
+
+TEST(TestSharedCorpus, EnergyFavorsCheapProductiveUnits) {
+    fuzzer::PowerSchedule ps;
+    fuzzer::UnitStats fresh, cheap, slow, dry;
+    for (int i = 0; i < 200; ++i) {
+        cheap.Record(0.001, false, i % 10 == 0);
+        slow.Record(0.1, false, i % 10 == 0);
+        dry.Record(0.001, false, false);
+        ps.Record(0.001, false, i % 10 == 0);
+        ps.Record(0.1, false, i % 10 == 0);
+        ps.Record(0.001, false, false);
+    }
+    ASSERT_GT(ps.Energy(cheap), 10 * ps.Energy(slow));
+    ASSERT_GT(ps.Energy(cheap), 10 * ps.Energy(dry));
+    // a unit without mutants gets the average of all mutants
+    ASSERT_GT(ps.Energy(fresh), ps.Energy(dry));
+    ASSERT_LT(ps.Energy(fresh), ps.Energy(cheap));
+
+    fuzzer::UnitStats tuples = dry;
+    tuples.NewTuples = 40;
+    ASSERT_GT(ps.Energy(tuples), ps.Energy(dry));
+}
+
+TEST(TestSharedCorpus, SampleByEnergy) {
+    ShardedCorpus corpus(1);
+    Random rand(1);
+    fuzzer::PowerSchedule ps;
+    ShardedCorpus::Ref ref;
+    ASSERT_EQ(corpus.SampleByEnergy(rand, ps, &ref), nullptr);
+    for (int i = 0; i < 4; ++i) {
+        corpus.Add(0, unit(i));
+    }
+    for (int i = 0; i < 4000; ++i) {
+        UnitPtr u = corpus.SampleByEnergy(rand, ps, &ref);
+        ASSERT_EQ(*u, unit(ref.Idx));
+        bool productive = ref.Idx == 2;
+        corpus.Record(ref, 0.001, false, productive && i % 2 == 0);
+        ps.Record(0.001, false, productive && i % 2 == 0);
+    }
+    int counts[4] = {};
+    for (int i = 0; i < 4000; ++i) {
+        corpus.SampleByEnergy(rand, ps, &ref);
+        counts[ref.Idx]++;
+    }
+    for (int i : {0, 1, 3}) {
+        ASSERT_GT(counts[2], 3 * counts[i]) << i;
+        ASSERT_GT(counts[i], 0) << i;
+    }
+}
+
+TEST(TestSharedCorpus, TupleSetInsert) {
+    ConcurrentTupleSet set;
+    ASSERT_TRUE(set.Insert({1, 2, 3}));
+    ASSERT_FALSE(set.Insert({1, 2, 3}));
+    ASSERT_TRUE(set.Insert({3, 2, 1}));
+    ASSERT_EQ(set.size(), 2);
+
+    std::atomic<int> fresh{0};
+    std::vector<std::thread> v;
+    for (int t = 0; t < 4; ++t) {
+        v.emplace_back([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                if (set.Insert({i, i})) {
+                    fresh++;
+                }
+            }
+        });
+    }
+    for (auto &th : v) {
+        th.join();
+    }
+    ASSERT_EQ(fresh, 1000);
+    ASSERT_EQ(set.size(), 1002);
+}
+
+TEST(TestSharedCorpus, SignatureSetInsert) {
+    fuzzer::SignatureSet set;
+    ASSERT_TRUE(set.Insert(0));
+    ASSERT_FALSE(set.Insert(0));
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        ASSERT_TRUE(set.Insert(i * 0x9e3779b97f4a7c15ULL));
+    }
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        ASSERT_FALSE(set.Insert(i * 0x9e3779b97f4a7c15ULL));  // still found after growing
+    }
+    ASSERT_EQ(set.size(), 1001);
+    set.clear();
+    ASSERT_EQ(set.size(), 0);
+    ASSERT_TRUE(set.Insert(0));
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "../shm_ring.h"
+
+class Shm_Ring_Fixture : public ::testing::Test {
+protected:
+    SpscRingHeader hdr{};
+    std::vector<uint8_t> buf;
+
+    SpscRing make(uint64_t cap) {
+        hdr.reset();
+        buf.assign(cap, 0);
+        return SpscRing(&hdr, buf.data(), cap);
+    }
+};
+
+TEST_F(Shm_Ring_Fixture, PushPop) {
+    SpscRing r = make(256);
+    std::vector<uint8_t> out;
+    ASSERT_TRUE(r.empty());
+    ASSERT_FALSE(r.try_pop(out));
+
+    const char a[] = "hello";
+    const char b[] = " world";
+    ASSERT_TRUE(r.try_push(a, 5, b, 6));
+    ASSERT_TRUE(r.try_push(a, 0));  // empty messages are messages too
+    ASSERT_FALSE(r.empty());
+
+    ASSERT_TRUE(r.try_pop(out));
+    ASSERT_EQ(std::string(out.begin(), out.end()), "hello world");
+    ASSERT_TRUE(r.try_pop(out));
+    ASSERT_TRUE(out.empty());
+    ASSERT_TRUE(r.empty());
+}
+
+TEST_F(Shm_Ring_Fixture, FullAndTooLarge) {
+    SpscRing r = make(256);
+    std::vector<uint8_t> msg(r.max_message(), 'x');
+    ASSERT_FALSE(r.try_push(msg.data(), (uint32_t) msg.size() + 1));
+
+    ASSERT_TRUE(r.try_push(msg.data(), (uint32_t) msg.size()));
+    ASSERT_TRUE(r.try_push(msg.data(), 64));
+    ASSERT_FALSE(r.try_push(msg.data(), 64));  // full until the consumer catches up
+
+    std::vector<uint8_t> out;
+    ASSERT_TRUE(r.try_pop(out));
+    ASSERT_EQ(out.size(), msg.size());
+    ASSERT_TRUE(r.try_push(msg.data(), 64));
+}
+
+TEST_F(Shm_Ring_Fixture, WrapAround) {
+    SpscRing r = make(128);
+    std::vector<uint8_t> out;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        uint32_t len = (i * 7) % 50;
+        std::vector<uint8_t> msg(len, (uint8_t) i);
+        ASSERT_TRUE(r.try_push(msg.data(), len)) << i;
+        ASSERT_TRUE(r.try_pop(out)) << i;
+        ASSERT_EQ(out, msg) << i;
+    }
+    ASSERT_TRUE(r.empty());
+}
+
+TEST_F(Shm_Ring_Fixture, AcrossThreads) {
+    SpscRing r = make(4096);
+    const uint32_t n = 200000;
+
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < n; ++i) {
+            uint8_t msg[64];
+            uint32_t len = 4 + i % 60;
+            memcpy(msg, &i, 4);
+            memset(msg + 4, (int) (i & 0xff), len - 4);
+            while (!r.try_push(msg, len)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::vector<uint8_t> out;
+    for (uint32_t i = 0; i < n; ++i) {
+        while (!r.try_pop(out)) {
+            std::this_thread::yield();
+        }
+        ASSERT_EQ(out.size(), 4 + i % 60);
+        uint32_t seq;
+        memcpy(&seq, out.data(), 4);
+        ASSERT_EQ(seq, i);
+        for (size_t k = 4; k < out.size(); ++k) {
+            ASSERT_EQ(out[k], (uint8_t) (i & 0xff));
+        }
+    }
+    producer.join();
+    ASSERT_TRUE(r.empty());
+}
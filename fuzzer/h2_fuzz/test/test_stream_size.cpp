@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+#include "test_mutator_common.h"
+#include "libfuzzer_mutator.h"
+#include "../basedir.h"
+#include "../stream_size.h"
+
+#define WITH PrefType::LITERAL_HEADER_WITH_INDEXING
+#define WITHOUT PrefType::LITERAL_HEADER_WITHOUT_INDEXING
+#define NEVER PrefType::LITERAL_HEADER_NEVER_INDEXED
+#define FULLIDX PrefType::INDEXED_HEADER, IdxType::ALL
+
+/** Serializes strm from scratch, i.e., without the header blocks cached by earlier serializations */
+static uint64_t serialized_size(H2Stream &strm) {
+    for (Frame *f : strm) {
+        if (auto *h = dynamic_cast<Headers *>(f)) {
+            h->reset_srlz_blk();
+        }
+    }
+    std::vector<char> buf(1 << 20);
+    return strm.serialize(buf.data(), buf.size());
+}
+
+static size_t flip_mutate(uint8_t *Data, size_t Size, size_t MaxSize) {
+    if (Size == 0) {
+        return 0;
+    }
+    Random r(Size);
+    LibFuzz_Mut lfm(r);
+    return lfm.DefaultMutate(Data, Size, MaxSize);
+}
+
+TEST(StreamSize, MatchesSerialize) {
+    H2Stream *s1 = TestMutator::get_stream1();
+    H2Stream *s2 = TestMutator::get_stream2();
+    StreamSize sz1, sz2;
+    EXPECT_EQ(sz1.total(*s1), serialized_size(*s1));
+    EXPECT_EQ(sz2.total(*s2), serialized_size(*s2));
+    TestMutator::delete_stream(s1);
+    TestMutator::delete_stream(s2);
+}
+
+TEST(StreamSize, PaddingAndPriorityFollowTheFlags) {
+    HeadersFrame hf;
+    hf.add_header(":method", "GET", FULLIDX);
+    hf.padlen = 7;
+    hf.padding.resize(7);
+    DataFrame df;
+    df.data.resize(10);
+    df.padlen = 3;
+    df.padding.resize(3);
+    PushPromiseFrame pp;
+    pp.add_header("a", "b", NEVER, IdxType::NONE);
+    PriorityFrame pf;
+    GoAway ga;
+    ga.debug_data.resize(5);
+    H2Stream strm = {&hf, &df, &pp, &pf, &ga};
+
+    for (uint8_t flags : {0, FLAG_PADDED, FLAG_PRIORITY, FLAG_PADDED | FLAG_PRIORITY}) {
+        hf.flags = df.flags = pp.flags = pf.flags = flags;
+        StreamSize sz;
+        EXPECT_EQ(sz.total(strm), serialized_size(strm)) << (int) flags;
+    }
+    strm.clear();
+}
+
+TEST(StreamSize, IndicesGrowWithTheDynamicTable) {
+    // 100 insertions push the first entry to index 161, which takes 2 bytes with a 7-bit prefix and 3 with a 4-bit one
+    HeadersFrame hf;
+    for (int i = 0; i < 100; ++i) {
+        hf.add_header("n" + std::to_string(i), "v", WITH, IdxType::NONE);
+    }
+    Continuation c;
+    c.add_header("n0", "v", FULLIDX);
+    c.add_header("n0", "x", WITHOUT, IdxType::NAME);
+    c.add_header("n0", "y", WITH, IdxType::NAME);
+    c.add_header("n99", "v", FULLIDX);
+    // entries in the dynamic table are preferred over static ones, even for pairs that are in the static table
+    c.add_header(":method", "GET", WITH, IdxType::NAME);
+    c.add_header(":method", "GET", FULLIDX);
+    c.add_header("accept", "a", WITH, IdxType::NAME);
+    c.add_header("accept", "b", NEVER, IdxType::NAME);
+    H2Stream strm = {&hf, &c};
+
+    StreamSize sz;
+    EXPECT_EQ(sz.total(strm), serialized_size(strm));
+    strm.clear();
+}
+
+TEST(StreamSize, EvictedEntriesAreNotIndexed) {
+    // each entry takes 32 + 1 + 1000 bytes of the 4096 byte table, so the fifth evicts the first
+    std::vector<Continuation> c(6);
+    H2Stream strm;
+    for (int i = 0; i < 5; ++i) {
+        c[i].add_header(std::to_string(i), std::string(1000, 'v'), WITH, IdxType::NONE);
+        strm.push_back(&c[i]);
+    }
+    c[5].add_header("4", std::string(1000, 'v'), FULLIDX);
+    strm.push_back(&c[5]);
+
+    StreamSize sz;
+    EXPECT_EQ(sz.total(strm), serialized_size(strm));
+
+    c[5].hdr_pairs[0].first = "0";
+    sz.invalidate(5);
+    EXPECT_GE(sz.total(strm), UNENCODABLE);
+    strm.clear();
+}
+
+TEST(StreamSize, UnencodableHeaders) {
+    HeadersFrame hf;
+    hf.add_header("not-in-table", "v", WITHOUT, IdxType::NAME);
+    H2Stream strm = {&hf};
+    StreamSize sz;
+    EXPECT_GE(sz.total(strm), UNENCODABLE);
+
+    // a header block that does not fit into the buffer Headers serializes it into
+    hf.idx_types[0] = IdxType::NONE;
+    hf.hdr_pairs[0].second = std::string(4096, 'v');
+    sz.invalidate(0);
+    EXPECT_GE(sz.total(strm), UNENCODABLE);
+
+    hf.hdr_pairs[0].second = std::string(4000, 'v');
+    sz.invalidate(0);
+    EXPECT_EQ(sz.total(strm), serialized_size(strm));
+    strm.clear();
+}
+
+TEST(StreamSize, OnlyTheFirstHeaderBlockUpdatesTheTableSize) {
+    HeadersFrame empty;
+    Continuation c1, c2;
+    c1.add_header("a", "b", WITH, IdxType::NONE);
+    c2.add_header("a", "b", FULLIDX);
+    H2Stream strm = {&empty, &c1, &c2};
+
+    StreamSize sz;
+    EXPECT_EQ(sz.total(strm), serialized_size(strm));
+
+    // the size update moves to the next non-empty block
+    strm.erase(strm.begin() + 1);
+    c2.prefixes[0] = WITH;
+    c2.idx_types[0] = IdxType::NONE;
+    sz.invalidate(1);
+    EXPECT_EQ(sz.total(strm), serialized_size(strm));
+    strm.clear();
+}
+
+TEST(StreamSize, ResizesOnlyFromTheChange) {
+    H2Stream *s = TestMutator::get_stream1();
+    StreamSize sz;
+    sz.total(*s);
+    ASSERT_EQ(sz.simulated(), s->size());
+
+    // frames that moved are found on their own
+    std::swap(s->at(1), s->at(4));
+    sz.total(*s);
+    EXPECT_EQ(sz.total(*s), serialized_size(*s));
+
+    // frames changed in place are not
+    auto *df = dynamic_cast<DataFrame *>(s->at(4));
+    df->data.resize(100);
+    sz.invalidate(4);
+    ASSERT_EQ(sz.simulated(), 4);
+    EXPECT_EQ(sz.total(*s), serialized_size(*s));
+
+    FrameCopier::release_frame(s->front());
+    s->erase(s->begin());
+    EXPECT_EQ(sz.total(*s), serialized_size(*s));
+    TestMutator::delete_stream(s);
+}
+
+/** Mutates a stream over and over, checking after every mutation that the mutator knows the exact size */
+static void check_mutations(H2Stream &strm, const std::string &cfg, unsigned int max_size) {
+    std::vector<char> buf(1 << 16);
+    uint32_t sz = strm.serialize(buf.data(), buf.size());
+    std::string orig(buf.data(), sz);
+    std::string prev = orig;
+    H2Mutator other(&orig[0], orig.size(), cfg);
+
+    unsigned int applied = 0;
+    for (unsigned int i = 0; i < 1000; ++i) {
+        H2Mutator m(&prev[0], prev.size(), cfg);
+        size_t ok = i % 4 == 0 ? m.CrossOver(other, i, max_size) : m.Mutate(flip_mutate, i, max_size);
+        if (ok == 0) {
+            continue;
+        }
+        ++applied;
+        ASSERT_LE(m.size(), max_size) << i;
+        uint32_t newsz = m.strm_->serialize(buf.data(), buf.size());
+        ASSERT_EQ(m.size(), newsz) << i;
+        prev.assign(buf.data(), newsz);
+    }
+    ASSERT_GT(applied, 500);
+}
+
+TEST(StreamSize, MutatorSizeIsExact) {
+    H2Stream *s = TestMutator::get_stream1();
+    check_mutations(*s, BASEDIR"h2_fuzz/mut_config_data.conf", 512);
+    TestMutator::delete_stream(s);
+}
+
+TEST(StreamSize, MutatorSizeIsExact_Headers) {
+    HeadersFrame hf;
+    for (int i = 0; i < 35; ++i) {
+        hf.add_header("name" + std::to_string(i % 7), "value" + std::to_string(i), WITH, IdxType::NONE);
+    }
+    hf.add_header(":method", "POST", FULLIDX);
+    Continuation c;
+    c.add_header("name0", "value0", FULLIDX);
+    c.add_header("name1", "x", WITHOUT, IdxType::NAME);
+    c.add_header("yunchan", "lim", WITH, IdxType::NONE);
+    H2Stream strm = {&hf, &c};
+    check_mutations(strm, BASEDIR"h2_fuzz/test/headers_stress.conf", 700);
+    strm.clear();
+}
@@ -5,36 +5,32 @@
 #include <iostream>
 
 #include "callbacks.h"
+#include "proxy_registry.h"
 #include "../h2_serializer/src/frames/frames.h"
 #include "../h2_serializer/src/deserializer.h"
 
-void callback_helper(const char *prox, const char *addr, int port, const uint8_t *Data, size_t Size, HashComp **hc) {
-    DEBUG("----- Working on " << prox << " -----")
-    ProxyConfig *filt = ProxyConfig::get_proxy_config(prox);
-    HashComp *out = callback(addr, port, *filt, Data, Size);
+void callback_helper(const ProxyEntry *prox, const uint8_t *Data, size_t Size, HashComp **hc) {
+    const ProxyReplica &r = prox->replicas[0];
+    DEBUG("----- Working on " << prox->name << " at " << r.to_string() << " -----")
+    HashComp *out = callback(r.addr.c_str(), r.port, prox->filter, Data, Size, prox->deadline_ms);
     *hc = out;
 }
 
-#define LAUNCH(tname, fname, addr, idx) std::thread tname(callback_helper, fname, addr, 9090, Data, Size, ret_vals + idx);
-#define CLEAN(tname) tname.join();
-
 int main(int argc, char** argv) {
-    HashComp* ret_vals[11];
+    ProxyRegistry proxies;
+    std::string reg_fn = ProxyRegistry::default_path();
+    int ret = proxies.load(reg_fn);
+    if (ret != 0) {
+        std::cout << "Error " << ret << " loading proxy registry " << reg_fn << std::endl;
+        return 1;
+    }
+
+    std::vector<HashComp*> ret_vals(proxies.size(), nullptr);
     uint8_t Data[4096];
     uint32_t Size;
 
     if (argc == 1) {
-        HeadersFrame hf;
-        hf.flags = FLAG_END_HEADERS | FLAG_END_STREAM;
-        hf.stream_id = 0x00000001;
-        auto npref = hpack::HPacker::PrefixType::LITERAL_HEADER_WITHOUT_INDEXING;
-        auto nidx = hpack::HPacker::IndexingType::NONE;
-        hf.add_header(":method", "GET",npref, nidx);
-        hf.add_header(":scheme", "https",npref, nidx);
-        hf.add_header(":path", "/",npref, nidx);
-        hf.add_header(":authority", GRAMMAR_AUTH,npref, nidx);
-        hpack::HPacker hpe;
-        Size = hf.serialize((char*)Data, 4096, &hpe, false);
+        Size = build_probe_stream(Data, sizeof(Data));
     } else {
         std::ifstream is(argv[1], std::ifstream::binary);
         auto *strm = Deserializer::deserialize_stream(is);
@@ -46,38 +42,21 @@ int main(int argc, char** argv) {
     }
 
     std::cout << "Successfully obtained and serialized test input. Launching threads." << std::endl;
-    LAUNCH(t_nginx, "nginx", "172.17.0.3", 0)
-    LAUNCH(t_caddy, "caddy", "172.17.0.4", 1)
-    LAUNCH(t_apache, "apache", "172.17.0.5", 2)
-    LAUNCH(t_envoy, "envoy", "172.17.0.6", 3)
-    LAUNCH(t_haproxy, "haproxy", "172.17.0.7", 4)
-    LAUNCH(t_traefik, "traefik", "172.17.0.8", 5)
-    LAUNCH(t_varnish, "varnish", "172.17.0.9", 6)
-    LAUNCH(t_h2o, "h2o", "172.17.0.10", 7)
-    LAUNCH(t_ats, "ats", "172.17.0.11", 8)
-    LAUNCH(t_nghttp2, "nghttp2", "172.17.0.12", 9)
-    LAUNCH(t_ols, "openlitespeed", "172.17.0.13", 10)
-
-    CLEAN(t_nginx)
-    CLEAN(t_caddy)
-    CLEAN(t_apache)
-    CLEAN(t_envoy)
-    CLEAN(t_haproxy)
-    CLEAN(t_traefik)
-    CLEAN(t_varnish)
-    CLEAN(t_h2o)
-    CLEAN(t_ats)
-    CLEAN(t_nghttp2)
-    CLEAN(t_ols)
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < proxies.size(); ++i) {
+        threads.emplace_back(callback_helper, &proxies[i], Data, Size, &ret_vals[i]);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
 
-    std::vector<std::string> proxies = {"nginx", "caddy", "apache", "envoy", "haproxy", "traefik", "varnish",
-                                        "h2o", "ats", "nghttp2", "openlitespeed"};
     bool all_good = true;
-    for (int i = 0; i < proxies.size(); ++i) {
+    for (size_t i = 0; i < proxies.size(); ++i) {
         if (ret_vals[i] == nullptr) {
+            std::cout << proxies[i].name << " could not be reached" << std::endl;
             all_good = false;
         } else if (ret_vals[i]->noresp_err) {
-            std::cout << proxies[i] << " signaled a no-response error " << ret_vals[i]->status << std::endl;
+            std::cout << proxies[i].name << " signaled a no-response error " << ret_vals[i]->status << std::endl;
             all_good = false;
         }
     }
@@ -86,9 +65,11 @@ int main(int argc, char** argv) {
         std::cout << "All proxies returned status 200" << std::endl;
     }
 
-    ProxyConfig::clear_cache();
     std::string h1reqs;
     for (auto hc : ret_vals) {
+        if (hc == nullptr) {
+            continue;  // proxy could not be reached
+        }
         h1reqs += hc->to_filedata();
         h1reqs += "----------\n";
         delete hc;
@@ -0,0 +1,435 @@
+/**
+ * Utility program for triaging the differences the fuzzer logged, in place of reading out/ or the trim.py batch files
+ * by hand.
+ *
+ * Every difference is logged as a pair of files with the same prefix: the stream (<prefix><sha1>) and the HTTP/1
+ * requests the proxies forwarded for it (<prefix>h1_<sha1>). The forwarded requests are parsed again with the filters
+ * of the proxies in the registry, in registry order, and loaded into a ResultMatrix, so that differences can be
+ * clustered by disagreement signature: the fields the proxies disagree on and how they split into groups on each.
+ * Differences with the same stream and signature are counted once. Clusters are ranked by number of differences, and
+ * each is shown with its smallest stream that parses.
+ *
+ * Inputs are read by several threads at once: the files of a directory are shared out among them, and each batch file
+ * is read by a single thread.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "hashcomp.h"
+#include "proxy_registry.h"
+#include "result_matrix.h"
+#include "../h2_serializer/src/deserializer.h"
+
+#define H1_SEP "----------\n"  // ends the forwarded request of each proxy in a *_h1_* file
+#define DEFAULT_TOP 50         // clusters shown
+
+static void usage(const char *prog) {
+    std::cout << "usage: " << prog << " [-j <threads>] [-top <clusters>] [-o <dir>] <out dir or batch file>..."
+              << std::endl
+              << "  Clusters the logged differences by the fields the proxies in " << ProxyRegistry::default_path()
+              << std::endl
+              << "  disagree on and how they split on each, and prints the largest clusters with their smallest stream."
+              << std::endl
+              << "  -o writes the stream of every cluster shown there, named <rank>_<signature>." << std::endl
+              << "  Defaults: -j <cores> -top " << DEFAULT_TOP << std::endl;
+}
+
+static bool is_dir(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/** One of the two files of a difference, as read by a worker */
+struct Part {
+    std::string prefix;  // shared by both files of a difference
+    bool h1 = false;
+
+    // stream files
+    std::string name;
+    std::string source;  // file the stream is in: the stream itself, or the batch file at offset
+    size_t offset = 0;
+    size_t size = 0;
+    int frames = -1;  // -1 if the stream does not parse
+
+    // *_h1_* files
+    bool parsed = false;  // false if the file does not hold a request for every proxy
+    uint64_t signature = 0;
+};
+
+/** A logged difference, once both of its files are read */
+struct Diff {
+    const Part *stream = nullptr;
+    const Part *h1 = nullptr;
+};
+
+/** Differences with the same signature */
+struct Cluster {
+    uint64_t signature = 0;
+    size_t diffs = 0;
+    const Part *rep = nullptr;
+};
+
+/** Whether a is a better representative than b: it parses, then it is smaller, then it has fewer frames */
+static bool better(const Part *a, const Part *b) {
+    if (b == nullptr) {
+        return true;
+    }
+    if ((a->frames >= 0) != (b->frames >= 0)) {
+        return a->frames >= 0;
+    }
+    if (a->size != b->size) {
+        return a->size < b->size;
+    }
+    if (a->frames != b->frames) {
+        return a->frames < b->frames;
+    }
+    return a->name < b->name;
+}
+
+/** Reads files and batch files into parts. Every worker thread has its own */
+class Worker {
+public:
+    std::vector<Part> parts;
+    std::unordered_map<uint64_t, std::string> describe;  // how the proxies split, for every signature seen
+    size_t unparsed = 0;  // *_h1_* files that did not hold a request for every proxy
+
+    explicit Worker(const ProxyRegistry &proxies) : proxies_(proxies) {}
+
+    /** Reads the file name in dir. Returns false if it cannot be read */
+    bool read_file(const std::string &dir, const std::string &name) {
+        std::string path = dir + "/" + name;
+        std::ifstream is(path, std::ifstream::binary);
+        if (!is) {
+            return false;
+        }
+        std::stringstream ss;
+        ss << is.rdbuf();
+        std::string data = ss.str();
+        add(name, data, path, 0);
+        return true;
+    }
+
+    /** Reads every file in a trim.py batch file: its name, its size and its contents, one after another */
+    bool read_batch(const std::string &path) {
+        std::ifstream is(path, std::ifstream::binary);
+        if (!is) {
+            return false;
+        }
+        std::string name, len;
+        std::string data;
+        while (std::getline(is, name) && std::getline(is, len)) {
+            size_t sz = strtoul(len.c_str(), nullptr, 10);
+            data.resize(sz);
+            size_t offset = (size_t) is.tellg();
+            if (!is.read(&data[0], (std::streamsize) sz)) {
+                std::cerr << path << ": truncated at " << name << std::endl;
+                return false;
+            }
+            if (is_diff(name)) {
+                add(name, data, path, offset);
+            }
+        }
+        return true;
+    }
+
+    /** Whether name is one of the files of a logged difference, as opposed to an input before mutation or a crash */
+    static bool is_diff(const std::string &name) {
+        return name.find('_') != std::string::npos && name.find("BeforeMutationWas") == std::string::npos;
+    }
+
+private:
+    const ProxyRegistry &proxies_;
+
+    void add(const std::string &name, const std::string &data, const std::string &source, size_t offset) {
+        Part p;
+        size_t h1 = name.rfind("h1_");
+        if (h1 != std::string::npos && (h1 == 0 || name[h1 - 1] == '_')) {
+            p.h1 = true;
+            p.prefix = name.substr(0, h1);
+            p.parsed = load(data, p.signature);
+        } else {
+            p.prefix = name.substr(0, name.find_last_of('_') + 1);
+            p.name = name;
+            p.source = source;
+            p.offset = offset;
+            p.size = data.size();
+            try {
+                H2Stream *strm = Deserializer::deserialize_stream(data.data(), data.size());
+                p.frames = (int) strm->size();
+                for (auto f : *strm) {
+                    delete f;
+                }
+                delete strm;
+            } catch (const std::exception &e) {
+                p.frames = -1;
+            }
+        }
+        unparsed += p.h1 && !p.parsed;
+        parts.push_back(std::move(p));
+    }
+
+    /**
+     * Rebuilds the results of every proxy from a *_h1_* file, where each is written as "<noresp>;<status>;<chunk
+     * error>\n<forwarded request>" followed by H1_SEP. Returns false if there are not as many as proxies
+     */
+    bool load(const std::string &data, uint64_t &signature) {
+        std::vector<HashComp *> hcs;
+        size_t pos = 0;
+        while (hcs.size() < proxies_.size()) {
+            size_t end = data.find(H1_SEP, pos);
+            size_t nl = data.find('\n', pos);
+            if (end == std::string::npos || nl == std::string::npos || nl > end) {
+                break;
+            }
+            std::string flags = data.substr(pos, nl - pos);
+            std::string req = data.substr(nl + 1, end - nl - 1);
+            pos = end + strlen(H1_SEP);
+
+            size_t semi1 = flags.find(';');
+            size_t semi2 = semi1 == std::string::npos ? semi1 : flags.find(';', semi1 + 1);
+            if (semi2 == std::string::npos) {
+                break;
+            }
+            auto *hc = new HashComp();
+            hc->noresp_err = flags[0] == '1';
+            if (!req.empty()) {
+                H1Parser hp;
+                hp.parse(req.data(), req.length());
+                hc->orig = req;
+                hc->parse(hp, proxies_[hcs.size()].filter);
+                hc->hash_indiv();
+            }
+            hc->status = flags.substr(semi1 + 1, semi2 - semi1 - 1);
+            hc->chnk_err = atoi(flags.c_str() + semi2 + 1);
+            hcs.push_back(hc);
+        }
+
+        bool ok = hcs.size() == proxies_.size() && pos == data.size();
+        if (ok) {
+            ResultMatrix m;
+            m.load(hcs.data(), (int) hcs.size());
+            // only compared fields make a difference. splits on the others are noise and would scatter clusters
+            signature = m.has_diff() ? m.signature() : 0;
+            if (signature != 0 && describe.find(signature) == describe.end()) {
+                describe[signature] = split(m);
+            }
+        }
+        for (auto hc : hcs) {
+            delete hc;
+        }
+        return ok;
+    }
+
+    /** How the proxies split on every field they disagree on, e.g. "host: a,b | c" */
+    std::string split(const ResultMatrix &m) const {
+        std::string out;
+        for (size_t c = 0; c < ResultMatrix::KEY_COLS; ++c) {
+            if (!(m.differing_columns() & (1ULL << c))) {
+                continue;
+            }
+            out += (out.empty() ? "" : "\n") + ResultMatrix::key_name(c) + ":";
+            uint64_t seen = 0;
+            const uint64_t *v = m.key(c);
+            for (int i = 0; i < m.proxies(); ++i) {
+                if (seen & (1ULL << i)) {
+                    continue;
+                }
+                out += seen != 0 ? " |" : "";
+                std::string sep = " ";
+                for (int j = i; j < m.proxies(); ++j) {
+                    if (v[j] == v[i]) {
+                        seen |= 1ULL << j;
+                        out += sep + proxies_[j].name;
+                        sep = ",";
+                    }
+                }
+            }
+        }
+        return out;
+    }
+};
+
+/** Copies the stream of a part to path */
+static bool write_stream(const Part &p, const std::string &path) {
+    std::ifstream is(p.source, std::ifstream::binary);
+    std::string data(p.size, '\0');
+    if (!is.seekg((std::streamoff) p.offset) || !is.read(&data[0], (std::streamsize) p.size)) {
+        return false;
+    }
+    std::ofstream os(path, std::ofstream::binary);
+    os.write(data.data(), (std::streamsize) data.size());
+    return (bool) os;
+}
+
+int main(int argc, char **argv) {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t top = DEFAULT_TOP;
+    std::string out_dir;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = (size_t) std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-top") == 0 && i + 1 < argc) {
+            top = (size_t) std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            inputs.emplace_back(argv[i]);
+        }
+    }
+    if (inputs.empty() || (!out_dir.empty() && !is_dir(out_dir))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ProxyRegistry proxies;
+    std::string reg_fn = ProxyRegistry::default_path();
+    int ret = proxies.load(reg_fn);
+    if (ret != 0) {
+        std::cout << "Error " << ret << " loading proxy registry " << reg_fn << std::endl;
+        return 1;
+    }
+    if (proxies.size() > MATRIX_MAX_PROXIES) {
+        std::cout << "Error: at most " << MATRIX_MAX_PROXIES << " proxies are supported" << std::endl;
+        return 1;
+    }
+
+    // work items: single files of the directories, and whole batch files
+    std::vector<std::pair<std::string, std::string>> items;  // (dir, file name), or ("", batch file)
+    for (const auto &in : inputs) {
+        if (!is_dir(in)) {
+            items.emplace_back("", in);
+            continue;
+        }
+        DIR *d = opendir(in.c_str());
+        if (d == nullptr) {
+            std::cout << "Error opening " << in << std::endl;
+            return 1;
+        }
+        while (struct dirent *e = readdir(d)) {
+            if (Worker::is_diff(e->d_name)) {
+                items.emplace_back(in, e->d_name);
+            }
+        }
+        closedir(d);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(new Worker(proxies));
+    }
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> failed{0};
+    std::vector<std::thread> pool;
+    for (auto &w : workers) {
+        pool.emplace_back([&items, &next, &failed](Worker *w) {
+            for (size_t i; (i = next++) < items.size();) {
+                const auto &item = items[i];
+                bool ok = item.first.empty() ? w->read_batch(item.second) : w->read_file(item.first, item.second);
+                if (!ok) {
+                    failed++;
+                }
+            }
+        }, w.get());
+    }
+    for (auto &t : pool) {
+        t.join();
+    }
+
+    // pair up the files of every difference
+    std::unordered_map<std::string, Diff> diffs;
+    std::unordered_map<uint64_t, std::string> describe;
+    size_t files = 0, unparsed = 0;
+    for (auto &w : workers) {
+        files += w->parts.size();
+        unparsed += w->unparsed;
+        for (const auto &p : w->parts) {
+            Diff &d = diffs[p.prefix];
+            (p.h1 ? d.h1 : d.stream) = &p;
+        }
+        describe.insert(w->describe.begin(), w->describe.end());
+    }
+
+    std::unordered_map<uint64_t, Cluster> clusters;
+    std::unordered_set<std::string> seen;  // signature and stream hash of the differences counted
+    size_t lone = 0, agree = 0, dups = 0;
+    for (const auto &entry : diffs) {
+        const Diff &d = entry.second;
+        if (d.stream == nullptr || d.h1 == nullptr || !d.h1->parsed) {
+            lone++;
+            continue;
+        }
+        uint64_t sig = d.h1->signature;
+        if (sig == 0) {
+            agree++;  // e.g., the difference was in a field the registry's filters now normalize away, or not compared
+            continue;
+        }
+        const std::string &name = d.stream->name;
+        if (!seen.insert(std::to_string(sig) + name.substr(name.find_last_of('_'))).second) {
+            dups++;
+            continue;
+        }
+        Cluster &c = clusters[sig];
+        c.signature = sig;
+        c.diffs++;
+        if (better(d.stream, c.rep)) {
+            c.rep = d.stream;
+        }
+    }
+
+    std::vector<const Cluster *> ranked;
+    for (const auto &entry : clusters) {
+        ranked.push_back(&entry.second);
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const Cluster *a, const Cluster *b) {
+        return a->diffs != b->diffs ? a->diffs > b->diffs : a->signature < b->signature;
+    });
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Read " << files << " files from " << items.size() << " inputs on " << threads << " threads in "
+              << std::fixed << std::setprecision(1) << secs << " s" << std::endl
+              << (diffs.size() - lone - agree - dups) << " differences in " << clusters.size() << " clusters; "
+              << dups << " duplicates, " << agree << " where the proxies agree, " << lone
+              << " without both files, " << unparsed << " unreadable *_h1_* files, " << failed << " inputs unreadable"
+              << std::endl;
+
+    for (size_t r = 0; r < ranked.size() && r < top; ++r) {
+        const Cluster &c = *ranked[r];
+        std::stringstream sig;
+        sig << std::hex << std::setw(16) << std::setfill('0') << c.signature;
+        std::cout << std::endl << "#" << r + 1 << "\t" << c.diffs << " differences\tsignature " << sig.str()
+                  << std::endl;
+        std::stringstream split(describe[c.signature]);
+        for (std::string line; std::getline(split, line);) {
+            std::cout << "\t" << line << std::endl;
+        }
+        std::cout << "\trepresentative: " << c.rep->name << " (" << c.rep->size << " bytes, ";
+        if (c.rep->frames >= 0) {
+            std::cout << c.rep->frames << " frames)" << std::endl;
+        } else {
+            std::cout << "does not parse)" << std::endl;
+        }
+        if (!out_dir.empty() && !write_stream(*c.rep, out_dir + "/" + std::to_string(r + 1) + "_" + sig.str())) {
+            std::cout << "\tError writing the representative to " << out_dir << std::endl;
+        }
+    }
+    return 0;
+}
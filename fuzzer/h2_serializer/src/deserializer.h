@@ -23,10 +23,19 @@ public:
         auto *out = new H2Stream();
 
         // probably a smarter way to do this, but it's all I got
-        in.peek();
-        while (!in.eof()) {
-            out->push_back(deserialize_frame(in, &hpe));
+        try {
             in.peek();
+            while (!in.eof()) {
+                out->push_back(deserialize_frame(in, &hpe));
+                in.peek();
+            }
+        } catch (...) {
+            // don't leak the frames parsed so far
+            for (auto f : *out) {
+                delete f;
+            }
+            delete out;
+            throw;
         }
 
         return out;
@@ -33,6 +33,35 @@ public:
         }
     }
 
+    /**
+     * Returns the given Frame for another stream to hold as well, so that crossover does not copy frames that it
+     * splices in unchanged. Shared frames must be released with release_frame and copied before they are written to.
+     *
+     * Frames with headers are always copied, since they cache their HPACK block and that block depends on the stream
+     * they are serialized in. Not thread safe: a frame must only be shared among streams of one thread.
+     */
+    static Frame* share_frame(Frame *f) {
+        if (Frame::has_headers(f)) {
+            return copy_frame(f);
+        }
+        ++f->shares;
+        return f;
+    }
+
+    /** Whether the given Frame is held by more than one stream, and must be copied before it is written to */
+    static bool is_shared(const Frame *f) {
+        return f->shares != 0;
+    }
+
+    /** Drops one stream's hold of the given Frame, deleting it if no other stream holds it */
+    static void release_frame(Frame *f) {
+        if (f->shares != 0) {
+            --f->shares;
+        } else {
+            delete f;
+        }
+    }
+
 private:
     /** Copies all common Frame fields from "in" to "out" */
     static void copy_baseframe(Frame *in, Frame *out) {
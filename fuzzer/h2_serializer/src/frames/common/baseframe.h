@@ -72,6 +72,9 @@ public:
 
     bool reserved  = false; // always 0x0 when sending, but just in case we want to mutate it
 
+    // number of streams holding this frame besides the one that created it. See FrameCopier::share_frame
+    uint32_t shares = 0;
+
     virtual ~Frame() {}
 
     /*
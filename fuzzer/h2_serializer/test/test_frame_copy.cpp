@@ -167,4 +167,30 @@ TEST(FrameCopy, Continuation) {
     frame_eq(copy, f);
     delete copy;
     delete f;
-}
\ No newline at end of file
+}
+
+TEST(FrameCopy, ShareDataFrame) {
+    auto *f = new DataFrame();
+    f->len = 3;
+    f->data.insert(f->data.end(), 3, 'A');
+
+    Frame *shared = FrameCopier::share_frame(f);
+    ASSERT_EQ(shared, f);
+    ASSERT_TRUE(FrameCopier::is_shared(f));
+
+    FrameCopier::release_frame(shared);
+    ASSERT_FALSE(FrameCopier::is_shared(f));
+    FrameCopier::release_frame(f);  // deletes it
+}
+
+TEST(FrameCopy, ShareHeadersFrameCopies) {
+    auto *f = new HeadersFrame();
+    f->add_header(":method", "GET", PrefType::INDEXED_HEADER, IdxType::ALL);
+
+    Frame *shared = FrameCopier::share_frame(f);
+    ASSERT_NE(shared, f);
+    ASSERT_FALSE(FrameCopier::is_shared(f));
+    frame_eq(shared, f);
+    FrameCopier::release_frame(shared);
+    FrameCopier::release_frame(f);
+}
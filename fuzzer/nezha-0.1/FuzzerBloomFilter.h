@@ -0,0 +1,144 @@
+//===- FuzzerBloomFilter.h - Scalable Bloom filter --------------*- C++ -* ===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// A scalable Bloom filter over 64-bit hashes, used to remember recently
+// executed inputs.
+//
+// The filter is a sequence of plain Bloom filters ("slices"). Only the newest
+// slice receives inserts; once it holds its capacity a new slice with twice
+// the capacity and half the error rate is appended, which keeps the overall
+// false positive rate bounded by the requested one. Once MaxSlices exist the
+// oldest slice is dropped, so the filter answers "seen recently" rather than
+// "ever seen" and its memory stays bounded.
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_FUZZER_BLOOM_FILTER_H
+#define LLVM_FUZZER_BLOOM_FILTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace fuzzer {
+
+class ScalableBloomFilter {
+public:
+  ScalableBloomFilter(size_t InitialCapacity = 1 << 16,
+                      double FalsePositiveRate = 1e-4, size_t MaxSlices = 4)
+      : InitialCapacity(InitialCapacity ? InitialCapacity : 1),
+        FalsePositiveRate(FalsePositiveRate), MaxSlices(MaxSlices ? MaxSlices : 1) {
+    Clear();
+  }
+
+  // Returns true if H was (probably) inserted and has not been aged out.
+  bool Contains(uint64_t H) const {
+    for (const auto &S : Slices)
+      if (S.Contains(H))
+        return true;
+    return false;
+  }
+
+  // Inserts H. Returns true if H was (probably) already present, in which
+  // case the filter is left unchanged.
+  bool TestAndInsert(uint64_t H) {
+    if (Contains(H))
+      return true;
+    if (Slices.back().Count >= Slices.back().Capacity)
+      Grow();
+    Slices.back().Insert(H);
+    return false;
+  }
+
+  void Clear() {
+    Slices.clear();
+    NextSlice = 0;
+    Grow();
+  }
+
+  size_t NumSlices() const { return Slices.size(); }
+
+  size_t SizeInBytes() const {
+    size_t Res = 0;
+    for (const auto &S : Slices)
+      Res += S.Bits.size() * sizeof(uint64_t);
+    return Res;
+  }
+
+private:
+  struct Slice {
+    Slice(size_t Capacity, double ErrorRate) : Capacity(Capacity) {
+      // Optimal bits and hash count for Capacity items at ErrorRate.
+      const double Ln2 = std::log(2.0);
+      NumBits = static_cast<size_t>(
+          std::ceil(-(double)Capacity * std::log(ErrorRate) / (Ln2 * Ln2)));
+      NumBits = std::max<size_t>(NumBits, 64);
+      NumHashes = static_cast<size_t>(std::ceil(-std::log2(ErrorRate)));
+      NumHashes = std::max<size_t>(NumHashes, 1);
+      Bits.assign((NumBits + 63) / 64, 0);
+    }
+
+    // Kirsch-Mitzenmacher double hashing: the i-th probe is H1 + i * H2.
+    template <class Fn> void ForEachBit(uint64_t H, Fn F) const {
+      uint64_t H1 = Mix(H);
+      uint64_t H2 = Mix(H1) | 1;
+      for (size_t I = 0; I < NumHashes; I++)
+        F((H1 + I * H2) % NumBits);
+    }
+
+    bool Contains(uint64_t H) const {
+      bool Res = true;
+      ForEachBit(H, [&](size_t B) {
+        Res = Res && (Bits[B / 64] >> (B % 64)) & 1;
+      });
+      return Res;
+    }
+
+    void Insert(uint64_t H) {
+      ForEachBit(H, [&](size_t B) { Bits[B / 64] |= 1ULL << (B % 64); });
+      Count++;
+    }
+
+    size_t Capacity;
+    size_t Count = 0;
+    size_t NumBits;
+    size_t NumHashes;
+    std::vector<uint64_t> Bits;
+  };
+
+  // splitmix64 finalizer; spreads hashes whose low bits are weak.
+  static uint64_t Mix(uint64_t X) {
+    X = (X ^ (X >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    X = (X ^ (X >> 27)) * 0x94d049bb133111ebULL;
+    return X ^ (X >> 31);
+  }
+
+  void Grow() {
+    if (Slices.size() >= MaxSlices)
+      Slices.pop_front();
+    // Slice I gets error P * (1 - r) * r^I with r = 1/2, so the sum over all
+    // slices stays below P. Growth stops at MaxSlices to bound memory.
+    size_t I = std::min(NextSlice, MaxSlices - 1);
+    size_t Capacity = InitialCapacity << I;
+    double ErrorRate = FalsePositiveRate * 0.5 / static_cast<double>(1ULL << I);
+    Slices.emplace_back(Capacity, ErrorRate);
+    NextSlice++;
+  }
+
+  size_t InitialCapacity;
+  double FalsePositiveRate;
+  size_t MaxSlices;
+  size_t NextSlice = 0;
+  std::deque<Slice> Slices;
+};
+
+} // namespace fuzzer
+
+#endif // LLVM_FUZZER_BLOOM_FILTER_H
@@ -0,0 +1,634 @@
+//===- FuzzerCheckpoint.cpp - Checkpoint and resume a campaign ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Periodic checkpoints of the campaign state (-checkpoint) and restoring them
+// after a restart (-resume).
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerInternal.h"
+#include "../h2_fuzz/hash_utils.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <map>
+#include <unistd.h>
+
+namespace fuzzer {
+
+namespace {
+
+const char kCheckpointMagic[8] = {'n', 'z', 'c', 'k', 'p', 't', '0', '1'};
+const uint32_t kSegmentMagic = 0x4745534e; // "NSEG"
+
+struct FileHeader {
+  char Magic[8];
+  uint64_t Fingerprint;
+};
+
+struct SegmentHeader {
+  uint32_t Magic;
+  uint32_t Reserved;
+  uint64_t Size;
+  uint64_t Checksum; // of the payload
+};
+
+// A full checkpoint replaces the file after this many incremental ones, so
+// that the UnitStats they repeat do not pile up.
+const size_t kMaxAppendedSegments = 128;
+
+// What a segment holds, one record after another.
+enum RecordTag : uint8_t {
+  kThreadState = 1, // thread index, CheckpointThreadState of that thread
+  kUnit,            // shard, unit
+  kUnitStats,       // shard, index in the shard, UnitStats
+  kOutput,          // output tuple (-diff_od)
+  kSignature,       // disagreement signature (-diff_signature)
+  kDiffHash,        // logged difference: prefix, fuzzy hashes, outputs
+  kCovPath,         // -diff_pdfine path
+  kEcDiff,          // -diff_pdcoarse edge counts
+};
+
+bool WriteAll(int Fd, const char *Data, size_t Size) {
+  while (Size) {
+    ssize_t N = write(Fd, Data, Size);
+    if (N <= 0)
+      return false;
+    Data += N;
+    Size -= N;
+  }
+  return true;
+}
+
+// Makes a rename in the directory of Path durable.
+void SyncDir(const std::string &Path) {
+  size_t Slash = Path.find_last_of('/');
+  std::string Dir =
+      Slash == std::string::npos ? "." : Path.substr(0, Slash + 1);
+  int Fd = open(Dir.c_str(), O_RDONLY);
+  if (Fd < 0)
+    return;
+  fsync(Fd);
+  close(Fd);
+}
+
+std::string SegmentOf(const std::string &Payload) {
+  SegmentHeader H = {kSegmentMagic, 0, Payload.size(),
+                     HashUtils::fnv1a(Payload)};
+  std::string Out((const char *)&H, sizeof(H));
+  return Out + Payload;
+}
+
+class Encoder {
+public:
+  void Tag(RecordTag T) { Out.push_back((char)T); }
+  void Varint(uint64_t V) {
+    for (; V >= 0x80; V >>= 7)
+      Out.push_back((char)(V | 0x80));
+    Out.push_back((char)V);
+  }
+  // Zigzag, so that negative hashes stay short
+  void Int(int V) {
+    int64_t X = V;
+    Varint(((uint64_t)X << 1) ^ (uint64_t)(X >> 63));
+  }
+  void Double(double V) { Out.append((const char *)&V, sizeof(V)); }
+  void Bytes(const void *Data, size_t Size) {
+    Varint(Size);
+    Out.append((const char *)Data, Size);
+  }
+  void String(const std::string &S) { Bytes(S.data(), S.size()); }
+  void Ints(const std::vector<int> &V) {
+    Varint(V.size());
+    for (int I : V)
+      Int(I);
+  }
+  void Stats(const UnitStats &S) {
+    Varint(S.Children);
+    Double(S.ExecSeconds);
+    Varint(S.NewTuples);
+    Varint(S.Diffs);
+  }
+
+  std::string Out;
+};
+
+// Reads what Encoder wrote. Every read fails once the input is exhausted.
+class Decoder {
+public:
+  explicit Decoder(const std::string &In)
+      : P(In.data()), End(In.data() + In.size()) {}
+
+  bool AtEnd() const { return P == End; }
+  bool Varint(uint64_t *V) {
+    *V = 0;
+    for (int Shift = 0; P < End && Shift < 64; Shift += 7) {
+      uint8_t B = *P++;
+      *V |= (uint64_t)(B & 0x7f) << Shift;
+      if (!(B & 0x80))
+        return true;
+    }
+    return false;
+  }
+  bool Size(size_t *V) {
+    uint64_t X;
+    if (!Varint(&X))
+      return false;
+    *V = X;
+    return true;
+  }
+  bool Int(int *V) {
+    uint64_t X;
+    if (!Varint(&X))
+      return false;
+    *V = (int)(int64_t)((X >> 1) ^ (0 - (X & 1)));
+    return true;
+  }
+  bool Double(double *V) {
+    if ((size_t)(End - P) < sizeof(*V))
+      return false;
+    memcpy(V, P, sizeof(*V));
+    P += sizeof(*V);
+    return true;
+  }
+  bool String(std::string *S) {
+    size_t N;
+    if (!Size(&N) || (size_t)(End - P) < N)
+      return false;
+    S->assign(P, N);
+    P += N;
+    return true;
+  }
+  bool Ints(std::vector<int> *V) {
+    size_t N;
+    if (!Size(&N) || N > (size_t)(End - P))
+      return false;
+    V->resize(N);
+    for (auto &I : *V)
+      if (!Int(&I))
+        return false;
+    return true;
+  }
+  bool Stats(UnitStats *S) {
+    return Size(&S->Children) && Double(&S->ExecSeconds) &&
+           Size(&S->NewTuples) && Size(&S->Diffs);
+  }
+
+private:
+  const char *P;
+  const char *End;
+};
+
+// The state held by a checkpoint, as it is read back.
+struct CheckpointContents {
+  std::vector<std::vector<Unit>> Units; // per shard
+  std::vector<std::vector<UnitStats>> Stats;
+  std::vector<std::vector<int>> Outputs;
+  std::vector<uint64_t> Signatures;
+  std::vector<std::pair<std::string,
+                        std::pair<std::vector<std::string>, std::vector<int>>>>
+      DiffHashes;
+  std::vector<std::string> CovPaths;
+  std::vector<std::vector<int>> EcDiffs;
+  std::map<size_t, std::string> Threads; // the last state of each thread
+};
+
+bool ReadSegment(const std::string &Payload, CheckpointContents *C) {
+  Decoder D(Payload);
+  while (!D.AtEnd()) {
+    uint64_t Tag;
+    size_t Shard, Idx;
+    if (!D.Varint(&Tag))
+      return false;
+    switch (Tag) {
+    case kThreadState: {
+      std::string State;
+      if (!D.Size(&Idx) || !D.String(&State))
+        return false;
+      C->Threads[Idx] = State;
+      break;
+    }
+    case kUnit: {
+      std::string U;
+      if (!D.Size(&Shard) || !D.String(&U))
+        return false;
+      if (C->Units.size() <= Shard)
+        C->Units.resize(Shard + 1);
+      C->Units[Shard].emplace_back(U.begin(), U.end());
+      break;
+    }
+    case kUnitStats: {
+      UnitStats S;
+      if (!D.Size(&Shard) || !D.Size(&Idx) || !D.Stats(&S))
+        return false;
+      if (Shard >= C->Units.size() || Idx >= C->Units[Shard].size())
+        return false;
+      if (C->Stats.size() <= Shard)
+        C->Stats.resize(Shard + 1);
+      if (C->Stats[Shard].size() <= Idx)
+        C->Stats[Shard].resize(Idx + 1);
+      C->Stats[Shard][Idx] = S;
+      break;
+    }
+    case kOutput:
+    case kEcDiff: {
+      std::vector<int> V;
+      if (!D.Ints(&V))
+        return false;
+      (Tag == kOutput ? C->Outputs : C->EcDiffs).push_back(V);
+      break;
+    }
+    case kSignature: {
+      uint64_t Sig;
+      if (!D.Varint(&Sig))
+        return false;
+      C->Signatures.push_back(Sig);
+      break;
+    }
+    case kDiffHash: {
+      std::string Prefix;
+      size_t N;
+      if (!D.String(&Prefix) || !D.Size(&N))
+        return false;
+      if (N > Payload.size())
+        return false;
+      std::vector<std::string> Fuzzy(N);
+      for (auto &H : Fuzzy)
+        if (!D.String(&H))
+          return false;
+      std::vector<int> Outputs;
+      if (!D.Ints(&Outputs))
+        return false;
+      C->DiffHashes.push_back({Prefix, {Fuzzy, Outputs}});
+      break;
+    }
+    case kCovPath: {
+      std::string P;
+      if (!D.String(&P))
+        return false;
+      C->CovPaths.push_back(P);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+void DiffJournal::Take(DiffJournal *J) {
+  std::lock_guard<std::mutex> Lock(Mu);
+  J->Outputs.swap(Outputs);
+  J->EcDiffs.swap(EcDiffs);
+  J->CovPaths.swap(CovPaths);
+  J->Signatures.swap(Signatures);
+  clear();
+}
+
+void DiffJournal::clear() {
+  Outputs.clear();
+  EcDiffs.clear();
+  CovPaths.clear();
+  Signatures.clear();
+}
+
+CampaignCheckpoint::CampaignCheckpoint(const std::string &Path,
+                                       uint64_t Fingerprint)
+    : Path(Path), Fingerprint(Fingerprint) {}
+
+CampaignCheckpoint::~CampaignCheckpoint() {
+  if (Fd >= 0)
+    close(Fd);
+}
+
+CampaignCheckpoint::Status
+CampaignCheckpoint::Load(std::vector<std::string> *Segments) const {
+  Segments->clear();
+  if (!IsFile(Path))
+    return Status::Missing;
+  std::string Buf = FileToString(Path);
+  FileHeader FH;
+  if (Buf.size() < sizeof(FH))
+    return Status::Invalid;
+  memcpy(&FH, Buf.data(), sizeof(FH));
+  if (memcmp(FH.Magic, kCheckpointMagic, sizeof(FH.Magic)) ||
+      FH.Fingerprint != Fingerprint)
+    return Status::Invalid;
+
+  // Stop at the first segment that was not written completely.
+  size_t Pos = sizeof(FH);
+  SegmentHeader SH;
+  while (Buf.size() - Pos >= sizeof(SH)) {
+    memcpy(&SH, Buf.data() + Pos, sizeof(SH));
+    Pos += sizeof(SH);
+    if (SH.Magic != kSegmentMagic || SH.Size > Buf.size() - Pos)
+      break;
+    std::string Payload = Buf.substr(Pos, SH.Size);
+    if (HashUtils::fnv1a(Payload) != SH.Checksum)
+      break;
+    Segments->push_back(std::move(Payload));
+    Pos += SH.Size;
+  }
+  return Status::Loaded;
+}
+
+bool CampaignCheckpoint::Rewrite(const std::string &Segment) {
+  if (Fd >= 0)
+    close(Fd);
+  Fd = -1;
+  NumAppended = 0;
+
+  std::string Tmp = Path + ".tmp." + std::to_string(GetPid());
+  int TmpFd = open(Tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (TmpFd < 0)
+    return false;
+  FileHeader FH;
+  memcpy(FH.Magic, kCheckpointMagic, sizeof(FH.Magic));
+  FH.Fingerprint = Fingerprint;
+  std::string Data((const char *)&FH, sizeof(FH));
+  Data += SegmentOf(Segment);
+  bool Ok = WriteAll(TmpFd, Data.data(), Data.size()) && fsync(TmpFd) == 0;
+  close(TmpFd);
+  if (!Ok || rename(Tmp.c_str(), Path.c_str()) != 0) {
+    unlink(Tmp.c_str());
+    return false;
+  }
+  SyncDir(Path);
+  Fd = open(Path.c_str(), O_WRONLY | O_APPEND);
+  return true;
+}
+
+bool CampaignCheckpoint::Append(const std::string &Segment) {
+  if (Fd < 0)
+    return false;
+  off_t Before = lseek(Fd, 0, SEEK_END);
+  std::string Data = SegmentOf(Segment);
+  if (Before < 0 || !WriteAll(Fd, Data.data(), Data.size()) ||
+      fdatasync(Fd) != 0) {
+    // Leave no partial segment behind for later ones to follow.
+    if (Before >= 0)
+      ftruncate(Fd, Before);
+    close(Fd);
+    Fd = -1;
+    return false;
+  }
+  NumAppended++;
+  return true;
+}
+
+std::string Fuzzer::CheckpointThreadState() const {
+  Encoder E;
+  E.Varint(TotalNumberOfRuns);
+  E.Varint(TotalNumberOfDiffs);
+  E.Varint(NumberOfTupleDiffs);
+  E.Varint(NumberOfNewUnitsAdded);
+  E.Stats(Schedule.Totals());
+  auto &Dict = MD.GetPersistentAutoDictionary();
+  E.Varint(Dict.size());
+  for (auto &DE : Dict) {
+    E.Bytes(DE.GetW().data(), DE.GetW().size());
+    // 0 stands for no position hint
+    E.Varint(DE.HasPositionHint() ? DE.GetPositionHint() + 1 : 0);
+    E.Varint(DE.GetUseCount());
+    E.Varint(DE.GetSuccessCount());
+  }
+  return E.Out;
+}
+
+std::string Fuzzer::CheckpointSegment(bool Full) {
+  CampaignCheckpoint &C = *Checkpoint;
+  Encoder E;
+
+  if (Shared) {
+    std::lock_guard<std::mutex> Lock(Shared->CheckpointMu);
+    for (size_t I = 0; I < Shared->ThreadCheckpoints.size(); I++) {
+      if (Shared->ThreadCheckpoints[I].empty())
+        continue;
+      E.Tag(kThreadState);
+      E.Varint(I);
+      E.String(Shared->ThreadCheckpoints[I]);
+    }
+  } else {
+    E.Tag(kThreadState);
+    E.Varint(0);
+    E.String(CheckpointThreadState());
+  }
+
+  // The journal is emptied before the sets are copied, so an entry added
+  // meanwhile is written twice rather than not at all.
+  Diff &D = Shared ? Shared->Diffs : DiffStats;
+  DiffJournal Added;
+  D.Added.Take(&Added);
+  auto Output = [&](const std::vector<int> &V) {
+    E.Tag(kOutput);
+    E.Ints(V);
+  };
+  auto Signature = [&](uint64_t Sig) {
+    E.Tag(kSignature);
+    E.Varint(Sig);
+  };
+  if (Full) {
+    if (Shared)
+      Shared->Outputs.ForEach(Output);
+    else
+      for (auto &V : D.SetOutputs)
+        Output(V);
+    D.Signatures.ForEach(Signature);
+    Added.CovPaths.assign(D.SetCovPaths.begin(), D.SetCovPaths.end());
+    Added.EcDiffs.assign(D.SetRawEcDiffs.begin(), D.SetRawEcDiffs.end());
+  } else {
+    for (auto &V : Added.Outputs)
+      Output(V);
+    for (uint64_t Sig : Added.Signatures)
+      Signature(Sig);
+  }
+  for (auto &P : Added.CovPaths) {
+    E.Tag(kCovPath);
+    E.String(P);
+  }
+  for (auto &V : Added.EcDiffs) {
+    E.Tag(kEcDiff);
+    E.Ints(V);
+  }
+
+  {
+    std::unique_lock<std::mutex> DiffLock;
+    if (Shared)
+      DiffLock = std::unique_lock<std::mutex>(Shared->DiffMu);
+    if (Full)
+      C.DiffHashes = 0;
+    for (size_t I = C.DiffHashes; I < D.DiffHashes.size(); I++) {
+      auto &DH = D.DiffHashes[I];
+      E.Tag(kDiffHash);
+      E.String(DH.first);
+      E.Varint(DH.second.first.size());
+      for (auto &H : DH.second.first)
+        E.String(H);
+      E.Ints(DH.second.second);
+    }
+    C.DiffHashes = D.DiffHashes.size();
+  }
+
+  size_t NumShards = Shared ? Shared->Corpus.NumberOfShards() : 1;
+  if (Full) {
+    C.Units.assign(NumShards, 0);
+    C.Stats.assign(NumShards, {});
+  }
+  for (size_t S = 0; S < NumShards; S++) {
+    std::vector<UnitStats> Stats;
+    if (Shared) {
+      std::vector<UnitPtr> New;
+      Shared->Corpus.Snapshot(S, C.Units[S], &New, &Stats);
+      for (auto &U : New) {
+        E.Tag(kUnit);
+        E.Varint(S);
+        E.Bytes(U->data(), U->size());
+      }
+      C.Units[S] += New.size();
+    } else {
+      for (size_t I = C.Units[S]; I < Corpus.size(); I++) {
+        E.Tag(kUnit);
+        E.Varint(S);
+        E.Bytes(Corpus[I].data(), Corpus[I].size());
+      }
+      C.Units[S] = Corpus.size();
+      Stats = CorpusStats;
+    }
+    // Only the stats of units that had mutants since the last checkpoint
+    auto &Old = C.Stats[S];
+    for (size_t I = 0; I < Stats.size() && I < C.Units[S]; I++) {
+      if (Stats[I].Children == (I < Old.size() ? Old[I].Children : 0))
+        continue;
+      E.Tag(kUnitStats);
+      E.Varint(S);
+      E.Varint(I);
+      E.Stats(Stats[I]);
+    }
+    Old.swap(Stats);
+  }
+  return E.Out;
+}
+
+void Fuzzer::PublishCheckpoint() {
+  assert(Shared);
+  std::string State = CheckpointThreadState();
+  std::lock_guard<std::mutex> Lock(Shared->CheckpointMu);
+  if (Shared->ThreadCheckpoints.size() <= ThreadIdx)
+    Shared->ThreadCheckpoints.resize(ThreadIdx + 1);
+  Shared->ThreadCheckpoints[ThreadIdx].swap(State);
+}
+
+static uint64_t CheckpointFingerprint() {
+  return EF->LLVMFuzzerNezhaFingerprint ? EF->LLVMFuzzerNezhaFingerprint() : 0;
+}
+
+void Fuzzer::WriteCheckpoint() {
+  if (Options.CheckpointPath.empty())
+    return;
+  if (!Checkpoint)
+    Checkpoint.reset(new CampaignCheckpoint(Options.CheckpointPath,
+                                            CheckpointFingerprint()));
+  if (Shared)
+    PublishCheckpoint();
+  auto Start = system_clock::now();
+  bool Full = Checkpoint->NeedsRewrite() ||
+              Checkpoint->Appended() >= kMaxAppendedSegments;
+  std::string Segment = CheckpointSegment(Full);
+  bool Ok = Full ? Checkpoint->Rewrite(Segment) : Checkpoint->Append(Segment);
+  LastCheckpoint = system_clock::now();
+  if (!Ok)
+    Printf("WARNING: could not write checkpoint %s\n",
+           Options.CheckpointPath.c_str());
+  else if (Options.Verbosity >= 2)
+    Printf("INFO: %s checkpoint: %zd bytes in %zd ms\n",
+           Full ? "Full" : "Incremental", Segment.size(),
+           (size_t)duration_cast<milliseconds>(LastCheckpoint - Start).count());
+}
+
+bool Fuzzer::Resume() {
+  assert(!Shared && Corpus.empty());
+  Checkpoint.reset(new CampaignCheckpoint(Options.CheckpointPath,
+                                          CheckpointFingerprint()));
+  std::vector<std::string> Segments;
+  auto Status = Checkpoint->Load(&Segments);
+  if (Status == CampaignCheckpoint::Status::Missing) {
+    Printf("INFO: -resume: no checkpoint at %s yet, starting afresh\n",
+           Options.CheckpointPath.c_str());
+    return false;
+  }
+  CheckpointContents C;
+  bool Ok = Status == CampaignCheckpoint::Status::Loaded;
+  for (size_t I = 0; Ok && I < Segments.size(); I++)
+    Ok = ReadSegment(Segments[I], &C);
+  if (!Ok) {
+    // Not overwritten, since it may belong to another campaign.
+    Printf("ERROR: -resume: %s is not a checkpoint of this campaign (other "
+           "proxies?). Exiting.\n",
+           Options.CheckpointPath.c_str());
+    exit(1);
+  }
+
+  for (size_t S = 0; S < C.Units.size(); S++) {
+    for (size_t I = 0; I < C.Units[S].size(); I++) {
+      if (!UnitHashesAddedToCorpus.insert(Hash(C.Units[S][I])).second)
+        continue;
+      Corpus.push_back(std::move(C.Units[S][I]));
+      CorpusStats.push_back(S < C.Stats.size() && I < C.Stats[S].size()
+                                ? C.Stats[S][I]
+                                : UnitStats());
+    }
+  }
+  for (auto &V : C.Outputs)
+    DiffStats.SetOutputs.insert(V);
+  for (uint64_t Sig : C.Signatures)
+    DiffStats.Signatures.Insert(Sig);
+  DiffStats.DiffHashes = std::move(C.DiffHashes);
+  DiffStats.SetCovPaths.insert(C.CovPaths.begin(), C.CovPaths.end());
+  DiffStats.SetRawEcDiffs.insert(C.EcDiffs.begin(), C.EcDiffs.end());
+
+  // This fuzzer takes over the counters of all threads, so that the totals
+  // add up with any number of threads.
+  size_t Runs = 0;
+  for (auto &T : C.Threads) {
+    Decoder D(T.second);
+    size_t ThreadRuns, Diffs, TupleDiffs, NewUnits, DictSize;
+    UnitStats Totals;
+    if (!D.Size(&ThreadRuns) || !D.Size(&Diffs) || !D.Size(&TupleDiffs) ||
+        !D.Size(&NewUnits) || !D.Stats(&Totals) || !D.Size(&DictSize))
+      continue;
+    Runs += ThreadRuns;
+    TotalNumberOfDiffs += Diffs;
+    NumberOfTupleDiffs += TupleDiffs;
+    NumberOfNewUnitsAdded += NewUnits;
+    Schedule.Merge(Totals);
+    for (size_t I = 0; I < DictSize; I++) {
+      std::string W;
+      uint64_t Hint, Uses, Successes;
+      if (!D.String(&W) || W.size() > Word::GetMaxSize() ||
+          !D.Varint(&Hint) || !D.Varint(&Uses) || !D.Varint(&Successes))
+        break;
+      Word Wd((const uint8_t *)W.data(), W.size());
+      DictionaryEntry DE = Hint ? DictionaryEntry(Wd, Hint - 1)
+                                : DictionaryEntry(Wd);
+      DE.SetCounts(Uses, Successes);
+      MD.AddWordToPersistentAutoDictionary(DE);
+    }
+  }
+  Resumed = true;
+  UpdateCorpusDistribution();
+  Printf("INFO: Resumed from %s: %zd units, %zd output tuples, %zd "
+         "signatures, %zd differences, %zd dictionary words (%zd runs so "
+         "far)\n",
+         Options.CheckpointPath.c_str(), Corpus.size(),
+         DiffStats.SetOutputs.size(), DiffStats.Signatures.size(),
+         TotalNumberOfDiffs,
+         MD.GetPersistentAutoDictionary().size(), Runs);
+  return true;
+}
+
+} // namespace fuzzer
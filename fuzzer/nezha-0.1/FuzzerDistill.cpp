@@ -0,0 +1,218 @@
+//===- FuzzerDistill.cpp - Output-preserving corpus distillation ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Distills corpora into the smallest set of units that keeps every output
+// tuple and disagreement signature they show (-distill).
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerInternal.h"
+#include "../h2_fuzz/hash_utils.h"
+#include "../h2_fuzz/result_matrix.h"
+#include <thread>
+#include <unordered_map>
+
+namespace fuzzer {
+
+namespace {
+
+// Times a unit is offered to the target while it declines to execute it,
+// e.g., because a proxy is down, before the unit is left out.
+const int kMaxDistillAttempts = 10;
+
+typedef std::unordered_map<uint64_t, size_t> FeatureCounts;
+
+void Count(const DistillSample &S, FeatureCounts *Tuples,
+           FeatureCounts *Signatures, int Delta) {
+  if (!S.Executed)
+    return;
+  (*Tuples)[S.Tuple] += Delta;
+  if (S.HasDiff)
+    (*Signatures)[S.Signature] += Delta;
+}
+
+} // namespace
+
+std::vector<size_t> DistillSelect(const std::vector<DistillSample> &Samples) {
+  std::vector<size_t> Order;
+  for (size_t I = 0; I < Samples.size(); I++)
+    if (Samples[I].Executed || Samples[I].Pinned)
+      Order.push_back(I);
+  std::stable_sort(Order.begin(), Order.end(), [&](size_t A, size_t B) {
+    const DistillSample &SA = Samples[A], &SB = Samples[B];
+    if (SA.Pinned != SB.Pinned)
+      return SA.Pinned;
+    if (SA.Size != SB.Size)
+      return SA.Size < SB.Size;
+    return SA.ExecSeconds < SB.ExecSeconds;
+  });
+
+  // How many taken samples show each tuple and signature.
+  FeatureCounts Tuples, Signatures;
+  std::vector<size_t> Taken;
+  for (size_t I : Order) {
+    const DistillSample &S = Samples[I];
+    bool New = S.Executed &&
+               (!Tuples.count(S.Tuple) ||
+                (S.HasDiff && !Signatures.count(S.Signature)));
+    if (!New && !S.Pinned)
+      continue;
+    Count(S, &Tuples, &Signatures, 1);
+    Taken.push_back(I);
+  }
+
+  // A sample taken for a tuple may have had its signature shown by a larger
+  // one later on, and the other way round. Drop those, largest first.
+  std::vector<size_t> Res;
+  for (auto It = Taken.rbegin(); It != Taken.rend(); ++It) {
+    const DistillSample &S = Samples[*It];
+    bool Redundant = !S.Pinned && S.Executed && Tuples[S.Tuple] > 1 &&
+                     (!S.HasDiff || Signatures[S.Signature] > 1);
+    if (Redundant)
+      Count(S, &Tuples, &Signatures, -1);
+    else
+      Res.push_back(*It);
+  }
+  std::sort(Res.begin(), Res.end());
+  return Res;
+}
+
+void Fuzzer::MeasureUnit(const Unit &U, DistillSample *S) {
+  S->Size = U.size();
+  auto Start = system_clock::now();
+  bool FromStore = LoadStoredResults(U.data(), U.size());
+  int Res = 0;
+  for (int Attempt = 0; !FromStore && Attempt < kMaxDistillAttempts;
+       Attempt++) {
+    TotalNumberOfRuns++;
+    Res = ExecuteCallback(U.data(), U.size());
+    if (Res <= 0)
+      break;
+    NumberOfSkippedExecs++;
+  }
+  S->ExecSeconds = duration<double>(system_clock::now() - Start).count();
+  if (!FromStore && Res != 0)
+    return;
+
+  ValContainerCallback *Outputs = EF->LLVMFuzzerNezhaOutputs();
+  std::vector<CallbackRet> Rets(Outputs->vals, Outputs->vals + Outputs->size);
+  ValContainerU64 *Disagree = EF->LLVMFuzzerNezhaDisagreement
+                                  ? EF->LLVMFuzzerNezhaDisagreement(FromStore)
+                                  : nullptr;
+  std::vector<int> Hashes;
+  for (auto *HC : Rets)
+    Hashes.push_back(HC->hash_full());
+  S->Executed = true;
+  S->Tuple = HashUtils::fnv1a(reinterpret_cast<const char *>(Hashes.data()),
+                              Hashes.size() * sizeof(int));
+  // Keyed on the signature, which only splits on compared fields make nonzero
+  S->HasDiff = Disagree && Disagree->vals[DISAGREE_SIGNATURE] != 0;
+  if (S->HasDiff)
+    S->Signature = Disagree->vals[DISAGREE_SIGNATURE];
+
+  // A later campaign loading the distilled corpus need not execute it again
+  if (Results && !FromStore && Results->store(Hash(U), Rets))
+    NumberOfStoreWrites++;
+  for (auto *HC : Rets)
+    delete HC;
+}
+
+void Fuzzer::Distill(const std::vector<std::string> &Corpora,
+                     const std::vector<Fuzzer *> &Helpers) {
+  if (Corpora.size() <= 1) {
+    Printf("Distill requires two or more corpus dirs\n");
+    return;
+  }
+  CheckDiffBasedFuncs();
+  assert(Options.MaxLen > 0);
+
+  // Units already in Corpora[0] come first and are all kept.
+  UnitVector Initial, Extra, Units;
+  ReadDirToVectorOfUnits(Corpora[0].c_str(), &Initial, nullptr,
+                         Options.MaxLen);
+  for (size_t I = 1; I < Corpora.size(); I++)
+    ReadDirToVectorOfUnits(Corpora[I].c_str(), &Extra, nullptr,
+                           Options.MaxLen);
+  std::unordered_set<std::string> Seen;
+  for (auto &U : Initial)
+    if (Seen.insert(Hash(U)).second)
+      Units.push_back(std::move(U));
+  size_t NumInitial = Units.size();
+  for (auto &U : Extra)
+    if (Seen.insert(Hash(U)).second)
+      Units.push_back(std::move(U));
+  Initial.clear();
+  Extra.clear();
+
+  std::vector<DistillSample> Samples(Units.size());
+  for (size_t I = 0; I < NumInitial; I++)
+    Samples[I].Pinned = true;
+  Printf("=== Distilling %zd units into %s (%zd there already) on %zd "
+         "threads\n",
+         Units.size(), Corpora[0].c_str(), NumInitial, Helpers.size() + 1);
+
+  // Every thread takes the next unit nobody took yet, so a slow unit only
+  // holds up its own thread.
+  std::atomic<size_t> Next{0};
+  std::atomic<size_t> Done{0};
+  auto Measure = [&](Fuzzer *W) {
+    IsMyThread = true;
+    for (size_t I; (I = Next++) < Units.size(); Done++)
+      W->MeasureUnit(Units[I], &Samples[I]);
+  };
+  std::vector<std::thread> Threads;
+  for (auto *H : Helpers)
+    Threads.emplace_back(Measure, H);
+  IsMyThread = true;
+  auto Start = system_clock::now(), LastReport = Start;
+  for (size_t I; (I = Next++) < Units.size(); Done++) {
+    MeasureUnit(Units[I], &Samples[I]);
+    auto Now = system_clock::now();
+    if (duration_cast<seconds>(Now - LastReport).count() >= 1) {
+      size_t Seconds = duration_cast<seconds>(Now - Start).count();
+      Printf("#%zd\tDISTILL of %zd units/s: %zd\n", Done.load(),
+             Units.size(), Done.load() / Seconds);
+      LastReport = Now;
+    }
+  }
+  for (auto &T : Threads)
+    T.join();
+
+  size_t NotExecuted = 0;
+  FeatureCounts Tuples, Signatures;
+  for (auto &S : Samples) {
+    NotExecuted += !S.Executed && !S.Pinned;
+    Count(S, &Tuples, &Signatures, 1);
+  }
+  size_t Written = 0;
+  size_t Bytes = 0;
+  std::vector<size_t> Keep = DistillSelect(Samples);
+  for (size_t I : Keep) {
+    Bytes += Units[I].size();
+    if (I < NumInitial)
+      continue;
+    WriteToFile(Units[I], DirPlusFile(Corpora[0], Hash(Units[I])));
+    Written++;
+  }
+  for (auto *H : Helpers) {
+    TotalNumberOfRuns += H->TotalNumberOfRuns;
+    NumberOfStoreHits += H->NumberOfStoreHits;
+  }
+  Printf("=== Distill: %zd output tuples and %zd disagreement signatures "
+         "in %zd units (%zd bytes); written %zd units\n",
+         Tuples.size(), Signatures.size(), Keep.size(), Bytes, Written);
+  Printf("=== Distill: %zd execs, %zd answered from the result store, in "
+         "%zd s\n",
+         TotalNumberOfRuns, NumberOfStoreHits,
+         (size_t)duration_cast<seconds>(system_clock::now() - Start).count());
+  if (NotExecuted)
+    Printf("WARNING: %zd units had no outputs to compare (rejected by every "
+           "proxy, or a proxy was down) and were left out\n",
+           NotExecuted);
+}
+
+} // namespace fuzzer
@@ -15,8 +15,11 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <string>
 #include <thread>
 #include <unistd.h>
@@ -202,7 +205,9 @@ static void WorkerThread(const std::string &Cmd, std::atomic<int> *Counter,
     int C = (*Counter)++;
     if (C >= NumJobs) break;
     std::string Log = "fuzz-" + std::to_string(C) + ".log";
-    std::string ToRun = Cmd + " > " + Log + " 2>&1\n";
+    // NEZHA_JOB_ID lets the target tell jobs apart, e.g., to spread them over replicas
+    std::string ToRun = "NEZHA_JOB_ID=" + std::to_string(C) + " " + Cmd + " > " +
+                        Log + " 2>&1\n";
     if (Flags.verbosity)
       Printf("%s", ToRun.c_str());
     int ExitCode = ExecuteCommand(ToRun);
@@ -250,6 +255,86 @@ static void StartRssThread(Fuzzer *F, size_t RssLimitMb) {
   T.detach();
 }
 
+// Fuzzer holds a PcCoverageMap aligned to 512 bytes, which plain new does not
+// honour before C++17. Extra fuzzers are allocated with posix_memalign instead.
+struct AlignedFuzzerDeleter {
+  void operator()(Fuzzer *F) const {
+    F->~Fuzzer();
+    free(F);
+  }
+};
+typedef std::unique_ptr<Fuzzer, AlignedFuzzerDeleter> AlignedFuzzer;
+
+static AlignedFuzzer NewAlignedFuzzer(UserCallback Callback,
+                                      MutationDispatcher &MD,
+                                      const FuzzingOptions &Options) {
+  void *P = nullptr;
+  if (posix_memalign(&P, alignof(Fuzzer), sizeof(Fuzzer)) != 0) {
+    Printf("ERROR: failed to allocate a fuzzer\n");
+    exit(1);
+  }
+  return AlignedFuzzer(new (P) Fuzzer(Callback, MD, Options));
+}
+
+// Runs NumThreads fuzzing loops in this process. F has loaded the corpus and
+// becomes thread 0; the others get their own mutators and random seeds.
+static void RunInMultipleThreads(Fuzzer *F, UserCallback Callback,
+                                 const FuzzingOptions &Options, unsigned Seed,
+                                 const std::vector<Unit> &Dictionary,
+                                 int NumThreads) {
+  SharedFuzzingState Shared(NumThreads);
+  F->AttachShared(&Shared, 0);
+  F->ShareCorpus();
+
+  std::vector<std::unique_ptr<Random>> Rands;
+  std::vector<std::unique_ptr<MutationDispatcher>> MDs;
+  std::vector<AlignedFuzzer> Fuzzers;
+  for (int i = 1; i < NumThreads; i++) {
+    Rands.emplace_back(new Random(Seed + i));
+    MDs.emplace_back(new MutationDispatcher(*Rands.back(), Options));
+    for (auto &U : Dictionary)
+      if (U.size() <= Word::GetMaxSize())
+        MDs.back()->AddWordToManualDictionary(Word(U.data(), U.size()));
+    // Words restored by -resume; their counts stay with thread 0
+    for (auto &DE : F->GetMD().GetPersistentAutoDictionary())
+      MDs.back()->AddWordToPersistentAutoDictionary(DictionaryEntry(DE.GetW()));
+    Fuzzers.push_back(NewAlignedFuzzer(Callback, *MDs.back(), Options));
+    Fuzzers.back()->AttachShared(&Shared, i);
+  }
+  Printf("INFO: Running %d fuzzing threads\n", NumThreads);
+
+  std::vector<std::thread> V;
+  for (auto &T : Fuzzers)
+    V.push_back(std::thread([&T]() { T->Loop(); }));
+  F->Loop();
+  for (auto &T : V)
+    T.join();
+  F->WriteCheckpoint();
+
+  if (Flags.verbosity)
+    Printf("Done %zd runs in %zd second(s)\n", Shared.TotalRuns.load(),
+           F->secondsSinceProcessStartUp());
+  F->PrintFinalStats();
+}
+
+// Distills the corpora (-distill) on NumThreads threads. F executes units like
+// the others and writes the result.
+static void RunDistill(Fuzzer *F, UserCallback Callback,
+                       const FuzzingOptions &Options, unsigned Seed,
+                       int NumThreads) {
+  std::vector<std::unique_ptr<Random>> Rands;
+  std::vector<std::unique_ptr<MutationDispatcher>> MDs;
+  std::vector<AlignedFuzzer> Helpers;
+  std::vector<Fuzzer *> HelperPtrs;
+  for (int i = 1; i < NumThreads; i++) {
+    Rands.emplace_back(new Random(Seed + i));
+    MDs.emplace_back(new MutationDispatcher(*Rands.back(), Options));
+    Helpers.push_back(NewAlignedFuzzer(Callback, *MDs.back(), Options));
+    HelperPtrs.push_back(Helpers.back().get());
+  }
+  F->Distill(*Inputs, HelperPtrs);
+}
+
 int RunOneTest(Fuzzer *F, const char *InputFilePath) {
   Unit U = FileToVector(InputFilePath);
   Unit PreciseSizedU(U);
@@ -346,6 +431,59 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
   Options.PDCoarse = Flags.diff_pdcoarse;
   Options.PDFine = Flags.diff_pdfine;
   Options.OD = Flags.diff_od;
+  Options.DiffSignature = Flags.diff_signature;
+  Options.DedupStreams = Flags.dedup_streams;
+  Options.PowerSchedule = Flags.power_schedule;
+  if (Flags.result_store)
+    Options.ResultStoreDir = Flags.result_store;
+  if (Flags.checkpoint) {
+    Options.CheckpointPath = Flags.checkpoint;
+    // Jobs of one campaign run with the same flags
+    if (const char *Job = getenv("NEZHA_JOB_ID"))
+      Options.CheckpointPath += "." + std::string(Job);
+  }
+  Options.CheckpointIntervalSec = Flags.checkpoint_interval;
+  Options.Resume = Flags.resume;
+
+  if (Flags.checkpoint || Flags.resume) {
+    // Coverage is not part of the checkpoint, so only output diversity can
+    // carry on where it stopped.
+    if (!Flags.checkpoint || !Options.OD || Options.ForceDefault ||
+        Flags.drill) {
+      Printf("ERROR: -resume requires -checkpoint, and -checkpoint requires "
+             "-diff_od=1 and cannot be combined with -force_default or "
+             "-drill.\n");
+      return 1;
+    }
+  }
+
+  if (Flags.distill) {
+    if (!Options.OD || Options.ForceDefault || Flags.merge || Flags.drill ||
+        DoPlainRun || Inputs->size() < 2) {
+      Printf("ERROR: -distill requires -diff_od=1 and two or more corpus dirs, "
+             "and cannot be combined with -force_default, -merge or -drill.\n");
+      return 1;
+    }
+    // Each thread waits on the proxies most of the time, so the more the better
+    if (Flags.threads == 0)
+      Flags.threads = NumberOfCpuCores();
+  }
+
+  if (Flags.threads > 1) {
+    // Coverage is process-wide, so only output diversity works per thread.
+    if (!Options.OD || Options.ForceDefault || Options.GlobalCoverage ||
+        Options.PDCoarse || Options.PDFine || Flags.drill || Flags.merge ||
+        DoPlainRun) {
+      Printf("ERROR: -threads requires -diff_od=1 and cannot be combined with "
+             "-force_default, -diff_union, -diff_pdcoarse, -diff_pdfine, "
+             "-drill, -merge or input files.\n");
+      return 1;
+    }
+    Options.UseCounters = false;
+    Options.UseTraces = false;
+    Options.UseMemcmp = false;
+    Options.DetectLeaks = false;
+  }
 
   unsigned Seed = Flags.seed;
   // Initialize Seed.
@@ -412,16 +550,30 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
     exit(0);
   }
 
+  if (Flags.distill) {
+    if (Options.MaxLen == 0) {
+      Options.MaxLen = kMaxSaneLen;
+      F.SetMaxLen(kMaxSaneLen);
+    }
+    RunDistill(&F, Callback, Options, Seed, std::max(1, Flags.threads));
+    exit(0);
+  }
+
   size_t TemporaryMaxLen = Options.MaxLen ? Options.MaxLen : kMaxSaneLen;
 
+  // Units loaded after this are only executed if the checkpoint lacks them.
+  if (Options.Resume)
+    F.Resume();
   F.RereadOutputCorpus(TemporaryMaxLen);
   for (auto &inp : *Inputs)
     if (inp != Options.OutputCorpus)
       F.ReadDir(inp, nullptr, TemporaryMaxLen);
 
-  if (Options.MaxLen == 0)
-    F.SetMaxLen(
-        std::min(std::max(kMinDefaultLen, F.MaxUnitSizeInCorpus()), kMaxSaneLen));
+  if (Options.MaxLen == 0) {
+    Options.MaxLen =
+        std::min(std::max(kMinDefaultLen, F.MaxUnitSizeInCorpus()), kMaxSaneLen);
+    F.SetMaxLen(Options.MaxLen);
+  }
 
   if (F.CorpusSize() == 0) {
     F.AddToCorpus(Unit());  // Can't fuzz empty corpus, so add an empty input.
@@ -429,6 +581,11 @@ int FuzzerDriver(int *argc, char ***argv, UserCallback Callback) {
       Printf("INFO: A corpus is not provided, starting from an empty corpus\n");
   }
 
+  if (Flags.threads > 1) {
+    RunInMultipleThreads(&F, Callback, Options, Seed, Dictionary, Flags.threads);
+    exit(0);  // Don't let the fuzzers destroy themselves.
+  }
+
   if (!Options.OD)
     F.ShuffleAndMinimize();
   if (Flags.drill)
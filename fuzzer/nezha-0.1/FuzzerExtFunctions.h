@@ -30,6 +30,13 @@ struct ValContainerCallback {
     int size;
 };
 
+struct ValContainerWords {
+  const char *const *vals;
+  const size_t *sizes;
+  int size;
+  uint64_t version;  // changes whenever the words do
+};
+
 namespace fuzzer {
 
 struct ExternalFunctions {
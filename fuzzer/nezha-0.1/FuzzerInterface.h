@@ -32,7 +32,10 @@ extern "C" {
 // Mandatory user-provided target function.
 // Executes the code under test with [Data, Data+Size) as the input.
 // libFuzzer will invoke this function *many* times with different inputs.
-// Must return 0.
+// Must return 0. NEZHA targets may return a negative value if the input
+// produced no usable outputs, or a positive value if it was not executed at
+// all (e.g., a target was temporarily unavailable); such units are neither
+// compared nor remembered as executed.
 int64_t LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size);
 
 // Optional user-provided initialization function.
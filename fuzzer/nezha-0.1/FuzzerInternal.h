@@ -19,16 +19,21 @@
 #include <climits>
 #include <cstddef>
 #include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <string.h>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
+#include "FuzzerBloomFilter.h"
 #include "FuzzerExtFunctions.h"
 #include "FuzzerInterface.h"
 #include "FuzzerTracePC.h"
 #include "../debug.h"
+#include "../h2_fuzz/result_store.h"
 
 // Platform detection.
 #ifdef __linux__
@@ -171,6 +176,10 @@ class DictionaryEntry {
   }
   void IncUseCount() { UseCount++; }
   void IncSuccessCount() { SuccessCount++; }
+  void SetCounts(size_t Uses, size_t Successes) {
+    UseCount = Uses;
+    SuccessCount = Successes;
+  }
   size_t GetUseCount() const { return UseCount; }
   size_t GetSuccessCount() const {return SuccessCount; }
 
@@ -209,6 +218,245 @@ private:
   size_t Size = 0;
 };
 
+// Ref: http://stackoverflow.com/questions/29855908/c-unordered-set-of-vectors
+struct VectorIntHash {
+  size_t operator()(const std::vector<int>& v) const {
+    std::hash<int> hasher;
+    size_t seed = 0;
+    for (int i : v) {
+      seed ^= hasher(i) + 0x9e3779b9 + (seed<<6) + (seed>>2);
+    }
+    return seed;
+  }
+};
+using SetOfVector = std::unordered_set<std::vector<int>, VectorIntHash>;
+
+typedef std::shared_ptr<const Unit> UnitPtr;
+
+// What the mutants of a corpus unit cost and found (-power_schedule).
+struct UnitStats {
+  size_t Children = 0;     // mutants executed
+  double ExecSeconds = 0;  // wall time spent mutating and executing them
+  size_t NewTuples = 0;    // mutants with a new output tuple
+  size_t Diffs = 0;        // mutants logged as a new difference
+
+  void Record(double Seconds, bool NewTuple, bool Diff) {
+    Children++;
+    ExecSeconds += Seconds;
+    NewTuples += NewTuple;
+    Diffs += Diff;
+  }
+  void Merge(const UnitStats &S) {
+    Children += S.Children;
+    ExecSeconds += S.ExecSeconds;
+    NewTuples += S.NewTuples;
+    Diffs += S.Diffs;
+  }
+};
+
+// -power_schedule=1: the energy of a corpus unit is the number of new
+// differences its mutants are expected to find per second of wall time.
+// A unit's yield and cost are shrunk towards those of all mutants executed so
+// far, so a unit with few mutants is judged mostly by the corpus average and
+// units that are slow (large DATA frames, slow proxies) or that stopped
+// paying off get picked less. New output tuples count as a fraction of a
+// difference, since they are what leads to differences while those are rare.
+class PowerSchedule {
+public:
+  void Record(double Seconds, bool NewTuple, bool Diff) {
+    Total.Record(Seconds, NewTuple, Diff);
+  }
+  double Energy(const UnitStats &S) const;
+  const UnitStats &Totals() const { return Total; }
+  // Adds the totals of an earlier run (-resume).
+  void Merge(const UnitStats &S) { Total.Merge(S); }
+
+private:
+  UnitStats Total;
+};
+
+// Corpus shared by the fuzzing threads of one process (-threads).
+// Each thread appends to its own shard, so adding a unit only contends with
+// readers of that shard; any thread may sample from any shard. Units are
+// immutable and reference counted, so a sampled unit stays valid after the
+// lock is released. Identical units are stored once.
+class ShardedCorpus {
+public:
+  explicit ShardedCorpus(size_t NumShards);
+
+  // Adds U to shard Shard. Returns false if the corpus already holds it.
+  bool Add(size_t Shard, const Unit &U, const UnitStats &Stats = UnitStats());
+  bool Contains(const std::string &UnitHash) const;
+  // Picks a unit, favouring the most recently added units of each shard like
+  // Fuzzer::UpdateCorpusDistribution does. Returns nullptr if empty.
+  UnitPtr Sample(Random &Rand) const;
+  // Picks a unit uniformly at random. Returns nullptr if empty.
+  UnitPtr SampleUniform(Random &Rand) const;
+
+  // Where a unit and its UnitStats are kept.
+  struct Ref {
+    size_t Shard = 0;
+    size_t Idx = 0;
+  };
+  // Picks a shard like Sample does, then a unit of that shard with
+  // probability proportional to its energy under PS. Returns nullptr if empty.
+  UnitPtr SampleByEnergy(Random &Rand, const PowerSchedule &PS, Ref *R) const;
+  // Adds the outcome of a mutant of the unit at R to its UnitStats.
+  void Record(const Ref &R, double Seconds, bool NewTuple, bool Diff);
+  size_t size() const { return Size.load(std::memory_order_relaxed); }
+  size_t MaxUnitSize() const;
+  size_t NumberOfShards() const { return NumShards; }
+  // Copies the units of shard Shard from index From on to Units, and the
+  // UnitStats of all units of the shard to Stats (-checkpoint).
+  void Snapshot(size_t Shard, size_t From, std::vector<UnitPtr> *Units,
+                std::vector<UnitStats> *Stats) const;
+
+private:
+  struct Shard {
+    mutable std::mutex Mu;
+    std::vector<UnitPtr> Units;
+    std::vector<UnitStats> Stats;  // of Units[i]
+    std::atomic<size_t> Count{0};
+    std::unordered_set<std::string> Hashes;  // hashes that map to this shard
+  };
+
+  const Shard *PickShard(Random &Rand, size_t *Count) const;
+
+  std::unique_ptr<Shard[]> Shards;
+  size_t NumShards;
+  std::atomic<size_t> Size{0};
+};
+
+// Set of output tuples shared by the fuzzing threads of one process, split
+// into independently locked shards by tuple hash.
+class ConcurrentTupleSet {
+public:
+  explicit ConcurrentTupleSet(size_t NumShards = 64);
+  // Returns true if V was not in the set yet.
+  bool Insert(const std::vector<int> &V);
+  size_t size() const;
+  // Calls F on every tuple, one shard at a time.
+  void ForEach(const std::function<void(const std::vector<int> &)> &F) const;
+
+private:
+  struct Shard {
+    mutable std::mutex Mu;
+    SetOfVector Set;
+  };
+
+  std::unique_ptr<Shard[]> Shards;
+  size_t NumShards;
+};
+
+// Set of 64-bit difference signatures (-diff_signature). Open addressing in a
+// flat array, so an entry costs 8 to 16 bytes. Safe to use from several threads.
+class SignatureSet {
+public:
+  // Returns true if Sig was not in the set yet.
+  bool Insert(uint64_t Sig);
+  size_t size() const;
+  void clear();
+  void ForEach(const std::function<void(uint64_t)> &F) const;
+
+private:
+  void Grow();
+
+  mutable std::mutex Mu;
+  std::vector<uint64_t> Slots;  // 0 marks a free slot
+  bool HasZero = false;         // so 0 is kept out of Slots
+  size_t Size = 0;
+};
+
+// Entries added to the sets of a Fuzzer::Diff since the last checkpoint
+// (-checkpoint), so that only those are appended to the checkpoint file.
+// Records nothing unless enabled. Safe to use from several threads.
+class DiffJournal {
+public:
+  bool Enabled = false;
+
+  void AddOutput(const std::vector<int> &V) { Add(&Outputs, V); }
+  void AddEcDiff(const std::vector<int> &V) { Add(&EcDiffs, V); }
+  void AddCovPath(const std::string &P) { Add(&CovPaths, P); }
+  void AddSignature(uint64_t Sig) { Add(&Signatures, Sig); }
+  // Moves the recorded entries to J and forgets them.
+  void Take(DiffJournal *J);
+  void clear();
+
+  std::vector<std::vector<int>> Outputs;
+  std::vector<std::vector<int>> EcDiffs;
+  std::vector<std::string> CovPaths;
+  std::vector<uint64_t> Signatures;
+
+private:
+  template <class T> void Add(std::vector<T> *Log, const T &X) {
+    if (!Enabled)
+      return;
+    std::lock_guard<std::mutex> Lock(Mu);
+    Log->push_back(X);
+  }
+
+  std::mutex Mu;
+};
+
+// Append-only file of checksummed segments holding the state of a campaign
+// (-checkpoint). A segment is only trusted if it was written completely, so
+// a process killed while appending leaves a file that still loads, up to the
+// last complete segment. The first segment written by a process replaces the
+// file atomically; the following ones only hold what changed since.
+class CampaignCheckpoint {
+public:
+  enum class Status { Missing, Loaded, Invalid };
+
+  // Fingerprint identifies the outputs the state is about, e.g., the proxies
+  // that produced them; a file with another fingerprint is not loaded.
+  CampaignCheckpoint(const std::string &Path, uint64_t Fingerprint);
+  ~CampaignCheckpoint();
+
+  // Reads the complete segments of the file, in the order they were written.
+  Status Load(std::vector<std::string> *Segments) const;
+  // Replaces the file with one holding only Segment.
+  bool Rewrite(const std::string &Segment);
+  // Appends Segment and flushes it to disk. Fails if nothing was written
+  // yet, or if the segment could not be written completely; the file is
+  // then as it was before, and the next segment must be a Rewrite.
+  bool Append(const std::string &Segment);
+  // Segments appended since the last Rewrite.
+  size_t Appended() const { return NumAppended; }
+  bool NeedsRewrite() const { return Fd < 0; }
+  const std::string &GetPath() const { return Path; }
+
+  // What the file holds so far: units and UnitStats per corpus shard, and
+  // the number of logged differences.
+  std::vector<size_t> Units;
+  std::vector<std::vector<UnitStats>> Stats;
+  size_t DiffHashes = 0;
+
+private:
+  std::string Path;
+  uint64_t Fingerprint;
+  int Fd = -1;
+  size_t NumAppended = 0;
+};
+
+// What executing one unit showed (-distill).
+struct DistillSample {
+  size_t Size = 0;
+  double ExecSeconds = 0;
+  bool Executed = false;  // false if the unit had no outputs to compare
+  bool Pinned = false;    // already in the output corpus; always kept
+  uint64_t Tuple = 0;     // hash of the output tuple
+  bool HasDiff = false;
+  uint64_t Signature = 0; // disagreement signature, if HasDiff
+};
+
+// Picks a minimal subset of Samples that shows every output tuple and every
+// disagreement signature that Samples show (-distill), and returns their
+// indices in ascending order. Small units are preferred, then fast ones:
+// samples are taken greedily in that order when they show something new, then
+// taken samples are dropped again, largest first, while the others still show
+// all they do. Pinned samples are taken first and never dropped.
+std::vector<size_t> DistillSelect(const std::vector<DistillSample> &Samples);
+
 struct FuzzingOptions {
   int Verbosity = 1;
   size_t MaxLen = 0;
@@ -250,6 +498,13 @@ struct FuzzingOptions {
   bool PDCoarse = false;
   bool PDFine = false;
   bool OD = false;
+  bool DiffSignature = false;
+  std::string ResultStoreDir;
+  bool DedupStreams = true;
+  int PowerSchedule = 0;
+  std::string CheckpointPath;
+  int CheckpointIntervalSec = 60;
+  bool Resume = false;
 };
 
 class MutationDispatcher {
@@ -294,6 +549,9 @@ public:
   /// Mutates data by adding a word from the persistent automatic dictionary.
   size_t Mutate_AddWordFromPersistentAutoDictionary(uint8_t *Data, size_t Size, size_t MaxSize);
 
+  /// Mutates data by adding a word from the dictionary of the target.
+  size_t Mutate_AddWordFromTargetDictionary(uint8_t *Data, size_t Size, size_t MaxSize);
+
   /// Tries to find an ASCII integer in Data, changes it to another ASCII int.
   size_t Mutate_ChangeASCIIInteger(uint8_t *Data, size_t Size, size_t MaxSize);
 
@@ -315,9 +573,18 @@ public:
 
   void AddWordToAutoDictionary(DictionaryEntry DE);
   void ClearAutoDictionary();
+  // Saved and restored by -checkpoint and -resume.
+  const Dictionary &GetPersistentAutoDictionary() const {
+    return PersistentAutoDictionary;
+  }
+  void AddWordToPersistentAutoDictionary(const DictionaryEntry &DE);
+  // Words the target harvested from its outputs (LLVMFuzzerNezhaDictionary).
+  void AddWordToTargetDictionary(const Word &W);
+  void ClearTargetDictionary();
   void PrintRecommendedDictionary();
 
   void SetCorpus(const std::vector<Unit> *Corpus) { this->Corpus = Corpus; }
+  void SetSharedCorpus(const ShardedCorpus *SC) { this->SharedCorpus = SC; }
 
   Random &GetRand() { return Rand; }
 
@@ -332,6 +599,9 @@ private:
                                size_t MaxSize);
   size_t MutateImpl(uint8_t *Data, size_t Size, size_t MaxSize,
                     const std::vector<Mutator> &Mutators);
+  // Picks a random corpus unit to cross over with, or returns nullptr if the
+  // corpus has fewer than two units.
+  const Unit *ChooseCrossOverPartner();
 
   Random &Rand;
   const FuzzingOptions Options;
@@ -344,9 +614,14 @@ private:
   // Persistent dictionary modified by the fuzzer, consists of
   // entries that led to successfull discoveries in the past mutations.
   Dictionary PersistentAutoDictionary;
+  // Dictionary provided by the target, replaced whenever it changes.
+  Dictionary TargetDictionary;
   std::vector<Mutator> CurrentMutatorSequence;
   std::vector<DictionaryEntry *> CurrentDictionaryEntrySequence;
   const std::vector<Unit> *Corpus = nullptr;
+  const ShardedCorpus *SharedCorpus = nullptr;
+  // Keeps the current cross-over partner alive while it is read.
+  UnitPtr CrossOverPartner;
   std::vector<uint8_t> MutateInPlaceHere;
 
   std::vector<Mutator> Mutators;
@@ -354,19 +629,7 @@ private:
 };
 
 
-// Ref: http://stackoverflow.com/questions/29855908/c-unordered-set-of-vectors
-struct VectorIntHash {
-  size_t operator()(const std::vector<int>& v) const {
-    std::hash<int> hasher;
-    size_t seed = 0;
-    for (int i : v) {
-      seed ^= hasher(i) + 0x9e3779b9 + (seed<<6) + (seed>>2);
-    }
-    return seed;
-  }
-};
-using SetOfVector = std::unordered_set<std::vector<int>, VectorIntHash>;
-
+struct SharedFuzzingState;
 
 class Fuzzer {
 public:
@@ -416,6 +679,8 @@ public:
       SetCovDiffs.clear();
       SetCovPaths.clear();
       SetRawEcDiffs.clear();
+      Signatures.clear();
+      Added.clear();
     }
 
     std::vector<std::pair <std::string,
@@ -425,6 +690,12 @@ public:
     SetOfVector SetOutputs;
     SetOfVector SetCovDiffs;
     SetOfVector SetRawEcDiffs;
+    // Disagreement signatures seen so far (-diff_signature).
+    SignatureSet Signatures;
+    // What the sets above gained since the last checkpoint. With -threads,
+    // output tuples are recorded here even though they are kept in
+    // SharedFuzzingState::Outputs.
+    DiffJournal Added;
   };
 
 
@@ -434,19 +705,16 @@ public:
     UpdateCorpusDistribution();
   }
   size_t ChooseUnitIdxToMutate();
-  const Unit &ChooseUnitToMutate() { return Corpus[ChooseUnitIdxToMutate()]; };
+  const Unit &ChooseUnitToMutate();
   void TruncateUnits(std::vector<Unit> *NewCorpus);
   void Loop();
   void Drill();
   void ShuffleAndMinimize();
   void InitializeTraceState();
   void AssignTaintLabels(uint8_t *Data, size_t Size);
-  size_t CorpusSize() const { return Corpus.size(); }
+  size_t CorpusSize() const;
   size_t MaxUnitSizeInCorpus() const;
-  void ReadDir(const std::string &Path, long *Epoch, size_t MaxSize) {
-    Printf("Loading corpus: %s\n", Path.c_str());
-    ReadDirToVectorOfUnits(Path.c_str(), &Corpus, Epoch, MaxSize);
-  }
+  void ReadDir(const std::string &Path, long *Epoch, size_t MaxSize);
   void RereadOutputCorpus(size_t MaxSize);
   // Save the current corpus to OutputCorpus.
   void SaveCorpus();
@@ -473,6 +741,11 @@ public:
   void Merge(const std::vector<std::string> &Corpora);
   // Returns a subset of 'Extra' that adds coverage to 'Initial'.
   UnitVector FindExtraUnits(const UnitVector &Initial, const UnitVector &Extra);
+  // Distill Corpora[1:] into Corpora[0]: executes every unit once, on this
+  // thread and one thread per helper, and writes the smallest set of units
+  // that keeps every output tuple and disagreement signature (-distill).
+  void Distill(const std::vector<std::string> &Corpora,
+               const std::vector<Fuzzer *> &Helpers);
   MutationDispatcher &GetMD() { return MD; }
   void PrintFinalStats();
   void SetMaxLen(size_t MaxLen);
@@ -482,6 +755,28 @@ public:
   void ResetCoverage();
   void ResetDiff();
 
+  // Makes this fuzzer thread number Idx of a multi-threaded run (-threads).
+  // Its corpus, output tuples, logged differences and recent streams are then
+  // the ones in S. Must be called before the fuzzer runs any unit.
+  void AttachShared(SharedFuzzingState *S, size_t Idx);
+  // Moves the units loaded so far, with their UnitStats, and the outputs and
+  // differences restored by Resume into the shared state.
+  void ShareCorpus();
+
+  // Restores the state of an earlier campaign from -checkpoint: the corpus
+  // and its UnitStats, the output tuples, signatures and logged differences,
+  // the counters, and the persistent dictionary. Must be called before any
+  // corpus is loaded and before AttachShared. Returns false if there is no
+  // checkpoint yet.
+  bool Resume();
+  // Writes what changed since the last checkpoint to -checkpoint. With
+  // -threads, only thread 0 writes, and other threads contribute what was
+  // last published with PublishCheckpoint.
+  void WriteCheckpoint();
+  // Makes the counters and dictionary of this fuzzing thread, which no other
+  // thread may read, part of the next checkpoint (-threads).
+  void PublishCheckpoint();
+
   bool InFuzzingThread() const { return IsMyThread; }
   size_t GetCurrentUnitInFuzzingThead(const uint8_t **Data) const;
 
@@ -491,10 +786,14 @@ private:
   void InterruptCallback();
   void MutateAndTestOne();
   void ReportNewCoverage(const Unit &U);
+  // True once -runs executions have been made, by this fuzzer or, with
+  // -threads, by all of them together.
+  bool RunBudgetExhausted() const;
   bool RunOne(const Unit &U) { return RunOne(U.data(), U.size()); }
   void RunOneAndUpdateCorpus(const uint8_t *Data, size_t Size);
   void WriteToOutputCorpus(const Unit &U);
-  void WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix);
+  // Returns the path the unit was written to, or "" if artifacts are not saved.
+  std::string WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix);
   void PrintStats(const char *Where, const char *End = "\n");
   void PrintStatusForNewUnit(const Unit &U);
   void ShuffleCorpus(UnitVector *V);
@@ -504,6 +803,18 @@ private:
   // Updates the probability distribution for the units in the corpus.
   // Must be called whenever the corpus or unit weights are changed.
   void UpdateCorpusDistribution();
+  // Adds the outcome of the last mutant to the stats of the unit it was
+  // mutated from (-power_schedule).
+  void RecordMutant(double Seconds);
+  // Reloads the target's dictionary into MD if it changed.
+  void UpdateTargetDictionary();
+  // Encodes what only this fuzzing thread may read for the checkpoint.
+  std::string CheckpointThreadState() const;
+  // Encodes the state that changed since the last checkpoint, or all of it.
+  std::string CheckpointSegment(bool Full);
+  // Executes U, or loads its results from the result store, and fills S with
+  // what it showed (-distill).
+  void MeasureUnit(const Unit &U, DistillSample *S);
 
   bool UpdateMaxCoverage();
 
@@ -517,7 +828,18 @@ private:
   void StopTraceRecording();
 
   // Update difference-related statistics and log differences
-  bool UpdateDiffAndLog(const uint8_t *Data, size_t Size);
+  bool UpdateDiffAndLog(const uint8_t *Data, size_t Size, bool FromStore = false);
+
+  // Fill the callback outputs from the result store instead of executing.
+  // Returns false if the unit has no valid stored results.
+  bool LoadStoredResults(const uint8_t *Data, size_t Size);
+
+  // Returns true if a unit with the same canonical stream was executed
+  // recently (-dedup_streams). Otherwise stores the canonical hash in
+  // *StreamHash (0 if there is none) so the caller can record it once the
+  // unit has actually been executed.
+  bool IsRecentDuplicate(const uint8_t *Data, size_t Size,
+                         uint64_t *StreamHash);
 
   // Check for external functions required for difference-based fuzzing.
   void CheckDiffBasedFuncs();
@@ -533,6 +855,9 @@ private:
 
   size_t TotalNumberOfRuns = 0;
   size_t TotalNumberOfDiffs = 0;
+  // Differences with a new tuple of outputs, i.e. the ones that would be
+  // logged without -diff_signature.
+  size_t NumberOfTupleDiffs = 0;
   size_t NumberOfNewUnitsAdded = 0;
 
   bool HasMoreMallocsThanFrees = false;
@@ -556,10 +881,68 @@ private:
   // Diff-based statistics.
   Diff DiffStats;
 
+  // Per-proxy results shared across jobs and restarts (-result_store).
+  std::unique_ptr<ResultStore> Results;
+  // Set while (re)loading a corpus; only then may RunOne answer from Results.
+  bool ReplayFromStore = false;
+  size_t NumberOfStoreHits = 0;
+  size_t NumberOfStoreWrites = 0;
+
+  // Canonical stream hashes of recently executed units (-dedup_streams).
+  ScalableBloomFilter RecentStreams;
+  size_t NumberOfDuplicateSkips = 0;
+
+  // Units the callback declined to execute (positive return value).
+  size_t NumberOfSkippedExecs = 0;
+
+  // -power_schedule: UnitStats of Corpus[i] are CorpusStats[i]. With -threads
+  // they are kept in Shared->Corpus instead.
+  std::vector<UnitStats> CorpusStats;
+  PowerSchedule Schedule;
+  // Where the unit being mutated came from.
+  size_t CurrentParentIdx = 0;
+  ShardedCorpus::Ref CurrentParentRef;
+
+  // Version of the target's dictionary last loaded into MD.
+  uint64_t TargetDictionaryVersion = 0;
+
+  // -checkpoint: the file, created by the first Resume or WriteCheckpoint.
+  std::unique_ptr<CampaignCheckpoint> Checkpoint;
+  system_clock::time_point LastCheckpoint = system_clock::now();
+  // Set by Resume; units loaded afterwards are added only if not restored.
+  bool Resumed = false;
+
+  // State shared with the other fuzzing threads (-threads), or nullptr.
+  SharedFuzzingState *Shared = nullptr;
+  size_t ThreadIdx = 0;
+  // Keeps the unit being mutated alive while it is read from Shared->Corpus.
+  UnitPtr CurrentParent;
+
   // Need to know our own thread.
   static thread_local bool IsMyThread;
 };
 
+// State shared by the fuzzing threads of one process (-threads).
+struct SharedFuzzingState {
+  explicit SharedFuzzingState(size_t NumThreads) : Corpus(NumThreads) {}
+
+  ShardedCorpus Corpus;
+  // Output tuples seen so far (-diff_od).
+  ConcurrentTupleSet Outputs;
+  // Logged differences, bucketed by fuzzy hash and outputs.
+  std::mutex DiffMu;
+  Fuzzer::Diff Diffs;
+  // Canonical hashes of recently executed streams (-dedup_streams).
+  std::mutex StreamsMu;
+  ScalableBloomFilter RecentStreams;
+  std::atomic<size_t> TotalRuns{0};
+  // Every fuzzing thread, in thread order. Fuzzers[0] reports the totals.
+  std::vector<Fuzzer *> Fuzzers;
+  // What each thread last published for the checkpoint (-checkpoint).
+  std::mutex CheckpointMu;
+  std::vector<std::string> ThreadCheckpoints;
+};
+
 // Global interface to functions that may or may not be available.
 extern ExternalFunctions *EF;
 
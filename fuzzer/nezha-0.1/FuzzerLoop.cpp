@@ -14,6 +14,7 @@
 #include <cstring>
 #include <memory>
 #include "../debug.h"
+#include "../h2_fuzz/result_matrix.h"
 
 // To log differences natively within libFuzzer
 #include <sstream>
@@ -44,6 +45,9 @@ namespace fuzzer {
 // Track if a difference was encountered in the return values of this unit.
     thread_local bool UnitHadDiff;
 
+// Track if this unit had a new tuple of return values.
+    thread_local bool UnitHadNewRetTuple;
+
 
     static void MissingExternalApiFunction(const char *FnName) {
         Printf("ERROR: %s is not defined. Exiting.\n"
@@ -58,9 +62,13 @@ namespace fuzzer {
       MissingExternalApiFunction(#fn);                                         \
   } while (false)
 
-// Only one Fuzzer per process.
+// The first Fuzzer of the process; it handles signals and reports the
+// totals when several fuzzing threads run (-threads).
     static Fuzzer *F;
 
+// The Fuzzer driving the current thread, for LLVMFuzzerMutate.
+    static thread_local Fuzzer *CurrentFuzzer;
+
     struct DiffController {
         /**
          * Returns whether any of the CallbackRets (HashComps) in the given vector are different from the rest.
@@ -249,11 +257,23 @@ namespace fuzzer {
             : CB(CB), MD(MD), Options(Options) {
         SetDeathCallback();
         InitializeTraceState();
-        assert(!F);
-        F = this;
+        if (!F)
+            F = this;
+        CurrentFuzzer = this;
         ResetCoverage();
         ResetDiff();
+        DiffStats.Added.Enabled = !Options.CheckpointPath.empty();
         IsMyThread = true;
+        if (!Options.ResultStoreDir.empty()) {
+            if (!EF->LLVMFuzzerNezhaFingerprint) {
+                Printf("ERROR: -result_store requires LLVMFuzzerNezhaFingerprint. Exiting.\n");
+                exit(1);
+            }
+            Results.reset(new ResultStore(Options.ResultStoreDir, EF->LLVMFuzzerNezhaFingerprint()));
+            if (Options.Verbosity)
+                Printf("INFO: Result store: %s (fingerprint %llx)\n", Options.ResultStoreDir.c_str(),
+                       (unsigned long long) Results->get_fingerprint());
+        }
         if (Options.DetectLeaks && EF->__sanitizer_install_malloc_and_free_hooks)
             EF->__sanitizer_install_malloc_and_free_hooks(MallocHook, FreeHook);
     }
@@ -374,11 +394,13 @@ namespace fuzzer {
             }
             Printf("%zd,%zd,%zd,%zd,%zd,%zd,%s\n", TotalNumberOfRuns,
                    MaxCoverage.BlockCoverage, MaxCoverage.CounterBitmapBits,
-                   MaxCoverage.CallerCalleeCoverage, Corpus.size(), ExecPerSec, Where);
+                   MaxCoverage.CallerCalleeCoverage, CorpusSize(), ExecPerSec, Where);
         }
 
         if (!Options.Verbosity)
             return;
+        if (Shared)
+            Printf("[%zd] ", ThreadIdx);
         Printf("#%zd\t%s", TotalNumberOfRuns, Where);
         if (MaxCoverage.BlockCoverage)
             Printf(" cov: %zd", MaxCoverage.BlockCoverage);
@@ -388,13 +410,37 @@ namespace fuzzer {
             Printf(" bits: %zd", TB);
         if (MaxCoverage.CallerCalleeCoverage)
             Printf(" indir: %zd", MaxCoverage.CallerCalleeCoverage);
-        Printf(" units: %zd exec/s: %zd", Corpus.size(), ExecPerSec);
+        Printf(" units: %zd exec/s: %zd", CorpusSize(), ExecPerSec);
+        if (NumberOfDuplicateSkips)
+            Printf(" dup: %zd", NumberOfDuplicateSkips);
+        if (NumberOfSkippedExecs)
+            Printf(" skip: %zd", NumberOfSkippedExecs);
         Printf("%s", End);
     }
 
     void Fuzzer::PrintFinalStats() {
         if (!Options.PrintFinalStats) return;
-        size_t ExecPerSec = execPerSec();
+
+        // With -threads, report the totals of all fuzzing threads
+        std::vector<Fuzzer *> All = Shared ? Shared->Fuzzers : std::vector<Fuzzer *>{this};
+        size_t TotalRuns = 0, Diffs = 0, TupleDiffs = 0, NewUnits = 0, Slowest = 0, DupSkips = 0, Skipped = 0;
+        size_t StoreHits = 0, StoreWrites = 0;
+        UnitStats Mutants;
+        for (auto *T: All) {
+            Mutants.Children += T->Schedule.Totals().Children;
+            Mutants.ExecSeconds += T->Schedule.Totals().ExecSeconds;
+            TotalRuns += T->TotalNumberOfRuns;
+            Diffs += T->TotalNumberOfDiffs;
+            TupleDiffs += T->NumberOfTupleDiffs;
+            NewUnits += T->NumberOfNewUnitsAdded;
+            Slowest = std::max(Slowest, (size_t) T->TimeOfLongestUnitInSeconds);
+            DupSkips += T->NumberOfDuplicateSkips;
+            Skipped += T->NumberOfSkippedExecs;
+            StoreHits += T->NumberOfStoreHits;
+            StoreWrites += T->NumberOfStoreWrites;
+        }
+        size_t Seconds = secondsSinceProcessStartUp();
+        size_t ExecPerSec = Seconds ? TotalRuns / Seconds : 0;
 
         std::string mode;
         if (Options.GlobalCoverage)
@@ -415,16 +461,51 @@ namespace fuzzer {
             Printf("stat::mode:                     Default\n");
         }
 
-        if (!Options.ForceDefault)
-            Printf("stat::number_of_diffs:          %zd\n", TotalNumberOfDiffs);
-        Printf("stat::number_of_executed_units: %zd\n", TotalNumberOfRuns);
+        if (Shared)
+            Printf("stat::threads:                  %zd\n", All.size());
+        if (!Options.ForceDefault) {
+            Printf("stat::number_of_diffs:          %zd\n", Diffs);
+            Printf("stat::diffs_per_hour:           %.1f\n", Seconds ? 3600.0 * Diffs / Seconds : 0.0);
+        }
+        if (!Options.ForceDefault && Options.DiffSignature) {
+            // Each logged difference writes a unit and its HTTP/1 outputs to the artifact directory
+            Printf("stat::diff_signatures:          %zd\n", (Shared ? Shared->Diffs : DiffStats).Signatures.size());
+            Printf("stat::tuple_diffs:              %zd\n", TupleDiffs);
+            Printf("stat::diff_files_saved_pct:     %.2f\n",
+                   TupleDiffs > Diffs ? 100.0 * (TupleDiffs - Diffs) / TupleDiffs : 0.0);
+        }
+        Printf("stat::number_of_executed_units: %zd\n", TotalRuns);
         Printf("stat::average_exec_per_sec:     %zd\n", ExecPerSec);
-        Printf("stat::new_units_added:          %zd\n", NumberOfNewUnitsAdded);
-        Printf("stat::slowest_unit_time_sec:    %zd\n", TimeOfLongestUnitInSeconds);
+        Printf("stat::new_units_added:          %zd\n", NewUnits);
+        Printf("stat::corpus_size:              %zd\n", CorpusSize());
+        Printf("stat::slowest_unit_time_sec:    %zd\n", Slowest);
         Printf("stat::peak_rss_mb:              %zd\n", GetPeakRSSMb());
+        if (Options.DedupStreams) {
+            Printf("stat::duplicate_skips:          %zd\n", DupSkips);
+            Printf("stat::duplicate_skip_pct:       %.2f\n",
+                   TotalRuns ? 100.0 * DupSkips / TotalRuns : 0.0);
+        }
+        Printf("stat::skipped_execs:            %zd\n", Skipped);
+        if (Options.PowerSchedule) {
+            Printf("stat::scheduled_mutants:        %zd\n", Mutants.Children);
+            Printf("stat::mean_mutant_exec_ms:      %.3f\n",
+                   Mutants.Children ? 1000.0 * Mutants.ExecSeconds / Mutants.Children : 0.0);
+        }
+        if (Results) {
+            Printf("stat::result_store_hits:        %zd\n", StoreHits);
+            Printf("stat::result_store_writes:      %zd\n", StoreWrites);
+        }
+        if (EF->LLVMFuzzerNezhaPrintStats)
+            EF->LLVMFuzzerNezhaPrintStats();
+    }
+
+    size_t Fuzzer::CorpusSize() const {
+        return Shared ? Shared->Corpus.size() : Corpus.size();
     }
 
     size_t Fuzzer::MaxUnitSizeInCorpus() const {
+        if (Shared)
+            return Shared->Corpus.MaxUnitSize();
         size_t Res = 0;
         for (auto &X: Corpus)
             Res = std::max(Res, X.size());
@@ -439,13 +520,28 @@ namespace fuzzer {
     }
 
 
+    void Fuzzer::ReadDir(const std::string &Path, long *Epoch, size_t MaxSize) {
+        Printf("Loading corpus: %s\n", Path.c_str());
+        if (!Resumed) {
+            ReadDirToVectorOfUnits(Path.c_str(), &Corpus, Epoch, MaxSize);
+            return;
+        }
+        // Units restored from the checkpoint are in the corpus already
+        std::vector<Unit> Units;
+        ReadDirToVectorOfUnits(Path.c_str(), &Units, Epoch, MaxSize);
+        for (auto &U: Units)
+            if (UnitHashesAddedToCorpus.insert(Hash(U)).second)
+                Corpus.push_back(U);
+        UpdateCorpusDistribution();
+    }
+
     void Fuzzer::RereadOutputCorpus(size_t MaxSize) {
         if (Options.OutputCorpus.empty())
             return;
         std::vector<Unit> AdditionalCorpus;
         ReadDirToVectorOfUnits(Options.OutputCorpus.c_str(), &AdditionalCorpus,
                                &EpochOfLastReadOfOutputCorpus, MaxSize);
-        if (Corpus.empty()) {
+        if (Corpus.empty() && !Shared) {
             Corpus = AdditionalCorpus;
             return;
         }
@@ -456,10 +552,21 @@ namespace fuzzer {
         for (auto &X: AdditionalCorpus) {
             if (X.size() > MaxSize)
                 X.resize(MaxSize);
-            if (UnitHashesAddedToCorpus.insert(Hash(X)).second) {
-                if (RunOne(X)) {
-                    Corpus.push_back(X);
-                    UpdateCorpusDistribution();
+            std::string H = Hash(X);
+            // Units found by the other fuzzing threads are already in the shared corpus.
+            if (Shared && Shared->Corpus.Contains(H))
+                continue;
+            if (UnitHashesAddedToCorpus.insert(H).second) {
+                ReplayFromStore = true;
+                bool Added = RunOne(X);
+                ReplayFromStore = false;
+                if (Added) {
+                    if (Shared) {
+                        Shared->Corpus.Add(ThreadIdx, X);
+                    } else {
+                        Corpus.push_back(X);
+                        UpdateCorpusDistribution();
+                    }
                     PrintStats("RELOAD");
                 }
             }
@@ -530,6 +637,7 @@ namespace fuzzer {
         ResetCoverage();
         ResetDiff();
 
+        ReplayFromStore = true;
         for (const auto &U: Corpus) {
             bool NewCoverage = RunOne(U);
             if (!Options.PruneCorpus || NewCoverage) {
@@ -539,6 +647,7 @@ namespace fuzzer {
             }
             TryDetectingAMemoryLeak(U.data(), U.size(), /*DuringInitialCorpusExecution*/ true);
         }
+        ReplayFromStore = false;
         Corpus = NewCorpus;
         UpdateCorpusDistribution();
         for (auto &X: Corpus)
@@ -568,7 +677,7 @@ namespace fuzzer {
         return Res;
     }
 
-    bool Fuzzer::UpdateDiffAndLog(const uint8_t *Data, size_t Size) {
+    bool Fuzzer::UpdateDiffAndLog(const uint8_t *Data, size_t Size, bool FromStore) {
         // Returns true if a differential-based metric indicates that we should add this unit to the corpus
         bool Res;
 
@@ -637,7 +746,15 @@ namespace fuzzer {
         assert(vcont && vcont->vals);
         std::vector<CallbackRet> ret_v = DiffController::ParseGenericCallbackVector(vcont);
         assert(!ret_v.empty());
-        HasRetDiff = DiffController::RetTupleHasRetDiff(ret_v);
+        // Which proxies disagree on which fields, worked out by the target when it normalized the outputs. Outputs
+        // loaded from the result store were never normalized here, so the target has to look at them again.
+        ValContainerU64 *Disagree = EF->LLVMFuzzerNezhaDisagreement
+                                    ? EF->LLVMFuzzerNezhaDisagreement(FromStore) : nullptr;
+        if (Disagree) {
+            HasRetDiff = Disagree->vals[DISAGREE_PROXIES] != 0;
+        } else {
+            HasRetDiff = DiffController::RetTupleHasRetDiff(ret_v);
+        }
 
         // having used the HashComp objects to detect differences, now hash them all so that NEZHA's
         // internal logic can work as-is
@@ -650,10 +767,23 @@ namespace fuzzer {
         }
         DEBUG("")
 
+        // With -diff_signature, an exec is new if the way the proxies disagree is new, whatever their outputs are.
+        Fuzzer::Diff &DiffState = Shared ? Shared->Diffs : DiffStats;
+        bool NewSignature = Options.DiffSignature && Disagree &&
+                            DiffState.Signatures.Insert(Disagree->vals[DISAGREE_SIGNATURE]);
+        if (NewSignature)
+            DiffState.Added.AddSignature(Disagree->vals[DISAGREE_SIGNATURE]);
+
         // Log difference with fuzzy hash bucketing.
         bool IsNewDiff = false;
         if (HasRetDiff) {
             DEBUG("found ret diff")
+#if DBG_MODE
+            for (int I = DISAGREE_COLS; Disagree && I < Disagree->size; ++I)
+                if (Disagree->vals[I])
+                    DEBUG("  " << ResultMatrix::key_name(I - DISAGREE_COLS) << ": proxies 0x" << std::hex
+                               << Disagree->vals[I] << std::dec << " disagree")
+#endif
             // Compute fuzzy similarity score normalized by number of libraries.
             std::vector<std::string> HCandidate;
             std::string HLib;
@@ -667,8 +797,15 @@ namespace fuzzer {
                 assert(!HCandidate.empty());
             }
 
-            IsNewDiff = true;
-            for (const auto &FHashPair: DiffStats.DiffHashes) {
+            // With -threads, differences are bucketed against those logged by every thread
+            Fuzzer::Diff &LoggedDiffs = DiffState;
+            std::unique_lock<std::mutex> DiffLock;
+            if (Shared)
+                DiffLock = std::unique_lock<std::mutex>(Shared->DiffMu);
+
+            bool IsNewTupleDiff = true;
+            size_t Bucket = 0;
+            for (const auto &FHashPair: LoggedDiffs.DiffHashes) {
                 auto FHashVec = FHashPair.second.first;
                 auto FRetVec = FHashPair.second.second;
                 int I = 0;
@@ -683,31 +820,52 @@ namespace fuzzer {
                 // enough w.r.t. the fuzzy hashes and (2) their return values match.
                 if ((std::equal(FRetVec.begin(), FRetVec.end(), hashvec.begin())) &&
                     (ScoreUnit > Options.DiffFhashMin)) {
-                    IsNewDiff = false;
+                    IsNewTupleDiff = false;
                     PrefixParent = FHashPair.first;
                     DEBUG("Same output as " << PrefixParent)
                     break;
                 }
+                Bucket++;
             }
 
+            // Buckets are kept with -diff_signature too, to report how many files it saves.
+            IsNewDiff = Options.DiffSignature ? NewSignature : IsNewTupleDiff;
             if (IsNewDiff) {
+                TotalNumberOfDiffs++;
+                UnitHadDiff = true;
+            }
+            bool WillLog = IsNewDiff || !Options.LogUnique || !vcont64;
+
+            // A bucket is named after the first file logged for it, and only a logged file can be a parent.
+            // Buckets whose first difference was not logged (with -diff_signature) have no name until one is.
+            if (IsNewTupleDiff || PrefixParent.empty()) {
                 // Log new difference.
                 Prefix << DiffController::VectorToString(hashvec);
                 Prefix << "_" << TotalNumberOfRuns << "_";
                 std::stringstream PrefixToStore;
                 PrefixToStore << Prefix.str() << Hash({Data, Data + Size});
-                DiffStats.DiffHashes.push_back(
-                        std::make_pair(PrefixToStore.str(), std::make_pair(HCandidate, hashvec)));
-                TotalNumberOfDiffs++;
-                UnitHadDiff = true;
+                std::string Name = WillLog ? PrefixToStore.str() : "";
+                if (IsNewTupleDiff) {
+                    LoggedDiffs.DiffHashes.push_back(
+                            std::make_pair(Name, std::make_pair(HCandidate, hashvec)));
+                    NumberOfTupleDiffs++;
+                } else {
+                    LoggedDiffs.DiffHashes[Bucket].first = Name;
+                }
             } else {
                 Prefix << PrefixParent << "_";
                 Prefix << TotalNumberOfRuns << "_";
                 Prefix << (int) ScoreUnit << "_";
             }
+            if (DiffLock.owns_lock())
+                DiffLock.unlock();
+
+            if (WillLog) {
+                std::string Path = WriteUnitToFileWithPrefix({Data, Data + Size}, Prefix.str().c_str());
 
-            if ((IsNewDiff) || (!Options.LogUnique) || (!vcont64 && HasRetDiff)) {
-                WriteUnitToFileWithPrefix({Data, Data + Size}, Prefix.str().c_str());
+                // The target may want to check whether the difference shows up again
+                if (EF->LLVMFuzzerNezhaDiffLogged && !Path.empty())
+                    EF->LLVMFuzzerNezhaDiffLogged(Data, Size, Path.c_str());
 
                 // Dump original non-hashed HTTP/1 requests to a file for easier debugging
                 std::string h1reqs;
@@ -720,16 +878,17 @@ namespace fuzzer {
             }
         }
 
-        // reclaim memory here -- TODO can we change data types to keep this in the callback?
-        for (auto *hc: ret_v) {
-            delete hc;
-        }
-
         /* Output Diversity
          *    Track number of unique output (return values) tuples observed so far. */
-        if (Options.OD) {
-            NewRetTuple = DiffController::IsNewRetTuple(Options, &DiffStats, hashvec);
+        if (Options.OD && Options.DiffSignature) {
+            NewRetTuple = NewSignature;
+        } else if (Options.OD) {
+            NewRetTuple = Shared ? Shared->Outputs.Insert(hashvec)
+                                 : DiffController::IsNewRetTuple(Options, &DiffStats, hashvec);
+            if (NewRetTuple)
+                DiffState.Added.AddOutput(hashvec);
         }
+        UnitHadNewRetTuple = NewRetTuple;
 
         /* Path Diversity Coarse
          *    Track number of unique tuples of per-lib path raw cardinality.
@@ -741,14 +900,18 @@ namespace fuzzer {
             assert(vcontint && vcontint->vals);
             std::vector<int> ec_v = DiffController::ParseGenericIntVector(vcontint);
             PathRawCovDiff = DiffController::IsNewEcDiff(Options, &DiffStats, ec_v);
+            if (PathRawCovDiff)
+                DiffStats.Added.AddEcDiff(ec_v);
         }
 
         /* Fitness_PD: Coverage Path Diversity
          * Track number of unique tuples of per-lib path edge set.
          * NOTE: Vpath comprises unique edges. */
         if (Options.PDFine) {
-            if (DiffStats.SetCovPaths.insert(Vpath).second)
+            if (DiffStats.SetCovPaths.insert(Vpath).second) {
                 NewPathTuple = true;
+                DiffStats.Added.AddCovPath(Vpath);
+            }
         }
 
         Res = NewRetTuple | PathSetCovDiff | PathRawCovDiff | NewPathTuple;
@@ -757,19 +920,54 @@ namespace fuzzer {
                    NewRetTuple, PathSetCovDiff, PathRawCovDiff, NewPathTuple);
         }
 
+        // Persist results that other jobs (or a restarted campaign) are likely to ask for again: units that enter
+        // the corpus, logged differences, and everything executed while loading a corpus.
+        if (Results && !FromStore && (Res || IsNewDiff || ReplayFromStore)) {
+            if (Results->store(Hash({Data, Data + Size}), ret_v))
+                NumberOfStoreWrites++;
+        }
+
+        // reclaim memory here -- TODO can we change data types to keep this in the callback?
+        for (auto *hc: ret_v) {
+            delete hc;
+        }
+
         return Res;
     }
 
     bool Fuzzer::RunOne(const uint8_t *Data, size_t Size) {
         bool Res;
         TotalNumberOfRuns++;
+        if (Shared)
+            Shared->TotalRuns++;
 
         // TODO(aizatsky): this Reset call seems to be not needed.
         CoverageController::ResetCounters(Options);
 
-        if (ExecuteCallback(Data, Size) != 0) {
+        bool FromStore = ReplayFromStore && LoadStoredResults(Data, Size);
+        uint64_t StreamHash = 0;
+        if (!FromStore && IsRecentDuplicate(Data, Size, &StreamHash)) {
+            // Byte-identical stream on the wire: outputs were already recorded.
             return false;
         }
+        if (!FromStore) {
+            int CBRes = ExecuteCallback(Data, Size);
+            if (CBRes > 0) {
+                // Not executed; the same stream must still be tried later.
+                NumberOfSkippedExecs++;
+                return false;
+            }
+            if (StreamHash) {
+                if (Shared) {
+                    std::lock_guard<std::mutex> Lock(Shared->StreamsMu);
+                    Shared->RecentStreams.TestAndInsert(StreamHash);
+                } else {
+                    RecentStreams.TestAndInsert(StreamHash);
+                }
+            }
+            if (CBRes != 0)
+                return false;
+        }
 
         if (!Options.ForceDefault) {
             UnitHadDiff = false;
@@ -778,7 +976,7 @@ namespace fuzzer {
             //  (1) Log any differences,
             //  (2) Res returns true if the unit shows an improvement for the desired
             //      fitness function(s).
-            Res = UpdateDiffAndLog(Data, Size);
+            Res = UpdateDiffAndLog(Data, Size, FromStore);
             if (!Options.OD) {
                 bool HasNewUnionCov = UpdateMaxCoverage();
                 if (Options.GlobalCoverage)
@@ -803,8 +1001,56 @@ namespace fuzzer {
         return Res;
     }
 
+    bool Fuzzer::LoadStoredResults(const uint8_t *Data, size_t Size) {
+        if (!Results || Options.ForceDefault)
+            return false;
+        std::vector<CallbackRet> Stored;
+        if (!Results->load(Hash({Data, Data + Size}), Stored))
+            return false;
+
+        // Hand the stored results to UpdateDiffAndLog exactly as if the callback had produced them.
+        ValContainerCallback *vcont = EF->LLVMFuzzerNezhaOutputs();
+        if (!vcont || !vcont->vals || vcont->size != (int) Stored.size()) {
+            for (auto *hc: Stored)
+                delete hc;
+            return false;
+        }
+        std::copy(Stored.begin(), Stored.end(), vcont->vals);
+        UnitStartTime = system_clock::now();
+        NumberOfStoreHits++;
+        return true;
+    }
+
+    bool Fuzzer::IsRecentDuplicate(const uint8_t *Data, size_t Size,
+                                   uint64_t *StreamHash) {
+        *StreamHash = 0;
+        if (!Options.DedupStreams || !EF->LLVMFuzzerNezhaCanonicalHash)
+            return false;
+        uint64_t H = EF->LLVMFuzzerNezhaCanonicalHash(Data, Size);
+        if (!H)
+            return false;  // No canonical form; always execute.
+        bool Seen;
+        if (Shared) {
+            std::lock_guard<std::mutex> Lock(Shared->StreamsMu);
+            Seen = Shared->RecentStreams.Contains(H);
+        } else {
+            Seen = RecentStreams.Contains(H);
+        }
+        if (!Seen) {
+            *StreamHash = H;
+            return false;
+        }
+        NumberOfDuplicateSkips++;
+        return true;
+    }
+
+    bool Fuzzer::RunBudgetExhausted() const {
+        size_t Runs = Shared ? Shared->TotalRuns.load() : TotalNumberOfRuns;
+        return Runs >= Options.MaxNumberOfRuns;
+    }
+
     void Fuzzer::RunOneAndUpdateCorpus(const uint8_t *Data, size_t Size) {
-        if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
+        if (RunBudgetExhausted())
             return;
         if (RunOne(Data, Size))
             ReportNewCoverage({Data, Data + Size});
@@ -858,9 +1104,9 @@ namespace fuzzer {
             Printf("Written to %s\n", Path.c_str());
     }
 
-    void Fuzzer::WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix) {
+    std::string Fuzzer::WriteUnitToFileWithPrefix(const Unit &U, const char *Prefix) {
         if (!Options.SaveArtifacts)
-            return;
+            return "";
         std::string Path = Options.ArtifactPrefix + Prefix + Hash(U);
         if (!Options.ExactArtifactPath.empty())
             Path = Options.ExactArtifactPath; // Overrides ArtifactPrefix.
@@ -869,6 +1115,7 @@ namespace fuzzer {
                Options.ArtifactPrefix.c_str(), Path.c_str());
         if (U.size() <= kMaxUnitSizeToPrint)
             Printf("Base64: %s\n", Base64(U).c_str());
+        return Path;
     }
 
     void Fuzzer::SaveCorpus() {
@@ -893,8 +1140,12 @@ namespace fuzzer {
     }
 
     void Fuzzer::ReportNewCoverage(const Unit &U) {
-        Corpus.push_back(U);
-        UpdateCorpusDistribution();
+        if (Shared) {
+            Shared->Corpus.Add(ThreadIdx, U);
+        } else {
+            Corpus.push_back(U);
+            UpdateCorpusDistribution();
+        }
         UnitHashesAddedToCorpus.insert(Hash(U));
         MD.RecordSuccessfulMutationSequence();
         PrintStatusForNewUnit(U);
@@ -1004,6 +1255,7 @@ namespace fuzzer {
 
     void Fuzzer::MutateAndTestOne() {
         LazyAllocateCurrentUnitData();
+        UpdateTargetDictionary();
         MD.StartMutationSequence();
 
         auto &U = ChooseUnitToMutate();
@@ -1022,6 +1274,7 @@ namespace fuzzer {
         for (int i = 0; i < Options.MutateDepth; i++) {
             memcpy(PreviousUnit, CurrentUnitData, Size);
             PreviousSize = Size;
+            auto MutantStartTime = system_clock::now();
 
             size_t NewSize = 0;
             NewSize = MD.Mutate(CurrentUnitData, Size, Options.MaxLen/2); // MaxSize / 2 to avoid buffer overflows
@@ -1030,8 +1283,13 @@ namespace fuzzer {
             Size = NewSize;
             if (i == 0)
                 StartTraceRecording();
+            UnitHadDiff = UnitHadNewRetTuple = false;
             RunOneAndUpdateCorpus(CurrentUnitData, Size);
             StopTraceRecording();
+            if (EF->LLVMFuzzerMutationFeedback)
+                EF->LLVMFuzzerMutationFeedback(UnitHadNewRetTuple, UnitHadDiff);
+            if (Options.PowerSchedule)
+                RecordMutant(duration<double>(system_clock::now() - MutantStartTime).count());
             TryDetectingAMemoryLeak(CurrentUnitData, Size,
                     /*DuringInitialCorpusExecution*/ false);
 
@@ -1045,11 +1303,48 @@ namespace fuzzer {
         }
 
         delete[] PreviousUnit;
+        // Energies changed with the stats of the parent
+        if (Options.PowerSchedule && !Shared)
+            UpdateCorpusDistribution();
+    }
+
+    void Fuzzer::UpdateTargetDictionary() {
+        if (!EF->LLVMFuzzerNezhaDictionary)
+            return;
+        ValContainerWords *W = EF->LLVMFuzzerNezhaDictionary();
+        if (!W || W->version == TargetDictionaryVersion)
+            return;
+        TargetDictionaryVersion = W->version;
+        MD.ClearTargetDictionary();
+        for (int i = 0; i < W->size; i++) {
+            if (W->sizes[i] <= Word::GetMaxSize())
+                MD.AddWordToTargetDictionary(Word((const uint8_t *) W->vals[i], W->sizes[i]));
+        }
+    }
+
+    void Fuzzer::RecordMutant(double Seconds) {
+        Schedule.Record(Seconds, UnitHadNewRetTuple, UnitHadDiff);
+        if (Shared)
+            Shared->Corpus.Record(CurrentParentRef, Seconds, UnitHadNewRetTuple, UnitHadDiff);
+        else if (CurrentParentIdx < CorpusStats.size())
+            CorpusStats[CurrentParentIdx].Record(Seconds, UnitHadNewRetTuple, UnitHadDiff);
     }
 
 // Returns an index of random unit from the corpus to mutate.
 // Hypothesis: units added to the corpus last are more likely to be interesting.
 // This function gives more weight to the more recent units.
+    const Unit &Fuzzer::ChooseUnitToMutate() {
+        if (Shared) {
+            CurrentParent = Options.PowerSchedule
+                            ? Shared->Corpus.SampleByEnergy(MD.GetRand(), Schedule, &CurrentParentRef)
+                            : Shared->Corpus.Sample(MD.GetRand());
+            assert(CurrentParent);
+            return *CurrentParent;
+        }
+        CurrentParentIdx = ChooseUnitIdxToMutate();
+        return Corpus[CurrentParentIdx];
+    }
+
     size_t Fuzzer::ChooseUnitIdxToMutate() {
         size_t Idx =
                 static_cast<size_t>(CorpusDistribution(MD.GetRand().Get_mt19937()));
@@ -1067,6 +1362,28 @@ namespace fuzzer {
         DiffController::Reset(&DiffStats);
     }
 
+    void Fuzzer::AttachShared(SharedFuzzingState *S, size_t Idx) {
+        Shared = S;
+        ThreadIdx = Idx;
+        S->Fuzzers.push_back(this);
+        S->Diffs.Added.Enabled = !Options.CheckpointPath.empty();
+    }
+
+    void Fuzzer::ShareCorpus() {
+        assert(Shared);
+        for (size_t i = 0; i < Corpus.size(); i++)
+            Shared->Corpus.Add(ThreadIdx, Corpus[i], i < CorpusStats.size() ? CorpusStats[i] : UnitStats());
+        Corpus.clear();
+        CorpusStats.clear();
+        UpdateCorpusDistribution();
+
+        for (auto &V: DiffStats.SetOutputs)
+            Shared->Outputs.Insert(V);
+        DiffStats.Signatures.ForEach([this](uint64_t Sig) { Shared->Diffs.Signatures.Insert(Sig); });
+        Shared->Diffs.DiffHashes.swap(DiffStats.DiffHashes);
+        ResetDiff();
+    }
+
 // Experimental search heuristic: drilling.
 // - Read, shuffle, execute and minimize the corpus.
 // - Choose one random unit.
@@ -1086,6 +1403,7 @@ namespace fuzzer {
 
         std::vector<Unit> SavedCorpus;
         SavedCorpus.swap(Corpus);
+        CorpusStats.clear();
         Corpus.push_back(U);
         UpdateCorpusDistribution();
         assert(Corpus.size() == 1);
@@ -1121,6 +1439,8 @@ namespace fuzzer {
         if (Options.ForceDefault)
             return;
 
+        if (Options.DiffSignature)
+            CHECK_EXTERNAL_FUNCTION(LLVMFuzzerNezhaDisagreement && "LLVMFuzzerNezhaDisagreement missing");
         if (Options.OD) {
             CHECK_EXTERNAL_FUNCTION(LLVMFuzzerNezhaOutputs && "LLVMFuzzerNezhaOutputs missing");
         } else {
@@ -1134,16 +1454,32 @@ namespace fuzzer {
     void Fuzzer::Loop() {
         CheckDiffBasedFuncs();
 
+        IsMyThread = true;
+        CurrentFuzzer = this;
+
         system_clock::time_point LastCorpusReload = system_clock::now();
-        if (Options.DoCrossOver)
-            MD.SetCorpus(&Corpus);
+        if (Options.DoCrossOver) {
+            if (Shared)
+                MD.SetSharedCorpus(&Shared->Corpus);
+            else
+                MD.SetCorpus(&Corpus);
+        }
         while (true) {
             auto Now = system_clock::now();
-            if (duration_cast<seconds>(Now - LastCorpusReload).count()) {
+            // One thread is enough to pick up units written by other processes
+            if (duration_cast<seconds>(Now - LastCorpusReload).count() && ThreadIdx == 0) {
                 RereadOutputCorpus(Options.MaxLen);
                 LastCorpusReload = Now;
             }
-            if (TotalNumberOfRuns >= Options.MaxNumberOfRuns)
+            if (!Options.CheckpointPath.empty() &&
+                duration_cast<seconds>(Now - LastCheckpoint).count() >= Options.CheckpointIntervalSec) {
+                if (ThreadIdx == 0)
+                    WriteCheckpoint();
+                else
+                    PublishCheckpoint();
+                LastCheckpoint = Now;
+            }
+            if (RunBudgetExhausted())
                 break;
             if (Options.MaxTotalTimeSec > 0 &&
                 secondsSinceProcessStartUp() >
@@ -1155,6 +1491,28 @@ namespace fuzzer {
 
         PrintStats("DONE  ", "\n");
         MD.PrintRecommendedDictionary();
+        // With -threads, thread 0 writes the last checkpoint once every thread is done
+        if (!Options.CheckpointPath.empty()) {
+            if (Shared)
+                PublishCheckpoint();
+            else
+                WriteCheckpoint();
+        }
+    }
+
+// Weight of a new output tuple, in differences
+    static const double kTupleWeight = 0.25;
+// Mutants a unit needs before its own yield and cost count as much as the
+// averages of all mutants
+    static const double kPseudoChildren = 16;
+
+    double PowerSchedule::Energy(const UnitStats &S) const {
+        double Yield = (Total.Diffs + kTupleWeight * Total.NewTuples + 1) / (Total.Children + 1);
+        double Cost = (Total.ExecSeconds + 1e-3) / (Total.Children + 1);
+        double UnitYield = (S.Diffs + kTupleWeight * S.NewTuples + kPseudoChildren * Yield) /
+                           (S.Children + kPseudoChildren);
+        double UnitCost = (S.ExecSeconds + kPseudoChildren * Cost) / (S.Children + kPseudoChildren);
+        return UnitYield / UnitCost;
     }
 
     void Fuzzer::UpdateCorpusDistribution() {
@@ -1162,7 +1520,13 @@ namespace fuzzer {
         std::vector<double> Intervals(N + 1);
         std::vector<double> Weights(N);
         std::iota(Intervals.begin(), Intervals.end(), 0);
-        std::iota(Weights.begin(), Weights.end(), 1);
+        if (Options.PowerSchedule) {
+            CorpusStats.resize(N);
+            for (size_t i = 0; i < N; i++)
+                Weights[i] = Schedule.Energy(CorpusStats[i]);
+        } else {
+            std::iota(Weights.begin(), Weights.end(), 1);
+        }
         CorpusDistribution = std::piecewise_constant_distribution<double>(
                 Intervals.begin(), Intervals.end(), Weights.begin());
     }
@@ -1172,7 +1536,8 @@ namespace fuzzer {
 extern "C" {
 
 size_t LLVMFuzzerMutate(uint8_t *Data, size_t Size, size_t MaxSize) {
-    assert(fuzzer::F);
-    return fuzzer::F->GetMD().DefaultMutate(Data, Size, MaxSize);
+    fuzzer::Fuzzer *Cur = fuzzer::CurrentFuzzer ? fuzzer::CurrentFuzzer : fuzzer::F;
+    assert(Cur);
+    return Cur->GetMD().DefaultMutate(Data, Size, MaxSize);
 }
 }  // extern "C"
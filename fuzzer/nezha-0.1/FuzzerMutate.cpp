@@ -30,6 +30,7 @@ MutationDispatcher::MutationDispatcher(Random &Rand,
           {&MutationDispatcher::Mutate_ChangeByte, "ChangeByte"},
           {&MutationDispatcher::Mutate_ChangeASCIIInteger, "ChangeASCIIInt"},
           {&MutationDispatcher::Mutate_AddWordFromManualDictionary, "AddFromManualDict"},
+          {&MutationDispatcher::Mutate_AddWordFromTargetDictionary, "AddFromTargetDict"},
           {&MutationDispatcher::Mutate_ChangeCase, "ChangeCase"},
           {&MutationDispatcher::Mutate_ClearField, "ClearField"},
           {&MutationDispatcher::Mutate_AddCharAtBeginning, "AddCharAtBeginning"},
@@ -72,12 +73,12 @@ size_t MutationDispatcher::Mutate_Custom(uint8_t *Data, size_t Size,
 
 size_t MutationDispatcher::Mutate_CustomCrossOver(uint8_t *Data, size_t Size,
                                                   size_t MaxSize) {
-  if (!Corpus || Corpus->size() < 2 || Size == 0)
+  if (Size == 0)
     return 0;
-  size_t Idx = Rand(Corpus->size());
-  const Unit &Other = (*Corpus)[Idx];
-  if (Other.empty())
+  const Unit *Partner = ChooseCrossOverPartner();
+  if (!Partner || Partner->empty())
     return 0;
+  const Unit &Other = *Partner;
   MutateInPlaceHere.resize(MaxSize);
   auto &U = MutateInPlaceHere;
   size_t NewSize = EF->LLVMFuzzerCustomCrossOver(
@@ -203,6 +204,11 @@ size_t MutationDispatcher::Mutate_AddWordFromPersistentAutoDictionary(
   return AddWordFromDictionary(PersistentAutoDictionary, Data, Size, MaxSize);
 }
 
+size_t MutationDispatcher::Mutate_AddWordFromTargetDictionary(
+    uint8_t *Data, size_t Size, size_t MaxSize) {
+  return AddWordFromDictionary(TargetDictionary, Data, Size, MaxSize);
+}
+
 size_t MutationDispatcher::Mutate_ChangeCase(uint8_t *Data, size_t Size, size_t MaxSize) {
     bool lower = Rand(2);
     for (int i = 0; i < Size; ++i) {
@@ -277,10 +283,10 @@ size_t MutationDispatcher::Mutate_ChangeASCIIInteger(uint8_t *Data, size_t Size,
 
 size_t MutationDispatcher::Mutate_CrossOver(uint8_t *Data, size_t Size,
                                             size_t MaxSize) {
-  if (!Corpus || Corpus->size() < 2 || Size == 0) return 0;
-  size_t Idx = Rand(Corpus->size());
-  const Unit &Other = (*Corpus)[Idx];
-  if (Other.empty()) return 0;
+  if (Size == 0) return 0;
+  const Unit *Partner = ChooseCrossOverPartner();
+  if (!Partner || Partner->empty()) return 0;
+  const Unit &Other = *Partner;
   MutateInPlaceHere.resize(MaxSize);
   auto &U = MutateInPlaceHere;
   size_t NewSize =
@@ -291,6 +297,16 @@ size_t MutationDispatcher::Mutate_CrossOver(uint8_t *Data, size_t Size,
   return NewSize;
 }
 
+const Unit *MutationDispatcher::ChooseCrossOverPartner() {
+  if (SharedCorpus) {
+    if (SharedCorpus->size() < 2) return nullptr;
+    CrossOverPartner = SharedCorpus->SampleUniform(Rand);
+    return CrossOverPartner.get();
+  }
+  if (!Corpus || Corpus->size() < 2) return nullptr;
+  return &(*Corpus)[Rand(Corpus->size())];
+}
+
 void MutationDispatcher::StartMutationSequence() {
   CurrentMutatorSequence.clear();
   CurrentDictionaryEntrySequence.clear();
@@ -307,6 +323,12 @@ void MutationDispatcher::RecordSuccessfulMutationSequence() {
   }
 }
 
+void MutationDispatcher::AddWordToPersistentAutoDictionary(
+    const DictionaryEntry &DE) {
+  if (!PersistentAutoDictionary.ContainsWord(DE.GetW()))
+    PersistentAutoDictionary.push_back(DE);
+}
+
 void MutationDispatcher::PrintRecommendedDictionary() {
   std::vector<DictionaryEntry> V;
   for (auto &DE : PersistentAutoDictionary)
@@ -381,4 +403,12 @@ void MutationDispatcher::ClearAutoDictionary() {
   TempAutoDictionary.clear();
 }
 
+void MutationDispatcher::AddWordToTargetDictionary(const Word &W) {
+  TargetDictionary.push_back({W});
+}
+
+void MutationDispatcher::ClearTargetDictionary() {
+  TargetDictionary.clear();
+}
+
 }  // namespace fuzzer
@@ -0,0 +1,222 @@
+//===- FuzzerShared.cpp - State shared by fuzzing threads -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Concurrent corpus and output-tuple set used by -threads.
+//===----------------------------------------------------------------------===//
+
+#include "FuzzerInternal.h"
+#include <cmath>
+
+namespace fuzzer {
+
+ShardedCorpus::ShardedCorpus(size_t NumShards)
+    : Shards(new Shard[std::max<size_t>(NumShards, 1)]),
+      NumShards(std::max<size_t>(NumShards, 1)) {}
+
+bool ShardedCorpus::Add(size_t Shard, const Unit &U, const UnitStats &Stats) {
+  std::string H = Hash(U);
+  {
+    auto &HS = Shards[std::hash<std::string>()(H) % NumShards];
+    std::lock_guard<std::mutex> Lock(HS.Mu);
+    if (!HS.Hashes.insert(H).second)
+      return false;
+  }
+  auto &S = Shards[Shard % NumShards];
+  UnitPtr P = std::make_shared<const Unit>(U);
+  std::lock_guard<std::mutex> Lock(S.Mu);
+  S.Units.push_back(std::move(P));
+  S.Stats.push_back(Stats);
+  S.Count.store(S.Units.size(), std::memory_order_relaxed);
+  Size.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool ShardedCorpus::Contains(const std::string &UnitHash) const {
+  auto &HS = Shards[std::hash<std::string>()(UnitHash) % NumShards];
+  std::lock_guard<std::mutex> Lock(HS.Mu);
+  return HS.Hashes.count(UnitHash) != 0;
+}
+
+// Picks a shard with probability proportional to its size. Counts may lag
+// behind concurrent additions, which only skews the choice slightly.
+const ShardedCorpus::Shard *ShardedCorpus::PickShard(Random &Rand,
+                                                     size_t *Count) const {
+  size_t Total = 0;
+  for (size_t I = 0; I < NumShards; I++)
+    Total += Shards[I].Count.load(std::memory_order_relaxed);
+  if (!Total)
+    return nullptr;
+  size_t R = Rand(Total);
+  for (size_t I = 0; I < NumShards; I++) {
+    size_t C = Shards[I].Count.load(std::memory_order_relaxed);
+    if (R < C) {
+      *Count = C;
+      return &Shards[I];
+    }
+    R -= C;
+  }
+  return nullptr;
+}
+
+UnitPtr ShardedCorpus::Sample(Random &Rand) const {
+  size_t N = 0;
+  const Shard *S = PickShard(Rand, &N);
+  if (!S)
+    return nullptr;
+  // Unit I has weight I + 1: draw from the cumulative weight N * (N + 1) / 2
+  // and invert it.
+  double R = (double)Rand(N * (N + 1) / 2);
+  size_t Idx = std::min(N - 1, (size_t)((std::sqrt(8 * R + 1) - 1) / 2));
+  std::lock_guard<std::mutex> Lock(S->Mu);
+  return S->Units[Idx];
+}
+
+UnitPtr ShardedCorpus::SampleUniform(Random &Rand) const {
+  size_t N = 0;
+  const Shard *S = PickShard(Rand, &N);
+  if (!S)
+    return nullptr;
+  std::lock_guard<std::mutex> Lock(S->Mu);
+  return S->Units[Rand(N)];
+}
+
+UnitPtr ShardedCorpus::SampleByEnergy(Random &Rand, const PowerSchedule &PS,
+                                      Ref *R) const {
+  size_t N = 0;
+  const Shard *S = PickShard(Rand, &N);
+  if (!S)
+    return nullptr;
+  std::lock_guard<std::mutex> Lock(S->Mu);
+  std::vector<double> Cumulative(S->Units.size());
+  double Sum = 0;
+  for (size_t I = 0; I < Cumulative.size(); I++)
+    Cumulative[I] = Sum += PS.Energy(S->Stats[I]);
+  double X = std::uniform_real_distribution<double>(0, Sum)(Rand.Get_mt19937());
+  size_t Idx = std::upper_bound(Cumulative.begin(), Cumulative.end(), X) -
+               Cumulative.begin();
+  R->Shard = S - Shards.get();
+  R->Idx = std::min(Idx, Cumulative.size() - 1);
+  return S->Units[R->Idx];
+}
+
+void ShardedCorpus::Record(const Ref &R, double Seconds, bool NewTuple,
+                           bool Diff) {
+  auto &S = Shards[R.Shard];
+  std::lock_guard<std::mutex> Lock(S.Mu);
+  S.Stats[R.Idx].Record(Seconds, NewTuple, Diff);
+}
+
+size_t ShardedCorpus::MaxUnitSize() const {
+  size_t Res = 0;
+  for (size_t I = 0; I < NumShards; I++) {
+    std::lock_guard<std::mutex> Lock(Shards[I].Mu);
+    for (auto &U : Shards[I].Units)
+      Res = std::max(Res, U->size());
+  }
+  return Res;
+}
+
+void ShardedCorpus::Snapshot(size_t Shard, size_t From,
+                             std::vector<UnitPtr> *Units,
+                             std::vector<UnitStats> *Stats) const {
+  auto &S = Shards[Shard];
+  std::lock_guard<std::mutex> Lock(S.Mu);
+  if (From < S.Units.size())
+    Units->assign(S.Units.begin() + From, S.Units.end());
+  else
+    Units->clear();
+  *Stats = S.Stats;
+}
+
+ConcurrentTupleSet::ConcurrentTupleSet(size_t NumShards)
+    : Shards(new Shard[std::max<size_t>(NumShards, 1)]),
+      NumShards(std::max<size_t>(NumShards, 1)) {}
+
+bool ConcurrentTupleSet::Insert(const std::vector<int> &V) {
+  auto &S = Shards[VectorIntHash()(V) % NumShards];
+  std::lock_guard<std::mutex> Lock(S.Mu);
+  return S.Set.insert(V).second;
+}
+
+void ConcurrentTupleSet::ForEach(
+    const std::function<void(const std::vector<int> &)> &F) const {
+  for (size_t I = 0; I < NumShards; I++) {
+    std::lock_guard<std::mutex> Lock(Shards[I].Mu);
+    for (auto &V : Shards[I].Set)
+      F(V);
+  }
+}
+
+bool SignatureSet::Insert(uint64_t Sig) {
+  std::lock_guard<std::mutex> Lock(Mu);
+  if (Sig == 0) {
+    bool New = !HasZero;
+    HasZero = true;
+    Size += New;
+    return New;
+  }
+  if (2 * (Size + 1) > Slots.size())
+    Grow();
+  size_t Mask = Slots.size() - 1;
+  for (size_t I = Sig & Mask;; I = (I + 1) & Mask) {
+    if (Slots[I] == Sig)
+      return false;
+    if (Slots[I] == 0) {
+      Slots[I] = Sig;
+      Size++;
+      return true;
+    }
+  }
+}
+
+void SignatureSet::Grow() {
+  std::vector<uint64_t> Old;
+  Old.swap(Slots);
+  Slots.assign(std::max<size_t>(64, Old.size() * 2), 0);
+  size_t Mask = Slots.size() - 1;
+  for (uint64_t Sig : Old) {
+    if (Sig == 0)
+      continue;
+    size_t I = Sig & Mask;
+    while (Slots[I] != 0)
+      I = (I + 1) & Mask;
+    Slots[I] = Sig;
+  }
+}
+
+size_t SignatureSet::size() const {
+  std::lock_guard<std::mutex> Lock(Mu);
+  return Size;
+}
+
+void SignatureSet::ForEach(const std::function<void(uint64_t)> &F) const {
+  std::lock_guard<std::mutex> Lock(Mu);
+  if (HasZero)
+    F(0);
+  for (uint64_t Sig : Slots)
+    if (Sig != 0)
+      F(Sig);
+}
+
+void SignatureSet::clear() {
+  std::lock_guard<std::mutex> Lock(Mu);
+  Slots.clear();
+  HasZero = false;
+  Size = 0;
+}
+
+size_t ConcurrentTupleSet::size() const {
+  size_t Res = 0;
+  for (size_t I = 0; I < NumShards; I++) {
+    std::lock_guard<std::mutex> Lock(Shards[I].Mu);
+    Res += Shards[I].Set.size();
+  }
+  return Res;
+}
+
+}  // namespace fuzzer